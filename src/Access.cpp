@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include "Util.h"
 #include "Volume.h"
 #include "Access.h"
@@ -15,7 +16,11 @@ Access::Access( Volume* volume ) :
     m_SelectionIsInvalid(true),
     m_IsLocked(false),
     m_AccessMode(VMAN_READ_ACCESS),
-    m_Priority(0)
+    m_Priority(0),
+    m_SelectionCallback(NULL),
+    m_SelectionCallbackContext(NULL),
+    m_LoadingChunks(0),
+    m_PendingCallbacks(0)
 {
     memset(&m_Selection, 0, sizeof(m_Selection));
 }
@@ -33,10 +38,27 @@ void Access::setPriority( int priority )
 
 void Access::select( const vmanSelection* selection )
 {
+    // The previous chunks must not call back anymore.
+    if(m_SelectionCallback != NULL)
+    {
+        for(int i = 0; i < m_Cache.size(); ++i)
+            m_Cache[i]->removeLoadListener(this);
+
+        // Chunks, which started calling back before, are waited for.
+        {
+            lock_guard guard(m_CallbackMutex);
+            while(m_PendingCallbacks > 0)
+                m_CallbackCondition.wait(m_CallbackMutex);
+        }
+        m_SelectionCallback = NULL;
+        m_SelectionCallbackContext = NULL;
+    }
+
     m_SelectionIsInvalid = true;
     for(int i = 0; i < m_Cache.size(); ++i)
         m_Cache[i]->releaseReference();
     m_Cache.clear();
+    m_LockOrder.clear();
 
     if(selection != NULL)
     {
@@ -50,14 +72,69 @@ void Access::select( const vmanSelection* selection )
             m_ChunkSelection.d;
         m_Cache.resize(chunkCount);
 
-        m_Volume->getMutex()->lock();
+        // Chunks are returned referenced,
+        // so no one can remove my cached chunks.
         m_Volume->getSelection(&m_ChunkSelection, &m_Cache[0], m_Priority);
-        for(int i = 0; i < m_Cache.size(); ++i)
-            m_Cache[i]->addReference();
-        m_Volume->getMutex()->unlock(); // So no one can remove my cached chunks while i'm putting references on them
+
+        m_LockOrder = m_Cache;
+        LockManager::SortChunks(&m_LockOrder);
     }
 }
 
+void Access::selectAsync( const vmanSelection* selection, vmanSelectionCallback callback, void* context )
+{
+    // Selecting doesn't wait for the disk anyway,
+    // it only enqueues load jobs for the chunks.
+    select(selection);
+    if(callback == NULL)
+        return;
+
+    m_SelectionCallback = callback;
+    m_SelectionCallbackContext = context;
+
+    // Counts itself too, so chunks that are loaded meanwhile
+    // can't call back before all have been registered.
+    // Each chunk is counted before it can notify the access.
+    m_LoadingChunks = 1;
+    for(int i = 0; i < m_Cache.size(); ++i)
+    {
+        m_LoadingChunks++;
+        if(m_Cache[i]->addLoadListener(this) == false)
+            m_LoadingChunks--;
+    }
+    holdCallback();
+    chunkLoaded();
+}
+
+bool Access::isSelectionReady() const
+{
+    // Running saves hold the chunk mutex exclusively too.
+    for(int i = 0; i < m_Cache.size(); ++i)
+    {
+        const vmanChunkState state = m_Cache[i]->getState();
+        if(state == VMAN_CHUNK_LOADING || state == VMAN_CHUNK_SAVING)
+            return false;
+    }
+    return true;
+}
+
+void Access::holdCallback()
+{
+    lock_guard guard(m_CallbackMutex);
+    m_PendingCallbacks++;
+}
+
+void Access::chunkLoaded()
+{
+    assert(m_SelectionCallback != NULL);
+    if(--m_LoadingChunks == 0)
+        m_SelectionCallback(this, m_SelectionCallbackContext);
+
+    lock_guard guard(m_CallbackMutex);
+    m_PendingCallbacks--;
+    m_CallbackCondition.notify_all();
+}
+
 /*
 const vmanSelection* Access::getSelection() const
 {
@@ -69,33 +146,59 @@ const vmanSelection* Access::getSelection() const
 */
 
 void Access::lock( int mode )
+{
+    lockFor(mode, -1);
+}
+
+bool Access::tryLock( int mode )
 {
     assert(m_IsLocked == false);
     m_AccessMode = mode;
 
-    for(int i = 0; i < m_Cache.size(); ++i)
+    const bool exclusive = (mode & VMAN_WRITE_ACCESS) != 0;
+    if(m_Cache.empty() == false)
     {
-        m_Cache[i]->getMutex()->lock();
+        if(mode == VMAN_OPTIMISTIC_READ_ACCESS)
+        {
+            for(int i = 0; i < m_Cache.size(); ++i)
+                if(m_Cache[i]->getState() == VMAN_CHUNK_LOADING)
+                    return false;
+        }
+        else if(m_Volume->getLockManager()->tryLock(&m_LockOrder[0], m_LockOrder.size(), exclusive) == false)
+        {
+            return false;
+        }
     }
 
     m_IsLocked = true;
+    return true;
 }
 
-bool Access::tryLock( int mode )
+bool Access::lockFor( int mode, int milliseconds )
 {
     assert(m_IsLocked == false);
     m_AccessMode = mode;
 
-    for(int i = 0; i < m_Cache.size(); ++i)
+    if(m_Cache.empty() == false)
     {
-        if(m_Cache[i]->getMutex()->try_lock() == false)
+        if(mode == VMAN_OPTIMISTIC_READ_ACCESS)
         {
-            // Unlock all previously locked mutexes.
-            for(; i >= 0; --i)
+            // Optimistic readers don't lock at all,
+            // but they mustn't see chunks, which aren't loaded yet.
+            const uint64_t startTime = GetMonotonicMilliseconds();
+            for(int i = 0; i < m_Cache.size(); ++i)
             {
-                m_Cache[i]->getMutex()->unlock();
+                const int remaining = RemainingMilliseconds(startTime, milliseconds);
+                if(m_Cache[i]->waitWhileState(VMAN_CHUNK_LOADING, remaining) == false)
+                    return false;
             }
-            return false;
+        }
+        else
+        {
+            // Readers share the chunks.
+            const bool exclusive = (mode & VMAN_WRITE_ACCESS) != 0;
+            if(m_Volume->getLockManager()->lockFor(&m_LockOrder[0], m_LockOrder.size(), exclusive, milliseconds) == false)
+                return false;
         }
     }
 
@@ -107,25 +210,21 @@ void Access::unlock()
 {
     assert(m_IsLocked == true);
 
-    for(int i = 0; i < m_Cache.size(); ++i)
-    {
-        m_Cache[i]->getMutex()->unlock();
-    }
+    if(m_WrittenVoxels.empty() == false)
+        journalWrittenVoxels();
+
+    const bool exclusive = (m_AccessMode & VMAN_WRITE_ACCESS) != 0;
+    if(m_Cache.empty() == false && m_AccessMode != VMAN_OPTIMISTIC_READ_ACCESS)
+        m_Volume->getLockManager()->unlock(&m_LockOrder[0], m_LockOrder.size(), exclusive);
 
     m_IsLocked = false;
 }
 
-bool InsideSelection( const vmanSelection* selection, int x, int y, int z )
+int Access::getChunkStates( vmanChunkState* statesOut, int maxCount ) const
 {
-    return
-        (x >= selection->x) &&
-        (x <  selection->x + selection->w) &&
-
-        (y >= selection->y) &&
-        (y <  selection->y + selection->h) &&
-        
-        (z >= selection->z) &&
-        (z <  selection->z + selection->d);
+    for(int i = 0; i < m_Cache.size() && i < maxCount; ++i)
+        statesOut[i] = m_Cache[i]->getState();
+    return m_Cache.size();
 }
 
 const void* Access::readVoxelLayer( int x, int y, int z, int layer ) const
@@ -141,7 +240,43 @@ void* Access::readWriteVoxelLayer( int x, int y, int z, int layer ) const
     return getVoxelLayer(x,y,z, layer, VMAN_READ_ACCESS|VMAN_WRITE_ACCESS);
 }
 
+bool Access::writeVoxelLayer( int x, int y, int z, int layer, const void* voxel ) const
+{
+    int voxelIndex;
+    Chunk* chunk = getVoxelChunk(x,y,z, VMAN_WRITE_ACCESS, &voxelIndex);
+    if(chunk == NULL)
+        return false;
+
+    if(chunk->writeVoxel(layer, voxelIndex, voxel))
+        addWrittenVoxels(chunk, layer, voxelIndex, 1);
+    return true;
+}
+
 void* Access::getVoxelLayer( int x, int y, int z, int layer, int mode ) const
+{
+    int voxelIndex;
+    Chunk* chunk = getVoxelChunk(x,y,z, mode, &voxelIndex);
+    if(chunk == NULL)
+        return NULL;
+
+    const int voxelSize = m_Volume->getLayer(layer)->voxelSize;
+
+    // Check if mode includes write access.
+    if(mode & VMAN_WRITE_ACCESS)
+    {
+        char* voxels = reinterpret_cast<char*>( chunk->getLayer(layer) );
+        chunk->setVoxelsModified(layer, voxelIndex, 1);
+        addWrittenVoxels(chunk, layer, voxelIndex, 1);
+        return &voxels[voxelIndex*voxelSize];
+    }
+    else
+    {
+        // TODO: Evil evil evil !
+        return &const_cast<char*>( reinterpret_cast<const char*>( chunk->getConstLayer(layer) ) )[voxelIndex*voxelSize];
+    }
+}
+
+Chunk* Access::getVoxelChunk( int x, int y, int z, int mode, int* voxelIndexOut ) const
 {
     assert(m_IsLocked == true);
 
@@ -187,7 +322,17 @@ void* Access::getVoxelLayer( int x, int y, int z, int layer, int mode ) const
 
     assert(InsideSelection(&m_ChunkSelection, chunkX, chunkY, chunkZ));
 
-    Chunk* chunk = m_Cache[ Index3D(
+    *voxelIndexOut = Index3D(
+        edgeLength,
+        edgeLength,
+        edgeLength,
+
+        x - chunkX*edgeLength,
+        y - chunkY*edgeLength,
+        z - chunkZ*edgeLength
+    );
+
+    return m_Cache[ Index3D(
         m_ChunkSelection.w,
         m_ChunkSelection.h,
         m_ChunkSelection.d,
@@ -196,38 +341,370 @@ void* Access::getVoxelLayer( int x, int y, int z, int layer, int mode ) const
         chunkY-m_ChunkSelection.y,
         chunkZ-m_ChunkSelection.z
     ) ];
-    
-    // Check if mode includes write access.
-    if(mode & VMAN_WRITE_ACCESS)
-        chunk->setModified();
+}
+
+bool Access::readRegion( const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount ) const
+{
+    if(m_AccessMode == VMAN_OPTIMISTIC_READ_ACCESS)
+        return copyRegion(box, buffers, bufferCount, VMAN_OPTIMISTIC_READ_ACCESS);
+    return copyRegion(box, buffers, bufferCount, VMAN_READ_ACCESS);
+}
+
+bool Access::writeRegion( const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount ) const
+{
+    return copyRegion(box, buffers, bufferCount, VMAN_WRITE_ACCESS);
+}
+
+bool Access::copyRegion( const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount, int mode ) const
+{
+    assert(m_IsLocked == true);
+    assert(bufferCount == 0 || buffers != NULL);
+
+    if((m_AccessMode & mode) != mode)
+    {
+        m_Volume->log(VMAN_LOG_ERROR, "Access mode not allowed!\n");
+        return false;
+    }
 
+    if(box->w < 0 || box->h < 0 || box->d < 0 ||
+       ContainsBox(&m_Selection, box) == false)
+    {
+        m_Volume->log(VMAN_LOG_ERROR, "Box (%s) is not in access selection (%s).\n",
+            SelectionToString(box).c_str(),
+            SelectionToString(&m_Selection).c_str()
+        );
+        return false;
+    }
+
+    for(int i = 0; i < bufferCount; ++i)
+    {
+        if(buffers[i].layer < 0 ||
+           buffers[i].layer >= m_Volume->getLayerCount() ||
+           buffers[i].data == NULL)
+        {
+            m_Volume->log(VMAN_LOG_ERROR, "Buffer %d uses an invalid layer or has no data.\n", i);
+            return false;
+        }
+    }
+
+    const int voxelCount = box->w * box->h * box->d;
+    if(voxelCount == 0 || bufferCount == 0)
+        return true;
+    m_Volume->incStatistic((mode == VMAN_WRITE_ACCESS) ? STATISTIC_WRITE_OPS : STATISTIC_READ_OPS, voxelCount*bufferCount);
+
+    const int edgeLength = m_Volume->getChunkEdgeLength();
+
+    int firstChunkX, firstChunkY, firstChunkZ;
+    m_Volume->voxelToChunkCoordinates(box->x, box->y, box->z, &firstChunkX, &firstChunkY, &firstChunkZ);
+    int lastChunkX, lastChunkY, lastChunkZ;
+    m_Volume->voxelToChunkCoordinates(
+        box->x + box->w - 1,
+        box->y + box->h - 1,
+        box->z + box->d - 1,
+        &lastChunkX,
+        &lastChunkY,
+        &lastChunkZ
+    );
+
+    // Rows of buffers with a voxel stride are gathered here,
+    // so they can be compared and copied as a whole.
+    std::vector<char> rowBuffer;
+
+    for(int chunkZ = firstChunkZ; chunkZ <= lastChunkZ; ++chunkZ)
+    for(int chunkY = firstChunkY; chunkY <= lastChunkY; ++chunkY)
+    for(int chunkX = firstChunkX; chunkX <= lastChunkX; ++chunkX)
+    {
+        Chunk* chunk = m_Cache[ Index3D(
+            m_ChunkSelection.w,
+            m_ChunkSelection.h,
+            m_ChunkSelection.d,
+
+            chunkX-m_ChunkSelection.x,
+            chunkY-m_ChunkSelection.y,
+            chunkZ-m_ChunkSelection.z
+        ) ];
+
+        // Part of the box, that lies inside the chunk, in chunk coordinates.
+        const int originX = chunkX*edgeLength;
+        const int originY = chunkY*edgeLength;
+        const int originZ = chunkZ*edgeLength;
+        const int beginX = std::max(box->x, originX) - originX;
+        const int beginY = std::max(box->y, originY) - originY;
+        const int beginZ = std::max(box->z, originZ) - originZ;
+        const int endX = std::min(box->x + box->w, originX + edgeLength) - originX;
+        const int endY = std::min(box->y + box->h, originY + edgeLength) - originY;
+        const int endZ = std::min(box->z + box->d, originZ + edgeLength) - originZ;
+        const int rowVoxels = endX - beginX;
+
+        for(int i = 0; i < bufferCount; ++i)
+        {
+            const vmanLayerBuffer& buffer = buffers[i];
+            const int voxelSize = m_Volume->getLayer(buffer.layer)->voxelSize;
+            const int voxelStride = buffer.voxelStride ? buffer.voxelStride : voxelSize;
+            const int rowStride = buffer.rowStride ? buffer.rowStride : voxelStride*box->w;
+            const int sliceStride = buffer.sliceStride ? buffer.sliceStride : rowStride*box->h;
+            const bool packed = voxelStride == voxelSize;
+            const int rowBytes = rowVoxels*voxelSize;
+
+            if(mode != VMAN_WRITE_ACCESS)
+            {
+                ChunkRows rows;
+                rows.beginX = beginX;
+                rows.beginY = beginY;
+                rows.beginZ = beginZ;
+                rows.endX = endX;
+                rows.endY = endY;
+                rows.endZ = endZ;
+                rows.voxelSize = voxelSize;
+                rows.data = reinterpret_cast<char*>(buffer.data) +
+                    (originX + beginX - box->x)*voxelStride +
+                    (originY + beginY - box->y)*rowStride +
+                    (originZ + beginZ - box->z)*sliceStride;
+                rows.voxelStride = voxelStride;
+                rows.rowStride = rowStride;
+                rows.sliceStride = sliceStride;
+
+                if(mode == VMAN_OPTIMISTIC_READ_ACCESS)
+                    readChunkOptimistic(chunk, buffer.layer, rows);
+                else
+                    readChunkRows(reinterpret_cast<const char*>( chunk->getConstLayer(buffer.layer) ), rows);
+                continue;
+            }
+
+            rowBuffer.resize(rowBytes);
+
+            // Writable voxels are only requested once a row changes.
+            const char* voxels = reinterpret_cast<const char*>( chunk->getConstLayer(buffer.layer) );
+            char* writableVoxels = NULL;
+
+            for(int z = beginZ; z < endZ; ++z)
+            for(int y = beginY; y < endY; ++y)
+            {
+                const int voxelIndex = Index3D(edgeLength, edgeLength, edgeLength, beginX, y, z);
+                char* bufferRow = reinterpret_cast<char*>(buffer.data) +
+                    (originX + beginX - box->x)*voxelStride +
+                    (originY + y - box->y)*rowStride +
+                    (originZ + z - box->z)*sliceStride;
+
+                const char* source = bufferRow;
+                if(!packed)
+                {
+                    for(int x = 0; x < rowVoxels; ++x)
+                        memcpy(&rowBuffer[x*voxelSize], &bufferRow[x*voxelStride], voxelSize);
+                    source = &rowBuffer[0];
+                }
+
+                if(memcmp(&voxels[voxelIndex*voxelSize], source, rowBytes) == 0)
+                    continue;
+
+                if(writableVoxels == NULL)
+                {
+                    writableVoxels = reinterpret_cast<char*>( chunk->getLayer(buffer.layer) );
+                    voxels = writableVoxels;
+                }
+                memcpy(&writableVoxels[voxelIndex*voxelSize], source, rowBytes);
+                chunk->setVoxelsModified(buffer.layer, voxelIndex, rowVoxels);
+                addWrittenVoxels(chunk, buffer.layer, voxelIndex, rowVoxels);
+            }
+        }
+    }
+    return true;
+}
+
+void Access::readChunkRows( const char* voxels, const ChunkRows& rows ) const
+{
+    const int edgeLength = m_Volume->getChunkEdgeLength();
+    const int rowVoxels = rows.endX - rows.beginX;
+    const int rowBytes = rowVoxels*rows.voxelSize;
+    const bool packed = rows.voxelStride == rows.voxelSize;
+
+    for(int z = rows.beginZ; z < rows.endZ; ++z)
+    for(int y = rows.beginY; y < rows.endY; ++y)
+    {
+        const int voxelIndex = Index3D(edgeLength, edgeLength, edgeLength, rows.beginX, y, z);
+        const char* source = &voxels[voxelIndex*rows.voxelSize];
+        char* bufferRow = rows.data +
+            (y - rows.beginY)*rows.rowStride +
+            (z - rows.beginZ)*rows.sliceStride;
+
+        if(packed)
+        {
+            memcpy(bufferRow, source, rowBytes);
+            continue;
+        }
+        for(int x = 0; x < rowVoxels; ++x)
+            memcpy(&bufferRow[x*rows.voxelStride], &source[x*rows.voxelSize], rows.voxelSize);
+    }
+}
+
+void Access::readChunkOptimistic( const Chunk* chunk, int layer, const ChunkRows& rows ) const
+{
+    for(int attempt = 0; attempt < MAX_OPTIMISTIC_READ_ATTEMPTS; ++attempt)
+    {
+        const unsigned int version = chunk->getVersion();
+        if(version & 1)
+        {
+            // Someone is modifying the chunk right now.
+            m_Volume->incStatistic(STATISTIC_OPTIMISTIC_READ_CONFLICTS);
+            tthread::this_thread::yield();
+            continue;
+        }
+
+        const char* voxels = reinterpret_cast<const char*>( chunk->getOptimisticLayer(layer, version) );
+        if(voxels == NULL)
+            break;
+
+        readChunkRows(voxels, rows);
+        if(chunk->getVersion() == version)
+            return;
+        m_Volume->incStatistic(STATISTIC_OPTIMISTIC_READ_CONFLICTS);
+    }
+
+    // Only this chunk is locked and workers never block while holding chunks,
+    // since they take all but the first chunk of a batch with try_lock.
+    // So this can't deadlock.
+    m_Volume->incStatistic(STATISTIC_OPTIMISTIC_READ_FALLBACKS);
+    SharedMutex* mutex = const_cast<Chunk*>(chunk)->getMutex();
+    mutex->lock_shared();
+    readChunkRows(reinterpret_cast<const char*>( chunk->getConstLayer(layer) ), rows);
+    mutex->unlock_shared();
+}
+
+bool Access::readVoxelSpan( int x, int y, int z, int layer, vmanVoxelSpan* spanOut ) const
+{
+    return getVoxelSpan(x,y,z, layer, VMAN_READ_ACCESS, spanOut);
+}
+
+bool Access::readWriteVoxelSpan( int x, int y, int z, int layer, vmanVoxelSpan* spanOut ) const
+{
+    return getVoxelSpan(x,y,z, layer, VMAN_READ_ACCESS|VMAN_WRITE_ACCESS, spanOut);
+}
+
+bool Access::getVoxelSpan( int x, int y, int z, int layer, int mode, vmanVoxelSpan* spanOut ) const
+{
+    int voxelIndex;
+    Chunk* chunk = getVoxelChunk(x,y,z, mode, &voxelIndex);
+    if(chunk == NULL)
+        return false;
+
+    const int edgeLength = m_Volume->getChunkEdgeLength();
     const int voxelSize = m_Volume->getLayer(layer)->voxelSize;
 
+    // The span ends at the chunk or selection boundary.
+    const int localX = voxelIndex % edgeLength;
+    const int localY = (voxelIndex / edgeLength) % edgeLength;
+    const int localZ = voxelIndex / (edgeLength*edgeLength);
+    spanOut->length = std::min(edgeLength - localX, m_Selection.x + m_Selection.w - x);
+    spanOut->rows   = std::min(edgeLength - localY, m_Selection.y + m_Selection.h - y);
+    spanOut->slices = std::min(edgeLength - localZ, m_Selection.z + m_Selection.d - z);
+    spanOut->voxelStride = voxelSize;
+    spanOut->rowStride = edgeLength*voxelSize;
+    spanOut->sliceStride = edgeLength*edgeLength*voxelSize;
+
+    const int voxelCount = spanOut->length * spanOut->rows * spanOut->slices;
+    m_Volume->incStatistic(STATISTIC_READ_OPS, voxelCount);
+
     if(mode & VMAN_WRITE_ACCESS)
     {
-        return &reinterpret_cast<char*>( chunk->getLayer(layer) )[Index3D(
-            voxelSize*edgeLength,
-            voxelSize*edgeLength,
-            voxelSize*edgeLength,
+        m_Volume->incStatistic(STATISTIC_WRITE_OPS, voxelCount);
 
-            x - chunkX*edgeLength,
-            y - chunkY*edgeLength,
-            z - chunkZ*edgeLength
-        )];
+        char* voxels = reinterpret_cast<char*>( chunk->getLayer(layer) );
+        spanOut->data = &voxels[voxelIndex*voxelSize];
+
+        const int lastVoxelIndex = Index3D(
+            edgeLength,
+            edgeLength,
+            edgeLength,
+
+            localX + spanOut->length - 1,
+            localY + spanOut->rows - 1,
+            localZ + spanOut->slices - 1
+        );
+        chunk->setVoxelsModified(layer, voxelIndex, lastVoxelIndex - voxelIndex + 1);
+
+        // Rows are recorded as runs, which are merged on unlock.
+        if(m_Volume->getJournal() != NULL)
+        {
+            for(int sz = 0; sz < spanOut->slices; ++sz)
+            for(int sy = 0; sy < spanOut->rows; ++sy)
+                addWrittenVoxels(chunk, layer, Index3D(edgeLength, edgeLength, edgeLength, localX, localY+sy, localZ+sz), spanOut->length);
+        }
     }
     else
     {
-        // TODO: Evil evil evil !
-        return &const_cast<char*>( reinterpret_cast<const char*>( chunk->getConstLayer(layer) ) )[Index3D(
-            voxelSize*edgeLength,
-            voxelSize*edgeLength,
-            voxelSize*edgeLength,
+        // Like readVoxelLayer, the pointer must not be written.
+        const char* voxels = reinterpret_cast<const char*>( chunk->getConstLayer(layer) );
+        spanOut->data = const_cast<char*>(&voxels[voxelIndex*voxelSize]);
+    }
+    return true;
+}
+
+bool Access::WrittenVoxels::operator < ( const WrittenVoxels& other ) const
+{
+    if(chunk != other.chunk)
+        return chunk < other.chunk;
+    if(layer != other.layer)
+        return layer < other.layer;
+    return voxelIndex < other.voxelIndex;
+}
+
+void Access::addWrittenVoxels( Chunk* chunk, int layer, int voxelIndex, int voxelCount ) const
+{
+    if(m_Volume->getJournal() == NULL)
+        return;
+
+    WrittenVoxels voxels;
+    voxels.chunk = chunk;
+    voxels.layer = layer;
+    voxels.voxelIndex = voxelIndex;
+    voxels.voxelCount = voxelCount;
+    m_WrittenVoxels.push_back(voxels);
+}
 
-            x - chunkX*edgeLength,
-            y - chunkY*edgeLength,
-            z - chunkZ*edgeLength
-        )];
+void Access::journalWrittenVoxels()
+{
+    Journal* journal = m_Volume->getJournal();
+    assert(journal != NULL);
+
+    // Voxels that were accessed repeatedly are only recorded once
+    // and neighbouring voxels share a record.
+    std::sort(m_WrittenVoxels.begin(), m_WrittenVoxels.end());
+    int merged = 0;
+    for(int i = 1; i < m_WrittenVoxels.size(); ++i)
+    {
+        WrittenVoxels& previous = m_WrittenVoxels[merged];
+        const WrittenVoxels& current = m_WrittenVoxels[i];
+        const int previousEnd = previous.voxelIndex + previous.voxelCount;
+        if(current.chunk == previous.chunk &&
+           current.layer == previous.layer &&
+           current.voxelIndex <= previousEnd)
+        {
+            const int currentEnd = current.voxelIndex + current.voxelCount;
+            previous.voxelCount = std::max(previousEnd, currentEnd) - previous.voxelIndex;
+        }
+        else
+        {
+            m_WrittenVoxels[++merged] = current;
+        }
     }
+    m_WrittenVoxels.resize(merged+1);
+
+    for(int i = 0; i < m_WrittenVoxels.size(); ++i)
+    {
+        const WrittenVoxels& written = m_WrittenVoxels[i];
+        const int voxelSize = m_Volume->getLayer(written.layer)->voxelSize;
+        const char* voxels = reinterpret_cast<const char*>( written.chunk->getConstLayer(written.layer) );
+        journal->append(
+            written.chunk->getId(),
+            written.layer,
+            written.voxelIndex,
+            written.voxelCount,
+            &voxels[written.voxelIndex*voxelSize]
+        );
+    }
+    m_WrittenVoxels.clear();
+
+    m_Volume->scheduleJournalFlush();
 }
 
 
@@ -2,6 +2,7 @@
 #define __VMAN_ACCESS_H__
 
 #include <vector>
+#include <tinythread.h>
 #include "vman.h"
 
 namespace vman
@@ -17,6 +18,15 @@ class Chunk;
 class Access
 {
 public:
+    enum
+    {
+        /**
+         * Optimistic reads of a chunk, before it's locked instead.
+         * @see VMAN_OPTIMISTIC_READ_ACCESS
+         */
+        MAX_OPTIMISTIC_READ_ATTEMPTS = 4
+    };
+
     /**
      * Initially the selection will be invalid and all r/w operations will fail.
      */
@@ -41,11 +51,28 @@ public:
      */
     void select( const vmanSelection* selection );
 
+    /**
+     * Behaves like select(), but calls `callback` once
+     * no selected chunk needs to be loaded anymore.
+     * @see vmanSelectAsync
+     */
+    void selectAsync( const vmanSelection* selection, vmanSelectionCallback callback, void* context );
+
+    /**
+     * Is thread safe.
+     * @return Whether none of the selected chunks is being loaded or saved,
+     * so locking doesn't need to wait for the disk.
+     */
+    bool isSelectionReady() const;
+
     /**
      * Locks access to the specified selection.
      * May block when intersecting chunks are already locked by other access objects.
      * May also block while affected chunks are loaded from disk.
-     * Multiple access objects may read simultaneously from the same chunk.
+     * Multiple access objects may read simultaneously from the same chunk,
+     * as long as they were locked without VMAN_WRITE_ACCESS.
+     * All chunks of the selection are granted at once and
+     * access objects that wait for the same chunk are served in order.
      * Will generate an error if its already locked!
      * @param mode: Access mode bitmask.
      * @see vmanAccessMode
@@ -59,12 +86,44 @@ public:
      */
     bool tryLock( int mode );
 
+    /**
+     * Behaves like lock(), but gives up after the given time.
+     * @param milliseconds Negative values wait forever.
+     * @return `false` if it timed out.
+     * @see lock
+     */
+    bool lockFor( int mode, int milliseconds );
+
     /**
      * Unlocks access.
+     * Voxels that have been written are appended to the journal before.
      * Will generate an error if its not locked!
      */
     void unlock();
 
+    /**
+     * Copies the state of each selected chunk to `statesOut`.
+     * @return Amount of selected chunks.
+     * @see vmanGetAccessChunkStates
+     */
+    int getChunkStates( vmanChunkState* statesOut, int maxCount ) const;
+
+    /**
+     * Only used by the chunks of an asynchronous selection,
+     * while they still list the access as load listener.
+     * Keeps select() from returning, until chunkLoaded() has been called.
+     * Is thread safe.
+     */
+    void holdCallback();
+
+    /**
+     * Only used by the chunks of an asynchronous selection,
+     * when they have been loaded.
+     * Calls the callback after the last one.
+     * Must follow holdCallback().
+     */
+    void chunkLoaded();
+
     /**
      * @return: Returns a read only pointer to the voxel data in the specified layer.
      * Will return `NULL` if the voxel lies outside the selection or
@@ -80,12 +139,128 @@ public:
      */
     void* readWriteVoxelLayer( int x, int y, int z, int layer ) const;
 
+    /**
+     * Copies `voxel` into the specified layer.
+     * Unlike readWriteVoxelLayer() this doesn't allocate layers
+     * that are absent or uniform, as long as the value doesn't change.
+     * @return: `false` if the voxel lies outside the selection or
+     * an incomplatible access mode has been selected.
+     */
+    bool writeVoxelLayer( int x, int y, int z, int layer, const void* voxel ) const;
+
+    /**
+     * Copies a box of voxels from one or more layers into caller buffers.
+     * Voxels are copied chunk by chunk and row by row.
+     * @param box Voxel box, which must lie inside the selection.
+     * @return: `false` if the box lies outside the selection,
+     * a layer doesn't exist or an incomplatible access mode has been selected.
+     * @see vmanLayerBuffer
+     */
+    bool readRegion( const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount ) const;
+
+    /**
+     * Copies caller buffers into a box of voxels.
+     * Rows that don't change are skipped, so absent and uniform layers
+     * are only allocated if the written values differ from them.
+     * @see readRegion
+     */
+    bool writeRegion( const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount ) const;
+
+    /**
+     * Describes the voxels of the chunk, starting at the given voxel,
+     * until the chunk or selection ends.
+     * The span stays valid until the access is unlocked.
+     * @return: `false` if the voxel lies outside the selection or
+     * an incomplatible access mode has been selected.
+     * @see vmanVoxelSpan
+     */
+    bool readVoxelSpan( int x, int y, int z, int layer, vmanVoxelSpan* spanOut ) const;
+
+    /**
+     * Like readVoxelSpan(), but the voxels may be written.
+     * All voxels of the span are marked as modified.
+     */
+    bool readWriteVoxelSpan( int x, int y, int z, int layer, vmanVoxelSpan* spanOut ) const;
+
 private:
     Access( const Access& access );
     Access& operator = ( const Access& access );
 
     void* getVoxelLayer( int x, int y, int z, int layer, int mode ) const;
 
+    /**
+     * @param voxelIndexOut Index of the voxel inside the chunk.
+     * @return The chunk, which contains the voxel or `NULL` on errors.
+     */
+    Chunk* getVoxelChunk( int x, int y, int z, int mode, int* voxelIndexOut ) const;
+
+    /**
+     * Part of a box, that lies inside a chunk,
+     * and where its voxels are stored in a caller buffer.
+     */
+    struct ChunkRows
+    {
+        int beginX, beginY, beginZ;
+        int endX, endY, endZ;
+        int voxelSize;
+
+        /**
+         * Points to the buffer voxel at `(beginX,beginY,beginZ)`.
+         */
+        char* data;
+        int voxelStride;
+        int rowStride;
+        int sliceStride;
+    };
+
+    /**
+     * Implements readRegion and writeRegion.
+     * @param mode VMAN_READ_ACCESS, VMAN_WRITE_ACCESS or VMAN_OPTIMISTIC_READ_ACCESS.
+     */
+    bool copyRegion( const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount, int mode ) const;
+
+    /**
+     * Copies voxels of a chunk layer into the caller buffer.
+     */
+    void readChunkRows( const char* voxels, const ChunkRows& rows ) const;
+
+    /**
+     * Copies voxels of a chunk without locking it.
+     * Locks the chunk, if it's modified too often meanwhile.
+     * @see VMAN_OPTIMISTIC_READ_ACCESS
+     */
+    void readChunkOptimistic( const Chunk* chunk, int layer, const ChunkRows& rows ) const;
+
+    /**
+     * Implements readVoxelSpan and readWriteVoxelSpan.
+     */
+    bool getVoxelSpan( int x, int y, int z, int layer, int mode, vmanVoxelSpan* spanOut ) const;
+
+    /**
+     * Consecutive voxels that may have been written while the access was locked.
+     */
+    struct WrittenVoxels
+    {
+        Chunk* chunk;
+        int layer;
+        int voxelIndex;
+        int voxelCount;
+
+        bool operator < ( const WrittenVoxels& other ) const;
+    };
+
+    /**
+     * Remembers written voxels, if the volume has a journal.
+     */
+    void addWrittenVoxels( Chunk* chunk, int layer, int voxelIndex, int voxelCount ) const;
+
+    /**
+     * Appends the current values of the written voxels to the journal.
+     * Overlapping and adjacent runs are merged into one record.
+     * Their chunks must still be locked.
+     */
+    void journalWrittenVoxels();
+
     Volume* m_Volume;
     bool m_SelectionIsInvalid;
     bool m_IsLocked;
@@ -100,6 +275,37 @@ private:
      * @see m_Selection
      */
     std::vector<Chunk*> m_Cache;
+
+    /**
+     * The cached chunks sorted for the LockManager.
+     * @see LockManager#SortChunks
+     */
+    std::vector<Chunk*> m_LockOrder;
+
+    /**
+     * Set by selectAsync() until the selection changes.
+     */
+    vmanSelectionCallback m_SelectionCallback;
+    void* m_SelectionCallbackContext;
+
+    /**
+     * Selected chunks, that still need to be loaded, before the callback is called.
+     */
+    tthread::atomic_int m_LoadingChunks;
+
+    /**
+     * Chunks, that have been held for chunkLoaded(), but didn't finish it yet.
+     * select() waits for them, before the callback is replaced.
+     */
+    int m_PendingCallbacks;
+    tthread::mutex m_CallbackMutex;
+    tthread::condition_variable m_CallbackCondition;
+
+    /**
+     * Voxels that are appended to the journal on unlock.
+     * Is mutable, since writing is const like the rest of the r/w interface.
+     */
+    mutable std::vector<WrittenVoxels> m_WrittenVoxels;
 };
 
 }
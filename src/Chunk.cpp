@@ -1,14 +1,18 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include "Util.h"
 #include "Volume.h"
+#include "Access.h"
 #include "Chunk.h"
 
 
 namespace vman
 {
 
+static const uint32_t AllDirtyBlocks = 0xFFFFFFFF;
+
 union ChunkIdHelper
 {
     struct
@@ -61,9 +65,26 @@ Chunk::Chunk( Volume* volume, int chunkX, int chunkY, int chunkZ ) :
     m_ChunkY(chunkY),
     m_ChunkZ(chunkZ),
     m_Layers(volume->getLayerCount()), // n layers initialized with NULL
-    m_Modified(false)
+    m_LayerCodecs(volume->getLayerCount(), VOXEL_CODEC_NONE),
+    m_CompressedLayerSizes(volume->getLayerCount(), 0),
+    m_LayerMapped(volume->getLayerCount(), false),
+    m_MappedLayerCount(0),
+    m_ReadableLayers(new AtomicPointer<const char>[volume->getLayerCount()]),
+    m_LayerVersions(volume->getLayerCount(), NULL),
+    m_Modified(false),
+    m_DirtyBlocks(volume->getLayerCount(), 0),
+    m_StoredLayerOffsets(volume->getLayerCount(), 0),
+    m_SavedLayerOffsets(volume->getLayerCount(), 0),
+    m_ModificationTime(0),
+    m_State(VMAN_CHUNK_READY),
+    m_LoadListeners()
 {
 	memset(&m_Layers[0], 0, m_Layers.size()*sizeof(char*));
+	memset(&m_Mapping, 0, sizeof(m_Mapping));
+    for(int i = 0; i < m_Layers.size(); ++i)
+        updateReadableLayer(i);
+    for(int i = 0; i < JOB_TYPE_COUNT; ++i)
+        m_JobQueuePositions[i] = -1;
 }
 
 Chunk::~Chunk()
@@ -71,7 +92,10 @@ Chunk::~Chunk()
     if(m_Volume->getBaseDir() != NULL)
         assert(m_Modified == false);
     assert(m_References == 0);
+    assert(m_LockState.readers == 0 && m_LockState.writer == false);
+    assert(m_LockState.waiters.empty());
     clearLayers(true);
+    delete[] m_ReadableLayers;
 }
 
 int Chunk::getChunkX() const
@@ -101,39 +125,159 @@ std::string Chunk::toString() const
 
 void Chunk::initializeLayer( int index )
 {
+    ModificationGuard guard(m_Mutex);
+
     const vmanLayer* layer = m_Volume->getLayer(index);
     assert(layer != NULL);
 
     const int bytes = m_Volume->getVoxelsPerChunk()*layer->voxelSize;
 
     assert(m_Layers[index] == NULL);
-    m_Layers[index] = new char[bytes];
-    memset(m_Layers[index], 0, bytes);
+    m_Layers[index] = allocateLayer(index);
+    memcpy(m_Layers[index], m_Volume->getDefaultPage(index), bytes);
+    updateReadableLayer(index);
+}
 
-    setModified();
+char* Chunk::allocateLayer( int index )
+{
+    LayerPool* pool = m_Volume->getLayerPool(index);
+    m_Volume->incResidentBytes(pool->getBlockSize());
+    return pool->allocate();
 }
 
-void Chunk::clearLayers( bool silent )
+void Chunk::freeLayer( int index, char* voxels )
 {
-    for(int i = 0; i < m_Layers.size(); ++i)
+    if(m_LayerVersions[index] != NULL)
+    {
+        assert(voxels == m_LayerVersions[index]->getVoxels());
+        m_LayerVersions[index]->releaseReference();
+        m_LayerVersions[index] = NULL;
+        return;
+    }
+
+    LayerPool* pool = m_Volume->getLayerPool(index);
+    pool->release(voxels);
+    m_Volume->decResidentBytes(pool->getBlockSize());
+}
+
+void Chunk::copyMappedLayer( int index )
+{
+    ModificationGuard guard(m_Mutex);
+
+    assert(m_LayerMapped[index]);
+
+    const int bytes = m_Volume->getVoxelsPerChunk()*m_Volume->getLayer(index)->voxelSize;
+    char* copy = allocateLayer(index);
+    memcpy(copy, m_Layers[index], bytes);
+
+    m_Layers[index] = copy;
+    m_LayerMapped[index] = false;
+    updateReadableLayer(index);
+    if(--m_MappedLayerCount == 0)
+        UnmapFile(&m_Mapping);
+}
+
+void Chunk::copySharedLayer( int index )
+{
+    ModificationGuard guard(m_Mutex);
+
+    LayerVersion* version = m_LayerVersions[index];
+    assert(version != NULL);
+    m_LayerVersions[index] = NULL;
+
+    // No one can pin the layer meanwhile, since the mutex is locked exclusively.
+    if(version->isShared() == false)
     {
-        if(m_Layers[i] != NULL)
+        m_Layers[index] = version->reclaimVoxels();
+        updateReadableLayer(index);
+        return;
+    }
+
+    const int bytes = m_Volume->getVoxelsPerChunk()*m_Volume->getLayer(index)->voxelSize;
+    char* copy = allocateLayer(index);
+    memcpy(copy, m_Layers[index], bytes);
+    m_Layers[index] = copy;
+    updateReadableLayer(index);
+    version->releaseReference();
+}
+
+bool Chunk::releaseLayer( int index )
+{
+    ModificationGuard guard(m_Mutex);
+
+    if(m_Layers[index] == NULL)
+        return false;
+
+    if(m_LayerMapped[index])
+    {
+        m_LayerMapped[index] = false;
+        if(--m_MappedLayerCount == 0)
+            UnmapFile(&m_Mapping);
+    }
+    else
+    {
+        if(m_LayerCodecs[index] != VOXEL_CODEC_NONE)
         {
-            delete[] m_Layers[i];
-            m_Layers[i] = NULL;
-            if(!silent)
-                setModified();
+            const int bytes = m_Volume->getVoxelsPerChunk()*m_Volume->getLayer(index)->voxelSize;
+            m_Volume->decStatistic(STATISTIC_COMPRESSED_BYTES, m_CompressedLayerSizes[index]);
+            m_Volume->decStatistic(STATISTIC_UNCOMPRESSED_BYTES, bytes);
+            m_Volume->decResidentBytes(m_CompressedLayerSizes[index]);
+            // Uniform layers use the shared pages of the volume.
+            if(m_LayerCodecs[index] != VOXEL_CODEC_UNIFORM)
+                delete[] m_Layers[index];
+            m_LayerCodecs[index] = VOXEL_CODEC_NONE;
+            m_CompressedLayerSizes[index] = 0;
+        }
+        else
+        {
+            freeLayer(index, m_Layers[index]);
         }
     }
+    m_Layers[index] = NULL;
+    updateReadableLayer(index);
+    return true;
+}
+
+void Chunk::updateReadableLayer( int index )
+{
+    const char* voxels = NULL;
+    if(m_Layers[index] == NULL)
+        voxels = m_Volume->getDefaultPage(index);
+    else if(m_LayerMapped[index] == false &&
+            (m_LayerCodecs[index] == VOXEL_CODEC_NONE ||
+             m_LayerCodecs[index] == VOXEL_CODEC_UNIFORM))
+        voxels = m_Layers[index];
+    m_ReadableLayers[index] = voxels;
+}
+
+void Chunk::clearLayers( bool silent )
+{
+    for(int i = 0; i < m_Layers.size(); ++i)
+    {
+        if(releaseLayer(i) && !silent)
+            setModified();
+    }
+
+    assert(m_MappedLayerCount == 0);
+    UnmapFile(&m_Mapping);
 }
 
 void* Chunk::getLayer( int index )
 {
     if((index < 0) || (index >= m_Layers.size()))
         return NULL;
+
+    // Changing the representation is a modification too.
+    ModificationGuard guard(m_Mutex);
+
     if(m_Layers[index] == NULL)
         initializeLayer(index);
-    setModified();
+    else if(m_LayerMapped[index])
+        copyMappedLayer(index);
+    else if(m_LayerCodecs[index] != VOXEL_CODEC_NONE)
+        decompressLayer(index);
+    else if(m_LayerVersions[index] != NULL)
+        copySharedLayer(index);
     return m_Layers[index];
 }
 
@@ -141,9 +285,237 @@ const void* Chunk::getConstLayer( int index ) const
 {
     if((index < 0) || (index >= m_Layers.size()))
         return NULL;
+
+    // Absent, uniform and plain layers need no decoding.
+    const char* voxels = m_ReadableLayers[index].load();
+    if(voxels != NULL)
+        return voxels;
+
+    lock_guard guard(m_DecodeMutex);
+
+    if(m_LayerCodecs[index] != VOXEL_CODEC_NONE)
+    {
+        // Doesn't change the voxels, just their representation.
+        // But optimistic readers must not use the old one, so decompressLayer() announces a modification.
+        const_cast<Chunk*>(this)->decompressLayer(index);
+    }
+    return m_Layers[index];
+}
+
+unsigned int Chunk::getVersion() const
+{
+    return m_Mutex.getVersion();
+}
+
+const char* Chunk::pinLayer( int index, LayerVersion** versionOut ) const
+{
+    *versionOut = NULL;
+    if((index < 0) || (index >= m_Layers.size()))
+        return NULL;
+
+    // Other readers may decompress layers meanwhile.
+    lock_guard guard(m_DecodeMutex);
+
+    if(m_Layers[index] == NULL)
+        return m_Volume->getDefaultPage(index);
+    Chunk* self = const_cast<Chunk*>(this);
+
+    // Uniform layers point to a shared page already.
+    if(m_LayerCodecs[index] == VOXEL_CODEC_UNIFORM)
+        return m_Layers[index];
+
+    if(m_LayerMapped[index])
+    {
+        // Other readers may still use the mapping, so the snapshot gets its own copy.
+        const int bytes = m_Volume->getVoxelsPerChunk()*m_Volume->getLayer(index)->voxelSize;
+        char* copy = self->allocateLayer(index);
+        memcpy(copy, m_Layers[index], bytes);
+        *versionOut = new LayerVersion(m_Volume, index, copy);
+        return copy;
+    }
+
+    if(m_LayerCodecs[index] != VOXEL_CODEC_NONE)
+        self->decompressLayer(index);
+
+    if(m_LayerVersions[index] == NULL)
+        self->m_LayerVersions[index] = new LayerVersion(m_Volume, index, m_Layers[index]);
+    m_LayerVersions[index]->addReference();
+    *versionOut = m_LayerVersions[index];
     return m_Layers[index];
 }
 
+const void* Chunk::getOptimisticLayer( int index, unsigned int version ) const
+{
+    if((index < 0) || (index >= m_Layers.size()))
+        return NULL;
+
+    // Mappings may go away and compressed data is freed on decompression,
+    // so those layers aren't readable.  Pool memory and uniform pages stay
+    // readable, even if the layer is released or replaced.
+    const char* voxels = m_ReadableLayers[index].load();
+    if(getVersion() != version)
+        return NULL;
+    return voxels;
+}
+
+bool Chunk::hasLayer( int index ) const
+{
+    if((index < 0) || (index >= m_Layers.size()))
+        return false;
+    return m_Layers[index] != NULL;
+}
+
+bool Chunk::writeVoxel( int layerIndex, int voxelIndex, const void* voxel )
+{
+    assert(layerIndex >= 0);
+    assert(layerIndex < m_Layers.size());
+    assert(voxelIndex >= 0);
+    assert(voxelIndex < m_Volume->getVoxelsPerChunk());
+
+    const int voxelSize = m_Volume->getLayer(layerIndex)->voxelSize;
+
+    const char* uniformVoxel = NULL;
+    if(m_Layers[layerIndex] == NULL)
+        uniformVoxel = m_Volume->getDefaultPage(layerIndex);
+    else if(m_LayerCodecs[layerIndex] == VOXEL_CODEC_UNIFORM)
+        uniformVoxel = m_Layers[layerIndex];
+
+    if(uniformVoxel != NULL && memcmp(uniformVoxel, voxel, voxelSize) == 0)
+        return false; // Nothing changes.
+
+    char* voxels = reinterpret_cast<char*>(getLayer(layerIndex));
+    char* target = &voxels[voxelIndex*voxelSize];
+    if(memcmp(target, voxel, voxelSize) == 0)
+        return false;
+    memcpy(target, voxel, voxelSize);
+    setVoxelsModified(layerIndex, voxelIndex, 1);
+    return true;
+}
+
+int Chunk::compressLayers()
+{
+    const int voxelsPerChunk = m_Volume->getVoxelsPerChunk();
+
+    int compressedLayers = 0;
+    ScratchBuffer runLengthBuffer(m_Volume->getScratchBuffers());
+    ScratchBuffer paletteBuffer(m_Volume->getScratchBuffers());
+    std::vector<char>& runLengthData = *runLengthBuffer;
+    std::vector<char>& paletteData = *paletteBuffer;
+    for(int i = 0; i < m_Layers.size(); ++i)
+    {
+        if(m_Layers[i] == NULL || m_LayerMapped[i] || m_LayerCodecs[i] != VOXEL_CODEC_NONE)
+            continue;
+
+        const int voxelSize = m_Volume->getLayer(i)->voxelSize;
+        const int bytes = voxelsPerChunk*voxelSize;
+
+        if(IsUniform(m_Layers[i], voxelsPerChunk, voxelSize) &&
+           setUniformLayer(i, m_Layers[i]))
+        {
+            compressedLayers++;
+            continue;
+        }
+
+        EncodeVoxels(m_Layers[i], voxelsPerChunk, voxelSize, &runLengthData);
+        const bool paletteEncoded = EncodePalette(m_Layers[i], voxelsPerChunk, voxelSize, &paletteData);
+
+        VoxelCodec codec = VOXEL_CODEC_RLE;
+        const std::vector<char>* data = &runLengthData;
+        if(paletteEncoded && paletteData.size() < runLengthData.size())
+        {
+            codec = VOXEL_CODEC_PALETTE;
+            data = &paletteData;
+        }
+
+        if(data->size() >= bytes)
+            continue;
+
+        setCompressedLayer(i, codec, &(*data)[0], data->size());
+        compressedLayers++;
+    }
+    return compressedLayers;
+}
+
+bool Chunk::setUniformLayer( int index, const char* voxel )
+{
+    ModificationGuard guard(m_Mutex);
+
+    // Optimistic readers may still use the page after the layer changed,
+    // so uniform layers never own their memory.
+    const char* page = m_Volume->getUniformPage(index, voxel);
+    if(page == NULL)
+        return false;
+
+    releaseLayer(index);
+    if(page == m_Volume->getDefaultPage(index))
+        return true;
+
+    // The page begins with the encoded voxel.
+    const int voxelSize = m_Volume->getLayer(index)->voxelSize;
+    const int bytes = m_Volume->getVoxelsPerChunk()*voxelSize;
+    m_Layers[index] = const_cast<char*>(page);
+    m_LayerCodecs[index] = VOXEL_CODEC_UNIFORM;
+    m_CompressedLayerSizes[index] = voxelSize;
+    updateReadableLayer(index);
+
+    m_Volume->incStatistic(STATISTIC_COMPRESSED_BYTES, voxelSize);
+    m_Volume->incStatistic(STATISTIC_UNCOMPRESSED_BYTES, bytes);
+    m_Volume->incResidentBytes(voxelSize);
+    return true;
+}
+
+void Chunk::setCompressedLayer( int index, VoxelCodec codec, const char* data, int dataSize )
+{
+    ModificationGuard guard(m_Mutex);
+
+    assert(codec != VOXEL_CODEC_NONE);
+    assert(codec != VOXEL_CODEC_UNIFORM); // Use setUniformLayer()
+    assert(m_LayerMapped[index] == false);
+    assert(m_LayerCodecs[index] == VOXEL_CODEC_NONE);
+
+    const int bytes = m_Volume->getVoxelsPerChunk()*m_Volume->getLayer(index)->voxelSize;
+
+    // Compressed layers vary in size, so they don't use the layer pool.
+    char* compressed = new char[dataSize];
+    memcpy(compressed, data, dataSize);
+    if(m_Layers[index] != NULL)
+        freeLayer(index, m_Layers[index]);
+    m_Layers[index] = compressed;
+    m_LayerCodecs[index] = codec;
+    m_CompressedLayerSizes[index] = dataSize;
+    updateReadableLayer(index);
+
+    m_Volume->incStatistic(STATISTIC_COMPRESSED_BYTES, dataSize);
+    m_Volume->incStatistic(STATISTIC_UNCOMPRESSED_BYTES, bytes);
+    m_Volume->incResidentBytes(dataSize);
+}
+
+void Chunk::decompressLayer( int index )
+{
+    ModificationGuard guard(m_Mutex);
+
+    assert(m_LayerCodecs[index] != VOXEL_CODEC_NONE);
+
+    const int voxelsPerChunk = m_Volume->getVoxelsPerChunk();
+    const int voxelSize = m_Volume->getLayer(index)->voxelSize;
+    const int bytes = voxelsPerChunk*voxelSize;
+
+    char* voxels = allocateLayer(index);
+    const bool success = DecodeLayer(m_LayerCodecs[index], m_Layers[index], m_CompressedLayerSizes[index], voxelsPerChunk, voxelSize, voxels);
+    assert(success);
+
+    m_Volume->decStatistic(STATISTIC_COMPRESSED_BYTES, m_CompressedLayerSizes[index]);
+    m_Volume->decStatistic(STATISTIC_UNCOMPRESSED_BYTES, bytes);
+    m_Volume->decResidentBytes(m_CompressedLayerSizes[index]);
+
+    if(m_LayerCodecs[index] != VOXEL_CODEC_UNIFORM)
+        delete[] m_Layers[index];
+    m_Layers[index] = voxels;
+    m_LayerCodecs[index] = VOXEL_CODEC_NONE;
+    m_CompressedLayerSizes[index] = 0;
+    updateReadableLayer(index);
+}
+
 /*
     Chunk file format:
 
@@ -153,9 +525,17 @@ const void* Chunk::getConstLayer( int index ) const
         uint32 layerCount
         [
             char[32] name
+            uint32 voxelSize
             uint32 revision
-            uint32 offsetPointer
+            uint32 fileOffset
+            uint32 codec (since version 2)
+            uint32 dataSize (since version 2)
         ]
+
+    Followed by the layer data, which is either a plain voxel array,
+    palette encoded or a single uniform voxel. (see VoxelCodec.cpp)
+    Palette entries are serialized like voxels.
+    Layers that consist of their default value are not stored.
 */
 
 struct ChunkFileHeader
@@ -171,8 +551,15 @@ struct ChunkFileLayerInfo
     uint32_t voxelSize;
     uint32_t revision;
     uint32_t fileOffset;
+    uint32_t codec;
+    uint32_t dataSize;
 };
 
+/**
+ * Version 1 layer infos lack the codec and data size.
+ */
+static const uint32_t ChunkFileLayerInfoSizeV1 = sizeof(ChunkFileLayerInfo) - 2*sizeof(uint32_t);
+
 ChunkFileLayerInfo* FindChunkLayerByName( std::vector<ChunkFileLayerInfo>& layerInfos, const char* name )
 {
     for(int i = 0; i < layerInfos.size(); ++i)
@@ -183,7 +570,14 @@ ChunkFileLayerInfo* FindChunkLayerByName( std::vector<ChunkFileLayerInfo>& layer
     return NULL;
 }
 
-static const int ChunkFileVersion = 1;
+static const int ChunkFileVersion = 2;
+
+static void ReadChunkData( const char* data, uint32_t dataSize, uint32_t offset, void* destination, uint32_t size, const std::string& error )
+{
+    if(offset + size > dataSize)
+        throw error;
+    memcpy(destination, &data[offset], size);
+}
 
 bool Chunk::loadFromFile()
 {
@@ -191,29 +585,59 @@ bool Chunk::loadFromFile()
 
     m_Volume->log(VMAN_LOG_DEBUG, "Loading chunk %s from file ..\n", toString().c_str());
 
-    if(m_Volume->getBaseDir() == NULL)
+    ChunkStorage* storage = m_Volume->getChunkStorage();
+    if(storage == NULL)
     {
         assert(!"Probably redundant.");
         return false;
     }
 
-    const int voxelsPerChunk = m_Volume->getVoxelsPerChunk();
-
-    std::string fileName = m_Volume->getChunkFileName(m_ChunkX, m_ChunkY, m_ChunkZ);
-
-    FILE* f = fopen(fileName.c_str(), "rb");
-    if(f == NULL)
+    // Either map the chunk data or read it into a buffer.
+    assert(m_Mapping.address == NULL);
+    ScratchBuffer fileBuffer(m_Volume->getScratchBuffers());
+    std::vector<char>& buffer = *fileBuffer;
+    const char* data = NULL;
+    uint32_t dataSize = 0;
+    if(m_Volume->isLayerMappingEnabled() &&
+       storage->mapChunk(m_ChunkX, m_ChunkY, m_ChunkZ, &m_Mapping))
     {
-        m_Volume->log(VMAN_LOG_DEBUG, "%s: File does not exist.\n", fileName.c_str());
-        return false;
+        data = m_Mapping.data;
+        dataSize = m_Mapping.length - (m_Mapping.data - (const char*)m_Mapping.address);
+    }
+    else
+    {
+        if(storage->readChunk(m_ChunkX, m_ChunkY, m_ChunkZ, &buffer) == false)
+            return false;
+        data = &buffer[0];
+        dataSize = buffer.size();
     }
 
+    return parseFileData(data, dataSize);
+}
+
+bool Chunk::loadFromData( const char* data, uint32_t dataSize )
+{
+    m_Volume->incStatistic(STATISTIC_CHUNK_LOAD_OPS);
+
+    m_Volume->log(VMAN_LOG_DEBUG, "Loading chunk %s from read data ..\n", toString().c_str());
+
+    assert(m_Mapping.address == NULL);
+    return parseFileData(data, dataSize);
+}
+
+bool Chunk::parseFileData( const char* data, uint32_t dataSize )
+{
+    ModificationGuard guard(m_Mutex);
+
+    const int voxelsPerChunk = m_Volume->getVoxelsPerChunk();
+
+    std::fill(m_StoredLayerOffsets.begin(), m_StoredLayerOffsets.end(), 0);
+
     try
     {
         // -- Read header --
         ChunkFileHeader header;
-        if(fread(&header, sizeof(header), 1, f) != 1)
-            throw "Read error in file header.";
+        ReadChunkData(data, dataSize, 0, &header, sizeof(header), "Read error in file header.");
         header.version = LittleEndian(header.version);
         header.edgeLength = LittleEndian(header.edgeLength);
         header.layerCount = LittleEndian(header.layerCount);
@@ -222,8 +646,10 @@ bool Chunk::loadFromFile()
         m_Volume->log(VMAN_LOG_DEBUG, "edgeLength: %d\n", header.edgeLength);
         m_Volume->log(VMAN_LOG_DEBUG, "layerCount: %d\n", header.layerCount);
 
-        if(header.version != ChunkFileVersion)
-            throw "Incorrect file version.";
+        if(header.version < 1 || header.version > ChunkFileVersion)
+            throw std::string("Incorrect file version.");
+
+        const uint32_t layerInfoSize = (header.version == 1) ? ChunkFileLayerInfoSizeV1 : sizeof(ChunkFileLayerInfo);
 
         std::vector<ChunkFileLayerInfo> layerInfos(header.layerCount);
 
@@ -231,25 +657,45 @@ bool Chunk::loadFromFile()
         for(int i = 0; i < layerInfos.size(); ++i)
         {
             ChunkFileLayerInfo* layerInfo = &layerInfos[i];
-            if(fread(layerInfo, sizeof(ChunkFileLayerInfo), 1, f) != 1)
-                throw Format("Read error in layer info %d", i);
+            ReadChunkData(
+                data,
+                dataSize,
+                sizeof(ChunkFileHeader) + layerInfoSize*i,
+                layerInfo,
+                layerInfoSize,
+                Format("Read error in layer info %d", i)
+            );
+            layerInfo->name[VMAN_MAX_LAYER_NAME_LENGTH] = '\0';
             layerInfo->voxelSize = LittleEndian(layerInfo->voxelSize);
             layerInfo->revision = LittleEndian(layerInfo->revision);
             layerInfo->fileOffset = LittleEndian(layerInfo->fileOffset);
+            if(header.version == 1)
+            {
+                layerInfo->codec = VOXEL_CODEC_NONE;
+                layerInfo->dataSize = voxelsPerChunk*layerInfo->voxelSize;
+            }
+            else
+            {
+                layerInfo->codec = LittleEndian(layerInfo->codec);
+                layerInfo->dataSize = LittleEndian(layerInfo->dataSize);
+            }
 
             m_Volume->log(VMAN_LOG_DEBUG, "[layer %d] name: '%s'\n", i, layerInfo->name);
             m_Volume->log(VMAN_LOG_DEBUG, "[layer %d] voxelSize: %d\n", i, layerInfo->voxelSize);
             m_Volume->log(VMAN_LOG_DEBUG, "[layer %d] revision: %d\n", i, layerInfo->revision);
             m_Volume->log(VMAN_LOG_DEBUG, "[layer %d] fileOffset: %d\n", i, layerInfo->fileOffset);
+            m_Volume->log(VMAN_LOG_DEBUG, "[layer %d] codec: %d\n", i, layerInfo->codec);
+            m_Volume->log(VMAN_LOG_DEBUG, "[layer %d] dataSize: %d\n", i, layerInfo->dataSize);
 
             if(m_Volume->getLayerIndexByName(layerInfo->name) == -1)
             {
-                m_Volume->log(VMAN_LOG_INFO, "%s: Ignoring chunk layer '%s'.\n", fileName.c_str(), layerInfo->name);
+                m_Volume->log(VMAN_LOG_INFO, "%s: Ignoring chunk layer '%s'.\n", toString().c_str(), layerInfo->name);
             }
         }
 
         // -- Copy used layers --
-        std::vector<char> buffer(voxelsPerChunk * m_Volume->getMaxLayerVoxelSize());
+        ScratchBuffer layerBuffer(m_Volume->getScratchBuffers());
+        std::vector<char>& layerData = *layerBuffer;
         for(int i = 0; i < m_Layers.size(); ++i)
         {
             const vmanLayer* layer = m_Volume->getLayer(i);
@@ -261,114 +707,431 @@ bool Chunk::loadFromFile()
                     (layer->revision != layerInfo->revision)
                 )
                 {
-                    m_Volume->log(VMAN_LOG_ERROR,"%s: Chunk layer '%s' differs, ignoring it.\n", fileName.c_str(), layer->name);
+                    m_Volume->log(VMAN_LOG_ERROR,"%s: Chunk layer '%s' differs, ignoring it.\n", toString().c_str(), layer->name);
                     // TODO: Maybe let the application try to import/convert the layer.
                     continue;
                 }
 
-                fseek(f, layerInfo->fileOffset, SEEK_SET);
-                if(fread(&buffer[0], voxelsPerChunk*layer->voxelSize, 1, f) != 1)
+                if(layerInfo->fileOffset + layerInfo->dataSize > dataSize)
                     throw Format("Read error in layer %d.", i);
+                const char* fileData = &data[layerInfo->fileOffset];
 
-                m_Layers[i] = new char[voxelsPerChunk*layer->voxelSize];
-                layer->deserializeFn(&buffer[0], m_Layers[i], voxelsPerChunk*layer->voxelSize);
+                switch(layerInfo->codec)
+                {
+                    case VOXEL_CODEC_NONE:
+                    {
+                        const uint32_t layerBytes = voxelsPerChunk*layer->voxelSize;
+                        if(layerInfo->dataSize != layerBytes)
+                            throw Format("Layer %d has an incorrect size.", i);
+
+                        // Plain layers can be patched in place.
+                        m_StoredLayerOffsets[i] = layerInfo->fileOffset;
+
+                        if(layer->deserializeFn == NULL && m_Mapping.address != NULL)
+                        {
+                            // Use the mapped data until the layer is written.
+                            m_Layers[i] = const_cast<char*>(fileData);
+                            m_LayerMapped[i] = true;
+                            m_MappedLayerCount++;
+                        }
+                        else
+                        {
+                            m_Layers[i] = allocateLayer(i);
+                            if(layer->deserializeFn != NULL)
+                                layer->deserializeFn(fileData, m_Layers[i], voxelsPerChunk);
+                            else
+                                memcpy(m_Layers[i], fileData, layerBytes);
+                        }
+                        break;
+                    }
+
+                    case VOXEL_CODEC_PALETTE:
+                    {
+                        // The layer is kept palette encoded until it's used.
+                        const int paletteSize = GetPaletteSize(fileData, layerInfo->dataSize);
+                        if(paletteSize < 0 ||
+                           PALETTE_HEADER_SIZE + paletteSize*layer->voxelSize > layerInfo->dataSize)
+                            throw Format("Layer %d has a corrupt palette.", i);
+
+                        layerData.assign(fileData, fileData + layerInfo->dataSize);
+                        if(layer->deserializeFn != NULL)
+                            layer->deserializeFn(&fileData[PALETTE_HEADER_SIZE], &layerData[PALETTE_HEADER_SIZE], paletteSize);
+                        setCompressedLayer(i, VOXEL_CODEC_PALETTE, &layerData[0], layerData.size());
+                        break;
+                    }
+
+                    case VOXEL_CODEC_UNIFORM:
+                    {
+                        if(layerInfo->dataSize != layer->voxelSize)
+                            throw Format("Layer %d has an incorrect size.", i);
+
+                        layerData.resize(layer->voxelSize);
+                        if(layer->deserializeFn != NULL)
+                            layer->deserializeFn(fileData, &layerData[0], 1);
+                        else
+                            memcpy(&layerData[0], fileData, layer->voxelSize);
+                        if(setUniformLayer(i, &layerData[0]) == false)
+                        {
+                            // All uniform pages are in use.
+                            m_Layers[i] = allocateLayer(i);
+                            FillVoxels(&layerData[0], voxelsPerChunk, layer->voxelSize, m_Layers[i]);
+                        }
+                        break;
+                    }
+
+                    default:
+                        throw Format("Layer %d uses an unknown codec.", i);
+                }
+                updateReadableLayer(i);
             }
         }
+
+        if(m_MappedLayerCount == 0)
+            UnmapFile(&m_Mapping);
     }
     catch(const std::string e)
     {
-        m_Volume->log(VMAN_LOG_ERROR, "%s: %s\n", fileName.c_str(), e.c_str());
-        fclose(f);
+        m_Volume->log(VMAN_LOG_ERROR, "%s: %s\n", toString().c_str(), e.c_str());
+        std::fill(m_StoredLayerOffsets.begin(), m_StoredLayerOffsets.end(), 0);
         clearLayers();
         assert(false);
         return false;
     }
 
-    fclose(f);
     return true;
 }
 
 bool Chunk::saveToFile()
 {
-    m_Volume->incStatistic(STATISTIC_CHUNK_SAVE_OPS);
-
     m_Volume->log(VMAN_LOG_DEBUG, "Saving chunk %s to file ..\n", toString().c_str());
 
-    if(m_Volume->getBaseDir() == NULL)
+    ChunkStorage* storage = m_Volume->getChunkStorage();
+    if(storage == NULL)
     {
         assert(!"Probably redundant.");
         return false;
     }
 
+    ScratchBuffer headerBuffer(m_Volume->getScratchBuffers());
+    ScratchBuffer layerBuffer(m_Volume->getScratchBuffers());
+    std::vector<IoVector> parts;
+    std::vector<uint32_t> offsets;
+    serializeChanges(&*headerBuffer, &*layerBuffer, &parts, &offsets);
+
+    ChunkStorage::ChunkWrite write;
+    write.chunkX = m_ChunkX;
+    write.chunkY = m_ChunkY;
+    write.chunkZ = m_ChunkZ;
+    write.parts = &parts[0];
+    write.partCount = parts.size();
+    write.offsets = offsets.empty() ? NULL : &offsets[0];
+    if(storage->writeChunks(&write, 1) == false)
+        return false;
+
+    unsetModified();
+    return true;
+}
+
+void Chunk::serialize( std::vector<char>* headerOut, std::vector<char>* layerDataOut )
+{
+    m_Volume->incStatistic(STATISTIC_CHUNK_SAVE_OPS);
+
     assert(m_Layers.size() > 0);
 
     const int voxelsPerChunk = m_Volume->getVoxelsPerChunk();
 
-    std::string fileName = m_Volume->getChunkFileName(m_ChunkX, m_ChunkY, m_ChunkZ);
+    // Writing the chunk changes the mapped file,
+    // so the layers need their own copy before.
+    for(int i = 0; i < m_Layers.size() && m_MappedLayerCount > 0; ++i)
+    {
+        if(m_LayerMapped[i])
+            copyMappedLayer(i);
+    }
+
+    // Layers are encoded first, since their size depends on the encoding.
+    // Offsets are relative to the layer data until the header size is known.
+    std::vector<ChunkFileLayerInfo> layerInfos;
+    std::vector<int> layerIndices;
+    std::vector<char>& layerData = *layerDataOut;
+    layerData.clear();
 
-    MakePath(fileName.c_str());
+    // Compressed layers are decoded temporarily,
+    // since the chunk probably stays idle.
+    ScratchBuffer voxelBuffer(m_Volume->getScratchBuffers());
+    ScratchBuffer paletteBuffer(m_Volume->getScratchBuffers());
+    std::vector<char>& voxels = *voxelBuffer;
+    std::vector<char>& paletteData = *paletteBuffer;
 
-    FILE* f = fopen(fileName.c_str(), "wb"); // TODO: Check
-    if(f == NULL)
+    for(int i = 0; i < m_Layers.size(); ++i)
     {
-        m_Volume->log(VMAN_LOG_ERROR, "%s: Can't open file for writing.\n", fileName.c_str());
-        return false;
+        if(m_Layers[i] == NULL)
+            continue;
+
+        const vmanLayer* layer = m_Volume->getLayer(i);
+        const uint32_t layerBytes = voxelsPerChunk*layer->voxelSize;
+
+        // Layers that may be mapped need to be stored as they are.
+        const bool mappable = m_Volume->isLayerMappingEnabled() && layer->deserializeFn == NULL;
+
+        VoxelCodec codec = VOXEL_CODEC_NONE;
+        const char* data = m_Layers[i];
+        uint32_t dataSize = layerBytes;
+        switch(m_LayerCodecs[i])
+        {
+            case VOXEL_CODEC_UNIFORM:
+                if(!mappable)
+                {
+                    codec = VOXEL_CODEC_UNIFORM;
+                    dataSize = layer->voxelSize;
+                    break;
+                }
+                // Fall through
+
+            case VOXEL_CODEC_PALETTE:
+                if(!mappable && m_LayerCodecs[i] == VOXEL_CODEC_PALETTE)
+                {
+                    codec = VOXEL_CODEC_PALETTE;
+                    dataSize = m_CompressedLayerSizes[i];
+                    break;
+                }
+                // Fall through
+
+            case VOXEL_CODEC_RLE:
+            {
+                voxels.resize(layerBytes);
+                const bool success = DecodeLayer(m_LayerCodecs[i], m_Layers[i], m_CompressedLayerSizes[i], voxelsPerChunk, layer->voxelSize, &voxels[0]);
+                assert(success);
+                data = &voxels[0];
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        if(codec == VOXEL_CODEC_NONE && !mappable)
+        {
+            if(IsUniform(data, voxelsPerChunk, layer->voxelSize) &&
+               setUniformLayer(i, data))
+            {
+                // The layer became uniform again, so it's stored that way.
+                if(m_Layers[i] == NULL)
+                    continue; // Default values don't need to be stored at all.
+                codec = VOXEL_CODEC_UNIFORM;
+                data = m_Layers[i];
+                dataSize = layer->voxelSize;
+            }
+            else if(EncodePalette(data, voxelsPerChunk, layer->voxelSize, &paletteData) &&
+                    paletteData.size() < layerBytes)
+            {
+                codec = VOXEL_CODEC_PALETTE;
+                data = &paletteData[0];
+                dataSize = paletteData.size();
+            }
+        }
+
+        ChunkFileLayerInfo layerInfo;
+        memset(layerInfo.name, 0, sizeof(layerInfo.name));
+        strncpy(layerInfo.name, layer->name, sizeof(layerInfo.name)-1);
+        layerInfo.voxelSize = layer->voxelSize;
+        layerInfo.revision = layer->revision;
+        layerInfo.fileOffset = layerData.size();
+        layerInfo.codec = codec;
+        layerInfo.dataSize = dataSize;
+        layerInfos.push_back(layerInfo);
+        layerIndices.push_back(i);
+
+        const uint32_t offset = layerData.size();
+        layerData.resize(offset + dataSize);
+        char* destination = &layerData[offset];
+        switch(codec)
+        {
+            case VOXEL_CODEC_NONE:
+            case VOXEL_CODEC_UNIFORM:
+                if(layer->serializeFn != NULL)
+                    layer->serializeFn(data, destination, dataSize / layer->voxelSize);
+                else
+                    memcpy(destination, data, dataSize);
+                break;
+
+            case VOXEL_CODEC_PALETTE:
+            {
+                const int paletteSize = GetPaletteSize(data, dataSize);
+                memcpy(destination, data, dataSize);
+                if(layer->serializeFn != NULL)
+                    layer->serializeFn(&data[PALETTE_HEADER_SIZE], &destination[PALETTE_HEADER_SIZE], paletteSize);
+                break;
+            }
+
+            default:
+                assert(false);
+        }
+    }
+
+    const uint32_t headerSize = sizeof(ChunkFileHeader) + sizeof(ChunkFileLayerInfo)*layerInfos.size();
+
+    // The stored layout is unknown until the new data has been written.
+    std::fill(m_StoredLayerOffsets.begin(), m_StoredLayerOffsets.end(), 0);
+    std::fill(m_SavedLayerOffsets.begin(), m_SavedLayerOffsets.end(), 0);
+    for(int i = 0; i < layerInfos.size(); ++i)
+    {
+        if(layerInfos[i].codec == VOXEL_CODEC_NONE)
+            m_SavedLayerOffsets[layerIndices[i]] = layerInfos[i].fileOffset + headerSize;
     }
 
+    std::vector<char>& data = *headerOut;
+    data.resize(headerSize);
+
     // -- Write header ---
     ChunkFileHeader header;
     header.version = LittleEndian( ChunkFileVersion );
     header.edgeLength = LittleEndian( m_Volume->getChunkEdgeLength() );
-    int usedLayers = 0;
-    for(int i = 0; i < m_Layers.size(); ++i)
-        if(m_Layers[i] != NULL)
-            ++usedLayers;
-    header.layerCount = LittleEndian( usedLayers );
-    fwrite(&header, sizeof(header), 1, f);
-
-    const uint32_t headerSize = sizeof(ChunkFileHeader) + sizeof(ChunkFileLayerInfo)*usedLayers;
+    header.layerCount = LittleEndian( int(layerInfos.size()) );
+    memcpy(&data[0], &header, sizeof(header));
 
     // -- Write layer list --
-    uint32_t fileOffset = headerSize;
-    for(int i = 0; i < m_Layers.size(); ++i)
+    for(int i = 0; i < layerInfos.size(); ++i)
     {
-        if(m_Layers[i] != NULL)
-        {
-            ChunkFileLayerInfo layerInfo;
-            const vmanLayer* layer = m_Volume->getLayer(i);
+        ChunkFileLayerInfo layerInfo = layerInfos[i];
+        layerInfo.voxelSize = LittleEndian(layerInfo.voxelSize);
+        layerInfo.revision = LittleEndian(layerInfo.revision);
+        layerInfo.fileOffset = LittleEndian(layerInfo.fileOffset + headerSize);
+        layerInfo.codec = LittleEndian(layerInfo.codec);
+        layerInfo.dataSize = LittleEndian(layerInfo.dataSize);
+        memcpy(&data[sizeof(ChunkFileHeader) + sizeof(ChunkFileLayerInfo)*i], &layerInfo, sizeof(layerInfo));
+    }
+}
 
-            memset(layerInfo.name, 0, sizeof(layerInfo.name));
-            strncpy(layerInfo.name, layer->name, sizeof(layerInfo.name)-1);
+void Chunk::serializeChanges( std::vector<char>* headerOut, std::vector<char>* layerDataOut, std::vector<IoVector>* partsOut, std::vector<uint32_t>* offsetsOut )
+{
+    partsOut->clear();
 
-            layerInfo.voxelSize = LittleEndian(layer->voxelSize);
-            layerInfo.revision = LittleEndian(layer->revision);
-            layerInfo.fileOffset = LittleEndian(fileOffset);
+    const ChunkStorage* storage = m_Volume->getChunkStorage();
+    std::vector<uint32_t> lengths;
+    if(storage != NULL && storage->canPatchChunks() &&
+       serializePatches(layerDataOut, offsetsOut, &lengths))
+    {
+        headerOut->clear();
+        uint32_t position = 0;
+        for(int i = 0; i < lengths.size(); ++i)
+        {
+            IoVector part;
+            part.data = &(*layerDataOut)[position];
+            part.length = lengths[i];
+            partsOut->push_back(part);
+            position += lengths[i];
+        }
+        return;
+    }
 
-            fwrite(&layerInfo, sizeof(layerInfo), 1, f);
+    offsetsOut->clear();
+    serialize(headerOut, layerDataOut);
+
+    // Header and layers are passed as separate parts,
+    // so the storage writes them in one go without joining them first.
+    IoVector parts[2];
+    parts[0].data = &(*headerOut)[0];
+    parts[0].length = headerOut->size();
+    parts[1].data = layerDataOut->empty() ? NULL : &(*layerDataOut)[0];
+    parts[1].length = layerDataOut->size();
+    partsOut->assign(parts, parts+2);
+}
 
-            // Calculate layer size
-            fileOffset += voxelsPerChunk * layerInfo.voxelSize;
-        }
+bool Chunk::serializePatches( std::vector<char>* dataOut, std::vector<uint32_t>* offsetsOut, std::vector<uint32_t>* lengthsOut )
+{
+    bool modified = false;
+    for(int i = 0; i < m_Layers.size(); ++i)
+    {
+        if(m_DirtyBlocks[i] == 0)
+            continue;
+        if(m_StoredLayerOffsets[i] == 0)
+            return false;
+        modified = true;
     }
+    if(!modified)
+        return false;
+
+    m_Volume->incStatistic(STATISTIC_CHUNK_SAVE_OPS);
+
+    dataOut->clear();
+    offsetsOut->clear();
+    lengthsOut->clear();
+
+    const int voxelsPerChunk = m_Volume->getVoxelsPerChunk();
+    const int blockVoxels = getDirtyBlockVoxels();
+
+    ScratchBuffer voxelBuffer(m_Volume->getScratchBuffers());
+    std::vector<char>& voxels = *voxelBuffer;
 
-    // -- Write actual layers --
-    std::vector<char> buffer(voxelsPerChunk * m_Volume->getMaxLayerVoxelSize()); // TODO: This buffer could be thread local ...
     for(int i = 0; i < m_Layers.size(); ++i)
     {
-        if(m_Layers[i] != NULL)
+        const uint32_t dirtyBlocks = m_DirtyBlocks[i];
+        if(dirtyBlocks == 0)
+            continue;
+
+        const vmanLayer* layer = m_Volume->getLayer(i);
+
+        // The patch changes the mapped file,
+        // so the layer needs its own copy before.
+        if(m_LayerMapped[i])
+            copyMappedLayer(i);
+
+        const char* data = m_Layers[i];
+        if(data == NULL)
         {
-            const vmanLayer* layer = m_Volume->getLayer(i);
-            layer->serializeFn(m_Layers[i], &buffer[0], voxelsPerChunk);
-            fwrite(&buffer[0], voxelsPerChunk*layer->voxelSize, 1, f); // TODO: Check
+            data = m_Volume->getDefaultPage(i);
+        }
+        else if(m_LayerCodecs[i] != VOXEL_CODEC_NONE)
+        {
+            // Decoded temporarily, like in serialize.
+            voxels.resize(voxelsPerChunk*layer->voxelSize);
+            const bool success = DecodeLayer(m_LayerCodecs[i], m_Layers[i], m_CompressedLayerSizes[i], voxelsPerChunk, layer->voxelSize, &voxels[0]);
+            assert(success);
+            data = &voxels[0];
+        }
+
+        int block = 0;
+        while(block < DIRTY_BLOCK_COUNT)
+        {
+            if((dirtyBlocks & (1u << block)) == 0)
+            {
+                block++;
+                continue;
+            }
+
+            const int firstBlock = block;
+            while(block < DIRTY_BLOCK_COUNT && (dirtyBlocks & (1u << block)))
+                block++;
+
+            const int firstVoxel = firstBlock*blockVoxels;
+            const int endVoxel = std::min(block*blockVoxels, voxelsPerChunk);
+            if(firstVoxel >= endVoxel)
+                break; // Chunks smaller than the block count have unused blocks.
+
+            const int count = endVoxel - firstVoxel;
+            const uint32_t length = count*layer->voxelSize;
+            const uint32_t position = dataOut->size();
+            dataOut->resize(position + length);
+
+            const char* source = &data[firstVoxel*layer->voxelSize];
+            char* destination = &(*dataOut)[position];
+            if(layer->serializeFn != NULL)
+                layer->serializeFn(source, destination, count);
+            else
+                memcpy(destination, source, length);
+
+            offsetsOut->push_back(m_StoredLayerOffsets[i] + firstVoxel*layer->voxelSize);
+            lengthsOut->push_back(length);
         }
     }
 
-    fclose(f);
-    unsetModified();
+    // The layout doesn't change, but the stored data
+    // is unknown until the patches have been written.
+    m_SavedLayerOffsets = m_StoredLayerOffsets;
+    std::fill(m_StoredLayerOffsets.begin(), m_StoredLayerOffsets.end(), 0);
     return true;
 }
 
-
 void Chunk::addReference()
 {
     m_References++;
@@ -378,48 +1141,215 @@ void Chunk::addReference()
 void Chunk::releaseReference()
 {
     assert(m_References > 0);
+
+    // The chunk may be unloaded as soon as it's unused.
+    Volume* volume = m_Volume;
+    const ChunkId id = getId();
     if(--m_References == 0)
     {
-        m_Volume->scheduleCheck(Volume::CHECK_CAUSE_UNUSED, this);
+        volume->scheduleCheck(Volume::CHECK_CAUSE_UNUSED, id);
+        if(volume->getIdleChunkTimeout() >= 0)
+            volume->scheduleCheck(Volume::CHECK_CAUSE_IDLE, id);
     }
     //m_Volume->log(VMAN_LOG_DEBUG, "%p references-- = %d\n", this, (int)m_References);
 }
 
+bool Chunk::tryAddReference()
+{
+    // Pairs with markUnloaded(): Each side announces itself first,
+    // so at least one of them sees the other and backs off.
+    m_References++;
+    if(m_Unloaded != 0)
+    {
+        // No check is scheduled: Either the chunk is unloaded anyway,
+        // or the caller references it again under the chunk table mutex.
+        m_References--;
+        return false;
+    }
+    return true;
+}
+
 bool Chunk::isUnused() const
 {
     return m_References == 0;
 }
 
+bool Chunk::markUnloaded()
+{
+    m_Unloaded++;
+    if(m_References != 0)
+    {
+        m_Unloaded--;
+        return false;
+    }
+    return true;
+}
+
+void Chunk::addJobReference()
+{
+    m_JobReferences++;
+}
+
+void Chunk::releaseJobReference()
+{
+    assert(m_JobReferences > 0);
+    m_JobReferences--;
+}
+
+bool Chunk::hasJobs() const
+{
+    return m_JobReferences > 0;
+}
+
+int Chunk::getJobQueuePosition( JobType type ) const
+{
+    return m_JobQueuePositions[type];
+}
+
+void Chunk::setJobQueuePosition( JobType type, int position )
+{
+    m_JobQueuePositions[type] = position;
+}
+
 bool Chunk::isModified() const
 {
     return m_Modified;
 }
 
-time_t Chunk::getModificationTime() const
+bool Chunk::isLayerModified( int index ) const
+{
+    assert(index >= 0);
+    assert(index < m_DirtyBlocks.size());
+    return m_DirtyBlocks[index] != 0;
+}
+
+int Chunk::getDirtyBlockVoxels() const
+{
+    return (m_Volume->getVoxelsPerChunk() + DIRTY_BLOCK_COUNT - 1) / DIRTY_BLOCK_COUNT;
+}
+
+uint64_t Chunk::getModificationTime() const
 {
     return m_ModificationTime;
 }
 
 void Chunk::setModified()
+{
+    std::fill(m_DirtyBlocks.begin(), m_DirtyBlocks.end(), AllDirtyBlocks);
+    setModifiedFlag();
+}
+
+void Chunk::setVoxelsModified( int layerIndex, int firstVoxel, int voxelCount )
+{
+    assert(layerIndex >= 0);
+    assert(layerIndex < m_DirtyBlocks.size());
+    assert(firstVoxel >= 0);
+    assert(voxelCount > 0);
+    assert(firstVoxel + voxelCount <= m_Volume->getVoxelsPerChunk());
+
+    const int blockVoxels = getDirtyBlockVoxels();
+    const int lastBlock = (firstVoxel + voxelCount - 1) / blockVoxels;
+    for(int block = firstVoxel / blockVoxels; block <= lastBlock; ++block)
+        m_DirtyBlocks[layerIndex] |= 1u << block;
+    setModifiedFlag();
+}
+
+void Chunk::setModifiedFlag()
 {
     if(m_Modified == false)
     {
         m_Modified = true;
-        m_ModificationTime = time(NULL);
-        m_Volume->scheduleCheck(Volume::CHECK_CAUSE_MODIFIED, this);
+        m_ModificationTime = GetMonotonicMilliseconds();
+        m_Volume->scheduleCheck(Volume::CHECK_CAUSE_MODIFIED, getId());
     }
 }
 
 void Chunk::unsetModified()
 {
     m_Modified = false;
+    std::fill(m_DirtyBlocks.begin(), m_DirtyBlocks.end(), 0);
+    m_StoredLayerOffsets = m_SavedLayerOffsets;
 }
 
-tthread::mutex* Chunk::getMutex()
+SharedMutex* Chunk::getMutex()
 {
     return &m_Mutex;
 }
 
+Chunk::LockState* Chunk::getLockState()
+{
+    return &m_LockState;
+}
+
+vmanChunkState Chunk::getState() const
+{
+    return vmanChunkState(m_State.load());
+}
+
+void Chunk::setState( vmanChunkState state )
+{
+    lock_guard guard(m_StateMutex);
+    m_State = state;
+    m_StateCondition.notify_all();
+}
+
+void Chunk::notifyLoadListeners()
+{
+    // Callbacks may select other access objects, which use this chunk,
+    // so the state mutex is released while notifying.
+    // The listener is held before that, so it can't be deselected meanwhile.
+    while(true)
+    {
+        Access* listener = NULL;
+        {
+            lock_guard guard(m_StateMutex);
+            if(m_State == VMAN_CHUNK_LOADING || m_LoadListeners.empty())
+                break;
+            listener = m_LoadListeners.back();
+            m_LoadListeners.pop_back();
+            listener->holdCallback();
+        }
+        listener->chunkLoaded();
+    }
+}
+
+bool Chunk::waitWhileState( vmanChunkState state, int milliseconds ) const
+{
+    if(m_State != state)
+        return true;
+
+    const uint64_t startTime = GetMonotonicMilliseconds();
+    lock_guard guard(m_StateMutex);
+    while(m_State == state)
+    {
+        const int remaining = RemainingMilliseconds(startTime, milliseconds);
+        if(remaining < 0)
+            m_StateCondition.wait(m_StateMutex);
+        else if(remaining > 0)
+            m_StateCondition.wait_for(m_StateMutex, tthread::chrono::milliseconds(remaining));
+        else
+            return false;
+    }
+    return true;
+}
+
+bool Chunk::addLoadListener( Access* access )
+{
+    lock_guard guard(m_StateMutex);
+    if(m_State != VMAN_CHUNK_LOADING)
+        return false;
+    m_LoadListeners.push_back(access);
+    return true;
+}
+
+void Chunk::removeLoadListener( Access* access )
+{
+    lock_guard guard(m_StateMutex);
+    m_LoadListeners.erase(
+        std::remove(m_LoadListeners.begin(), m_LoadListeners.end(), access),
+        m_LoadListeners.end()
+    );
+}
 
 
 /** Forbidden Stuff **/
@@ -4,20 +4,39 @@
 #include <stdint.h>
 #include <time.h>
 #include <vector>
+#include <list>
 #include <string>
 #include <tinythread.h>
 
+#include "Util.h"
+#include "VoxelCodec.h"
+#include "JobEntry.h"
+#include "IoBackend.h"
+#include "SharedMutex.h"
+#include "LayerVersion.h"
+
 
 namespace vman
 {
 
 class Volume;
+class Access;
+struct LockRequest;
 
 typedef uint64_t ChunkId;
 
 class Chunk
 {
 public:
+    enum
+    {
+        /**
+         * Layers are divided into this many spans of voxels,
+         * whose modifications are tracked separately.
+         */
+        DIRTY_BLOCK_COUNT = 32
+    };
+
     static ChunkId GenerateChunkId( int chunkX, int chunkY, int chunkZ );
 
     static std::string ChunkCoordsToString( int chunkX, int chunkY, int chunkZ );
@@ -35,8 +54,11 @@ public:
 
     /**
      * Will create a layer if it doesn't exists already.
-     * Data is initialized to `0`.
+     * Mapped layers are copied, so they can be written.
+     * Data is initialized to the layers default value.
      * Use the chunk edge length to compute the array size.
+     * Fetching the layer doesn't modify the chunk,
+     * call setVoxelsModified() after writing voxels through it.
      * @return Data of the given layer.
      * @see Volume#getChunkEdgeLength
      */
@@ -44,11 +66,69 @@ public:
 
     /**
      * Const pointer version of getLayer.
-     * @return `NULL` if a layer doesn't exists.
+     * Absent and uniform layers return a shared read only page,
+     * other compressed layers are decompressed.
+     * @return `NULL` if the index is out of bounds.
      * @see getLayer
      */
     const void* getConstLayer( int index ) const;
 
+    /**
+     * Version of the chunk data, which is odd while the chunk is modified.
+     * Is thread safe.
+     * @see SharedMutex#getVersion
+     */
+    unsigned int getVersion() const;
+
+    /**
+     * Returns the voxels of a layer without holding the mutex,
+     * if their memory stays readable while the chunk is modified.
+     * That are absent, uniform and uncompressed layers.
+     * Copy the voxels and check that the version didn't change,
+     * before using the copy.
+     * Is thread safe.
+     * @param version Version read before calling this.
+     * @return `NULL` if the layer needs to be read with the mutex held.
+     */
+    const void* getOptimisticLayer( int index, unsigned int version ) const;
+
+    /**
+     * Returns immutable voxels of a layer for a snapshot.
+     * The chunk copies the layer before it's written again.
+     * Needs the mutex, but sharing it is enough.
+     * @param versionOut
+     * Receives a referenced version of the voxels, which the caller has to release,
+     * or `NULL` for shared read only pages, which are never freed.
+     * @return `NULL` if the index is out of bounds.
+     */
+    const char* pinLayer( int index, LayerVersion** versionOut ) const;
+
+    /**
+     * @return Whether the layer has been written to.
+     * Absent layers consist of the layers default value.
+     */
+    bool hasLayer( int index ) const;
+
+    /**
+     * Writes a single voxel.
+     * Doesn't allocate the layer if the voxel
+     * equals the value of an absent or uniform layer.
+     * Marks the voxel as modified, if its value changed.
+     * @param voxelIndex Index of the voxel inside the chunk.
+     * @param voxel Points to a voxel of the layers voxel size.
+     * @return Whether the voxel value changed.
+     */
+    bool writeVoxel( int layerIndex, int voxelIndex, const void* voxel );
+
+    /**
+     * Compresses all layers, which aren't compressed or mapped yet.
+     * Uses the codec that needs the least memory.
+     * Layers stay compressed until they're accessed again.
+     * Layers that don't shrink are left as they are.
+     * @return Amount of layers that were compressed.
+     */
+    int compressLayers();
+
     /**
      * Clears chunk on failure!
      * @return `false` if the file is not readable.
@@ -56,11 +136,48 @@ public:
     bool loadFromFile();
 
     /**
+     * Like loadFromFile, but uses chunk data
+     * that has already been read from the storage.
+     * Clears chunk on failure!
+     * @return `false` if the data is corrupt.
+     */
+    bool loadFromData( const char* data, uint32_t dataSize );
+
+    /**
+     * Writes only the modified voxels if possible, see serializeChanges.
      * Will unset `m_Modified` on success.
      * @return `true` on success.
      */
     bool saveToFile();
 
+    /**
+     * Encodes header and layers like saveToFile, but leaves writing them to the caller.
+     * Call unsetModified() once they have been stored.
+     * The storage expects the header followed by the layer data.
+     */
+    void serialize( std::vector<char>* headerOut, std::vector<char>* layerDataOut );
+
+    /**
+     * Encodes the parts of the chunk that need to be written.
+     * If the storage allows it and all modified layers are stored
+     * as plain voxel arrays, only their modified blocks are encoded,
+     * so they can be written over the stored chunk data in place.
+     * Untouched layers aren't serialized in that case.
+     * Otherwise the whole chunk is serialized.
+     * Call unsetModified() once the parts have been stored.
+     * @param partsOut Receives the parts to write, they point into the buffers.
+     * @param offsetsOut Receives the offset of each part in the stored chunk data
+     * or nothing if the parts replace the stored chunk.
+     * @see ChunkStorage#ChunkWrite
+     */
+    void serializeChanges( std::vector<char>* headerOut, std::vector<char>* layerDataOut, std::vector<IoVector>* partsOut, std::vector<uint32_t>* offsetsOut );
+
+    /**
+     * Resets the modified flags of the chunk and its layers.
+     * The serialized data is now known to be stored.
+     */
+    void unsetModified();
+
 
     /**
      * Increments the internal reference counter.
@@ -77,34 +194,169 @@ public:
      */
     void releaseReference();
 
+    /**
+     * References a chunk, which was found without the chunk table mutex.
+     * Is thread safe.
+     * @return `false` if the chunk is being unloaded.
+     * Its pointer must not be used anymore then.
+     * @see markUnloaded
+     */
+    bool tryAddReference();
+
     /**
      * Is thread safe.
      * Whether the chunk may be unloaded.
      */
     bool isUnused() const;
 
+    /**
+     * Prevents further references before the chunk is unloaded.
+     * Needs the chunk table mutex of the chunk id.
+     * @return `false` if the chunk has been referenced meanwhile.
+     * @see tryAddReference
+     */
+    bool markUnloaded();
+
+    /**
+     * Counts load and save jobs, which are enqueued or running.
+     * Chunks with jobs won't be unloaded,
+     * since the job threads still need them.
+     * Is thread safe.
+     */
+    void addJobReference();
+
+    /**
+     * Is thread safe.
+     * @see addJobReference
+     */
+    void releaseJobReference();
+
+    /**
+     * Is thread safe.
+     * @return Whether load or save jobs are enqueued or running.
+     */
+    bool hasJobs() const;
+
+    /**
+     * Position of the chunks job in the job queue of the given type,
+     * so the queue can find it without searching.
+     * Only used by JobQueue, which needs the job list mutex.
+     * @return `-1` if the chunk has no job of that type.
+     */
+    int getJobQueuePosition( JobType type ) const;
+
+    /**
+     * @see getJobQueuePosition
+     */
+    void setJobQueuePosition( JobType type, int position );
+
     /**
      *
      */
     bool isModified() const;
 
+    /**
+     * @return Whether the layer has been modified since the last save.
+     */
+    bool isLayerModified( int index ) const;
+
     /**
      * Timestamp of the first modification since last save event.
+     * In milliseconds of the monotonic clock.
+     * @see GetMonotonicMilliseconds
      */
-    time_t getModificationTime() const;
+    uint64_t getModificationTime() const;
 
     /**
+     * Marks all voxels of all layers as modified.
      * If it wasn't modified before:
      * Sets the modification flag, updates the modification time
      * and adds the chunk to the modified list.
      */
     void setModified();
 
+    /**
+     * Marks voxels of a layer as modified, e.g. after they have been
+     * written through the pointer returned by getLayer.
+     * Sets the modification flag like setModified.
+     * @param firstVoxel Index of the first voxel inside the chunk.
+     */
+    void setVoxelsModified( int layerIndex, int firstVoxel, int voxelCount );
+
     /**
      * Use this to lock the object while
      * using methods that aren't thread safe.
+     * Readers, which only use the const methods, may share the lock.
+     */
+    SharedMutex* getMutex();
+
+    /**
+     * Holders and waiters of the chunk, which are granted by the LockManager.
+     */
+    struct LockState
+    {
+        LockState() : readers(0), writer(false), waiters() {}
+
+        int readers;
+        bool writer;
+
+        /**
+         * Requests waiting for the chunk, oldest first.
+         */
+        std::list<LockRequest*> waiters;
+    };
+
+    /**
+     * Is guarded by the LockManager.
      */
-    tthread::mutex* getMutex();
+    LockState* getLockState();
+
+    /**
+     * Is thread safe.
+     * @see vmanChunkState
+     */
+    vmanChunkState getState() const;
+
+    /**
+     * Wakes the threads, which wait for the chunk to leave its previous state.
+     * Load listeners are not notified here, see notifyLoadListeners().
+     * Is thread safe.
+     */
+    void setState( vmanChunkState state );
+
+    /**
+     * Notifies the load listeners, unless the chunk is still loading.
+     * Callbacks may select other chunks, so this must not be called
+     * while holding any chunk or chunk table mutex.
+     * Is thread safe.
+     */
+    void notifyLoadListeners();
+
+    /**
+     * Blocks while the chunk is in the given state.
+     * Must not be called while holding the chunks mutex,
+     * since the state is changed by jobs, which need it.
+     * Is thread safe.
+     * @param milliseconds Negative values wait forever.
+     * @return `false` if it timed out.
+     */
+    bool waitWhileState( vmanChunkState state, int milliseconds = -1 ) const;
+
+    /**
+     * Lets the access know, when the chunk has been loaded.
+     * Is thread safe.
+     * @return `false` if the chunk isn't loading,
+     * then the access isn't notified.
+     * @see Access::chunkLoaded
+     */
+    bool addLoadListener( Access* access );
+
+    /**
+     * Afterwards the chunk won't start notifying the access anymore.
+     * Notifications that started already are waited for by the access.
+     * Is thread safe.
+     */
+    void removeLoadListener( Access* access );
 
 
 //private:
@@ -115,6 +367,89 @@ public:
 
     void initializeLayer( int index );
 
+    /**
+     * Sets the modification flag, without marking any voxels.
+     * @see setModified
+     */
+    void setModifiedFlag();
+
+    /**
+     * @return Amount of voxels per dirty block.
+     */
+    int getDirtyBlockVoxels() const;
+
+    /**
+     * Encodes the modified blocks of all modified layers.
+     * Consecutive blocks are joined into one patch.
+     * @param dataOut Receives the encoded voxels of all patches.
+     * @param offsetsOut Receives the offset of each patch in the stored chunk data.
+     * @param lengthsOut Receives the length of each patch.
+     * @return `false` if a modified layer isn't stored as plain voxel array
+     * or the chunk isn't modified at all.
+     */
+    bool serializePatches( std::vector<char>* dataOut, std::vector<uint32_t>* offsetsOut, std::vector<uint32_t>* lengthsOut );
+
+    /**
+     * Reads header and layers from serialized chunk data.
+     * Layers may keep pointing into `m_Mapping`.
+     * Clears chunk on failure!
+     */
+    bool parseFileData( const char* data, uint32_t dataSize );
+
+    /**
+     * Replaces a mapped layer with a writable copy.
+     * Unmaps the chunk data once no layer uses it anymore.
+     */
+    void copyMappedLayer( int index );
+
+    /**
+     * Replaces a layer, which is shared with snapshots, with a writable copy.
+     * The copy is skipped, if the snapshots are gone already.
+     */
+    void copySharedLayer( int index );
+
+    /**
+     * Replaces a compressed layer with its uncompressed voxels.
+     */
+    void decompressLayer( int index );
+
+    /**
+     * Replaces an uncompressed or absent layer with encoded data.
+     */
+    void setCompressedLayer( int index, VoxelCodec codec, const char* data, int dataSize );
+
+    /**
+     * Replaces a layer with a uniform page of the volume.
+     * Layers that consist of the default value become absent.
+     * @return `false` if no page is available; the layer is unchanged then.
+     */
+    bool setUniformLayer( int index, const char* voxel );
+
+    /**
+     * Takes an uncompressed voxel array from the layer pool
+     * and counts it as resident memory.
+     */
+    char* allocateLayer( int index );
+
+    /**
+     * Gives an uncompressed voxel array back to the layer pool.
+     * Shared layers are just released.
+     */
+    void freeLayer( int index, char* voxels );
+
+    /**
+     * Frees the memory of a layer and marks it as absent.
+     * Doesn't modify the chunk.
+     * @return Whether the layer was present.
+     */
+    bool releaseLayer( int index );
+
+    /**
+     * Publishes the state of a layer for getOptimisticLayer() and getConstLayer().
+     * Must be called whenever m_Layers, m_LayerCodecs or m_LayerMapped change.
+     */
+    void updateReadableLayer( int index );
+
 
     /**
      * Deletes all layers and resets them to `NULL`.
@@ -132,14 +467,51 @@ public:
      * Holds voxel arrays for all layers registered in the volume.
      * A pointer is `NULL` if the layer is not used in this chunk,
      * in that case the layers default voxel value shuld be used.
-     * Voxels have to be initialized with `0`!
+     * New voxel arrays are filled with that default value.
+     * Compressed layers point to their encoded data instead,
+     * uniform layers to a page shared by the volume. (See m_LayerCodecs.)
      */
     std::vector<char*> m_Layers;
 
     /**
-     * Which layers are compressed.
+     * How the layers are encoded.
+     * Pointers of compressed layers in m_Layers hold the encoded data.
+     * @see VoxelCodec.h
+     */
+    std::vector<VoxelCodec> m_LayerCodecs;
+
+    /**
+     * Size of the encoded data of compressed layers.
+     */
+    std::vector<int> m_CompressedLayerSizes;
+
+    /**
+     * Which layers point into m_Mapping instead of owning their memory.
+     * They are read only and must not be deleted.
+     */
+    std::vector<bool> m_LayerMapped;
+    int m_MappedLayerCount;
+
+    /**
+     * Voxels of each layer, which can be read without the mutex,
+     * or `NULL` if the layer is mapped or compressed.
+     * Absent layers point to the default page.
+     * Packs the state of m_Layers, m_LayerCodecs and m_LayerMapped into one word,
+     * so readers, which don't hold the mutex, don't race with writers.
      */
-    // std::vector<bool> m_LayerCompressed;
+    AtomicPointer<const char>* m_ReadableLayers;
+
+    /**
+     * Versions of the layers, which are shared with snapshots.
+     * A layer must be copied before its voxels are written,
+     * if its version is not `NULL`.
+     */
+    std::vector<LayerVersion*> m_LayerVersions;
+
+    /**
+     * Serialized chunk data, if it was mapped while loading.
+     */
+    FileMapping m_Mapping;
 
     /**
      * True when the chunk has been modified
@@ -147,18 +519,31 @@ public:
      */
     bool m_Modified;
 
+    /**
+     * Bit mask of the modified voxel blocks for each layer.
+     * @see DIRTY_BLOCK_COUNT
+     */
+    std::vector<uint32_t> m_DirtyBlocks;
 
     /**
-     * Timestamp of the first modification since last save event.
-     * Is updated each time, when m_Modified changes from false to true.
+     * Offset of each layer in the stored chunk data,
+     * if it's stored as plain voxel array or `0` otherwise.
+     * All offsets are `0` if the stored data is unknown.
+     */
+    std::vector<uint32_t> m_StoredLayerOffsets;
+
+    /**
+     * Layer offsets of the data that is being saved.
+     * They replace m_StoredLayerOffsets in unsetModified.
      */
-    time_t m_ModificationTime;
+    std::vector<uint32_t> m_SavedLayerOffsets;
 
 
     /**
-     * Resets the modified flag.
+     * Timestamp of the first modification since last save event.
+     * Is updated each time, when m_Modified changes from false to true.
      */
-    void unsetModified();
+    uint64_t m_ModificationTime;
 
 
     /**
@@ -166,7 +551,45 @@ public:
      */
     tthread::atomic_int m_References;
 
-    mutable tthread::mutex m_Mutex;
+    /**
+     * Set while the chunk is being unloaded.
+     */
+    tthread::atomic_int m_Unloaded;
+
+    /**
+     * Amount of enqueued or running jobs.
+     */
+    tthread::atomic_int m_JobReferences;
+
+    int m_JobQueuePositions[JOB_TYPE_COUNT];
+
+    mutable SharedMutex m_Mutex;
+
+    /**
+     * Uses the stripe mutex of the LockManager.
+     */
+    LockState m_LockState;
+
+    /**
+     * Serializes decompression in getConstLayer,
+     * since readers may call it concurrently.
+     */
+    mutable tthread::mutex m_DecodeMutex;
+
+    /**
+     * Is written while holding the state mutex,
+     * so waiters don't miss a notification.
+     */
+    tthread::atomic_int m_State;
+    mutable tthread::mutex m_StateMutex;
+    mutable tthread::condition_variable m_StateCondition;
+
+    /**
+     * Access objects, which wait for the chunk to be loaded.
+     * Each one is removed before it is notified.
+     * Uses the state mutex.
+     */
+    std::vector<Access*> m_LoadListeners;
 };
 
 }
@@ -0,0 +1,141 @@
+#include <assert.h>
+#include "ChunkCache.h"
+
+
+namespace vman
+{
+
+ChunkCache::ChunkCache()
+{
+}
+
+void ChunkCache::touch( ChunkId id )
+{
+    std::map<ChunkId,Entry>::iterator i = m_Entries.find(id);
+    if(i != m_Entries.end())
+    {
+        if(i->second.isProtected)
+        {
+            // Move it to the front:
+            m_Protected.erase(i->second.position);
+            m_Protected.push_front(id);
+            i->second.position = m_Protected.begin();
+        }
+        // Repeated uses while in probation are correlated,
+        // e.g. a selection that is moved around a little.
+        return;
+    }
+
+    Entry entry;
+    std::map<ChunkId, std::list<ChunkId>::iterator>::iterator ghost = m_GhostPositions.find(id);
+    if(ghost != m_GhostPositions.end())
+    {
+        // Used again after it was evicted: Seems to be worth keeping.
+        m_Ghosts.erase(ghost->second);
+        m_GhostPositions.erase(ghost);
+
+        m_Protected.push_front(id);
+        entry.isProtected = true;
+        entry.position = m_Protected.begin();
+    }
+    else
+    {
+        m_Probation.push_front(id);
+        entry.isProtected = false;
+        entry.position = m_Probation.begin();
+    }
+    m_Entries.insert( std::pair<ChunkId,Entry>(id, entry) );
+}
+
+void ChunkCache::remove( ChunkId id )
+{
+    std::map<ChunkId,Entry>::iterator i = m_Entries.find(id);
+    if(i == m_Entries.end())
+        return;
+
+    if(i->second.isProtected)
+    {
+        m_Protected.erase(i->second.position);
+    }
+    else
+    {
+        m_Probation.erase(i->second.position);
+        addGhost(id);
+    }
+    m_Entries.erase(i);
+}
+
+void ChunkCache::addGhost( ChunkId id )
+{
+    m_Ghosts.push_front(id);
+    m_GhostPositions[id] = m_Ghosts.begin();
+
+    int maxGhosts = m_Entries.size() * GHOST_PERCENTAGE / 100;
+    if(maxGhosts < MIN_GHOSTS)
+        maxGhosts = MIN_GHOSTS;
+
+    while(m_Ghosts.size() > maxGhosts)
+    {
+        m_GhostPositions.erase(m_Ghosts.back());
+        m_Ghosts.pop_back();
+    }
+}
+
+bool ChunkCache::contains( ChunkId id ) const
+{
+    return m_Entries.find(id) != m_Entries.end();
+}
+
+bool ChunkCache::isProtected( ChunkId id ) const
+{
+    std::map<ChunkId,Entry>::const_iterator i = m_Entries.find(id);
+    return i != m_Entries.end() && i->second.isProtected;
+}
+
+void ChunkCache::getEvictionOrder( std::vector<ChunkId>* idsOut ) const
+{
+    assert(idsOut != NULL);
+
+    // Oldest probation chunks go first, while the probation queue is too large.
+    // Then the least recently used protected chunks and finally the rest.
+    const int maxProbation = m_Entries.size() * PROBATION_PERCENTAGE / 100;
+    int excess = m_Probation.size() - maxProbation;
+
+    std::list<ChunkId>::const_reverse_iterator i = m_Probation.rbegin();
+    for(; i != m_Probation.rend() && excess > 0; ++i, --excess)
+        idsOut->push_back(*i);
+
+    std::list<ChunkId>::const_reverse_iterator j = m_Protected.rbegin();
+    for(; j != m_Protected.rend(); ++j)
+        idsOut->push_back(*j);
+
+    for(; i != m_Probation.rend(); ++i)
+        idsOut->push_back(*i);
+}
+
+int ChunkCache::getSize() const
+{
+    return m_Entries.size();
+}
+
+tthread::mutex* ChunkCache::getMutex()
+{
+    return &m_Mutex;
+}
+
+
+/** Forbidden Stuff **/
+
+ChunkCache::ChunkCache( const ChunkCache& cache )
+{
+    assert(false);
+}
+
+ChunkCache& ChunkCache::operator = ( const ChunkCache& cache )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
@@ -0,0 +1,133 @@
+#ifndef __VMAN_CHUNK_CACHE_H__
+#define __VMAN_CHUNK_CACHE_H__
+
+#include <vector>
+#include <list>
+#include <map>
+#include <tinythread.h>
+
+#include "Chunk.h"
+
+
+namespace vman
+{
+
+/**
+ * Decides which chunks leave memory first, when a volume exceeds its memory budget.
+ *
+ * Uses the 2Q policy, so that a single scan over many chunks
+ * doesn't push out the chunks that are used over and over again:
+ *
+ * - Chunks that are used for the first time enter the probation queue (FIFO).
+ * - Chunks that are used again after they were evicted from the probation queue
+ *   enter the protected queue (LRU).
+ * - Ids of chunks evicted from the probation queue are remembered for a while,
+ *   without keeping the chunks themselves.
+ *
+ * Only chunk ids are stored, so it doesn't matter if a chunk
+ * is deleted before the cache learns about it.
+ *
+ * Policy: Lock the mutex before using methods that aren't thread safe.
+ */
+class ChunkCache
+{
+public:
+    enum
+    {
+        /**
+         * Percentage of the chunks, which may stay in the probation queue,
+         * before it's preferred for eviction.
+         */
+        PROBATION_PERCENTAGE = 25,
+
+        /**
+         * Percentage of the chunks, whose ids are remembered after eviction.
+         */
+        GHOST_PERCENTAGE = 50,
+
+        /**
+         * Amount of remembered ids for small caches.
+         */
+        MIN_GHOSTS = 64
+    };
+
+    ChunkCache();
+
+    /**
+     * Records that a chunk has been used.
+     */
+    void touch( ChunkId id );
+
+    /**
+     * Forgets a chunk that left memory.
+     * Chunks from the probation queue are remembered as ghosts,
+     * so they enter the protected queue when they come back soon.
+     */
+    void remove( ChunkId id );
+
+    /**
+     * @return Whether the chunk is in one of the queues.
+     */
+    bool contains( ChunkId id ) const;
+
+    /**
+     * @return Whether the chunk has been promoted to the protected queue.
+     */
+    bool isProtected( ChunkId id ) const;
+
+    /**
+     * Appends chunk ids in the order in which they should be evicted.
+     */
+    void getEvictionOrder( std::vector<ChunkId>* idsOut ) const;
+
+    /**
+     * @return Amount of chunks in both queues.
+     */
+    int getSize() const;
+
+    /**
+     * Use this to lock the object while
+     * using methods that aren't thread safe.
+     */
+    tthread::mutex* getMutex();
+
+private:
+    ChunkCache( const ChunkCache& cache );
+    ChunkCache& operator = ( const ChunkCache& cache );
+
+    struct Entry
+    {
+        bool isProtected;
+
+        /**
+         * Position in the probation or protected queue.
+         */
+        std::list<ChunkId>::iterator position;
+    };
+
+    void addGhost( ChunkId id );
+
+    std::map<ChunkId,Entry> m_Entries;
+
+    /**
+     * Newest chunks first.
+     */
+    std::list<ChunkId> m_Probation;
+
+    /**
+     * Most recently used chunks first.
+     */
+    std::list<ChunkId> m_Protected;
+
+    /**
+     * Most recently evicted ids first.
+     */
+    std::list<ChunkId> m_Ghosts;
+    std::map<ChunkId, std::list<ChunkId>::iterator> m_GhostPositions;
+
+    tthread::mutex m_Mutex;
+};
+
+}
+
+#endif
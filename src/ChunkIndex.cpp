@@ -0,0 +1,211 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "Util.h"
+#include "ChunkIndex.h"
+
+
+namespace vman
+{
+
+/*
+    Index file format:
+
+    Header:
+        char[4] magic
+        uint32 version
+        uint32 regionEdgeLength
+        uint32 clean
+        uint32 regionCount
+    [
+        int32 regionX
+        int32 regionY
+        int32 regionZ
+        uint8[ceil(regionEdgeLength^3 / 8)] bitmap
+    ]
+*/
+
+struct ChunkIndexHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t regionEdgeLength;
+    uint32_t clean;
+    uint32_t regionCount;
+};
+
+struct ChunkIndexRegionHeader
+{
+    int32_t x, y, z;
+};
+
+static const char ChunkIndexMagic[4] = {'V','M','C','I'};
+static const int ChunkIndexVersion = 1;
+
+
+ChunkIndex::ChunkIndex( int regionEdgeLength ) :
+    m_RegionEdgeLength(regionEdgeLength)
+{
+    assert(regionEdgeLength > 0);
+}
+
+int ChunkIndex::getRegionEdgeLength() const
+{
+    return m_RegionEdgeLength;
+}
+
+int ChunkIndex::getBitmapSize() const
+{
+    const int chunksPerRegion = m_RegionEdgeLength*m_RegionEdgeLength*m_RegionEdgeLength;
+    return (chunksPerRegion + 7) / 8;
+}
+
+void ChunkIndex::locate( int chunkX, int chunkY, int chunkZ, ChunkId* regionIdOut, int* bitOut ) const
+{
+    const int edgeLength = m_RegionEdgeLength;
+    const int regionX = FloorDiv(chunkX, edgeLength);
+    const int regionY = FloorDiv(chunkY, edgeLength);
+    const int regionZ = FloorDiv(chunkZ, edgeLength);
+
+    *regionIdOut = Chunk::GenerateChunkId(regionX, regionY, regionZ);
+    *bitOut = Index3D(
+        edgeLength, edgeLength, edgeLength,
+        chunkX - regionX*edgeLength,
+        chunkY - regionY*edgeLength,
+        chunkZ - regionZ*edgeLength
+    );
+}
+
+bool ChunkIndex::contains( int chunkX, int chunkY, int chunkZ ) const
+{
+    ChunkId regionId;
+    int bit;
+    locate(chunkX, chunkY, chunkZ, &regionId, &bit);
+
+    std::map<ChunkId, std::vector<uint8_t> >::const_iterator i = m_Regions.find(regionId);
+    if(i == m_Regions.end())
+        return false;
+    return (i->second[bit/8] & (1 << (bit%8))) != 0;
+}
+
+void ChunkIndex::insert( int chunkX, int chunkY, int chunkZ )
+{
+    ChunkId regionId;
+    int bit;
+    locate(chunkX, chunkY, chunkZ, &regionId, &bit);
+
+    std::vector<uint8_t>& bitmap = m_Regions[regionId];
+    if(bitmap.empty())
+        bitmap.resize(getBitmapSize(), 0);
+    bitmap[bit/8] |= (1 << (bit%8));
+}
+
+void ChunkIndex::clear()
+{
+    m_Regions.clear();
+}
+
+bool ChunkIndex::load( const char* fileName )
+{
+    clear();
+
+    FILE* f = fopen(fileName, "rb");
+    if(f == NULL)
+        return false;
+
+    bool success = true;
+
+    ChunkIndexHeader header;
+    if(fread(&header, sizeof(header), 1, f) != 1 ||
+       memcmp(header.magic, ChunkIndexMagic, sizeof(ChunkIndexMagic)) != 0 ||
+       LittleEndian(header.version) != ChunkIndexVersion ||
+       LittleEndian(header.regionEdgeLength) != m_RegionEdgeLength ||
+       LittleEndian(header.clean) == 0)
+        success = false;
+
+    const int regionCount = success ? LittleEndian(header.regionCount) : 0;
+    for(int i = 0; i < regionCount; ++i)
+    {
+        ChunkIndexRegionHeader regionHeader;
+        std::vector<uint8_t> bitmap(getBitmapSize());
+        if(fread(&regionHeader, sizeof(regionHeader), 1, f) != 1 ||
+           fread(&bitmap[0], bitmap.size(), 1, f) != 1)
+        {
+            success = false;
+            break;
+        }
+
+        const ChunkId regionId = Chunk::GenerateChunkId(
+            LittleEndian(regionHeader.x),
+            LittleEndian(regionHeader.y),
+            LittleEndian(regionHeader.z)
+        );
+        m_Regions[regionId].swap(bitmap);
+    }
+
+    fclose(f);
+
+    if(!success)
+        clear();
+    return success;
+}
+
+bool ChunkIndex::save( const char* fileName, bool clean ) const
+{
+    FILE* f = fopen(fileName, "wb");
+    if(f == NULL)
+        return false;
+
+    bool success = true;
+
+    ChunkIndexHeader header;
+    memcpy(header.magic, ChunkIndexMagic, sizeof(ChunkIndexMagic));
+    header.version = LittleEndian( uint32_t(ChunkIndexVersion) );
+    header.regionEdgeLength = LittleEndian( uint32_t(m_RegionEdgeLength) );
+    header.clean = LittleEndian( uint32_t(clean ? 1 : 0) );
+    header.regionCount = LittleEndian( uint32_t(m_Regions.size()) );
+    if(fwrite(&header, sizeof(header), 1, f) != 1)
+        success = false;
+
+    std::map<ChunkId, std::vector<uint8_t> >::const_iterator i = m_Regions.begin();
+    for(; success && i != m_Regions.end(); ++i)
+    {
+        int regionX, regionY, regionZ;
+        Chunk::UnpackChunkId(i->first, &regionX, &regionY, &regionZ);
+
+        ChunkIndexRegionHeader regionHeader;
+        regionHeader.x = LittleEndian( int32_t(regionX) );
+        regionHeader.y = LittleEndian( int32_t(regionY) );
+        regionHeader.z = LittleEndian( int32_t(regionZ) );
+        if(fwrite(&regionHeader, sizeof(regionHeader), 1, f) != 1 ||
+           fwrite(&i->second[0], i->second.size(), 1, f) != 1)
+            success = false;
+    }
+
+    if(fclose(f) != 0)
+        success = false;
+    return success;
+}
+
+tthread::mutex* ChunkIndex::getMutex()
+{
+    return &m_Mutex;
+}
+
+
+/** Forbidden Stuff **/
+
+ChunkIndex::ChunkIndex( const ChunkIndex& index ) :
+    m_RegionEdgeLength(0)
+{
+    assert(false);
+}
+
+ChunkIndex& ChunkIndex::operator = ( const ChunkIndex& index )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
@@ -0,0 +1,96 @@
+#ifndef __VMAN_CHUNK_INDEX_H__
+#define __VMAN_CHUNK_INDEX_H__
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <tinythread.h>
+
+#include "Chunk.h"
+
+
+namespace vman
+{
+
+/**
+ * Remembers which chunks have been stored,
+ * so that unstored chunks can be detected without touching the disk.
+ *
+ * Chunks are grouped into regions of `regionEdgeLength^3` chunks,
+ * each region is a bitmap with one bit per chunk.
+ *
+ * Policy: Lock the mutex before using methods that aren't thread safe.
+ */
+class ChunkIndex
+{
+public:
+    ChunkIndex( int regionEdgeLength );
+
+    /**
+     * Is thread safe.
+     */
+    int getRegionEdgeLength() const;
+
+    /**
+     * @return Whether the chunk has been stored.
+     */
+    bool contains( int chunkX, int chunkY, int chunkZ ) const;
+
+    /**
+     * Marks a chunk as stored.
+     */
+    void insert( int chunkX, int chunkY, int chunkZ );
+
+    /**
+     * Removes all entries.
+     */
+    void clear();
+
+    /**
+     * Replaces the index with the contents of an index file.
+     * Index files that were not closed cleanly are rejected,
+     * since chunks may have been stored after they were written.
+     * @return `false` if the file can't be used.
+     * In that case the index is cleared.
+     */
+    bool load( const char* fileName );
+
+    /**
+     * Writes the index to a file.
+     * @param clean
+     * Should only be `true` if no chunks are stored afterwards.
+     * Index files written with `false` are rejected by load().
+     * @return `true` on success.
+     */
+    bool save( const char* fileName, bool clean ) const;
+
+    /**
+     * Use this to lock the object while
+     * using methods that aren't thread safe.
+     */
+    tthread::mutex* getMutex();
+
+private:
+    ChunkIndex( const ChunkIndex& index );
+    ChunkIndex& operator = ( const ChunkIndex& index );
+
+    /**
+     * Calculates the region id and the bit index of a chunk.
+     */
+    void locate( int chunkX, int chunkY, int chunkZ, ChunkId* regionIdOut, int* bitOut ) const;
+
+    int getBitmapSize() const;
+
+    const int m_RegionEdgeLength;
+
+    /**
+     * Region ids use the same packing as chunk ids.
+     */
+    std::map<ChunkId, std::vector<uint8_t> > m_Regions;
+
+    mutable tthread::mutex m_Mutex;
+};
+
+}
+
+#endif
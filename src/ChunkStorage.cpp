@@ -0,0 +1,788 @@
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <functional>
+#include <set>
+#include "Util.h"
+#include "Volume.h"
+#include "ChunkStorage.h"
+
+
+namespace vman
+{
+
+/**
+ * Durable writes go to these files first and are renamed when they're synced.
+ */
+static const char* TempFileSuffix = ".tmp";
+
+ChunkStorage::ChunkStorage( Volume* volume, const char* baseDir, int regionEdgeLength, vmanDurability durability ) :
+    m_Volume(volume),
+    m_BaseDir(baseDir),
+    m_RegionEdgeLength(regionEdgeLength),
+    m_Durability(durability),
+    m_Index(regionEdgeLength > 0 ? regionEdgeLength : int(INDEX_REGION_EDGE_LENGTH))
+{
+    assert(baseDir != NULL);
+    assert(regionEdgeLength >= 0);
+
+    // Create the directory once, instead of on every save.
+    if(MakePath((m_BaseDir + DirSep).c_str()) == false)
+        m_Volume->log(VMAN_LOG_ERROR, "%s: Can't create directory.\n", m_BaseDir.c_str());
+
+    const std::string indexFileName = getIndexFileName();
+    lock_guard indexGuard(*m_Index.getMutex());
+    if(m_Index.load(indexFileName.c_str()) == false)
+    {
+        m_Volume->log(VMAN_LOG_INFO, "%s: Index is missing or outdated, rebuilding it ..\n", indexFileName.c_str());
+        rebuildIndex();
+    }
+
+    // Until the index is written on shutdown,
+    // the file on disk is marked as outdated.
+    if(m_Index.save(indexFileName.c_str(), false) == false)
+        m_Volume->log(VMAN_LOG_ERROR, "%s: Can't write index.\n", indexFileName.c_str());
+}
+
+ChunkStorage::~ChunkStorage()
+{
+    const std::string indexFileName = getIndexFileName();
+    {
+        lock_guard indexGuard(*m_Index.getMutex());
+        if(m_Index.save(indexFileName.c_str(), true) == false)
+            m_Volume->log(VMAN_LOG_ERROR, "%s: Can't write index.\n", indexFileName.c_str());
+    }
+
+    std::map<ChunkId,RegionFile*>::const_iterator i = m_Regions.begin();
+    for(; i != m_Regions.end(); ++i)
+        delete i->second;
+}
+
+bool ChunkStorage::usesRegionFiles() const
+{
+    return m_RegionEdgeLength > 0;
+}
+
+bool ChunkStorage::canPatchChunks() const
+{
+    return m_Durability == VMAN_DURABILITY_NONE;
+}
+
+std::string ChunkStorage::getChunkFileName( int chunkX, int chunkY, int chunkZ ) const
+{
+    return m_BaseDir + DirSep + Format("%d_%d_%d", chunkX, chunkY, chunkZ);
+}
+
+std::string ChunkStorage::getRegionFileName( int regionX, int regionY, int regionZ ) const
+{
+    return m_BaseDir + DirSep + Format("%d_%d_%d.region", regionX, regionY, regionZ);
+}
+
+std::string ChunkStorage::getIndexFileName() const
+{
+    return m_BaseDir + DirSep + "chunks.index";
+}
+
+void ChunkStorage::rebuildIndex()
+{
+    m_Index.clear();
+
+    std::vector<std::string> names;
+    if(ListDirectory(m_BaseDir.c_str(), &names) == false)
+        return;
+
+    for(int i = 0; i < names.size(); ++i)
+    {
+        int x, y, z;
+        int length = 0;
+        if(sscanf(names[i].c_str(), "%d_%d_%d%n", &x, &y, &z, &length) != 3)
+            continue;
+        const std::string suffix = names[i].substr(length);
+
+        if(suffix.empty())
+        {
+            // Chunk file
+            m_Index.insert(x, y, z);
+        }
+        else if(suffix == TempFileSuffix)
+        {
+            // Left over by a crash before it could replace the chunk file.
+            remove((m_BaseDir + DirSep + names[i]).c_str());
+        }
+        else if(suffix == ".region" && usesRegionFiles())
+        {
+            const int edgeLength = m_RegionEdgeLength;
+
+            int index;
+            RegionFile* region = getRegion(x*edgeLength, y*edgeLength, z*edgeLength, &index);
+            lock_guard regionGuard(*region->getMutex());
+
+            for(int j = 0; j < region->getEntryCount(); ++j)
+            {
+                if(region->hasChunk(j))
+                {
+                    m_Index.insert(
+                        x*edgeLength + j % edgeLength,
+                        y*edgeLength + (j / edgeLength) % edgeLength,
+                        z*edgeLength + j / (edgeLength*edgeLength)
+                    );
+                }
+            }
+        }
+    }
+}
+
+RegionFile* ChunkStorage::getRegion( int chunkX, int chunkY, int chunkZ, int* indexOut )
+{
+    assert(usesRegionFiles());
+
+    const int edgeLength = m_RegionEdgeLength;
+    const int regionX = FloorDiv(chunkX, edgeLength);
+    const int regionY = FloorDiv(chunkY, edgeLength);
+    const int regionZ = FloorDiv(chunkZ, edgeLength);
+
+    *indexOut = Index3D(
+        edgeLength, edgeLength, edgeLength,
+        chunkX - regionX*edgeLength,
+        chunkY - regionY*edgeLength,
+        chunkZ - regionZ*edgeLength
+    );
+
+    const ChunkId regionId = Chunk::GenerateChunkId(regionX, regionY, regionZ);
+
+    lock_guard guard(m_Mutex);
+
+    RegionFile* region = NULL;
+    std::map<ChunkId,RegionFile*>::const_iterator i = m_Regions.find(regionId);
+    if(i != m_Regions.end())
+    {
+        region = i->second;
+    }
+    else
+    {
+        region = new RegionFile(
+            getRegionFileName(regionX, regionY, regionZ),
+            edgeLength,
+            m_Durability != VMAN_DURABILITY_NONE
+        );
+        m_Regions.insert( std::pair<ChunkId,RegionFile*>(regionId, region) );
+    }
+
+    // Move it to the front:
+    m_OpenRegions.remove(region);
+    m_OpenRegions.push_front(region);
+
+    // Close the least recently used region files.
+    // Regions that are in use right now are skipped.
+    std::list<RegionFile*>::iterator j = m_OpenRegions.end();
+    while(m_OpenRegions.size() > MAX_OPEN_REGION_FILES && j != m_OpenRegions.begin())
+    {
+        --j;
+        RegionFile* candidate = *j;
+        if(candidate != region && candidate->getMutex()->try_lock())
+        {
+            candidate->close();
+            candidate->getMutex()->unlock();
+            j = m_OpenRegions.erase(j);
+        }
+    }
+
+    return region;
+}
+
+bool ChunkStorage::chunkExists( int chunkX, int chunkY, int chunkZ )
+{
+    lock_guard indexGuard(*m_Index.getMutex());
+    if(m_Index.contains(chunkX, chunkY, chunkZ))
+    {
+        m_Volume->incStatistic(STATISTIC_CHUNK_INDEX_HITS);
+        return true;
+    }
+    else
+    {
+        m_Volume->incStatistic(STATISTIC_CHUNK_INDEX_MISSES);
+        return false;
+    }
+}
+
+static bool ReadWholeFile( const char* fileName, std::vector<char>* dataOut )
+{
+    FILE* f = fopen(fileName, "rb");
+    if(f == NULL)
+        return false;
+
+    bool success = false;
+    if(fseek(f, 0, SEEK_END) == 0)
+    {
+        const long length = ftell(f);
+        if(length > 0 && fseek(f, 0, SEEK_SET) == 0)
+        {
+            dataOut->resize(length);
+            success = fread(&(*dataOut)[0], length, 1, f) == 1;
+        }
+    }
+
+    fclose(f);
+    return success;
+}
+
+bool ChunkStorage::readChunk( int chunkX, int chunkY, int chunkZ, std::vector<char>* dataOut )
+{
+    assert(dataOut != NULL);
+
+    ChunkRead read;
+    read.chunkX = chunkX;
+    read.chunkY = chunkY;
+    read.chunkZ = chunkZ;
+    read.dataOut = dataOut;
+    return readChunks(&read, 1);
+}
+
+/**
+ * Orders chunks by their region file.
+ */
+struct CompareRegions
+{
+    const std::vector<RegionFile*>* regions;
+
+    bool operator () ( int a, int b ) const
+    {
+        return std::less<RegionFile*>()((*regions)[a], (*regions)[b]);
+    }
+};
+
+/**
+ * Sorts the chunks, so that chunks of the same region are next to each other.
+ * Regions are locked in this order, which is the same for every thread.
+ */
+static void SortByRegion( const std::vector<RegionFile*>& regions, std::vector<int>* orderOut )
+{
+    orderOut->resize(regions.size());
+    for(int i = 0; i < regions.size(); ++i)
+        (*orderOut)[i] = i;
+
+    CompareRegions compare;
+    compare.regions = &regions;
+    std::sort(orderOut->begin(), orderOut->end(), compare);
+}
+
+/**
+ * @return Amount of chunks, which follow `begin` and belong to the same region.
+ */
+static int RegionGroupSize( const std::vector<RegionFile*>& regions, const std::vector<int>& order, int begin )
+{
+    int end = begin+1;
+    while(end < order.size() && regions[order[end]] == regions[order[begin]])
+        ++end;
+    return end - begin;
+}
+
+bool ChunkStorage::readChunks( ChunkRead* reads, int count )
+{
+    if(usesRegionFiles())
+        return readRegionChunks(reads, count);
+
+    bool success = true;
+
+    std::vector<IoRequest> requests;
+    std::vector<IoVector> vectors(count);
+    std::vector<int> requestIndices(count, -1);
+    requests.reserve(count);
+    for(int i = 0; i < count; ++i)
+    {
+        ChunkRead* read = &reads[i];
+        read->success = false;
+
+        const std::string fileName = getChunkFileName(read->chunkX, read->chunkY, read->chunkZ);
+        const int file = OpenFile(fileName.c_str(), false);
+        const int64_t length = (file == -1) ? -1 : GetFileLength(file);
+        if(length <= 0)
+        {
+            if(file != -1)
+                CloseFile(file);
+            m_Volume->log(VMAN_LOG_DEBUG, "%s: File is not readable.\n", fileName.c_str());
+            success = false;
+            continue;
+        }
+
+        read->dataOut->resize(length);
+        vectors[i].data = &(*read->dataOut)[0];
+        vectors[i].length = length;
+
+        IoRequest request;
+        request.file = file;
+        request.offset = 0;
+        request.vectors = &vectors[i];
+        request.vectorCount = 1;
+        request.write = false;
+        request.result = -1;
+        requestIndices[i] = requests.size();
+        requests.push_back(request);
+    }
+
+    if(!requests.empty())
+        m_Volume->getIoBackend()->run(&requests[0], requests.size());
+
+    for(int i = 0; i < count; ++i)
+    {
+        if(requestIndices[i] == -1)
+            continue;
+        const IoRequest& request = requests[requestIndices[i]];
+        CloseFile(request.file);
+
+        ChunkRead* read = &reads[i];
+        read->success = (request.result == int64_t(vectors[i].length));
+        if(!read->success)
+        {
+            m_Volume->log(VMAN_LOG_DEBUG, "%s: Read error.\n",
+                getChunkFileName(read->chunkX, read->chunkY, read->chunkZ).c_str());
+            success = false;
+        }
+    }
+    return success;
+}
+
+bool ChunkStorage::mapChunk( int chunkX, int chunkY, int chunkZ, FileMapping* mappingOut )
+{
+    assert(mappingOut != NULL);
+
+    if(usesRegionFiles())
+    {
+        int index;
+        RegionFile* region = getRegion(chunkX, chunkY, chunkZ, &index);
+        lock_guard regionGuard(*region->getMutex());
+
+        if(region->mapChunk(index, mappingOut) == false)
+        {
+            if(region->getLastError().empty() == false)
+                m_Volume->log(VMAN_LOG_DEBUG, "%s\n", region->getLastError().c_str());
+            return false;
+        }
+        return true;
+    }
+    else
+    {
+        const std::string fileName = getChunkFileName(chunkX, chunkY, chunkZ);
+        FILE* f = fopen(fileName.c_str(), "rb");
+        if(f == NULL)
+            return false;
+
+        bool success = false;
+        if(fseek(f, 0, SEEK_END) == 0)
+        {
+            const long length = ftell(f);
+            if(length > 0)
+                success = MapFile(f, 0, length, mappingOut);
+        }
+
+        fclose(f); // The mapping stays valid.
+        return success;
+    }
+}
+
+bool ChunkStorage::writeChunk( int chunkX, int chunkY, int chunkZ, const char* data, int length )
+{
+    IoVector part;
+    part.data = const_cast<char*>(data);
+    part.length = length;
+    return writeChunk(chunkX, chunkY, chunkZ, &part, 1);
+}
+
+bool ChunkStorage::writeChunk( int chunkX, int chunkY, int chunkZ, const IoVector* parts, int partCount )
+{
+    ChunkWrite write;
+    write.chunkX = chunkX;
+    write.chunkY = chunkY;
+    write.chunkZ = chunkZ;
+    write.parts = parts;
+    write.partCount = partCount;
+    write.offsets = NULL;
+    return writeChunks(&write, 1);
+}
+
+bool ChunkStorage::writeChunks( ChunkWrite* writes, int count )
+{
+    const bool success = usesRegionFiles() ?
+        writeRegionChunks(writes, count) :
+        writeChunkFiles(writes, count);
+
+    lock_guard indexGuard(*m_Index.getMutex());
+    for(int i = 0; i < count; ++i)
+    {
+        if(writes[i].success)
+            m_Index.insert(writes[i].chunkX, writes[i].chunkY, writes[i].chunkZ);
+    }
+    return success;
+}
+
+bool ChunkStorage::readRegionChunks( ChunkRead* reads, int count )
+{
+    bool success = true;
+
+    std::vector<RegionFile*> regions(count);
+    std::vector<int> indices(count);
+    for(int i = 0; i < count; ++i)
+        regions[i] = getRegion(reads[i].chunkX, reads[i].chunkY, reads[i].chunkZ, &indices[i]);
+
+    std::vector<int> order;
+    SortByRegion(regions, &order);
+
+    std::vector<RegionFile::ChunkRead> regionReads(count);
+    for(int i = 0; i < count; ++i)
+    {
+        regionReads[i].index = indices[order[i]];
+        regionReads[i].dataOut = reads[order[i]].dataOut;
+    }
+
+    // The reads of all regions are run as one batch.
+    std::vector<IoRequest> requests;
+    for(int i = 0; i < count; i += RegionGroupSize(regions, order, i))
+    {
+        RegionFile* region = regions[order[i]];
+        region->getMutex()->lock();
+        region->prepareReads(&regionReads[i], RegionGroupSize(regions, order, i), &requests);
+    }
+
+    if(!requests.empty())
+        m_Volume->getIoBackend()->run(&requests[0], requests.size());
+
+    for(int i = 0; i < count; i += RegionGroupSize(regions, order, i))
+    {
+        RegionFile* region = regions[order[i]];
+        const int groupSize = RegionGroupSize(regions, order, i);
+        region->finishReads(&regionReads[i], groupSize, requests.empty() ? NULL : &requests[0]);
+
+        for(int j = i; j < i+groupSize; ++j)
+        {
+            ChunkRead* read = &reads[order[j]];
+            read->success = regionReads[j].success;
+            if(read->success)
+                continue;
+
+            success = false;
+            if(region->hasChunk(regionReads[j].index))
+                m_Volume->log(VMAN_LOG_ERROR, "%s\n", region->getLastError().c_str());
+            else
+                m_Volume->log(VMAN_LOG_DEBUG, "%s: Chunk %s is not stored.\n",
+                    region->getFileName().c_str(),
+                    CoordsToString(read->chunkX, read->chunkY, read->chunkZ).c_str()
+                );
+        }
+        region->getMutex()->unlock();
+    }
+    return success;
+}
+
+bool ChunkStorage::writeRegionChunks( ChunkWrite* writes, int count )
+{
+    bool success = true;
+
+    // Each chunk has to reach the disk, before the next one is written.
+    if(m_Durability == VMAN_DURABILITY_CHUNK && count > 1)
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            if(!writeRegionChunks(&writes[i], 1))
+                success = false;
+        }
+        return success;
+    }
+
+    std::vector<RegionFile*> regions(count);
+    std::vector<int> indices(count);
+    for(int i = 0; i < count; ++i)
+    {
+        assert(writes[i].offsets == NULL || canPatchChunks());
+        regions[i] = getRegion(writes[i].chunkX, writes[i].chunkY, writes[i].chunkZ, &indices[i]);
+    }
+
+    std::vector<int> order;
+    SortByRegion(regions, &order);
+
+    std::vector<RegionFile::ChunkWrite> regionWrites(count);
+    for(int i = 0; i < count; ++i)
+    {
+        const ChunkWrite* write = &writes[order[i]];
+        regionWrites[i].index = indices[order[i]];
+        regionWrites[i].parts = write->parts;
+        regionWrites[i].partCount = write->partCount;
+        regionWrites[i].offsets = write->offsets;
+    }
+
+    // The writes of all regions are run as one batch.
+    std::vector<IoRequest> requests;
+    for(int i = 0; i < count; i += RegionGroupSize(regions, order, i))
+    {
+        RegionFile* region = regions[order[i]];
+        region->getMutex()->lock();
+        region->prepareWrites(&regionWrites[i], RegionGroupSize(regions, order, i), &requests);
+    }
+
+    if(!requests.empty())
+        m_Volume->getIoBackend()->run(&requests[0], requests.size());
+
+    for(int i = 0; i < count; i += RegionGroupSize(regions, order, i))
+    {
+        RegionFile* region = regions[order[i]];
+        const int groupSize = RegionGroupSize(regions, order, i);
+        if(!region->finishWrites(&regionWrites[i], groupSize, requests.empty() ? NULL : &requests[0]))
+            m_Volume->log(VMAN_LOG_ERROR, "%s\n", region->getLastError().c_str());
+
+        // Durable regions sync the data and then the index of all written chunks at once.
+        bool replaced = false;
+        bool patched = false;
+        for(int j = i; j < i+groupSize; ++j)
+        {
+            writes[order[j]].success = regionWrites[j].success;
+            if(!regionWrites[j].success)
+                success = false;
+            else if(regionWrites[j].offsets == NULL)
+                replaced = true;
+            else
+                patched = true;
+        }
+        if(m_Durability != VMAN_DURABILITY_NONE)
+        {
+            if(replaced)
+                m_Volume->incStatistic(STATISTIC_CHUNK_SYNC_OPS, 2);
+            else if(patched)
+                m_Volume->incStatistic(STATISTIC_CHUNK_SYNC_OPS);
+        }
+        region->getMutex()->unlock();
+    }
+    return success;
+}
+
+bool ChunkStorage::writeChunkFiles( ChunkWrite* writes, int count )
+{
+    bool success = true;
+    const bool durable = m_Durability != VMAN_DURABILITY_NONE;
+
+    // Replaced chunks use a single request,
+    // while patched ones need a request for each part.
+    std::vector<std::string> fileNames(count);
+    std::vector<IoRequest> requests;
+    std::vector<int> requestIndices(count, -1);
+    std::vector<int> requestCounts(count, 0);
+    requests.reserve(count);
+    for(int i = 0; i < count; ++i)
+    {
+        ChunkWrite* write = &writes[i];
+        write->success = false;
+
+        fileNames[i] = getChunkFileName(write->chunkX, write->chunkY, write->chunkZ);
+
+        const bool patch = write->offsets != NULL;
+        assert(!patch || (canPatchChunks() && write->partCount > 0));
+        const std::string writtenName = (durable && !patch) ? fileNames[i] + TempFileSuffix : fileNames[i];
+
+        const int file = patch ? OpenFileForUpdate(writtenName.c_str()) : OpenFile(writtenName.c_str(), true);
+        if(file == -1)
+        {
+            m_Volume->log(VMAN_LOG_ERROR, "%s: Can't open file for writing.\n", writtenName.c_str());
+            success = false;
+            continue;
+        }
+
+        IoRequest request;
+        request.file = file;
+        request.offset = 0;
+        request.vectors = write->parts;
+        request.vectorCount = write->partCount;
+        request.write = true;
+        request.result = -1;
+        requestIndices[i] = requests.size();
+
+        if(!patch)
+        {
+            requests.push_back(request);
+            requestCounts[i] = 1;
+            continue;
+        }
+
+        for(int j = 0; j < write->partCount; ++j)
+        {
+            request.offset = write->offsets[j];
+            request.vectors = &write->parts[j];
+            request.vectorCount = 1;
+            requests.push_back(request);
+        }
+        requestCounts[i] = write->partCount;
+    }
+
+    if(!requests.empty())
+        m_Volume->getIoBackend()->run(&requests[0], requests.size());
+
+    int syncFile = -1;
+    for(int i = 0; i < count; ++i)
+    {
+        if(requestIndices[i] == -1)
+            continue;
+        const int file = requests[requestIndices[i]].file;
+
+        writes[i].success = true;
+        for(int j = 0; j < requestCounts[i]; ++j)
+        {
+            const IoRequest& request = requests[requestIndices[i]+j];
+            int64_t length = 0;
+            for(int k = 0; k < request.vectorCount; ++k)
+                length += request.vectors[k].length;
+            writes[i].success = writes[i].success && (request.result == length);
+        }
+
+        if(writes[i].success && m_Durability == VMAN_DURABILITY_CHUNK)
+        {
+            m_Volume->incStatistic(STATISTIC_CHUNK_SYNC_OPS);
+            writes[i].success = SyncFile(file);
+        }
+        if(writes[i].success)
+            syncFile = file;
+    }
+
+    // A single call syncs the whole batch.
+    bool batchSynced = true;
+    if(m_Durability == VMAN_DURABILITY_BATCH && syncFile != -1)
+    {
+        m_Volume->incStatistic(STATISTIC_CHUNK_SYNC_OPS);
+        batchSynced = SyncFileSystem(syncFile);
+    }
+
+    bool renamed = false;
+    for(int i = 0; i < count; ++i)
+    {
+        if(requestIndices[i] == -1)
+            continue;
+        CloseFile(requests[requestIndices[i]].file);
+
+        ChunkWrite* write = &writes[i];
+        write->success = write->success && batchSynced;
+        if(durable)
+        {
+            const std::string tempName = fileNames[i] + TempFileSuffix;
+            if(write->success)
+            {
+                write->success = RenameFile(tempName.c_str(), fileNames[i].c_str());
+                renamed = renamed || write->success;
+            }
+            if(!write->success)
+                remove(tempName.c_str());
+        }
+
+        if(!write->success)
+        {
+            m_Volume->log(VMAN_LOG_ERROR, "%s: Write error.\n", fileNames[i].c_str());
+            success = false;
+        }
+    }
+
+    // The renames need to be durable too.
+    if(renamed)
+    {
+        m_Volume->incStatistic(STATISTIC_CHUNK_SYNC_OPS);
+        if(SyncDirectory(m_BaseDir.c_str()) == false)
+            m_Volume->log(VMAN_LOG_ERROR, "%s: Can't sync directory.\n", m_BaseDir.c_str());
+    }
+    return success;
+}
+
+int ChunkStorage::migrateChunkFiles()
+{
+    assert(usesRegionFiles());
+
+    std::vector<std::string> names;
+    if(ListDirectory(m_BaseDir.c_str(), &names) == false)
+        return 0;
+
+    // Chunk files are only removed, once their regions have been synced.
+    std::vector<std::string> migratedFiles;
+    std::vector<RegionFile*> migratedRegions;
+    std::vector<char> data;
+    for(int i = 0; i < names.size(); ++i)
+    {
+        int chunkX, chunkY, chunkZ;
+        char trailing;
+        if(sscanf(names[i].c_str(), "%d_%d_%d%c", &chunkX, &chunkY, &chunkZ, &trailing) != 3)
+            continue; // Not a chunk file.
+
+        const std::string fileName = getChunkFileName(chunkX, chunkY, chunkZ);
+        if(ReadWholeFile(fileName.c_str(), &data) == false || data.empty())
+        {
+            m_Volume->log(VMAN_LOG_ERROR, "%s: Can't migrate chunk file.\n", fileName.c_str());
+            continue;
+        }
+
+        if(writeChunk(chunkX, chunkY, chunkZ, &data[0], data.size()))
+        {
+            int index;
+            migratedFiles.push_back(fileName);
+            migratedRegions.push_back(getRegion(chunkX, chunkY, chunkZ, &index));
+        }
+    }
+
+    // This happens regardless of the durability,
+    // since the chunk files are safely stored already.
+    std::set<RegionFile*> syncedRegions;
+    std::set<RegionFile*> failedRegions;
+    for(int i = 0; i < migratedRegions.size(); ++i)
+    {
+        RegionFile* region = migratedRegions[i];
+        if(syncedRegions.count(region) || failedRegions.count(region))
+            continue;
+
+        lock_guard regionGuard(*region->getMutex());
+        m_Volume->incStatistic(STATISTIC_CHUNK_SYNC_OPS);
+        if(region->sync())
+        {
+            syncedRegions.insert(region);
+        }
+        else
+        {
+            m_Volume->log(VMAN_LOG_ERROR, "%s\n", region->getLastError().c_str());
+            failedRegions.insert(region);
+        }
+    }
+
+    // New region files need their directory entries.
+    if(!syncedRegions.empty())
+    {
+        m_Volume->incStatistic(STATISTIC_CHUNK_SYNC_OPS);
+        if(SyncDirectory(m_BaseDir.c_str()) == false)
+        {
+            m_Volume->log(VMAN_LOG_ERROR, "%s: Can't sync directory.\n", m_BaseDir.c_str());
+            return 0;
+        }
+    }
+
+    int migratedChunks = 0;
+    for(int i = 0; i < migratedFiles.size(); ++i)
+    {
+        if(syncedRegions.count(migratedRegions[i]) == 0)
+            continue;
+        remove(migratedFiles[i].c_str());
+        migratedChunks++;
+    }
+
+    if(migratedChunks > 0)
+        m_Volume->log(VMAN_LOG_INFO, "Migrated %d chunk files to region files.\n", migratedChunks);
+    return migratedChunks;
+}
+
+
+/** Forbidden Stuff **/
+
+ChunkStorage::ChunkStorage( const ChunkStorage& storage ) :
+    m_RegionEdgeLength(0),
+    m_Durability(VMAN_DURABILITY_NONE),
+    m_Index(1)
+{
+    assert(false);
+}
+
+ChunkStorage& ChunkStorage::operator = ( const ChunkStorage& storage )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
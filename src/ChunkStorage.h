@@ -0,0 +1,247 @@
+#ifndef __VMAN_CHUNK_STORAGE_H__
+#define __VMAN_CHUNK_STORAGE_H__
+
+#include <vector>
+#include <list>
+#include <map>
+#include <string>
+#include <tinythread.h>
+
+#include "Chunk.h"
+#include "ChunkIndex.h"
+#include "RegionFile.h"
+#include "IoBackend.h"
+
+
+namespace vman
+{
+
+class Volume;
+
+/**
+ * Stores serialized chunks in the base directory of a volume.
+ *
+ * Either each chunk is stored in its own file (`baseDir/x_y_z`)
+ * or chunks are grouped into region files (`baseDir/x_y_z.region`),
+ * which hold `regionEdgeLength^3` chunks each.
+ *
+ * An index of the stored chunks is kept in memory and in `baseDir/chunks.index`,
+ * so checking for unstored chunks doesn't need to access the disk.
+ *
+ * All methods are thread safe.
+ */
+class ChunkStorage
+{
+public:
+    enum
+    {
+        /**
+         * Amount of region file handles that are kept open.
+         */
+        MAX_OPEN_REGION_FILES = 32,
+
+        /**
+         * Region size used by the chunk index,
+         * if chunks are not grouped into region files.
+         */
+        INDEX_REGION_EDGE_LENGTH = 16
+    };
+
+    /**
+     * Creates the base directory if it doesn't exist yet.
+     * Loads the chunk index or rebuilds it,
+     * if the volume wasn't closed properly.
+     * @param regionEdgeLength
+     * Chunks per region edge or `0` if every chunk is stored in its own file.
+     * @param durability
+     * How chunks are written, see vmanDurability.
+     */
+    ChunkStorage( Volume* volume, const char* baseDir, int regionEdgeLength, vmanDurability durability );
+
+    /**
+     * Writes the chunk index.
+     */
+    ~ChunkStorage();
+
+    /**
+     * @return Whether chunks are grouped into region files.
+     */
+    bool usesRegionFiles() const;
+
+    /**
+     * Generates the file name where a specific chunk
+     * would be stored without region files.
+     */
+    std::string getChunkFileName( int chunkX, int chunkY, int chunkZ ) const;
+
+    /**
+     * Generates the file name of a region file.
+     * Note that these are region coordinates.
+     * `regionX = floor(chunkX / regionEdgeLength)`
+     */
+    std::string getRegionFileName( int regionX, int regionY, int regionZ ) const;
+
+    /**
+     * Only uses the chunk index and never accesses the disk.
+     * @return Whether data has been stored for the given chunk.
+     */
+    bool chunkExists( int chunkX, int chunkY, int chunkZ );
+
+    /**
+     * Reads the serialized data of a chunk.
+     * @return `false` if the chunk is not stored or on read errors.
+     */
+    bool readChunk( int chunkX, int chunkY, int chunkZ, std::vector<char>* dataOut );
+
+    /**
+     * Describes a chunk for readChunks.
+     */
+    struct ChunkRead
+    {
+        int chunkX, chunkY, chunkZ;
+        std::vector<char>* dataOut;
+
+        /**
+         * Set by readChunks.
+         */
+        bool success;
+    };
+
+    /**
+     * Reads the serialized data of several chunks.
+     * The chunks are read in a single submission,
+     * so their reads are in flight at the same time.
+     * @return Whether all chunks could be read.
+     * @see readChunk
+     */
+    bool readChunks( ChunkRead* reads, int count );
+
+    /**
+     * Maps the serialized data of a chunk read only into memory.
+     * The mapping reflects later writes of the chunk,
+     * so copy everything you need before writing the chunk again.
+     * @return `false` if the chunk is not stored or can't be mapped.
+     */
+    bool mapChunk( int chunkX, int chunkY, int chunkZ, FileMapping* mappingOut );
+
+    /**
+     * Writes the serialized data of a chunk.
+     * @return `true` on success.
+     */
+    bool writeChunk( int chunkX, int chunkY, int chunkZ, const char* data, int length );
+
+    /**
+     * Writes the serialized data of a chunk, which is split into several parts.
+     * The parts are written with a single vectored write.
+     * @see writeChunk
+     */
+    bool writeChunk( int chunkX, int chunkY, int chunkZ, const IoVector* parts, int partCount );
+
+    /**
+     * Describes a chunk for writeChunks.
+     */
+    struct ChunkWrite
+    {
+        int chunkX, chunkY, chunkZ;
+        const IoVector* parts;
+        int partCount;
+
+        /**
+         * If not `NULL`, each part is written at the given offset
+         * of the stored chunk data, while the rest of it is kept.
+         * Otherwise the parts replace the stored chunk.
+         * @see canPatchChunks
+         */
+        const uint32_t* offsets;
+
+        /**
+         * Set by writeChunks.
+         */
+        bool success;
+    };
+
+    /**
+     * Writes several chunks as one batch.
+     * The chunks are written in a single submission.
+     * With durability enabled they're written to temporary files,
+     * synced and then renamed over the previous files,
+     * so a crash leaves either the old or the new chunk.
+     * @return Whether all chunks could be written.
+     */
+    bool writeChunks( ChunkWrite* writes, int count );
+
+    /**
+     * Whether stored chunks may be patched in place, see ChunkWrite#offsets.
+     * With durability enabled chunks are replaced as a whole,
+     * which patches would defeat.
+     */
+    bool canPatchChunks() const;
+
+    /**
+     * Moves chunks stored in their own files into the region files.
+     * This is done when region files are used for a base directory
+     * that has been written without them.
+     * @return Amount of migrated chunks.
+     */
+    int migrateChunkFiles();
+
+private:
+    ChunkStorage( const ChunkStorage& storage );
+    ChunkStorage& operator = ( const ChunkStorage& storage );
+
+    /**
+     * Finds or creates the region file, which stores the given chunk
+     * and marks it as recently used.
+     * Region files that haven't been used for a while are closed.
+     * Lock the returned region before using it.
+     * @param indexOut Index of the chunk inside the region.
+     */
+    RegionFile* getRegion( int chunkX, int chunkY, int chunkZ, int* indexOut );
+
+    std::string getIndexFileName() const;
+
+    /**
+     * Fills the chunk index with all chunks found in the base directory.
+     */
+    void rebuildIndex();
+
+    /**
+     * @see readChunks
+     */
+    bool readRegionChunks( ChunkRead* reads, int count );
+
+    /**
+     * @see writeChunks
+     */
+    bool writeRegionChunks( ChunkWrite* writes, int count );
+
+    /**
+     * @see writeChunks
+     */
+    bool writeChunkFiles( ChunkWrite* writes, int count );
+
+    Volume* m_Volume;
+    std::string m_BaseDir;
+    const int m_RegionEdgeLength;
+    const vmanDurability m_Durability;
+
+    ChunkIndex m_Index;
+
+    mutable tthread::mutex m_Mutex;
+
+    /**
+     * Region files that were used so far.
+     * Region ids use the same packing as chunk ids.
+     */
+    std::map<ChunkId,RegionFile*> m_Regions;
+
+    /**
+     * Region files with open handles.
+     * The most recently used one comes first.
+     */
+    std::list<RegionFile*> m_OpenRegions;
+};
+
+}
+
+#endif
@@ -0,0 +1,217 @@
+#include <assert.h>
+#include "ChunkTable.h"
+
+
+namespace vman
+{
+
+static const int InitialBucketCount = 16; // Must be a power of two.
+
+ChunkTable::ChunkTable( EpochManager* epochManager ) :
+    m_EpochManager(epochManager),
+    m_Size(0)
+{
+    for(int i = 0; i < STRIPE_COUNT; ++i)
+    {
+        m_Stripes[i].buckets = new Buckets(InitialBucketCount);
+        m_Stripes[i].size = 0;
+    }
+}
+
+ChunkTable::~ChunkTable()
+{
+    for(int i = 0; i < STRIPE_COUNT; ++i)
+        delete m_Stripes[i].buckets.load();
+}
+
+ChunkTable::Buckets::Buckets( int count ) :
+    count(count),
+    heads(new AtomicPointer<Node>[count])
+{
+}
+
+ChunkTable::Buckets::~Buckets()
+{
+    for(int i = 0; i < count; ++i)
+    {
+        Node* node = heads[i];
+        while(node != NULL)
+        {
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+    delete[] heads;
+}
+
+void ChunkTable::DeleteNode( void* node )
+{
+    delete reinterpret_cast<Node*>(node);
+}
+
+void ChunkTable::DeleteBuckets( void* buckets )
+{
+    delete reinterpret_cast<Buckets*>(buckets);
+}
+
+uint64_t ChunkTable::Hash( ChunkId id )
+{
+    // Finalizer of MurmurHash3.
+    // The chunk id packs three 16 bit coordinates,
+    // so neighbouring chunks need to be spread over the whole range.
+    uint64_t h = id;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int ChunkTable::getStripe( ChunkId id ) const
+{
+    // Use the upper bits, the lower ones select the bucket.
+    return int(Hash(id) >> 58) & (STRIPE_COUNT-1);
+}
+
+tthread::mutex* ChunkTable::getMutex( ChunkId id )
+{
+    return &m_Stripes[getStripe(id)].mutex;
+}
+
+tthread::mutex* ChunkTable::getStripeMutex( int stripe )
+{
+    assert(stripe >= 0);
+    assert(stripe < STRIPE_COUNT);
+    return &m_Stripes[stripe].mutex;
+}
+
+Chunk* ChunkTable::get( ChunkId id ) const
+{
+    const Buckets* buckets = m_Stripes[getStripe(id)].buckets;
+    const Node* node = buckets->heads[Hash(id) & (buckets->count-1)];
+    for(; node != NULL; node = node->next)
+    {
+        if(node->id == id)
+        {
+            assert(node->chunk->getId() == id);
+            return node->chunk;
+        }
+    }
+    return NULL;
+}
+
+void ChunkTable::insert( Chunk* chunk )
+{
+    assert(chunk != NULL);
+    const ChunkId id = chunk->getId();
+    assert(get(id) == NULL);
+
+    Stripe* stripe = &m_Stripes[getStripe(id)];
+    if(stripe->size >= stripe->buckets.load()->count)
+        grow(stripe);
+
+    Buckets* buckets = stripe->buckets;
+    AtomicPointer<Node>& bucket = buckets->heads[Hash(id) & (buckets->count-1)];
+
+    // The node is complete before readers can see it.
+    Node* node = new Node;
+    node->id = id;
+    node->chunk = chunk;
+    node->next = bucket.load();
+    bucket = node;
+
+    stripe->size++;
+    m_Size++;
+}
+
+bool ChunkTable::erase( ChunkId id )
+{
+    Stripe* stripe = &m_Stripes[getStripe(id)];
+    Buckets* buckets = stripe->buckets;
+    AtomicPointer<Node>* link = &buckets->heads[Hash(id) & (buckets->count-1)];
+    for(; link->load() != NULL; link = &link->load()->next)
+    {
+        Node* node = *link;
+        if(node->id == id)
+        {
+            *link = node->next.load();
+            m_EpochManager->retire(node, DeleteNode);
+            stripe->size--;
+            m_Size--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ChunkTable::getStripeChunks( int stripe, std::vector<Chunk*>* chunksOut ) const
+{
+    assert(stripe >= 0);
+    assert(stripe < STRIPE_COUNT);
+    assert(chunksOut != NULL);
+
+    const Buckets* buckets = m_Stripes[stripe].buckets;
+    for(int i = 0; i < buckets->count; ++i)
+        for(const Node* node = buckets->heads[i]; node != NULL; node = node->next)
+            chunksOut->push_back(node->chunk);
+}
+
+int ChunkTable::getSize() const
+{
+    return m_Size;
+}
+
+void ChunkTable::grow( Stripe* stripe )
+{
+    Buckets* oldBuckets = stripe->buckets;
+    Buckets* buckets = new Buckets(oldBuckets->count*2);
+    const uint64_t mask = buckets->count-1;
+
+    // Readers may still be traversing the old nodes,
+    // so they're copied instead of being relinked.
+    for(int i = 0; i < oldBuckets->count; ++i)
+    {
+        for(const Node* oldNode = oldBuckets->heads[i]; oldNode != NULL; oldNode = oldNode->next)
+        {
+            AtomicPointer<Node>& bucket = buckets->heads[Hash(oldNode->id) & mask];
+            Node* node = new Node;
+            node->id = oldNode->id;
+            node->chunk = oldNode->chunk;
+            node->next = bucket.load();
+            bucket = node;
+        }
+    }
+
+    stripe->buckets = buckets;
+    m_EpochManager->retire(oldBuckets, DeleteBuckets);
+}
+
+
+/** Forbidden Stuff **/
+
+ChunkTable::ChunkTable( const ChunkTable& table )
+{
+    assert(false);
+}
+
+ChunkTable& ChunkTable::operator = ( const ChunkTable& table )
+{
+    assert(false);
+    return *this;
+}
+
+ChunkTable::Buckets::Buckets( const Buckets& buckets )
+{
+    assert(false);
+}
+
+ChunkTable::Buckets& ChunkTable::Buckets::operator = ( const Buckets& buckets )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
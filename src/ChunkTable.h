@@ -0,0 +1,155 @@
+#ifndef __VMAN_CHUNK_TABLE_H__
+#define __VMAN_CHUNK_TABLE_H__
+
+#include <vector>
+#include <tinythread.h>
+
+#include "Util.h"
+#include "Chunk.h"
+#include "EpochManager.h"
+
+
+namespace vman
+{
+
+/**
+ * Hash table that maps chunk ids to the loaded chunks of a volume.
+ *
+ * The table is divided into stripes, each guarded by its own mutex.
+ * A chunk id always belongs to the same stripe, so lookups and inserts
+ * of chunks that lie in different stripes can run in parallel.
+ *
+ * Lookups don't need the stripe mutex: Nodes and bucket arrays,
+ * which are replaced, are retired to the epoch manager instead of being
+ * deleted, so a reader that entered an epoch can still traverse them.
+ *
+ * Policy: Like the other classes the table never locks by itself.
+ * Lock the stripe mutex returned by getMutex() before using
+ * methods that aren't thread safe.
+ */
+class ChunkTable
+{
+public:
+    enum
+    {
+        /**
+         * Must be a power of two.
+         */
+        STRIPE_COUNT = 64
+    };
+
+    ChunkTable( EpochManager* epochManager );
+
+    /**
+     * Note that the stored chunks are not deleted.
+     */
+    ~ChunkTable();
+
+    /**
+     * Is thread safe.
+     * @return The stripe index that guards the given chunk id.
+     */
+    int getStripe( ChunkId id ) const;
+
+    /**
+     * Is thread safe.
+     * @return The mutex of the stripe that guards the given chunk id.
+     */
+    tthread::mutex* getMutex( ChunkId id );
+
+    /**
+     * Is thread safe.
+     * @return The mutex of the given stripe.
+     */
+    tthread::mutex* getStripeMutex( int stripe );
+
+    /**
+     * Needs the stripe mutex or an entered epoch.
+     * Without the mutex the chunk may be unloaded meanwhile,
+     * so reference it with Chunk::tryAddReference() before leaving the epoch.
+     * @return The chunk with the given id or `NULL` if its not in the table.
+     */
+    Chunk* get( ChunkId id ) const;
+
+    /**
+     * Needs the stripe mutex.
+     * There must be no chunk with the same id in the table.
+     */
+    void insert( Chunk* chunk );
+
+    /**
+     * Needs the stripe mutex.
+     * @return `false` if no chunk with the given id was found.
+     */
+    bool erase( ChunkId id );
+
+    /**
+     * Appends all chunks of a stripe to `chunksOut`.
+     * Needs the stripe mutex.
+     */
+    void getStripeChunks( int stripe, std::vector<Chunk*>* chunksOut ) const;
+
+    /**
+     * Is thread safe.
+     * @return Amount of chunks stored in the table.
+     */
+    int getSize() const;
+
+private:
+    ChunkTable( const ChunkTable& table );
+    ChunkTable& operator = ( const ChunkTable& table );
+
+    struct Node
+    {
+        ChunkId id;
+        Chunk* chunk;
+        AtomicPointer<Node> next;
+    };
+
+    /**
+     * Array of singly linked lists.
+     * Its size is always a power of two.
+     */
+    struct Buckets
+    {
+        Buckets( int count );
+
+        /**
+         * Deletes the nodes too.
+         */
+        ~Buckets();
+
+        int count;
+        AtomicPointer<Node>* heads;
+
+    private:
+        Buckets( const Buckets& buckets );
+        Buckets& operator = ( const Buckets& buckets );
+    };
+
+    struct Stripe
+    {
+        tthread::mutex mutex;
+        AtomicPointer<Buckets> buckets;
+        int size;
+    };
+
+    static uint64_t Hash( ChunkId id );
+
+    static void DeleteNode( void* node );
+    static void DeleteBuckets( void* buckets );
+
+    /**
+     * Copies the nodes of a stripe into twice as many buckets.
+     * The old ones are retired, as readers may still traverse them.
+     */
+    void grow( Stripe* stripe );
+
+    EpochManager* m_EpochManager;
+    Stripe m_Stripes[STRIPE_COUNT];
+    tthread::atomic_int m_Size;
+};
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+#include <assert.h>
+#include "Util.h"
+#include "EpochManager.h"
+
+
+namespace vman
+{
+
+EpochManager::EpochManager() :
+    m_Epoch(0),
+    m_RetiredCount(0),
+    m_Mutex()
+{
+}
+
+EpochManager::~EpochManager()
+{
+    assert(m_RetiredCount == 0);
+    for(int i = 0; i < EPOCH_COUNT; ++i)
+        assert(countReaders(i) == 0);
+}
+
+unsigned int EpochManager::enter( int stripe )
+{
+    while(true)
+    {
+        const unsigned int epoch = m_Epoch;
+        tthread::atomic_int& readers = getReaders(stripe, epoch);
+        readers++;
+
+        // The epoch may have advanced before we were counted,
+        // then objects retired meanwhile may be deleted already.
+        if(m_Epoch == epoch)
+            return epoch;
+
+        readers--;
+    }
+}
+
+void EpochManager::leave( unsigned int epoch, int stripe )
+{
+    tthread::atomic_int& readers = getReaders(stripe, epoch);
+    assert(readers > 0);
+    readers--;
+}
+
+tthread::atomic_int& EpochManager::getReaders( int stripe, unsigned int epoch )
+{
+    return m_ReaderStripes[stripe & (STRIPE_COUNT-1)].readers[epoch % EPOCH_COUNT];
+}
+
+int EpochManager::countReaders( unsigned int epoch ) const
+{
+    // A reader, which is counted after its stripe has been summed up,
+    // entered too late and retries in the new epoch.
+    int readers = 0;
+    for(int i = 0; i < STRIPE_COUNT; ++i)
+        readers += m_ReaderStripes[i].readers[epoch % EPOCH_COUNT];
+    return readers;
+}
+
+void EpochManager::retire( void* object, DeleteFn deleteFn )
+{
+    assert(object != NULL);
+    assert(deleteFn != NULL);
+    {
+        lock_guard guard(m_Mutex);
+        RetiredObject retired;
+        retired.object = object;
+        retired.deleteFn = deleteFn;
+        m_Retired[m_Epoch % EPOCH_COUNT].push_back(retired);
+        m_RetiredCount++;
+    }
+    reclaim();
+}
+
+int EpochManager::reclaim()
+{
+    std::vector<RetiredObject> safeObjects;
+    {
+        lock_guard guard(m_Mutex);
+
+        // Two steps make everything, which has been retired so far, safe.
+        for(int i = 0; i < EPOCH_COUNT-1 && m_RetiredCount > 0; ++i)
+        {
+            const unsigned int epoch = m_Epoch;
+            const int previous = (epoch+EPOCH_COUNT-1) % EPOCH_COUNT;
+            if(countReaders(previous) != 0)
+                break;
+            m_Epoch = epoch+1;
+
+            // Readers of the current epoch entered after these were retired.
+            std::vector<RetiredObject>& retired = m_Retired[previous];
+            safeObjects.insert(safeObjects.end(), retired.begin(), retired.end());
+            m_RetiredCount -= retired.size();
+            retired.clear();
+        }
+    }
+
+    // Deleted without the mutex, as the destructors may be expensive.
+    DeleteObjects(safeObjects);
+    return safeObjects.size();
+}
+
+void EpochManager::deleteRetired()
+{
+    std::vector<RetiredObject> objects;
+    {
+        lock_guard guard(m_Mutex);
+        for(int i = 0; i < EPOCH_COUNT; ++i)
+        {
+            assert(countReaders(i) == 0);
+            objects.insert(objects.end(), m_Retired[i].begin(), m_Retired[i].end());
+            m_Retired[i].clear();
+        }
+        m_RetiredCount = 0;
+    }
+    DeleteObjects(objects);
+}
+
+int EpochManager::getRetiredCount() const
+{
+    lock_guard guard(m_Mutex);
+    return m_RetiredCount;
+}
+
+void EpochManager::DeleteObjects( const std::vector<RetiredObject>& objects )
+{
+    for(int i = 0; i < objects.size(); ++i)
+        objects[i].deleteFn(objects[i].object);
+}
+
+
+EpochGuard::EpochGuard( EpochManager* manager, int stripe ) :
+    m_Manager(manager),
+    m_Stripe(stripe),
+    m_Epoch(manager->enter(stripe))
+{
+}
+
+EpochGuard::~EpochGuard()
+{
+    m_Manager->leave(m_Epoch, m_Stripe);
+}
+
+
+
+/** Forbidden Stuff **/
+
+EpochManager::EpochManager( const EpochManager& manager )
+{
+    assert(false);
+}
+
+EpochManager& EpochManager::operator = ( const EpochManager& manager )
+{
+    assert(false);
+    return *this;
+}
+
+EpochGuard::EpochGuard( const EpochGuard& guard )
+{
+    assert(false);
+}
+
+EpochGuard& EpochGuard::operator = ( const EpochGuard& guard )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
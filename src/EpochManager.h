@@ -0,0 +1,152 @@
+#ifndef __VMAN_EPOCH_MANAGER_H__
+#define __VMAN_EPOCH_MANAGER_H__
+
+#include <vector>
+#include <tinythread.h>
+
+
+namespace vman
+{
+
+/**
+ * Defers the deletion of objects, which lock free readers may still see.
+ *
+ * Readers enter an epoch before they look up shared pointers
+ * and leave it when they don't use them anymore.
+ * Objects are retired after they have been made unreachable,
+ * but deleted only once all readers, that might have seen them, left.
+ *
+ * The global epoch may only advance when no reader is left in the previous one.
+ * So objects retired in epoch `e` can be deleted once the epoch reached `e+2`,
+ * which is why three reader counters are enough.
+ *
+ * Readers are counted per stripe, so readers of different stripes
+ * don't contend for the same cache line.  Callers should spread them,
+ * e.g. by the ChunkTable stripe of the looked up chunk.
+ *
+ * All methods are thread safe.
+ */
+class EpochManager
+{
+public:
+    typedef void (*DeleteFn)( void* object );
+
+    enum
+    {
+        EPOCH_COUNT = 3,
+
+        /**
+         * Must be a power of two.
+         */
+        STRIPE_COUNT = 64,
+
+        CACHE_LINE_SIZE = 64
+    };
+
+    EpochManager();
+
+    /**
+     * All retired objects must have been deleted already.
+     * @see deleteRetired
+     */
+    ~EpochManager();
+
+    /**
+     * Pointers, which were read after entering,
+     * stay valid until leave() is called.
+     * @param stripe
+     * Any number, which is mapped to one of the STRIPE_COUNT reader counters.
+     * @return The entered epoch, which must be passed to leave().
+     */
+    unsigned int enter( int stripe );
+
+    /**
+     * @param stripe Same stripe that was passed to enter().
+     */
+    void leave( unsigned int epoch, int stripe );
+
+    /**
+     * Deletes the object with `deleteFn`, once no reader can see it anymore.
+     * It must not be reachable for new readers anymore.
+     */
+    void retire( void* object, DeleteFn deleteFn );
+
+    /**
+     * Advances the epoch as far as the readers allow it
+     * and deletes the objects that became safe.
+     * @return Amount of deleted objects.
+     */
+    int reclaim();
+
+    /**
+     * Deletes all retired objects at once.
+     * There must be no readers left.
+     */
+    void deleteRetired();
+
+    /**
+     * @return Amount of retired objects, which haven't been deleted yet.
+     */
+    int getRetiredCount() const;
+
+private:
+    EpochManager( const EpochManager& manager );
+    EpochManager& operator = ( const EpochManager& manager );
+
+    struct RetiredObject
+    {
+        void* object;
+        DeleteFn deleteFn;
+    };
+
+    /**
+     * Padded to keep the counters of neighbouring stripes apart.
+     */
+    struct ReaderStripe
+    {
+        tthread::atomic_int readers[EPOCH_COUNT];
+        char padding[CACHE_LINE_SIZE];
+    };
+
+    static void DeleteObjects( const std::vector<RetiredObject>& objects );
+
+    tthread::atomic_int& getReaders( int stripe, unsigned int epoch );
+
+    /**
+     * Sums up the readers of all stripes.
+     */
+    int countReaders( unsigned int epoch ) const;
+
+    tthread::atomic_uint m_Epoch;
+    ReaderStripe m_ReaderStripes[STRIPE_COUNT];
+
+    /**
+     * Objects by the epoch in which they were retired.
+     * Uses the mutex, which also serializes advancing the epoch.
+     */
+    std::vector<RetiredObject> m_Retired[EPOCH_COUNT];
+    int m_RetiredCount;
+    mutable tthread::mutex m_Mutex;
+};
+
+/**
+ * Stays in an epoch during its lifetime.
+ */
+class EpochGuard
+{
+public:
+    EpochGuard( EpochManager* manager, int stripe );
+    ~EpochGuard();
+
+private:
+    EpochGuard( const EpochGuard& guard );
+    EpochGuard& operator = ( const EpochGuard& guard );
+
+    EpochManager* m_Manager;
+    int m_Stripe;
+    unsigned int m_Epoch;
+};
+
+}
+
+#endif
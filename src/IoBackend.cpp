@@ -0,0 +1,484 @@
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include "Util.h"
+#include "IoBackend.h"
+
+#if defined(__WINDOWS__)
+    #include <io.h>
+    #include <stdio.h>
+#else
+    #include <unistd.h>
+    #include <sys/uio.h>
+#endif
+
+#if defined(VMAN_HAVE_IO_URING)
+    #include <sched.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+    #include <linux/io_uring.h>
+#endif
+
+
+namespace vman
+{
+
+static int64_t GetRequestLength( const IoRequest* request )
+{
+    int64_t length = 0;
+    for(int i = 0; i < request->vectorCount; ++i)
+        length += request->vectors[i].length;
+    return length;
+}
+
+/**
+ * Executes a request with blocking system calls,
+ * starting `done` bytes into it.
+ */
+static bool TransferFallback( IoRequest* request, int64_t done )
+{
+    enum
+    {
+        /**
+         * Vectors that are passed to a single `preadv`/`pwritev` call.
+         */
+        MAX_CALL_VECTORS = 16
+    };
+
+    const int64_t length = GetRequestLength(request);
+    bool failed = false;
+    while(done < length)
+    {
+        // Skip the vectors, which have been transferred already.
+        int64_t skipped = done;
+        int first = 0;
+        while(skipped >= request->vectors[first].length)
+        {
+            skipped -= request->vectors[first].length;
+            ++first;
+        }
+
+        int64_t transferred = 0;
+#if defined(__WINDOWS__)
+        char* data = (char*)request->vectors[first].data + skipped;
+        const unsigned int dataLength = request->vectors[first].length - skipped;
+        if(_lseeki64(request->file, request->offset + done, SEEK_SET) == -1)
+        {
+            failed = true;
+            break;
+        }
+        if(request->write)
+            transferred = _write(request->file, data, dataLength);
+        else
+            transferred = _read(request->file, data, dataLength);
+#else
+        iovec parts[MAX_CALL_VECTORS];
+        int partCount = 0;
+        for(int i = first; i < request->vectorCount && partCount < MAX_CALL_VECTORS; ++i)
+        {
+            parts[partCount].iov_base = (char*)request->vectors[i].data + skipped;
+            parts[partCount].iov_len = request->vectors[i].length - skipped;
+            skipped = 0;
+            partCount++;
+        }
+
+        if(request->write)
+            transferred = pwritev(request->file, parts, partCount, request->offset + done);
+        else
+            transferred = preadv(request->file, parts, partCount, request->offset + done);
+
+        if(transferred == -1 && errno == EINTR)
+            continue;
+#endif
+
+        if(transferred < 0)
+            failed = true;
+        if(transferred <= 0)
+            break; // Errors or end of file
+        done += transferred;
+    }
+
+    request->result = (failed && done == 0) ? -1 : done;
+    return done == length;
+}
+
+
+#if defined(VMAN_HAVE_IO_URING)
+
+/**
+ * Submission and completion queue shared with the kernel.
+ */
+struct IoBackend::Ring
+{
+    int fd;
+    unsigned int entries;
+
+    /**
+     * Set when the kernel refused to take requests.
+     * Broken rings are closed instead of being reused.
+     */
+    bool broken;
+
+    void* sqRing;
+    size_t sqRingLength;
+    void* cqRing;
+    size_t cqRingLength;
+    io_uring_sqe* sqes;
+    size_t sqesLength;
+
+    unsigned int* sqTail;
+    unsigned int* sqMask;
+    unsigned int* sqArray;
+
+    unsigned int* cqHead;
+    unsigned int* cqTail;
+    unsigned int* cqMask;
+    io_uring_cqe* cqes;
+
+    /**
+     * Vectors of the requests in flight.
+     */
+    std::vector<iovec> vectors;
+
+    /**
+     * Which requests of the current round completed.
+     */
+    std::vector<char> completed;
+
+    Ring() :
+        fd(-1),
+        entries(0),
+        broken(false),
+        sqRing(NULL),
+        sqRingLength(0),
+        cqRing(NULL),
+        cqRingLength(0),
+        sqes(NULL),
+        sqesLength(0)
+    {
+    }
+
+    ~Ring()
+    {
+        close();
+    }
+
+    bool open()
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, int(QUEUE_DEPTH), &params);
+        if(fd < 0)
+            return false;
+        entries = params.sq_entries;
+
+        sqRingLength = params.sq_off.array + params.sq_entries*sizeof(unsigned int);
+        cqRingLength = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+
+        bool singleMapping = false;
+#if defined(IORING_FEAT_SINGLE_MMAP)
+        singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if(singleMapping)
+        {
+            if(cqRingLength > sqRingLength)
+                sqRingLength = cqRingLength;
+            cqRingLength = sqRingLength;
+        }
+#endif
+
+        sqRing = mapRegion(sqRingLength, IORING_OFF_SQ_RING);
+        if(sqRing == NULL)
+            return false;
+
+        if(singleMapping)
+            cqRing = sqRing;
+        else
+            cqRing = mapRegion(cqRingLength, IORING_OFF_CQ_RING);
+        if(cqRing == NULL)
+            return false;
+
+        sqesLength = params.sq_entries*sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mapRegion(sqesLength, IORING_OFF_SQES);
+        if(sqes == NULL)
+            return false;
+
+        char* sq = (char*)sqRing;
+        sqTail  = (unsigned int*)(sq + params.sq_off.tail);
+        sqMask  = (unsigned int*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned int*)(sq + params.sq_off.array);
+
+        char* cq = (char*)cqRing;
+        cqHead = (unsigned int*)(cq + params.cq_off.head);
+        cqTail = (unsigned int*)(cq + params.cq_off.tail);
+        cqMask = (unsigned int*)(cq + params.cq_off.ring_mask);
+        cqes   = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void close()
+    {
+        if(sqes != NULL)
+            munmap(sqes, sqesLength);
+        if(cqRing != NULL && cqRing != sqRing)
+            munmap(cqRing, cqRingLength);
+        if(sqRing != NULL)
+            munmap(sqRing, sqRingLength);
+        if(fd >= 0)
+            ::close(fd);
+
+        fd = -1;
+        sqRing = NULL;
+        cqRing = NULL;
+        sqes = NULL;
+    }
+
+    void* mapRegion( size_t length, off_t offset )
+    {
+        void* address = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, offset);
+        return (address == MAP_FAILED) ? NULL : address;
+    }
+};
+
+#else
+
+struct IoBackend::Ring
+{
+    bool broken;
+
+    bool open()
+    {
+        return false;
+    }
+};
+
+#endif
+
+
+IoBackend::IoBackend( bool useIoUring ) :
+    m_IoUringAvailable(false)
+{
+    if(useIoUring)
+    {
+        // A first ring tells whether the kernel supports io_uring.
+        Ring* ring = new Ring();
+        m_IoUringAvailable = ring->open();
+        if(m_IoUringAvailable)
+            m_IdleRings.push_back(ring);
+        else
+            delete ring;
+    }
+}
+
+IoBackend::~IoBackend()
+{
+    for(int i = 0; i < m_IdleRings.size(); ++i)
+        delete m_IdleRings[i];
+}
+
+bool IoBackend::usesIoUring() const
+{
+    return m_IoUringAvailable;
+}
+
+IoBackend::Ring* IoBackend::acquireRing()
+{
+    if(!m_IoUringAvailable)
+        return NULL;
+
+    {
+        lock_guard guard(m_Mutex);
+        if(!m_IdleRings.empty())
+        {
+            Ring* ring = m_IdleRings.back();
+            m_IdleRings.pop_back();
+            return ring;
+        }
+    }
+
+    Ring* ring = new Ring();
+    if(ring->open() == false)
+    {
+        // Probably out of locked memory, so this thread uses the fallback.
+        delete ring;
+        return NULL;
+    }
+    return ring;
+}
+
+void IoBackend::releaseRing( Ring* ring )
+{
+    {
+        lock_guard guard(m_Mutex);
+        if(!ring->broken && m_IdleRings.size() < MAX_IDLE_RINGS)
+        {
+            m_IdleRings.push_back(ring);
+            return;
+        }
+    }
+    delete ring;
+}
+
+bool IoBackend::run( IoRequest* requests, int count )
+{
+    assert(count >= 0);
+    if(count == 0)
+        return true;
+
+    Ring* ring = acquireRing();
+    if(ring != NULL)
+    {
+        const bool success = runRing(ring, requests, count);
+        releaseRing(ring);
+        return success;
+    }
+
+    bool success = true;
+    for(int i = 0; i < count; ++i)
+    {
+        if(TransferFallback(&requests[i], 0) == false)
+            success = false;
+    }
+    return success;
+}
+
+bool IoBackend::runRing( Ring* ring, IoRequest* requests, int count )
+{
+#if defined(VMAN_HAVE_IO_URING)
+    bool success = true;
+    for(int first = 0; first < count; first += ring->entries)
+    {
+        int roundCount = count - first;
+        if(roundCount > ring->entries)
+            roundCount = ring->entries;
+
+        int vectorCount = 0;
+        for(int i = 0; i < roundCount; ++i)
+            vectorCount += requests[first+i].vectorCount;
+        ring->vectors.resize(vectorCount);
+        ring->completed.assign(roundCount, 0);
+
+        // -- Fill submission queue --
+        unsigned int tail = *ring->sqTail;
+        iovec* vectors = ring->vectors.empty() ? NULL : &ring->vectors[0];
+        for(int i = 0; i < roundCount; ++i)
+        {
+            const IoRequest* request = &requests[first+i];
+            for(int j = 0; j < request->vectorCount; ++j)
+            {
+                vectors[j].iov_base = request->vectors[j].data;
+                vectors[j].iov_len = request->vectors[j].length;
+            }
+
+            const unsigned int index = tail & *ring->sqMask;
+            io_uring_sqe* sqe = &ring->sqes[index];
+            memset(sqe, 0, sizeof(io_uring_sqe));
+            sqe->opcode = request->write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->fd = request->file;
+            sqe->off = request->offset;
+            sqe->addr = (uint64_t)(uintptr_t)vectors;
+            sqe->len = request->vectorCount;
+            sqe->user_data = i;
+            ring->sqArray[index] = index;
+
+            vectors += request->vectorCount;
+            tail++;
+        }
+        // The entries must be visible before the kernel sees the new tail.
+        __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+        // -- Submit and reap completions --
+        int submitted = 0;
+        int completed = 0;
+        while(completed < roundCount)
+        {
+            // Requests, which the kernel took, still use the buffers.
+            // So they're waited for, even if the ring broke.
+            if(ring->broken && completed == submitted)
+                break;
+
+            const int toSubmit = ring->broken ? 0 : roundCount - submitted;
+            const int toComplete = (ring->broken ? submitted : roundCount) - completed;
+
+            // The kernel only waits if all entries have been submitted.
+            const int result = syscall(__NR_io_uring_enter,
+                ring->fd,
+                toSubmit,
+                toComplete,
+                IORING_ENTER_GETEVENTS,
+                NULL,
+                0
+            );
+            if(result >= 0)
+            {
+                submitted += result;
+            }
+            else if(errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            {
+                // If waiting fails too, completions are polled instead.
+                if(ring->broken)
+                    sched_yield();
+                ring->broken = true;
+            }
+
+            unsigned int head = *ring->cqHead;
+            const unsigned int cqTail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+            for(; head != cqTail; ++head)
+            {
+                const io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+                const int i = cqe->user_data;
+                IoRequest* request = &requests[first+i];
+
+                // Short transfers are continued and failed ones retried,
+                // which also covers kernels that lack an operation.
+                bool transferred = false;
+                if(cqe->res >= 0 && cqe->res == GetRequestLength(request))
+                {
+                    request->result = cqe->res;
+                    transferred = true;
+                }
+                else
+                {
+                    transferred = TransferFallback(request, (cqe->res > 0) ? cqe->res : 0);
+                }
+                if(!transferred)
+                    success = false;
+
+                ring->completed[i] = 1;
+                completed++;
+            }
+            __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+        }
+
+        if(ring->broken)
+        {
+            // Whatever the kernel didn't take is done without the ring.
+            for(int i = 0; i < roundCount; ++i)
+            {
+                if(!ring->completed[i] && TransferFallback(&requests[first+i], 0) == false)
+                    success = false;
+            }
+        }
+    }
+    return success;
+#else
+    assert(false);
+    return false;
+#endif
+}
+
+
+/** Forbidden Stuff **/
+
+IoBackend::IoBackend( const IoBackend& backend )
+{
+    assert(false);
+}
+
+IoBackend& IoBackend::operator = ( const IoBackend& backend )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
@@ -0,0 +1,123 @@
+#ifndef __VMAN_IO_BACKEND_H__
+#define __VMAN_IO_BACKEND_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <tinythread.h>
+
+
+namespace vman
+{
+
+/**
+ * A contiguous part of a vectored read or write.
+ */
+struct IoVector
+{
+    void* data;
+    size_t length;
+};
+
+/**
+ * Reads or writes a list of buffers at a file offset.
+ */
+struct IoRequest
+{
+    /**
+     * Descriptor returned by OpenFile.
+     */
+    int file;
+
+    uint64_t offset;
+
+    const IoVector* vectors;
+    int vectorCount;
+
+    bool write;
+
+    /**
+     * Bytes that have been transferred or `-1` on errors.
+     * Set by IoBackend::run.
+     */
+    int64_t result;
+};
+
+/**
+ * Executes file reads and writes.
+ *
+ * On Linux many requests are submitted to the kernel at once using io_uring,
+ * so their I/O overlaps and each request costs no extra system call.
+ * Where io_uring is not available (older kernels, other systems
+ * or when disabled at build time) each request is executed
+ * with `preadv`/`pwritev` instead.
+ *
+ * Each thread uses its own submission ring, which is kept for reuse.
+ *
+ * All methods are thread safe.
+ */
+class IoBackend
+{
+public:
+    enum
+    {
+        /**
+         * Requests that are in flight at once per ring.
+         * Larger batches are submitted in several rounds.
+         */
+        QUEUE_DEPTH = 64,
+
+        /**
+         * Idle rings beyond this amount are closed.
+         */
+        MAX_IDLE_RINGS = 32
+    };
+
+    /**
+     * @param useIoUring
+     * Whether io_uring may be used.
+     * If the kernel doesn't support it, the fallback is used anyway.
+     */
+    IoBackend( bool useIoUring );
+    ~IoBackend();
+
+    /**
+     * @return Whether requests are submitted using io_uring.
+     */
+    bool usesIoUring() const;
+
+    /**
+     * Executes all requests and waits until they are complete.
+     * Their order of execution is undefined, so don't
+     * pass requests that overlap each other.
+     * Short transfers are continued until an error or the end of file is reached.
+     * @return Whether all requests transferred all of their bytes.
+     */
+    bool run( IoRequest* requests, int count );
+
+private:
+    IoBackend( const IoBackend& backend );
+    IoBackend& operator = ( const IoBackend& backend );
+
+    struct Ring;
+
+    /**
+     * @return An idle or new ring or `NULL` if io_uring can't be used.
+     */
+    Ring* acquireRing();
+    void releaseRing( Ring* ring );
+
+    /**
+     * Submits the requests in rounds of up to `QUEUE_DEPTH`.
+     * Requests that fail in the kernel are retried with the fallback.
+     */
+    bool runRing( Ring* ring, IoRequest* requests, int count );
+
+    bool m_IoUringAvailable;
+    std::vector<Ring*> m_IdleRings;
+    tthread::mutex m_Mutex;
+};
+
+}
+
+#endif
@@ -20,7 +20,7 @@ JobEntry::JobEntry( int priority, JobType type, Chunk* chunk ) :
     m_Chunk(chunk)
 {
     assert(m_Chunk != NULL);
-    m_Chunk->addReference();
+    m_Chunk->addJobReference();
 }
 
 JobEntry::JobEntry( const JobEntry& e ) :
@@ -29,20 +29,20 @@ JobEntry::JobEntry( const JobEntry& e ) :
     m_Chunk(e.m_Chunk)
 {
     if(m_Chunk)
-        m_Chunk->addReference();
+        m_Chunk->addJobReference();
 }
 
 JobEntry& JobEntry::operator = ( const JobEntry& e )
 {
     if(m_Chunk)
-        m_Chunk->releaseReference();
+        m_Chunk->releaseJobReference();
 
     m_Priority = e.m_Priority;
     m_Type     = e.m_Type;
     m_Chunk    = e.m_Chunk;
 
     if(m_Chunk)
-        m_Chunk->addReference();
+        m_Chunk->addJobReference();
 
     return *this;
 }
@@ -51,7 +51,7 @@ JobEntry::~JobEntry()
 {
     if(m_Chunk)
     {
-        m_Chunk->releaseReference();
+        m_Chunk->releaseJobReference();
     }
 }
 
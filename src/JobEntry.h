@@ -23,13 +23,17 @@ enum JobType
     /**
      * A save job saves a chunks to the filesystem.
      */
-    SAVE_JOB
+    SAVE_JOB,
+
+    JOB_TYPE_COUNT
 };
 
 
 /**
  * Structure that contains information about a chunk job.
- * It will hold a reference of the chunk.
+ * It will hold a job reference of the chunk,
+ * so the chunk isn't unloaded while the job exists.
+ * @see Chunk::addJobReference
  */
 class JobEntry
 {
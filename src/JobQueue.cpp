@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <algorithm>
+#include "Chunk.h"
+#include "JobQueue.h"
+
+
+namespace vman
+{
+
+JobQueue::JobQueue( JobType type ) :
+    m_Type(type),
+    m_Heap(),
+    m_NextSequence(0)
+{
+    assert(type != INVALID_JOB);
+}
+
+JobQueue::~JobQueue()
+{
+    for(int i = 0; i < m_Heap.size(); ++i)
+    {
+        m_Heap[i].chunk->setJobQueuePosition(m_Type, -1);
+        m_Heap[i].chunk->releaseJobReference();
+    }
+}
+
+bool JobQueue::push( int priority, Chunk* chunk )
+{
+    assert(chunk != NULL);
+
+    Node node;
+    node.priority = priority;
+    node.chunk = chunk;
+    node.sequence = m_NextSequence++;
+
+    const int position = chunk->getJobQueuePosition(m_Type);
+    if(position >= 0)
+    {
+        // There is already a job for this chunk.
+        // Only a higher priority is worth changing it,
+        // since we don't need to run enqueued jobs twice.
+        assert(m_Heap[position].chunk == chunk);
+        if(priority <= m_Heap[position].priority)
+            return false;
+
+        m_Heap[position] = node;
+        siftUp(position);
+        return true;
+    }
+
+    chunk->addJobReference();
+    m_Heap.push_back(node);
+    setPosition(m_Heap.size()-1);
+    siftUp(m_Heap.size()-1);
+    return true;
+}
+
+JobEntry JobQueue::pop()
+{
+    if(m_Heap.empty())
+        return JobEntry::InvalidJob;
+
+    const Node& front = m_Heap.front();
+    const JobEntry job(front.priority, m_Type, front.chunk);
+    front.chunk->setJobQueuePosition(m_Type, -1);
+    front.chunk->releaseJobReference(); // The job has its own.
+
+    const int last = m_Heap.size()-1;
+    if(last > 0)
+    {
+        m_Heap[0] = m_Heap[last];
+        setPosition(0);
+    }
+    m_Heap.pop_back();
+
+    if(m_Heap.empty() == false)
+        siftDown(0);
+    return job;
+}
+
+bool JobQueue::contains( const Chunk* chunk ) const
+{
+    return chunk->getJobQueuePosition(m_Type) >= 0;
+}
+
+int JobQueue::getPriority( const Chunk* chunk ) const
+{
+    const int position = chunk->getJobQueuePosition(m_Type);
+    assert(position >= 0);
+    return m_Heap[position].priority;
+}
+
+bool JobQueue::empty() const
+{
+    return m_Heap.empty();
+}
+
+int JobQueue::getSize() const
+{
+    return m_Heap.size();
+}
+
+JobType JobQueue::getType() const
+{
+    return m_Type;
+}
+
+bool JobQueue::isBefore( int a, int b ) const
+{
+    const Node& nodeA = m_Heap[a];
+    const Node& nodeB = m_Heap[b];
+    if(nodeA.priority != nodeB.priority)
+        return nodeA.priority > nodeB.priority;
+    else
+        return nodeA.sequence < nodeB.sequence;
+}
+
+void JobQueue::siftUp( int position )
+{
+    while(position > 0)
+    {
+        const int parent = (position-1) / 2;
+        if(isBefore(position, parent) == false)
+            break;
+        swapNodes(position, parent);
+        position = parent;
+    }
+}
+
+void JobQueue::siftDown( int position )
+{
+    const int size = m_Heap.size();
+    while(true)
+    {
+        const int left  = position*2 + 1;
+        const int right = left + 1;
+
+        int first = position;
+        if(left < size && isBefore(left, first))
+            first = left;
+        if(right < size && isBefore(right, first))
+            first = right;
+
+        if(first == position)
+            break;
+        swapNodes(position, first);
+        position = first;
+    }
+}
+
+void JobQueue::swapNodes( int a, int b )
+{
+    std::swap(m_Heap[a], m_Heap[b]);
+    setPosition(a);
+    setPosition(b);
+}
+
+void JobQueue::setPosition( int position )
+{
+    m_Heap[position].chunk->setJobQueuePosition(m_Type, position);
+}
+
+
+/** Forbidden Stuff **/
+
+JobQueue::JobQueue( const JobQueue& queue ) :
+    m_Type(INVALID_JOB)
+{
+    assert(false);
+}
+
+JobQueue& JobQueue::operator = ( const JobQueue& queue )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
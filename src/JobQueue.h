@@ -0,0 +1,94 @@
+#ifndef __VMAN_JOB_QUEUE_H__
+#define __VMAN_JOB_QUEUE_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "JobEntry.h"
+
+
+namespace vman
+{
+
+class Chunk;
+
+/**
+ * Priority queue for the jobs of one type.
+ *
+ * It's a binary heap, whose chunks remember their position in it.
+ * So finding, merging and reprioritizing the job of a chunk
+ * doesn't need to search the queue.
+ * Jobs with equal priority are processed in the order they were added.
+ * Enqueued chunks hold a job reference, like a JobEntry would.
+ *
+ * Policy: Like the other classes the queue never locks by itself.
+ * The volume guards it with the job list mutex.
+ */
+class JobQueue
+{
+public:
+    JobQueue( JobType type );
+    ~JobQueue();
+
+    /**
+     * Adds a job for the chunk.
+     * If the chunk has already a job in this queue,
+     * it is moved to the back of the new priority
+     * in case that's higher and left alone otherwise.
+     * @return Whether the queue changed.
+     */
+    bool push( int priority, Chunk* chunk );
+
+    /**
+     * Removes the job with the highest priority and returns it.
+     * Returns JobEntry::InvalidJob if the queue is empty.
+     */
+    JobEntry pop();
+
+    /**
+     * @return Whether the chunk has a job in this queue.
+     */
+    bool contains( const Chunk* chunk ) const;
+
+    /**
+     * @return Priority of the chunks job.
+     */
+    int getPriority( const Chunk* chunk ) const;
+
+    bool empty() const;
+    int getSize() const;
+    JobType getType() const;
+
+private:
+    JobQueue( const JobQueue& queue );
+    JobQueue& operator = ( const JobQueue& queue );
+
+    struct Node
+    {
+        int priority;
+        Chunk* chunk;
+
+        /**
+         * Keeps jobs with equal priority in FIFO order.
+         */
+        uint64_t sequence;
+    };
+
+    /**
+     * @return Whether the node at `a` must be processed before the one at `b`.
+     */
+    bool isBefore( int a, int b ) const;
+
+    void siftUp( int position );
+    void siftDown( int position );
+    void swapNodes( int a, int b );
+    void setPosition( int position );
+
+    const JobType m_Type;
+    std::vector<Node> m_Heap;
+    uint64_t m_NextSequence;
+};
+
+}
+
+#endif
@@ -0,0 +1,529 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "Util.h"
+#include "Volume.h"
+#include "Journal.h"
+
+
+namespace vman
+{
+
+/*
+    Journal file format:
+
+    Header:
+        char[4] magic
+        uint32 version
+        uint32 edgeLength
+        uint32 layerCount
+        [
+            char[32] name
+            uint32 voxelSize
+            uint32 revision
+        ]
+
+    Followed by one block per flush:
+        uint32 recordBytes
+        uint32 checksum (FNV-1a of the records)
+        [
+            int32 chunkX
+            int32 chunkY
+            int32 chunkZ
+            uint32 layer
+            uint32 voxelIndex
+            uint32 voxelCount (missing in version 1, where it's always 1)
+            uint8[voxelSize*voxelCount] voxels (serialized)
+        ]
+*/
+
+struct JournalFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t edgeLength;
+    uint32_t layerCount;
+};
+
+struct JournalLayerInfo
+{
+    char name[VMAN_MAX_LAYER_NAME_LENGTH+1];
+    uint32_t voxelSize;
+    uint32_t revision;
+};
+
+struct JournalBlockHeader
+{
+    uint32_t recordBytes;
+    uint32_t checksum;
+};
+
+struct JournalRecordHeader
+{
+    int32_t chunkX;
+    int32_t chunkY;
+    int32_t chunkZ;
+    uint32_t layer;
+    uint32_t voxelIndex;
+    uint32_t voxelCount;
+};
+
+/**
+ * Version 1 records stored single voxels and lacked the voxel count.
+ */
+static const size_t SingleVoxelRecordHeaderSize = offsetof(JournalRecordHeader, voxelCount);
+
+static const char JournalMagic[4] = {'V','M','V','J'};
+static const int JournalVersion = 2;
+
+static uint32_t Checksum( const char* data, size_t length )
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; ++i)
+    {
+        hash ^= uint8_t(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+Journal::Journal( Volume* volume, const char* baseDir, vmanDurability durability ) :
+    m_Volume(volume),
+    m_BaseDir(baseDir),
+    m_Durability(durability),
+    m_File(NULL),
+    m_HasOldFile(false),
+    m_FileRecordBytes(0)
+{
+}
+
+Journal::~Journal()
+{
+    std::vector<ChunkId> checkpointChunks;
+    flush(&checkpointChunks);
+
+    // Files of journals, which haven't been opened, are left alone.
+    lock_guard fileGuard(m_FileMutex);
+    if(m_File == NULL)
+        return;
+    fclose(m_File);
+    m_File = NULL;
+
+    lock_guard guard(m_Mutex);
+
+    if(m_Chunks.empty() && m_OldChunks.empty())
+    {
+        remove(getOldFileName().c_str());
+        remove(getFileName().c_str());
+    }
+    else
+    {
+        m_Volume->log(VMAN_LOG_WARNING, "Keeping journal, since %d chunks haven't been saved.\n",
+            int(m_Chunks.size() + m_OldChunks.size())
+        );
+    }
+}
+
+std::string Journal::getFileName() const
+{
+    return m_BaseDir + DirSep + "voxels.journal";
+}
+
+std::string Journal::getOldFileName() const
+{
+    return getFileName() + ".old";
+}
+
+bool Journal::readStoredRecords( std::vector<Record>* recordsOut, std::vector<char>* voxelsOut )
+{
+    lock_guard fileGuard(m_FileMutex);
+
+    bool success = true;
+    const std::string fileNames[2] = { getOldFileName(), getFileName() };
+    for(int i = 0; i < 2; ++i)
+    {
+        if(GetFileType(fileNames[i].c_str()) != FILE_TYPE_REGULAR)
+            continue;
+        if(readFile(fileNames[i], recordsOut, voxelsOut) == false)
+            success = false;
+    }
+    return success;
+}
+
+bool Journal::readFile( const std::string& fileName, std::vector<Record>* recordsOut, std::vector<char>* voxelsOut )
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    if(f == NULL)
+    {
+        m_Volume->log(VMAN_LOG_ERROR, "Can't read journal %s.\n", fileName.c_str());
+        return false;
+    }
+
+    std::vector<char> data;
+    if(fseek(f, 0, SEEK_END) == 0)
+    {
+        const long length = ftell(f);
+        if(length > 0)
+        {
+            data.resize(length);
+            rewind(f);
+            if(fread(&data[0], data.size(), 1, f) != 1)
+                data.clear();
+        }
+    }
+    fclose(f);
+
+    // -- Read header --
+    // Journals are created with their header,
+    // so a missing one means that the journal has no records.
+    JournalFileHeader header;
+    if(data.size() < sizeof(header))
+        return true;
+    memcpy(&header, &data[0], sizeof(header));
+    const uint32_t version = LittleEndian(header.version);
+    if(memcmp(header.magic, JournalMagic, sizeof(JournalMagic)) != 0 ||
+       version < 1 || version > JournalVersion)
+    {
+        m_Volume->log(VMAN_LOG_ERROR, "Journal %s has an unknown format.\n", fileName.c_str());
+        return false;
+    }
+    if(LittleEndian(header.edgeLength) != m_Volume->getChunkEdgeLength())
+    {
+        m_Volume->log(VMAN_LOG_ERROR, "Journal %s uses a different chunk edge length.\n", fileName.c_str());
+        return false;
+    }
+
+    // -- Read layer list --
+    const uint32_t layerCount = LittleEndian(header.layerCount);
+    size_t offset = sizeof(header);
+    if(data.size() < offset + layerCount*sizeof(JournalLayerInfo))
+        return true;
+
+    std::vector<int> layerIndices(layerCount);
+    std::vector<uint32_t> voxelSizes(layerCount);
+    for(int i = 0; i < layerCount; ++i)
+    {
+        JournalLayerInfo layerInfo;
+        memcpy(&layerInfo, &data[offset], sizeof(layerInfo));
+        offset += sizeof(layerInfo);
+        layerInfo.name[VMAN_MAX_LAYER_NAME_LENGTH] = '\0';
+        voxelSizes[i] = LittleEndian(layerInfo.voxelSize);
+
+        layerIndices[i] = m_Volume->getLayerIndexByName(layerInfo.name);
+        if(layerIndices[i] == -1)
+        {
+            m_Volume->log(VMAN_LOG_INFO, "Ignoring journal layer '%s'.\n", layerInfo.name);
+            continue;
+        }
+
+        const vmanLayer* layer = m_Volume->getLayer(layerIndices[i]);
+        if(layer->voxelSize != voxelSizes[i] || layer->revision != LittleEndian(layerInfo.revision))
+        {
+            m_Volume->log(VMAN_LOG_ERROR, "Journal layer '%s' differs, ignoring it.\n", layerInfo.name);
+            layerIndices[i] = -1;
+        }
+    }
+
+    // -- Read blocks --
+    const int voxelsPerChunk = m_Volume->getVoxelsPerChunk();
+    while(offset + sizeof(JournalBlockHeader) <= data.size())
+    {
+        JournalBlockHeader blockHeader;
+        memcpy(&blockHeader, &data[offset], sizeof(blockHeader));
+        const size_t recordBytes = LittleEndian(blockHeader.recordBytes);
+        offset += sizeof(blockHeader);
+        if(recordBytes == 0 ||
+           offset + recordBytes > data.size() ||
+           Checksum(&data[offset], recordBytes) != LittleEndian(blockHeader.checksum))
+        {
+            m_Volume->log(VMAN_LOG_WARNING, "Journal %s ends with an incomplete block.\n", fileName.c_str());
+            break;
+        }
+        const char* records = &data[offset];
+        offset += recordBytes;
+
+        const size_t recordHeaderSize = (version == 1) ?
+            SingleVoxelRecordHeaderSize : sizeof(JournalRecordHeader);
+        size_t recordOffset = 0;
+        while(recordOffset < recordBytes)
+        {
+            JournalRecordHeader recordHeader;
+            recordHeader.voxelCount = LittleEndian( uint32_t(1) );
+            if(recordOffset + recordHeaderSize > recordBytes)
+                break;
+            memcpy(&recordHeader, &records[recordOffset], recordHeaderSize);
+            recordOffset += recordHeaderSize;
+
+            const uint32_t fileLayer = LittleEndian(recordHeader.layer);
+            const uint32_t voxelIndex = LittleEndian(recordHeader.voxelIndex);
+            const uint32_t voxelCount = LittleEndian(recordHeader.voxelCount);
+            if(fileLayer >= layerCount ||
+               voxelCount == 0 ||
+               voxelIndex >= voxelsPerChunk ||
+               voxelCount > voxelsPerChunk - voxelIndex ||
+               recordOffset + size_t(voxelSizes[fileLayer])*voxelCount > recordBytes)
+            {
+                m_Volume->log(VMAN_LOG_ERROR, "Journal %s contains a corrupt record.\n", fileName.c_str());
+                return false;
+            }
+            const char* voxels = &records[recordOffset];
+            recordOffset += voxelSizes[fileLayer]*voxelCount;
+
+            const int layerIndex = layerIndices[fileLayer];
+            if(layerIndex == -1)
+                continue;
+
+            Record record;
+            record.chunkId = Chunk::GenerateChunkId(
+                LittleEndian(recordHeader.chunkX),
+                LittleEndian(recordHeader.chunkY),
+                LittleEndian(recordHeader.chunkZ)
+            );
+            record.layer = layerIndex;
+            record.voxelIndex = voxelIndex;
+            record.voxelCount = voxelCount;
+            record.voxelOffset = voxelsOut->size();
+            recordsOut->push_back(record);
+
+            const vmanLayer* layer = m_Volume->getLayer(layerIndex);
+            voxelsOut->resize(voxelsOut->size() + layer->voxelSize*voxelCount);
+            char* destination = &(*voxelsOut)[record.voxelOffset];
+            if(layer->deserializeFn != NULL)
+                layer->deserializeFn(voxels, destination, voxelCount);
+            else
+                memcpy(destination, voxels, layer->voxelSize*voxelCount);
+        }
+    }
+    return true;
+}
+
+bool Journal::open()
+{
+    lock_guard fileGuard(m_FileMutex);
+    remove(getOldFileName().c_str());
+    m_HasOldFile = false;
+    return startFile();
+}
+
+void Journal::removeFiles()
+{
+    lock_guard fileGuard(m_FileMutex);
+    if(m_File != NULL)
+        fclose(m_File);
+    m_File = NULL;
+    m_HasOldFile = false;
+    remove(getOldFileName().c_str());
+    remove(getFileName().c_str());
+}
+
+bool Journal::startFile()
+{
+    if(m_File != NULL)
+        fclose(m_File);
+    m_FileRecordBytes = 0;
+
+    const std::string fileName = getFileName();
+    m_File = fopen(fileName.c_str(), "wb");
+    if(m_File == NULL)
+    {
+        m_Volume->log(VMAN_LOG_ERROR, "Can't create journal %s.\n", fileName.c_str());
+        return false;
+    }
+
+    bool success = true;
+
+    JournalFileHeader header;
+    memcpy(header.magic, JournalMagic, sizeof(JournalMagic));
+    header.version = LittleEndian( uint32_t(JournalVersion) );
+    header.edgeLength = LittleEndian( uint32_t(m_Volume->getChunkEdgeLength()) );
+    header.layerCount = LittleEndian( uint32_t(m_Volume->getLayerCount()) );
+    if(fwrite(&header, sizeof(header), 1, m_File) != 1)
+        success = false;
+
+    for(int i = 0; success && i < m_Volume->getLayerCount(); ++i)
+    {
+        const vmanLayer* layer = m_Volume->getLayer(i);
+        JournalLayerInfo layerInfo;
+        memset(&layerInfo, 0, sizeof(layerInfo));
+        strncpy(layerInfo.name, layer->name, VMAN_MAX_LAYER_NAME_LENGTH);
+        layerInfo.voxelSize = LittleEndian( uint32_t(layer->voxelSize) );
+        layerInfo.revision = LittleEndian( uint32_t(layer->revision) );
+        if(fwrite(&layerInfo, sizeof(layerInfo), 1, m_File) != 1)
+            success = false;
+    }
+
+    if(fflush(m_File) != 0)
+        success = false;
+
+    // The new directory entry must survive, before records are synced into it.
+    if(success && m_Durability != VMAN_DURABILITY_NONE)
+        success = SyncDirectory(m_BaseDir.c_str());
+
+    if(!success)
+        m_Volume->log(VMAN_LOG_ERROR, "Write error in journal %s.\n", fileName.c_str());
+    return success;
+}
+
+bool Journal::append( ChunkId chunkId, int layerIndex, int voxelIndex, int voxelCount, const char* voxels )
+{
+    const vmanLayer* layer = m_Volume->getLayer(layerIndex);
+    assert(layer != NULL);
+
+    int chunkX, chunkY, chunkZ;
+    Chunk::UnpackChunkId(chunkId, &chunkX, &chunkY, &chunkZ);
+
+    JournalRecordHeader header;
+    header.chunkX = LittleEndian( int32_t(chunkX) );
+    header.chunkY = LittleEndian( int32_t(chunkY) );
+    header.chunkZ = LittleEndian( int32_t(chunkZ) );
+    header.layer = LittleEndian( uint32_t(layerIndex) );
+    header.voxelIndex = LittleEndian( uint32_t(voxelIndex) );
+    header.voxelCount = LittleEndian( uint32_t(voxelCount) );
+
+    lock_guard guard(m_Mutex);
+    const bool wasEmpty = m_Buffer.empty();
+
+    const size_t offset = m_Buffer.size();
+    m_Buffer.resize(offset + sizeof(header) + layer->voxelSize*voxelCount);
+    memcpy(&m_Buffer[offset], &header, sizeof(header));
+
+    char* destination = &m_Buffer[offset + sizeof(header)];
+    if(layer->serializeFn != NULL)
+        layer->serializeFn(voxels, destination, voxelCount);
+    else
+        memcpy(destination, voxels, layer->voxelSize*voxelCount);
+
+    m_Chunks.insert(chunkId);
+    return wasEmpty;
+}
+
+bool Journal::flush( std::vector<ChunkId>* checkpointChunksOut )
+{
+    lock_guard fileGuard(m_FileMutex);
+    if(m_File == NULL)
+        return false;
+
+    bool truncate = false;
+    bool removeOldFile = false;
+    bool checkpoint = false;
+    m_WriteBuffer.clear();
+    {
+        lock_guard guard(m_Mutex);
+
+        if(m_Chunks.empty())
+        {
+            // All records are part of saved chunks already.
+            m_Buffer.clear();
+            truncate = m_FileRecordBytes > 0;
+        }
+        else
+        {
+            m_WriteBuffer.swap(m_Buffer);
+        }
+
+        removeOldFile = m_HasOldFile && m_OldChunks.empty();
+
+        // The previous checkpoint must be complete, before the next one starts.
+        if(!truncate &&
+           checkpointChunksOut != NULL &&
+           m_FileRecordBytes + m_WriteBuffer.size() >= CHECKPOINT_BYTES &&
+           (m_HasOldFile == false || removeOldFile))
+        {
+            // Records appended from now on belong to the next journal.
+            checkpoint = true;
+            m_OldChunks.swap(m_Chunks);
+            checkpointChunksOut->insert(checkpointChunksOut->end(), m_OldChunks.begin(), m_OldChunks.end());
+        }
+    }
+
+    bool success = true;
+
+    if(removeOldFile)
+    {
+        remove(getOldFileName().c_str());
+        m_HasOldFile = false;
+    }
+
+    if(truncate)
+    {
+        success = startFile();
+    }
+    else if(m_WriteBuffer.empty() == false)
+    {
+        JournalBlockHeader header;
+        header.recordBytes = LittleEndian( uint32_t(m_WriteBuffer.size()) );
+        header.checksum = LittleEndian( Checksum(&m_WriteBuffer[0], m_WriteBuffer.size()) );
+
+        if(fwrite(&header, sizeof(header), 1, m_File) != 1 ||
+           fwrite(&m_WriteBuffer[0], m_WriteBuffer.size(), 1, m_File) != 1 ||
+           fflush(m_File) != 0)
+        {
+            m_Volume->log(VMAN_LOG_ERROR, "Write error in journal %s.\n", getFileName().c_str());
+            success = false;
+        }
+        m_FileRecordBytes += m_WriteBuffer.size();
+        m_Volume->incStatistic(STATISTIC_JOURNAL_BYTES, sizeof(header) + m_WriteBuffer.size());
+
+        if(success && m_Durability != VMAN_DURABILITY_NONE)
+        {
+            m_Volume->incStatistic(STATISTIC_CHUNK_SYNC_OPS);
+            success = SyncFile(fileno(m_File));
+        }
+    }
+
+    if(checkpoint)
+    {
+        m_Volume->log(VMAN_LOG_DEBUG, "Journal checkpoint: Saving %d chunks ..\n",
+            int(checkpointChunksOut->size())
+        );
+
+        fclose(m_File);
+        m_File = NULL;
+        if(RenameFile(getFileName().c_str(), getOldFileName().c_str()))
+        {
+            m_HasOldFile = true;
+            success = startFile() && success;
+        }
+        else
+        {
+            // Keep using the current journal.
+            m_Volume->log(VMAN_LOG_ERROR, "Can't rename journal %s.\n", getFileName().c_str());
+            m_File = fopen(getFileName().c_str(), "ab");
+            lock_guard guard(m_Mutex);
+            m_Chunks.insert(m_OldChunks.begin(), m_OldChunks.end());
+            m_OldChunks.clear();
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool Journal::chunkSaved( ChunkId chunkId )
+{
+    lock_guard guard(m_Mutex);
+    const bool wasCurrent = m_Chunks.erase(chunkId) > 0;
+    const bool wasOld = m_OldChunks.erase(chunkId) > 0;
+    return (wasCurrent && m_Chunks.empty()) ||
+           (wasOld && m_OldChunks.empty());
+}
+
+
+/** Forbidden Stuff **/
+
+Journal::Journal( const Journal& journal ) :
+    m_Durability(VMAN_DURABILITY_NONE)
+{
+    assert(false);
+}
+
+Journal& Journal::operator = ( const Journal& journal )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
@@ -0,0 +1,191 @@
+#ifndef __VMAN_JOURNAL_H__
+#define __VMAN_JOURNAL_H__
+
+#include <stdio.h>
+#include <vector>
+#include <set>
+#include <string>
+#include <tinythread.h>
+
+#include "vman.h"
+#include "Chunk.h"
+
+
+namespace vman
+{
+
+class Volume;
+
+/**
+ * Append-only log of voxel writes. (`baseDir/voxels.journal`)
+ *
+ * Writing a few voxels only appends a few bytes to the journal,
+ * instead of rewriting all layers of the chunk.
+ * Chunks are rewritten at checkpoints or before they're unloaded.
+ * Records are replayed by the volume, if it wasn't closed properly.
+ *
+ * Once the journal exceeds `CHECKPOINT_BYTES`, it's moved to
+ * `baseDir/voxels.journal.old` and a new one is started.
+ * The old journal is deleted as soon as all of its chunks have been saved.
+ *
+ * All methods are thread safe.
+ */
+class Journal
+{
+public:
+    enum
+    {
+        /**
+         * Record bytes after which a checkpoint is started.
+         */
+        CHECKPOINT_BYTES = 4*1024*1024
+    };
+
+    /**
+     * A journaled write of consecutive voxels.
+     */
+    struct Record
+    {
+        ChunkId chunkId;
+        int layer;
+        int voxelIndex;
+        int voxelCount;
+
+        /**
+         * Offset of the first deserialized voxel in the voxel buffer.
+         */
+        int voxelOffset;
+    };
+
+    /**
+     * Doesn't touch the disk until open() or readStoredRecords() is called.
+     * @param durability
+     * Journals are synced on each flush, unless this is VMAN_DURABILITY_NONE.
+     */
+    Journal( Volume* volume, const char* baseDir, vmanDurability durability );
+
+    /**
+     * Flushes the journal.
+     * If it has been opened, its files are deleted,
+     * when all journaled chunks have been saved.
+     */
+    ~Journal();
+
+    /**
+     * Reads the records a previous volume left behind.
+     * Older records come first.
+     * Records of layers that changed or don't exist anymore are skipped.
+     * Reading stops at the first incomplete block,
+     * since it was written while the system crashed.
+     * @param voxelsOut Receives the voxels of all records.
+     * @return `false` if the journal files can't be read.
+     */
+    bool readStoredRecords( std::vector<Record>* recordsOut, std::vector<char>* voxelsOut );
+
+    /**
+     * Replaces the stored journal files with an empty journal.
+     * @return `false` if the journal can't be created.
+     */
+    bool open();
+
+    /**
+     * Deletes the stored journal files.
+     */
+    void removeFiles();
+
+    /**
+     * Records that consecutive voxels have been written.
+     * The record is buffered until flush() is called.
+     * Needs the chunks mutex, so the record is ordered with its saves.
+     * @param voxels Points to `voxelCount` voxels of the layers voxel size.
+     * @return Whether the buffer was empty before.
+     */
+    bool append( ChunkId chunkId, int layer, int voxelIndex, int voxelCount, const char* voxels );
+
+    /**
+     * Writes the buffered records as a single block.
+     * Starts a checkpoint, if the journal grew too large.
+     * @param checkpointChunksOut
+     * Receives the chunks that need to be saved for the checkpoint.
+     * May be `NULL`, then no checkpoint is started.
+     * @return `false` on I/O errors.
+     */
+    bool flush( std::vector<ChunkId>* checkpointChunksOut );
+
+    /**
+     * Must be called, after a chunk has been saved completely.
+     * Its records must have been flushed before the save started,
+     * since replaying them is only harmless if the newest ones are there too.
+     * Needs the chunks mutex, so no records are appended in between.
+     * @return Whether the next flush could delete journaled data.
+     */
+    bool chunkSaved( ChunkId chunkId );
+
+private:
+    Journal( const Journal& journal );
+    Journal& operator = ( const Journal& journal );
+
+    std::string getFileName() const;
+    std::string getOldFileName() const;
+
+    /**
+     * Creates a journal file, that only contains the header.
+     * Needs the file mutex.
+     */
+    bool startFile();
+
+    /**
+     * Appends the records of a journal file.
+     * Needs the file mutex.
+     */
+    bool readFile( const std::string& fileName, std::vector<Record>* recordsOut, std::vector<char>* voxelsOut );
+
+    Volume* m_Volume;
+    const std::string m_BaseDir;
+    const vmanDurability m_Durability;
+
+    /**
+     * Serialized records, which haven't been written yet.
+     */
+    std::vector<char> m_Buffer;
+
+    /**
+     * Chunks with records in the current journal,
+     * which haven't been saved since.
+     */
+    std::set<ChunkId> m_Chunks;
+
+    /**
+     * Like m_Chunks, but for the old journal.
+     */
+    std::set<ChunkId> m_OldChunks;
+
+    /**
+     * Guards buffer and chunk sets.
+     */
+    tthread::mutex m_Mutex;
+
+    // --- Guarded by the file mutex ---
+
+    FILE* m_File;
+    bool m_HasOldFile;
+
+    /**
+     * Record bytes in the current journal file.
+     */
+    size_t m_FileRecordBytes;
+
+    /**
+     * Buffer that is being written.
+     */
+    std::vector<char> m_WriteBuffer;
+
+    /**
+     * Is locked before m_Mutex.
+     */
+    tthread::mutex m_FileMutex;
+};
+
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <new>
+#include "Util.h"
+#include "Volume.h"
+#include "LayerPool.h"
+
+
+namespace vman
+{
+
+static int AlignBlockSize( int blockSize )
+{
+    const int alignment = LayerPool::BLOCK_ALIGNMENT;
+    return ((blockSize + alignment - 1) / alignment) * alignment;
+}
+
+LayerPool::LayerPool( Volume* volume, int blockSize ) :
+    m_Volume(volume),
+    m_BlockSize(AlignBlockSize(blockSize)),
+    m_BlocksPerArena(AlignBlockSize(blockSize) < ARENA_SIZE ? ARENA_SIZE / AlignBlockSize(blockSize) : 1),
+    m_Arenas(),
+    m_FreeBlocks(NULL),
+    m_NextBlock(NULL),
+    m_RemainingBlocks(0),
+    m_UsedBlocks(0)
+{
+    assert(blockSize > 0);
+}
+
+LayerPool::~LayerPool()
+{
+    assert(m_UsedBlocks == 0);
+
+    for(int i = 0; i < m_Arenas.size(); ++i)
+    {
+        FreePages(m_Arenas[i].address, m_Arenas[i].length);
+        m_Volume->decStatistic(STATISTIC_LAYER_POOL_RESERVED_BYTES, m_Arenas[i].length);
+    }
+}
+
+int LayerPool::getBlockSize() const
+{
+    return m_BlockSize;
+}
+
+int LayerPool::getUsedBlockCount() const
+{
+    lock_guard guard(m_Mutex);
+    return m_UsedBlocks;
+}
+
+int LayerPool::getArenaCount() const
+{
+    lock_guard guard(m_Mutex);
+    return m_Arenas.size();
+}
+
+void LayerPool::addArena()
+{
+    Arena arena;
+    arena.length = size_t(m_BlockSize)*m_BlocksPerArena;
+    arena.address = (char*)AllocatePages(arena.length);
+    if(arena.address == NULL)
+    {
+        m_Volume->log(VMAN_LOG_ERROR, "Can't allocate %u bytes for layer arena.\n", unsigned(arena.length));
+        throw std::bad_alloc();
+    }
+    m_Arenas.push_back(arena);
+
+    m_NextBlock = arena.address;
+    m_RemainingBlocks = m_BlocksPerArena;
+
+    m_Volume->incStatistic(STATISTIC_LAYER_POOL_RESERVED_BYTES, arena.length);
+}
+
+char* LayerPool::allocate()
+{
+    lock_guard guard(m_Mutex);
+
+    char* block = NULL;
+    if(m_FreeBlocks != NULL)
+    {
+        block = reinterpret_cast<char*>(m_FreeBlocks);
+        m_FreeBlocks = m_FreeBlocks->next;
+    }
+    else
+    {
+        if(m_RemainingBlocks == 0)
+            addArena();
+        block = m_NextBlock;
+        m_NextBlock += m_BlockSize;
+        m_RemainingBlocks--;
+    }
+
+    m_UsedBlocks++;
+    m_Volume->incStatistic(STATISTIC_LAYER_POOL_USED_BYTES, m_BlockSize);
+    return block;
+}
+
+void LayerPool::release( char* block )
+{
+    assert(block != NULL);
+
+    lock_guard guard(m_Mutex);
+    assert(m_UsedBlocks > 0);
+
+    FreeBlock* freeBlock = reinterpret_cast<FreeBlock*>(block);
+    freeBlock->next = m_FreeBlocks;
+    m_FreeBlocks = freeBlock;
+
+    m_UsedBlocks--;
+    m_Volume->decStatistic(STATISTIC_LAYER_POOL_USED_BYTES, m_BlockSize);
+}
+
+
+/** Forbidden Stuff **/
+
+LayerPool::LayerPool( const LayerPool& pool ) :
+    m_BlockSize(0),
+    m_BlocksPerArena(0)
+{
+    assert(false);
+}
+
+LayerPool& LayerPool::operator = ( const LayerPool& pool )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
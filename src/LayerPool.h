@@ -0,0 +1,123 @@
+#ifndef __VMAN_LAYER_POOL_H__
+#define __VMAN_LAYER_POOL_H__
+
+#include <vector>
+#include <tinythread.h>
+
+
+namespace vman
+{
+
+class Volume;
+
+/**
+ * Hands out fixed size blocks for uncompressed chunk layers.
+ *
+ * Blocks are carved from large arenas, which are requested directly
+ * from the system and are backed by huge pages where possible.
+ * Released blocks are kept in a free list and are reused
+ * by the next allocation, so loading and unloading chunks
+ * doesn't fragment the heap.
+ * Arenas are only returned to the system when the pool is destroyed.
+ *
+ * All methods are thread safe.
+ */
+class LayerPool
+{
+public:
+    enum
+    {
+        /**
+         * Bytes allocated at once.
+         * Arenas are larger, if a single block doesn't fit.
+         */
+        ARENA_SIZE = 2*1024*1024,
+
+        /**
+         * Blocks sizes are rounded up to multiples of this.
+         */
+        BLOCK_ALIGNMENT = 16
+    };
+
+    /**
+     * @param blockSize Bytes needed by a single layer.
+     */
+    LayerPool( Volume* volume, int blockSize );
+
+    /**
+     * Frees all arenas.
+     * All blocks must have been released before.
+     */
+    ~LayerPool();
+
+    /**
+     * @return Bytes available in each block.
+     */
+    int getBlockSize() const;
+
+    /**
+     * @return Amount of blocks, which haven't been released yet.
+     */
+    int getUsedBlockCount() const;
+
+    /**
+     * @return Amount of arenas allocated so far.
+     */
+    int getArenaCount() const;
+
+    /**
+     * The contents of the returned block are undefined.
+     */
+    char* allocate();
+
+    /**
+     * Gives a block back to the pool.
+     */
+    void release( char* block );
+
+private:
+    LayerPool( const LayerPool& pool );
+    LayerPool& operator = ( const LayerPool& pool );
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct Arena
+    {
+        char* address;
+        size_t length;
+    };
+
+    /**
+     * Allocates a new arena, whose blocks are used by the next allocations.
+     */
+    void addArena();
+
+    Volume* m_Volume;
+    const int m_BlockSize;
+    const int m_BlocksPerArena;
+
+    std::vector<Arena> m_Arenas;
+
+    /**
+     * Blocks that were released and can be reused.
+     */
+    FreeBlock* m_FreeBlocks;
+
+    /**
+     * Next block of the latest arena, which hasn't been used yet.
+     * Arenas are used front to back, so untouched pages aren't loaded.
+     */
+    char* m_NextBlock;
+    int m_RemainingBlocks;
+
+    int m_UsedBlocks;
+
+    mutable tthread::mutex m_Mutex;
+};
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+#include <assert.h>
+#include "Volume.h"
+#include "LayerVersion.h"
+
+
+namespace vman
+{
+
+LayerVersion::LayerVersion( Volume* volume, int layerIndex, char* voxels ) :
+    m_Volume(volume),
+    m_LayerIndex(layerIndex),
+    m_Voxels(voxels),
+    m_References(1)
+{
+    assert(voxels != NULL);
+}
+
+LayerVersion::~LayerVersion()
+{
+    assert(m_References == 0);
+    if(m_Voxels == NULL)
+        return; // Reclaimed.
+
+    LayerPool* pool = m_Volume->getLayerPool(m_LayerIndex);
+    pool->release(m_Voxels);
+    m_Volume->decResidentBytes(pool->getBlockSize());
+}
+
+const char* LayerVersion::getVoxels() const
+{
+    return m_Voxels;
+}
+
+void LayerVersion::addReference()
+{
+    m_References.fetch_add(1);
+}
+
+void LayerVersion::releaseReference()
+{
+    // fetch_sub returns the previous value.
+    if(m_References.fetch_sub(1) == 1)
+        delete this;
+}
+
+bool LayerVersion::isShared() const
+{
+    return m_References > 1;
+}
+
+char* LayerVersion::reclaimVoxels()
+{
+    assert(m_References == 1);
+    char* voxels = m_Voxels;
+    m_Voxels = NULL;
+    releaseReference();
+    return voxels;
+}
+
+
+
+/** Forbidden Stuff **/
+
+LayerVersion::LayerVersion( const LayerVersion& version ) :
+    m_LayerIndex(0)
+{
+    assert(false);
+}
+
+LayerVersion& LayerVersion::operator = ( const LayerVersion& version )
+{
+    assert(false);
+    return *this;
+}
+
+
+
+}
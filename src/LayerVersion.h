@@ -0,0 +1,70 @@
+#ifndef __VMAN_LAYER_VERSION_H__
+#define __VMAN_LAYER_VERSION_H__
+
+#include <tinythread.h>
+
+
+namespace vman
+{
+
+class Volume;
+
+/**
+ * Uncompressed voxels of a chunk layer, which are shared
+ * by the chunk and the snapshots that pinned them.
+ *
+ * The voxels are immutable:
+ * Before the chunk writes the layer, it makes its own copy
+ * and drops its reference.
+ * The voxels are given back to the layer pool,
+ * when the last reference is released.
+ *
+ * All methods are thread safe.
+ */
+class LayerVersion
+{
+public:
+    /**
+     * Takes ownership of the voxels, which come from the layer pool.
+     * The creator holds the first reference.
+     */
+    LayerVersion( Volume* volume, int layerIndex, char* voxels );
+
+    const char* getVoxels() const;
+
+    void addReference();
+
+    /**
+     * Deletes the version, once no one references it anymore.
+     */
+    void releaseReference();
+
+    /**
+     * @return Whether someone besides the caller references the version.
+     */
+    bool isShared() const;
+
+    /**
+     * Deletes the version, but gives its voxels back to the caller.
+     * Only the last reference may do that.
+     */
+    char* reclaimVoxels();
+
+private:
+    LayerVersion( const LayerVersion& version );
+    LayerVersion& operator = ( const LayerVersion& version );
+
+    /**
+     * Use releaseReference instead.
+     */
+    ~LayerVersion();
+
+    Volume* m_Volume;
+    const int m_LayerIndex;
+    char* m_Voxels;
+    tthread::atomic_int m_References;
+};
+
+}
+
+#endif
@@ -0,0 +1,355 @@
+#include <assert.h>
+#include <algorithm>
+#include "Util.h"
+#include "Volume.h"
+#include "LockManager.h"
+
+
+namespace vman
+{
+
+static bool CompareChunkIds( const Chunk* a, const Chunk* b )
+{
+    return a->getId() < b->getId();
+}
+
+LockManager::LockManager( Volume* volume, const ChunkTable* chunkTable ) :
+    m_Volume(volume),
+    m_ChunkTable(chunkTable)
+{
+    // Stripes are tracked as bits of a uint64_t.
+    assert(ChunkTable::STRIPE_COUNT <= 64);
+}
+
+LockManager::~LockManager()
+{
+}
+
+void LockManager::SortChunks( std::vector<Chunk*>* chunks )
+{
+    std::sort(chunks->begin(), chunks->end(), CompareChunkIds);
+}
+
+void LockManager::lock( Chunk* const* chunks, int count, bool exclusive )
+{
+    lockFor(chunks, count, exclusive, -1);
+}
+
+bool LockManager::lockFor( Chunk* const* chunks, int count, bool exclusive, int milliseconds )
+{
+    const uint64_t startTime = GetMonotonicMilliseconds();
+
+    LockRequest request;
+    request.chunks = chunks;
+    request.count = count;
+    request.exclusive = exclusive;
+    request.stripes = getStripes(chunks, count);
+    request.woken = false;
+
+    bool waited = false;
+    lockStripes(request.stripes);
+    if(isGrantable(&request) == false)
+    {
+        waited = true;
+        enqueue(&request);
+        while(isGrantable(&request) == false)
+        {
+            // Releasers set the flag while holding a stripe of the request,
+            // so the wakeup can't get lost after unlocking them.
+            unlockStripes(request.stripes);
+            bool timedOut = false;
+            {
+                lock_guard guard(request.mutex);
+                while(request.woken == false && timedOut == false)
+                {
+                    const int remaining = RemainingMilliseconds(startTime, milliseconds);
+                    if(remaining < 0)
+                        request.condition.wait(request.mutex);
+                    else if(remaining > 0)
+                        request.condition.wait_for(request.mutex, tthread::chrono::milliseconds(remaining));
+                    else
+                        timedOut = true;
+                }
+                request.woken = false;
+            }
+            lockStripes(request.stripes);
+
+            if(timedOut && isGrantable(&request) == false)
+            {
+                // Requests behind this one may be grantable now.
+                dequeue(&request);
+                unlockStripes(request.stripes);
+                return false;
+            }
+        }
+        // Readers behind this one may be grantable now.
+        dequeue(&request);
+    }
+    grant(&request);
+    unlockStripes(request.stripes);
+
+    // Otherwise a chunk could be locked before its load job,
+    // which would then replace what has been written meanwhile.
+    // No mutex is held while waiting, since the workers may need them.
+    // Chunks are loaded only once, so they stay loaded afterwards.
+    for(int i = 0; i < count; ++i)
+    {
+        const int remaining = RemainingMilliseconds(startTime, milliseconds);
+        if(chunks[i]->waitWhileState(VMAN_CHUNK_LOADING, remaining) == false)
+        {
+            release(chunks, count, exclusive);
+            return false;
+        }
+    }
+
+    // Workers hold up to a batch of chunks (see LOAD_BATCH_SIZE and SAVE_BATCH_SIZE),
+    // but only block on the first one and take all others with try_lock.
+    // While holding them they only wait for the disk, never for another chunk or a stripe,
+    // and selection callbacks are run after the batch has been released.
+    // So this may block for a moment, but can't deadlock.
+    for(int i = 0; i < count; ++i)
+    {
+        SharedMutex* mutex = chunks[i]->getMutex();
+        const int remaining = RemainingMilliseconds(startTime, milliseconds);
+        bool locked;
+        if(remaining < 0)
+        {
+            if(exclusive)
+                mutex->lock();
+            else
+                mutex->lock_shared();
+            locked = true;
+        }
+        else
+        {
+            locked = exclusive ? mutex->try_lock_for(remaining) : mutex->try_lock_shared_for(remaining);
+        }
+
+        if(locked == false)
+        {
+            for(--i; i >= 0; --i)
+            {
+                if(exclusive)
+                    chunks[i]->getMutex()->unlock();
+                else
+                    chunks[i]->getMutex()->unlock_shared();
+            }
+            release(chunks, count, exclusive);
+            return false;
+        }
+    }
+
+    if(exclusive)
+    {
+        for(int i = 0; i < count; ++i)
+            chunks[i]->getMutex()->beginModification();
+    }
+
+    if(waited)
+    {
+        const int duration = int(GetMonotonicMilliseconds() - startTime);
+        m_Volume->incStatistic(STATISTIC_LOCK_WAITS);
+        m_Volume->incStatistic(STATISTIC_LOCK_WAIT_MILLISECONDS, duration);
+        m_Volume->maxStatistic(STATISTIC_MAX_LOCK_WAIT_MILLISECONDS, duration);
+    }
+    return true;
+}
+
+bool LockManager::tryLock( Chunk* const* chunks, int count, bool exclusive )
+{
+    for(int i = 0; i < count; ++i)
+        if(chunks[i]->getState() == VMAN_CHUNK_LOADING)
+            return false;
+
+    LockRequest request;
+    request.chunks = chunks;
+    request.count = count;
+    request.exclusive = exclusive;
+    request.stripes = getStripes(chunks, count);
+    request.woken = false;
+
+    lockStripes(request.stripes);
+    const bool grantable = isGrantable(&request);
+    if(grantable)
+        grant(&request);
+    unlockStripes(request.stripes);
+    if(grantable == false)
+        return false;
+
+    for(int i = 0; i < count; ++i)
+    {
+        SharedMutex* mutex = chunks[i]->getMutex();
+        if(exclusive ? mutex->try_lock() : mutex->try_lock_shared())
+            continue;
+
+        // A job uses the chunk.
+        for(--i; i >= 0; --i)
+        {
+            if(exclusive)
+                chunks[i]->getMutex()->unlock();
+            else
+                chunks[i]->getMutex()->unlock_shared();
+        }
+        release(chunks, count, exclusive);
+        return false;
+    }
+
+    if(exclusive)
+    {
+        for(int i = 0; i < count; ++i)
+            chunks[i]->getMutex()->beginModification();
+    }
+    return true;
+}
+
+void LockManager::unlock( Chunk* const* chunks, int count, bool exclusive )
+{
+    if(exclusive)
+    {
+        for(int i = 0; i < count; ++i)
+            chunks[i]->getMutex()->endModification();
+    }
+
+    for(int i = 0; i < count; ++i)
+    {
+        if(exclusive)
+            chunks[i]->getMutex()->unlock();
+        else
+            chunks[i]->getMutex()->unlock_shared();
+    }
+    release(chunks, count, exclusive);
+}
+
+uint64_t LockManager::getStripes( Chunk* const* chunks, int count ) const
+{
+    uint64_t stripes = 0;
+    for(int i = 0; i < count; ++i)
+    {
+        assert(i == 0 || CompareChunkIds(chunks[i-1], chunks[i]));
+        stripes |= uint64_t(1) << m_ChunkTable->getStripe(chunks[i]->getId());
+    }
+    return stripes;
+}
+
+void LockManager::lockStripes( uint64_t stripes )
+{
+    for(int i = 0; i < ChunkTable::STRIPE_COUNT; ++i)
+        if(stripes & (uint64_t(1) << i))
+            m_StripeMutexes[i].lock();
+}
+
+void LockManager::unlockStripes( uint64_t stripes )
+{
+    for(int i = 0; i < ChunkTable::STRIPE_COUNT; ++i)
+        if(stripes & (uint64_t(1) << i))
+            m_StripeMutexes[i].unlock();
+}
+
+bool LockManager::isGrantable( const LockRequest* request ) const
+{
+    for(int i = 0; i < request->count; ++i)
+    {
+        const Chunk::LockState* state = request->chunks[i]->getLockState();
+
+        if(state->writer)
+            return false;
+        if(request->exclusive && state->readers > 0)
+            return false;
+
+        std::list<LockRequest*>::const_iterator waiter = state->waiters.begin();
+        for(; waiter != state->waiters.end() && *waiter != request; ++waiter)
+            if(request->exclusive || (*waiter)->exclusive)
+                return false;
+    }
+    return true;
+}
+
+void LockManager::enqueue( LockRequest* request )
+{
+    for(int i = 0; i < request->count; ++i)
+        request->chunks[i]->getLockState()->waiters.push_back(request);
+}
+
+void LockManager::dequeue( LockRequest* request )
+{
+    for(int i = 0; i < request->count; ++i)
+        request->chunks[i]->getLockState()->waiters.remove(request);
+    wakeWaiters(request->chunks, request->count);
+}
+
+void LockManager::grant( const LockRequest* request )
+{
+    for(int i = 0; i < request->count; ++i)
+    {
+        Chunk::LockState* state = request->chunks[i]->getLockState();
+        if(request->exclusive)
+            state->writer = true;
+        else
+            state->readers++;
+    }
+}
+
+void LockManager::release( Chunk* const* chunks, int count, bool exclusive )
+{
+    const uint64_t stripes = getStripes(chunks, count);
+    lockStripes(stripes);
+    for(int i = 0; i < count; ++i)
+    {
+        Chunk::LockState* state = chunks[i]->getLockState();
+        if(exclusive)
+        {
+            assert(state->writer);
+            state->writer = false;
+        }
+        else
+        {
+            assert(state->readers > 0);
+            state->readers--;
+        }
+    }
+    wakeWaiters(chunks, count);
+    unlockStripes(stripes);
+}
+
+void LockManager::wakeWaiters( Chunk* const* chunks, int count )
+{
+    for(int i = 0; i < count; ++i)
+    {
+        const std::list<LockRequest*>& waiters = chunks[i]->getLockState()->waiters;
+        std::list<LockRequest*>::const_iterator waiter = waiters.begin();
+        for(; waiter != waiters.end(); ++waiter)
+        {
+            // The request can't leave the queue meanwhile,
+            // since it needs this stripe to do so.
+            LockRequest* request = *waiter;
+            {
+                lock_guard guard(request->mutex);
+                request->woken = true;
+            }
+            request->condition.notify_one();
+
+            // Requests behind an exclusive one can't be granted before it.
+            if(request->exclusive)
+                break;
+        }
+    }
+}
+
+
+
+/** Forbidden Stuff **/
+
+LockManager::LockManager( const LockManager& manager )
+{
+    assert(false);
+}
+
+LockManager& LockManager::operator = ( const LockManager& manager )
+{
+    assert(false);
+    return *this;
+}
+
+
+
+}
@@ -0,0 +1,164 @@
+#ifndef __VMAN_LOCK_MANAGER_H__
+#define __VMAN_LOCK_MANAGER_H__
+
+#include <vector>
+#include <list>
+#include <tinythread.h>
+
+#include "Chunk.h"
+#include "ChunkTable.h"
+
+
+namespace vman
+{
+
+class Volume;
+
+/**
+ * A pending call of LockManager::lockFor().
+ * Lives on the stack of the caller.
+ */
+struct LockRequest
+{
+    /**
+     * Sorted by ChunkId.
+     */
+    Chunk* const* chunks;
+    int count;
+    bool exclusive;
+
+    /**
+     * One bit for each stripe the chunks belong to.
+     */
+    uint64_t stripes;
+
+    /**
+     * Set when the request may have become grantable,
+     * so wakeups between unlocking the stripes and waiting aren't lost.
+     * Uses the mutex below.
+     */
+    bool woken;
+    tthread::mutex mutex;
+    tthread::condition_variable condition;
+};
+
+/**
+ * Grants access objects their chunks.
+ *
+ * A lock request covers all chunks of a selection and is granted as a whole,
+ * so no one holds some chunks of a selection while waiting for the others.
+ * Requests that can't be granted at once wait in a queue per chunk.
+ * A request is granted, when it's compatible with the current holders
+ * and with every request, which waits in front of it.
+ * Since requests are enqueued for all their chunks at once,
+ * the queues agree on the order of any two requests.
+ * So the oldest request always makes progress and
+ * big selections aren't starved by a stream of small ones.
+ *
+ * The holders and queues are stored in the chunks (see Chunk#getLockState)
+ * and guarded by one mutex per ChunkTable stripe,
+ * so requests for chunks of different stripes don't contend.
+ * A request locks all of its stripes in ascending order.
+ * Waiting requests sleep on their own condition and are only woken,
+ * when a chunk they wait for is released or a request in front of them leaves.
+ *
+ * The chunk mutexes are still locked after a request has been granted,
+ * in ChunkId order, since jobs use them without asking the lock manager.
+ *
+ * All methods are thread safe.
+ */
+class LockManager
+{
+public:
+    LockManager( Volume* volume, const ChunkTable* chunkTable );
+    ~LockManager();
+
+    /**
+     * Sorts chunks into the order, which the lock methods expect.
+     */
+    static void SortChunks( std::vector<Chunk*>* chunks );
+
+    /**
+     * Waits until the chunks are granted and locks their mutexes.
+     * @param chunks Must be sorted by SortChunks().
+     * @param exclusive
+     * Whether the chunks are modified.
+     * Otherwise they're shared with other readers.
+     * Exclusively locked chunks count as modified until they're unlocked,
+     * so optimistic readers retry meanwhile.
+     */
+    void lock( Chunk* const* chunks, int count, bool exclusive );
+
+    /**
+     * Behaves like lock(), except that it doesn't wait.
+     * @return `false` if the chunks are not available right now.
+     */
+    bool tryLock( Chunk* const* chunks, int count, bool exclusive );
+
+    /**
+     * Behaves like lock(), but gives up after the given time.
+     * @param milliseconds Negative values wait forever.
+     * @return `false` if it timed out; nothing is locked then.
+     */
+    bool lockFor( Chunk* const* chunks, int count, bool exclusive, int milliseconds );
+
+    /**
+     * Unlocks chunks that have been locked with the same parameters.
+     */
+    void unlock( Chunk* const* chunks, int count, bool exclusive );
+
+private:
+    LockManager( const LockManager& manager );
+    LockManager& operator = ( const LockManager& manager );
+
+    /**
+     * @return One bit for each stripe the chunks belong to.
+     */
+    uint64_t getStripes( Chunk* const* chunks, int count ) const;
+
+    /**
+     * Locks the given stripes in ascending order.
+     */
+    void lockStripes( uint64_t stripes );
+    void unlockStripes( uint64_t stripes );
+
+    /**
+     * Needs the stripes of the request.
+     * @return Whether the request is compatible with the holders
+     * and with the waiters in front of it.
+     * Requests that aren't enqueued need to be compatible with all waiters.
+     */
+    bool isGrantable( const LockRequest* request ) const;
+
+    /**
+     * Need the stripes of the request.
+     */
+    void enqueue( LockRequest* request );
+    void dequeue( LockRequest* request );
+
+    /**
+     * Makes the request a holder of its chunks.
+     * Needs the stripes of the request.
+     */
+    void grant( const LockRequest* request );
+
+    /**
+     * Removes the holder and wakes the requests, which may be grantable now.
+     */
+    void release( Chunk* const* chunks, int count, bool exclusive );
+
+    /**
+     * Wakes the waiters of the chunks, which may be grantable now:
+     * Those in front of each queue up to the first exclusive one.
+     * Needs the stripes of the chunks.
+     */
+    void wakeWaiters( Chunk* const* chunks, int count );
+
+    Volume* m_Volume;
+    const ChunkTable* m_ChunkTable;
+    tthread::mutex m_StripeMutexes[ChunkTable::STRIPE_COUNT];
+};
+
+}
+
+#endif
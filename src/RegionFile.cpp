@@ -0,0 +1,795 @@
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include "Util.h"
+#include "RegionFile.h"
+
+
+namespace vman
+{
+
+/*
+    Region file format:
+
+    Header:
+        char[4] magic
+        uint32 version
+        uint32 edgeLength
+        uint32 reserved
+        [
+            uint32 offset
+            uint32 length
+            uint32 capacity
+        ]
+
+    Followed by the chunk data.
+*/
+
+struct RegionFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t edgeLength;
+    uint32_t reserved;
+};
+
+struct RegionFileEntry
+{
+    uint32_t offset;
+    uint32_t length;
+    uint32_t capacity;
+};
+
+static const char RegionFileMagic[4] = {'V','M','R','F'};
+static const int RegionFileVersion = 1;
+
+/**
+ * Chunk data is stored in multiples of this,
+ * so that it can grow a little without being moved.
+ */
+static const uint32_t RegionSectorSize = 256;
+
+/**
+ * Minimum amount of bytes read at once.
+ */
+static const uint32_t RegionReadAheadSize = 64*1024;
+
+
+RegionFile::RegionFile( const std::string& fileName, int edgeLength, bool copyOnWrite ) :
+    m_FileName(fileName),
+    m_EdgeLength(edgeLength),
+    m_CopyOnWrite(copyOnWrite),
+    m_File(NULL),
+    m_IndexLoaded(false),
+    m_FileExists(false),
+    m_Entries(edgeLength*edgeLength*edgeLength),
+    m_FileEnd(0),
+    m_ReadAheadOffset(0)
+{
+    assert(edgeLength > 0);
+    memset(&m_Entries[0], 0, m_Entries.size()*sizeof(Entry));
+}
+
+RegionFile::~RegionFile()
+{
+    close();
+}
+
+const std::string& RegionFile::getFileName() const
+{
+    return m_FileName;
+}
+
+int RegionFile::getEntryCount() const
+{
+    return m_Entries.size();
+}
+
+bool RegionFile::isOpen() const
+{
+    return m_File != NULL;
+}
+
+void RegionFile::close()
+{
+    if(m_File != NULL)
+    {
+        fclose(m_File);
+        m_File = NULL;
+    }
+    m_ReadAheadBuffer.clear();
+}
+
+const std::string& RegionFile::getLastError() const
+{
+    return m_LastError;
+}
+
+tthread::mutex* RegionFile::getMutex()
+{
+    return &m_Mutex;
+}
+
+bool RegionFile::fail( const std::string& error )
+{
+    m_LastError = m_FileName + ": " + error;
+    return false;
+}
+
+static uint32_t HeaderSize( int entryCount )
+{
+    return sizeof(RegionFileHeader) + sizeof(RegionFileEntry)*entryCount;
+}
+
+bool RegionFile::open( bool create )
+{
+    if(m_File != NULL)
+        return true;
+
+    if(m_IndexLoaded && !m_FileExists && !create)
+        return false; // Already known that there is nothing to read.
+
+    m_File = fopen(m_FileName.c_str(), "r+b");
+    if(m_File != NULL)
+    {
+        m_FileExists = true;
+        if(!m_IndexLoaded)
+        {
+            if(!readIndex())
+            {
+                fclose(m_File);
+                m_File = NULL;
+                return false;
+            }
+            m_IndexLoaded = true;
+        }
+        return true;
+    }
+
+    if(m_IndexLoaded && m_FileExists)
+        return fail("Region file vanished.");
+
+    m_IndexLoaded = true;
+    m_FileExists = false;
+
+    if(!create)
+        return false;
+
+    m_File = fopen(m_FileName.c_str(), "w+b");
+    if(m_File == NULL)
+        return fail("Can't create file.");
+    m_FileExists = true;
+
+    if(!writeHeader())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool RegionFile::readIndex()
+{
+    RegionFileHeader header;
+    if(fread(&header, sizeof(header), 1, m_File) != 1)
+        return fail("Read error in file header.");
+
+    if(memcmp(header.magic, RegionFileMagic, sizeof(RegionFileMagic)) != 0)
+        return fail("Not a region file.");
+    if(LittleEndian(header.version) != RegionFileVersion)
+        return fail("Incorrect file version.");
+    if(LittleEndian(header.edgeLength) != m_EdgeLength)
+        return fail(Format("Region edge length is %d, but %d is used.", LittleEndian(header.edgeLength), m_EdgeLength));
+
+    std::vector<RegionFileEntry> entries(m_Entries.size());
+    if(fread(&entries[0], sizeof(RegionFileEntry), entries.size(), m_File) != entries.size())
+        return fail("Read error in index.");
+
+    // Data is only appended after the last used extent,
+    // the gaps in between become free extents.
+    std::map<uint32_t,uint32_t> usedExtents;
+    for(int i = 0; i < entries.size(); ++i)
+    {
+        Entry* entry = &m_Entries[i];
+        entry->offset   = LittleEndian(entries[i].offset);
+        entry->length   = LittleEndian(entries[i].length);
+        entry->capacity = LittleEndian(entries[i].capacity);
+        if(entry->offset != 0)
+            usedExtents[entry->offset] = entry->capacity;
+    }
+
+    m_FreeExtents.clear();
+    m_FileEnd = HeaderSize(m_Entries.size());
+    std::map<uint32_t,uint32_t>::const_iterator i = usedExtents.begin();
+    for(; i != usedExtents.end(); ++i)
+    {
+        if(i->first < m_FileEnd)
+            return fail("Overlapping chunk data.");
+        if(i->first > m_FileEnd)
+            m_FreeExtents[m_FileEnd] = i->first - m_FileEnd;
+        m_FileEnd = i->first + i->second;
+    }
+
+    return true;
+}
+
+bool RegionFile::writeHeader()
+{
+    RegionFileHeader header;
+    memcpy(header.magic, RegionFileMagic, sizeof(RegionFileMagic));
+    header.version    = LittleEndian( uint32_t(RegionFileVersion) );
+    header.edgeLength = LittleEndian( uint32_t(m_EdgeLength) );
+    header.reserved   = 0;
+
+    std::vector<RegionFileEntry> entries(m_Entries.size());
+    memset(&entries[0], 0, entries.size()*sizeof(RegionFileEntry));
+
+    if(fseek(m_File, 0, SEEK_SET) != 0 ||
+       fwrite(&header, sizeof(header), 1, m_File) != 1 ||
+       fwrite(&entries[0], sizeof(RegionFileEntry), entries.size(), m_File) != entries.size())
+        return fail("Write error in file header.");
+
+    // Chunk data bypasses the stream buffer.
+    if(fflush(m_File) != 0)
+        return fail("Flush error.");
+
+    m_FileEnd = HeaderSize(m_Entries.size());
+    m_FreeExtents.clear();
+    return true;
+}
+
+bool RegionFile::writeEntry( int index )
+{
+    const Entry& entry = m_Entries[index];
+
+    RegionFileEntry fileEntry;
+    fileEntry.offset   = LittleEndian(entry.offset);
+    fileEntry.length   = LittleEndian(entry.length);
+    fileEntry.capacity = LittleEndian(entry.capacity);
+
+    if(fseek(m_File, sizeof(RegionFileHeader) + sizeof(RegionFileEntry)*index, SEEK_SET) != 0 ||
+       fwrite(&fileEntry, sizeof(fileEntry), 1, m_File) != 1)
+        return fail(Format("Write error in index entry %d.", index));
+    return true;
+}
+
+bool RegionFile::hasChunk( int index )
+{
+    assert(index >= 0);
+    assert(index < m_Entries.size());
+
+    if(!m_IndexLoaded && !open(false))
+        return false;
+    return m_Entries[index].offset != 0;
+}
+
+/**
+ * Single chunks don't gain anything from a submission ring.
+ */
+static bool RunRequests( std::vector<IoRequest>* requests )
+{
+    if(requests->empty())
+        return true;
+    IoBackend backend(false);
+    return backend.run(&(*requests)[0], requests->size());
+}
+
+bool RegionFile::readChunk( int index, std::vector<char>* dataOut )
+{
+    assert(dataOut != NULL);
+
+    ChunkRead read;
+    read.index = index;
+    read.dataOut = dataOut;
+
+    std::vector<IoRequest> requests;
+    prepareReads(&read, 1, &requests);
+    RunRequests(&requests);
+    return finishReads(&read, 1, requests.empty() ? NULL : &requests[0]);
+}
+
+bool RegionFile::mapChunk( int index, FileMapping* mappingOut )
+{
+    assert(index >= 0);
+    assert(index < m_Entries.size());
+    assert(mappingOut != NULL);
+
+    if(!hasChunk(index) || !open(false))
+        return false;
+
+    const Entry& entry = m_Entries[index];
+    if(fflush(m_File) != 0)
+        return fail("Flush error.");
+    if(MapFile(m_File, entry.offset, entry.length, mappingOut) == false)
+        return fail(Format("Can't map chunk %d.", index));
+    return true;
+}
+
+bool RegionFile::writeChunk( int index, const char* data, int length )
+{
+    assert(data != NULL);
+
+    IoVector part;
+    part.data = const_cast<char*>(data);
+    part.length = length;
+    return writeChunk(index, &part, 1);
+}
+
+bool RegionFile::writeChunk( int index, const IoVector* parts, int partCount )
+{
+    ChunkWrite write;
+    write.index = index;
+    write.parts = parts;
+    write.partCount = partCount;
+    write.offsets = NULL;
+
+    std::vector<IoRequest> requests;
+    prepareWrites(&write, 1, &requests);
+    RunRequests(&requests);
+    return finishWrites(&write, 1, requests.empty() ? NULL : &requests[0]);
+}
+
+bool RegionFile::patchChunk( int index, const IoVector* parts, const uint32_t* offsets, int partCount )
+{
+    assert(offsets != NULL);
+
+    ChunkWrite write;
+    write.index = index;
+    write.parts = parts;
+    write.partCount = partCount;
+    write.offsets = offsets;
+
+    std::vector<IoRequest> requests;
+    prepareWrites(&write, 1, &requests);
+    RunRequests(&requests);
+    return finishWrites(&write, 1, requests.empty() ? NULL : &requests[0]);
+}
+
+/**
+ * Orders reads by the file offset of their chunk.
+ */
+struct CompareReadOffsets
+{
+    const std::vector<uint32_t>* offsets;
+
+    bool operator () ( int a, int b ) const
+    {
+        return (*offsets)[a] < (*offsets)[b];
+    }
+};
+
+void RegionFile::prepareReads( ChunkRead* reads, int count, std::vector<IoRequest>* requestsOut )
+{
+    for(int i = 0; i < count; ++i)
+    {
+        assert(reads[i].index >= 0);
+        assert(reads[i].index < m_Entries.size());
+        assert(reads[i].dataOut != NULL);
+        reads[i].success = false;
+        reads[i].request = -1;
+        reads[i].readAhead = false;
+        reads[i].readAheadOffset = 0;
+    }
+
+    // Read ahead works best in file order.
+    std::vector<uint32_t> offsets(count);
+    std::vector<int> order(count);
+    for(int i = 0; i < count; ++i)
+    {
+        offsets[i] = hasChunk(reads[i].index) ? m_Entries[reads[i].index].offset : 0;
+        order[i] = i;
+    }
+    CompareReadOffsets compare;
+    compare.offsets = &offsets;
+    std::sort(order.begin(), order.end(), compare);
+
+    int readAheadRequest = -1;
+    for(int i = 0; i < count; ++i)
+    {
+        ChunkRead* read = &reads[order[i]];
+        if(offsets[order[i]] == 0)
+            continue; // Not stored.
+
+        const Entry& entry = m_Entries[read->index];
+        const bool inReadAheadBuffer =
+            (entry.offset >= m_ReadAheadOffset) &&
+            (entry.offset + entry.length <= m_ReadAheadOffset + m_ReadAheadBuffer.size());
+
+        if(inReadAheadBuffer && readAheadRequest == -1)
+        {
+            const char* begin = &m_ReadAheadBuffer[entry.offset - m_ReadAheadOffset];
+            read->dataOut->assign(begin, begin + entry.length);
+            read->success = true;
+            continue;
+        }
+
+        if(!open(false))
+            continue;
+
+        IoRequest request;
+        request.file = fileno(m_File);
+        request.write = false;
+        request.result = -1;
+        request.vectors = &read->vector;
+        request.vectorCount = 1;
+
+        if(inReadAheadBuffer)
+        {
+            // Is read by the pending read ahead.
+            read->request = readAheadRequest;
+            read->readAhead = true;
+            read->readAheadOffset = entry.offset - m_ReadAheadOffset;
+        }
+        else if(readAheadRequest == -1)
+        {
+            // Read the following chunks too,
+            // since neighbours are likely to be requested next.
+            uint32_t readLength = m_FileEnd - entry.offset;
+            if(readLength > RegionReadAheadSize)
+                readLength = RegionReadAheadSize;
+            if(readLength < entry.length)
+                readLength = entry.length;
+
+            m_ReadAheadBuffer.resize(readLength);
+            m_ReadAheadOffset = entry.offset;
+
+            read->vector.data = &m_ReadAheadBuffer[0];
+            read->vector.length = readLength;
+            read->readAhead = true;
+            request.offset = entry.offset;
+            read->request = readAheadRequest = requestsOut->size();
+            requestsOut->push_back(request);
+        }
+        else
+        {
+            read->dataOut->resize(entry.length);
+            read->vector.data = &(*read->dataOut)[0];
+            read->vector.length = entry.length;
+            request.offset = entry.offset;
+            read->request = requestsOut->size();
+            requestsOut->push_back(request);
+        }
+    }
+}
+
+bool RegionFile::finishReads( ChunkRead* reads, int count, const IoRequest* requests )
+{
+    bool success = true;
+    for(int i = 0; i < count; ++i)
+    {
+        ChunkRead* read = &reads[i];
+        if(read->success)
+            continue;
+
+        if(read->request == -1)
+        {
+            success = false;
+            continue;
+        }
+
+        const IoRequest& request = requests[read->request];
+        const Entry& entry = m_Entries[read->index];
+        const int64_t end = read->readAheadOffset + entry.length;
+        if(request.result < end)
+        {
+            success = fail(Format("Read error in chunk %d.", read->index));
+            continue;
+        }
+
+        if(read->readAhead)
+        {
+            const char* begin = &m_ReadAheadBuffer[read->readAheadOffset];
+            read->dataOut->assign(begin, begin + entry.length);
+        }
+        read->success = true;
+    }
+
+    // Only what has been read stays in the buffer.
+    for(int i = 0; i < count; ++i)
+    {
+        if(!reads[i].readAhead || reads[i].readAheadOffset != 0)
+            continue;
+        const int64_t result = requests[reads[i].request].result;
+        m_ReadAheadBuffer.resize(result > 0 ? result : 0);
+        break;
+    }
+    return success;
+}
+
+void RegionFile::prepareWrites( ChunkWrite* writes, int count, std::vector<IoRequest>* requestsOut )
+{
+    for(int i = 0; i < count; ++i)
+    {
+        assert(writes[i].index >= 0);
+        assert(writes[i].index < m_Entries.size());
+        assert(writes[i].parts != NULL);
+        writes[i].success = false;
+        writes[i].request = -1;
+        writes[i].requestCount = 0;
+        writes[i].offset = 0;
+        writes[i].capacity = 0;
+    }
+
+    if(!open(true))
+        return;
+
+    m_ReadAheadBuffer.clear();
+
+    for(int i = 0; i < count; ++i)
+    {
+        ChunkWrite* write = &writes[i];
+        Entry* entry = &m_Entries[write->index];
+
+        IoRequest request;
+        request.file = fileno(m_File);
+        request.write = true;
+        request.result = -1;
+
+        if(write->offsets != NULL)
+        {
+            if(entry->offset == 0)
+            {
+                fail(Format("Chunk %d is not stored.", write->index));
+                continue;
+            }
+
+            bool fits = true;
+            for(int j = 0; j < write->partCount; ++j)
+                if(write->offsets[j] + write->parts[j].length > entry->length)
+                    fits = false;
+            if(!fits)
+            {
+                fail(Format("Patch exceeds chunk %d.", write->index));
+                continue;
+            }
+
+            write->request = requestsOut->size();
+            write->requestCount = write->partCount;
+            for(int j = 0; j < write->partCount; ++j)
+            {
+                request.offset = entry->offset + write->offsets[j];
+                request.vectors = &write->parts[j];
+                request.vectorCount = 1;
+                requestsOut->push_back(request);
+            }
+            continue;
+        }
+
+        uint32_t length = 0;
+        for(int j = 0; j < write->partCount; ++j)
+            length += write->parts[j].length;
+        assert(length > 0);
+
+        if(m_CopyOnWrite)
+        {
+            // The stored chunk is kept until finishWrites.
+            write->capacity = ((length + RegionSectorSize - 1) / RegionSectorSize) * RegionSectorSize;
+            write->offset = allocate(write->capacity);
+        }
+        else
+        {
+            if(entry->offset == 0 || entry->capacity < length)
+            {
+                if(entry->offset != 0)
+                    release(entry->offset, entry->capacity);
+
+                const uint32_t capacity = ((length + RegionSectorSize - 1) / RegionSectorSize) * RegionSectorSize;
+                entry->offset = allocate(capacity);
+                entry->capacity = capacity;
+            }
+            entry->length = length;
+            write->offset = entry->offset;
+            write->capacity = entry->capacity;
+        }
+
+        request.offset = write->offset;
+        request.vectors = write->parts;
+        request.vectorCount = write->partCount;
+        write->request = requestsOut->size();
+        write->requestCount = 1;
+        requestsOut->push_back(request);
+    }
+}
+
+bool RegionFile::finishWrites( ChunkWrite* writes, int count, const IoRequest* requests )
+{
+    bool success = true;
+    bool replaced = false;
+    for(int i = 0; i < count; ++i)
+    {
+        ChunkWrite* write = &writes[i];
+        if(write->request == -1)
+        {
+            success = false;
+            continue;
+        }
+
+        write->success = true;
+        for(int j = 0; j < write->requestCount; ++j)
+        {
+            const IoRequest& request = requests[write->request + j];
+            int64_t length = 0;
+            for(int k = 0; k < request.vectorCount; ++k)
+                length += request.vectors[k].length;
+            if(request.result != length)
+                write->success = false;
+        }
+        if(!write->success)
+        {
+            if(m_CopyOnWrite && write->offsets == NULL)
+                release(write->offset, write->capacity);
+            success = fail(Format("Write error in chunk %d.", write->index));
+            continue;
+        }
+        if(write->offsets == NULL)
+            replaced = true;
+    }
+
+    if(m_CopyOnWrite)
+        return finishCopyOnWrite(writes, count) && success;
+
+    // Update the index after the data has been written.
+    // Patches don't change it.
+    for(int i = 0; i < count; ++i)
+    {
+        if(!writes[i].success || writes[i].offsets != NULL)
+            continue;
+        if(!writeEntry(writes[i].index))
+        {
+            writes[i].success = false;
+            success = false;
+        }
+    }
+
+    if(replaced && fflush(m_File) != 0)
+    {
+        for(int i = 0; i < count; ++i)
+            writes[i].success = false;
+        return fail("Flush error.");
+    }
+    return success;
+}
+
+bool RegionFile::finishCopyOnWrite( ChunkWrite* writes, int count )
+{
+    bool written = false;
+    bool replaced = false;
+    for(int i = 0; i < count; ++i)
+    {
+        written = written || writes[i].success;
+        replaced = replaced || (writes[i].success && writes[i].offsets == NULL);
+    }
+    if(!written)
+        return true;
+
+    // The new data must be on disk, before the index points to it.
+    if(!SyncFile(fileno(m_File)))
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            if(writes[i].success && writes[i].offsets == NULL)
+                release(writes[i].offset, writes[i].capacity);
+            writes[i].success = false;
+        }
+        return fail("Sync error.");
+    }
+
+    // Patches don't change the index.
+    if(!replaced)
+        return true;
+
+    std::vector<Entry> oldEntries(count);
+    bool indexWritten = true;
+    for(int i = 0; i < count; ++i)
+    {
+        ChunkWrite* write = &writes[i];
+        if(!write->success || write->offsets != NULL)
+            continue;
+
+        Entry* entry = &m_Entries[write->index];
+        oldEntries[i] = *entry;
+        entry->offset = write->offset;
+        entry->length = 0;
+        for(int j = 0; j < write->partCount; ++j)
+            entry->length += write->parts[j].length;
+        entry->capacity = write->capacity;
+
+        if(!writeEntry(write->index))
+            indexWritten = false;
+    }
+
+    // Only once the index is on disk, the old data may be overwritten.
+    // If that fails, it's unknown which version the index on disk points to,
+    // so both are kept until the index is read again.
+    if(!indexWritten || fflush(m_File) != 0 || !SyncFile(fileno(m_File)))
+    {
+        for(int i = 0; i < count; ++i)
+            writes[i].success = false;
+        return fail("Index sync error.");
+    }
+
+    for(int i = 0; i < count; ++i)
+    {
+        if(writes[i].success && writes[i].offsets == NULL && oldEntries[i].offset != 0)
+            release(oldEntries[i].offset, oldEntries[i].capacity);
+    }
+    return true;
+}
+
+bool RegionFile::sync()
+{
+    // A closed file may still have dirty pages,
+    // which are synced through a new handle.
+    if(!open(false))
+        return false;
+
+    if(fflush(m_File) != 0 || !SyncFile(fileno(m_File)))
+        return fail("Sync error.");
+    return true;
+}
+
+uint32_t RegionFile::allocate( uint32_t capacity )
+{
+    std::map<uint32_t,uint32_t>::iterator i = m_FreeExtents.begin();
+    for(; i != m_FreeExtents.end(); ++i)
+    {
+        if(i->second >= capacity)
+        {
+            const uint32_t offset = i->first;
+            const uint32_t remaining = i->second - capacity;
+            m_FreeExtents.erase(i);
+            if(remaining > 0)
+                m_FreeExtents[offset + capacity] = remaining;
+            return offset;
+        }
+    }
+
+    const uint32_t offset = m_FileEnd;
+    m_FileEnd += capacity;
+    return offset;
+}
+
+void RegionFile::release( uint32_t offset, uint32_t capacity )
+{
+    std::map<uint32_t,uint32_t>::iterator next = m_FreeExtents.lower_bound(offset);
+
+    // Merge with the following extent.
+    if(next != m_FreeExtents.end() && next->first == offset + capacity)
+    {
+        capacity += next->second;
+        m_FreeExtents.erase(next++);
+    }
+
+    // Merge with the preceding extent.
+    if(next != m_FreeExtents.begin())
+    {
+        std::map<uint32_t,uint32_t>::iterator previous = next;
+        --previous;
+        if(previous->first + previous->second == offset)
+        {
+            previous->second += capacity;
+            return;
+        }
+    }
+
+    m_FreeExtents[offset] = capacity;
+}
+
+
+/** Forbidden Stuff **/
+
+RegionFile::RegionFile( const RegionFile& file ) :
+    m_EdgeLength(0),
+    m_CopyOnWrite(false)
+{
+    assert(false);
+}
+
+RegionFile& RegionFile::operator = ( const RegionFile& file )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
@@ -0,0 +1,328 @@
+#ifndef __VMAN_REGION_FILE_H__
+#define __VMAN_REGION_FILE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <tinythread.h>
+
+#include "Util.h"
+#include "IoBackend.h"
+
+
+namespace vman
+{
+
+/**
+ * A region file packs the data of `edgeLength^3` chunks into a single file.
+ *
+ * The file starts with an index that stores offset and length of each chunk.
+ * Chunk data is opaque to the region file.
+ * Space of chunks that were moved is reused for later writes.
+ *
+ * The index is kept in memory, while the file handle may be closed
+ * and is reopened on demand. Therefore an unlimited amount of region files
+ * can be used with a limited amount of file descriptors.
+ *
+ * Chunk data is transferred with IoRequests, so the reads and writes
+ * of several chunks and regions can be run as a single batch:
+ * prepareReads() and prepareWrites() append the requests,
+ * which are passed to finishReads() and finishWrites() after they have been run.
+ * The mutex must stay locked in between.
+ *
+ * With copy on write, replaced chunks are written to new space.
+ * The index is only updated, after the data has reached the disk,
+ * and the old space is reused, after the index has reached the disk.
+ * So a crash leaves either the old or the new chunk.
+ *
+ * Policy: Lock the mutex before using methods that aren't thread safe.
+ */
+class RegionFile
+{
+public:
+    /**
+     * Nothing is read or written until it's needed.
+     * @param copyOnWrite
+     * Whether replaced chunks are written to new space and synced,
+     * before the index points to them.
+     */
+    RegionFile( const std::string& fileName, int edgeLength, bool copyOnWrite );
+
+    /**
+     * Closes the file handle.
+     */
+    ~RegionFile();
+
+    /**
+     * Is thread safe.
+     */
+    const std::string& getFileName() const;
+
+    /**
+     * Is thread safe.
+     * @return Amount of chunk entries in this region file.
+     */
+    int getEntryCount() const;
+
+    /**
+     * @return Whether the file handle is currently open.
+     */
+    bool isOpen() const;
+
+    /**
+     * Closes the file handle, but keeps the index in memory.
+     * The file is reopened when its needed again.
+     */
+    void close();
+
+    /**
+     * @return Whether the region file stores data for the chunk at `index`.
+     * Also `false` if the file is not readable.
+     */
+    bool hasChunk( int index );
+
+    /**
+     * Reads the data of a chunk.
+     * Subsequent chunks are read in the same operation
+     * and may be returned from memory without accessing the disk again.
+     * @return `false` if the chunk is not stored or on read errors.
+     */
+    bool readChunk( int index, std::vector<char>* dataOut );
+
+    /**
+     * Maps the data of a chunk read only into memory.
+     * Note that the mapping reflects later writes of the chunk.
+     * @return `false` if the chunk is not stored or can't be mapped.
+     */
+    bool mapChunk( int index, FileMapping* mappingOut );
+
+    /**
+     * Writes the data of a chunk.
+     * The region file is created if it doesn't exist yet.
+     * @return `true` on success.
+     */
+    bool writeChunk( int index, const char* data, int length );
+
+    /**
+     * Writes the data of a chunk, which is split into several parts.
+     * @see writeChunk
+     */
+    bool writeChunk( int index, const IoVector* parts, int partCount );
+
+    /**
+     * Overwrites parts of the stored chunk data in place.
+     * The rest of the chunk data is kept.
+     * @param offsets Offset of each part inside the chunk data.
+     * @return `false` if the chunk is not stored,
+     * a part exceeds its data or on write errors.
+     */
+    bool patchChunk( int index, const IoVector* parts, const uint32_t* offsets, int partCount );
+
+    /**
+     * Describes a chunk for prepareReads.
+     */
+    struct ChunkRead
+    {
+        int index;
+        std::vector<char>* dataOut;
+
+        /**
+         * Set by prepareReads or finishReads.
+         */
+        bool success;
+
+        /**
+         * Request that reads the chunk or `-1`.
+         * Set by prepareReads.
+         */
+        int request;
+
+        /**
+         * Whether the request reads into the read ahead buffer
+         * and where the chunk starts in there.
+         */
+        bool readAhead;
+        uint32_t readAheadOffset;
+
+        IoVector vector;
+    };
+
+    /**
+     * Appends the requests, which read the given chunks.
+     * Chunks that are in the read ahead buffer are copied right away.
+     * The first chunk that isn't is read together with the data behind it,
+     * so neighbours don't need a request.
+     * Chunks that aren't stored fail.
+     */
+    void prepareReads( ChunkRead* reads, int count, std::vector<IoRequest>* requestsOut );
+
+    /**
+     * Completes reads, after their requests have been run.
+     * @param requests The requests, which prepareReads appended to.
+     * @return Whether all chunks could be read.
+     */
+    bool finishReads( ChunkRead* reads, int count, const IoRequest* requests );
+
+    /**
+     * Describes a chunk for prepareWrites.
+     */
+    struct ChunkWrite
+    {
+        int index;
+        const IoVector* parts;
+        int partCount;
+
+        /**
+         * If not `NULL`, each part is written at the given offset
+         * of the stored chunk data, while the rest of it is kept.
+         * @see patchChunk
+         */
+        const uint32_t* offsets;
+
+        /**
+         * Set by finishWrites.
+         */
+        bool success;
+
+        /**
+         * First of the requests, which write the chunk, or `-1`.
+         * Set by prepareWrites.
+         */
+        int request;
+        int requestCount;
+
+        /**
+         * Space, which the replaced chunk is written to.
+         * Set by prepareWrites.
+         */
+        uint32_t offset;
+        uint32_t capacity;
+    };
+
+    /**
+     * Appends the requests, which write the given chunks.
+     * The region file is created if it doesn't exist yet.
+     */
+    void prepareWrites( ChunkWrite* writes, int count, std::vector<IoRequest>* requestsOut );
+
+    /**
+     * Updates the index, after the requests have been run.
+     * With copy on write the data and the index are synced as well.
+     * @param requests The requests, which prepareWrites appended to.
+     * @return Whether all chunks have been written.
+     */
+    bool finishWrites( ChunkWrite* writes, int count, const IoRequest* requests );
+
+    /**
+     * Waits until the written chunks have reached the disk.
+     * @return `true` on success.
+     */
+    bool sync();
+
+    /**
+     * @return Description of the last error or an empty string.
+     */
+    const std::string& getLastError() const;
+
+    /**
+     * Use this to lock the object while
+     * using methods that aren't thread safe.
+     */
+    tthread::mutex* getMutex();
+
+private:
+    RegionFile( const RegionFile& file );
+    RegionFile& operator = ( const RegionFile& file );
+
+    struct Entry
+    {
+        /**
+         * File offset of the chunk data.
+         * `0` means that the chunk is not stored.
+         */
+        uint32_t offset;
+
+        /**
+         * Length of the chunk data.
+         */
+        uint32_t length;
+
+        /**
+         * Bytes reserved for the chunk data.
+         * Allows the data to grow a bit without moving it.
+         */
+        uint32_t capacity;
+    };
+
+    /**
+     * Reads the index if that didn't happen yet
+     * and reopens the file if it has been closed.
+     * @param create Creates the file if it doesn't exist.
+     * @return `false` if the file isn't usable.
+     */
+    bool open( bool create );
+
+    bool readIndex();
+    bool writeHeader();
+    bool writeEntry( int index );
+
+    /**
+     * Syncs the written data, points the index to it,
+     * syncs the index and frees the space of the replaced chunks.
+     * @see finishWrites
+     */
+    bool finishCopyOnWrite( ChunkWrite* writes, int count );
+
+    /**
+     * Finds space for `capacity` bytes.
+     * @return File offset of the reserved space.
+     */
+    uint32_t allocate( uint32_t capacity );
+
+    /**
+     * Marks the given space as free, so it can be reused.
+     */
+    void release( uint32_t offset, uint32_t capacity );
+
+    bool fail( const std::string& error );
+
+    const std::string m_FileName;
+    const int m_EdgeLength;
+    const bool m_CopyOnWrite;
+
+    FILE* m_File;
+    bool m_IndexLoaded;
+    bool m_FileExists;
+    std::string m_LastError;
+
+    std::vector<Entry> m_Entries;
+
+    /**
+     * Unused space between the chunks.
+     * Maps offsets to extent lengths.
+     */
+    std::map<uint32_t,uint32_t> m_FreeExtents;
+
+    /**
+     * Offset where new data would be appended.
+     */
+    uint32_t m_FileEnd;
+
+    /**
+     * File offset of the read ahead buffer.
+     */
+    uint32_t m_ReadAheadOffset;
+
+    /**
+     * Holds data that was read with the last chunk.
+     */
+    std::vector<char> m_ReadAheadBuffer;
+
+    tthread::mutex m_Mutex;
+};
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+#include <assert.h>
+#include "Util.h"
+#include "Volume.h"
+#include "ScratchBuffer.h"
+
+
+namespace vman
+{
+
+ScratchBufferPool::ScratchBufferPool( Volume* volume ) :
+    m_Volume(volume),
+    m_IdleBuffers()
+{
+}
+
+ScratchBufferPool::~ScratchBufferPool()
+{
+    for(int i = 0; i < m_IdleBuffers.size(); ++i)
+    {
+        m_Volume->decStatistic(STATISTIC_SCRATCH_BUFFER_BYTES, m_IdleBuffers[i]->capacity());
+        delete m_IdleBuffers[i];
+    }
+}
+
+std::vector<char>* ScratchBufferPool::acquire()
+{
+    {
+        lock_guard guard(m_Mutex);
+        if(m_IdleBuffers.empty() == false)
+        {
+            std::vector<char>* buffer = m_IdleBuffers.back();
+            m_IdleBuffers.pop_back();
+            m_Volume->decStatistic(STATISTIC_SCRATCH_BUFFER_BYTES, buffer->capacity());
+            return buffer;
+        }
+    }
+    return new std::vector<char>();
+}
+
+void ScratchBufferPool::release( std::vector<char>* buffer )
+{
+    assert(buffer != NULL);
+    buffer->clear(); // Keeps the capacity.
+
+    {
+        lock_guard guard(m_Mutex);
+        if(m_IdleBuffers.size() < MAX_IDLE_BUFFERS)
+        {
+            m_IdleBuffers.push_back(buffer);
+            m_Volume->incStatistic(STATISTIC_SCRATCH_BUFFER_BYTES, buffer->capacity());
+            return;
+        }
+    }
+    delete buffer;
+}
+
+
+ScratchBuffer::ScratchBuffer( ScratchBufferPool* pool ) :
+    m_Pool(pool),
+    m_Buffer(pool->acquire())
+{
+}
+
+ScratchBuffer::~ScratchBuffer()
+{
+    m_Pool->release(m_Buffer);
+}
+
+std::vector<char>& ScratchBuffer::operator * () const
+{
+    return *m_Buffer;
+}
+
+std::vector<char>* ScratchBuffer::operator -> () const
+{
+    return m_Buffer;
+}
+
+
+/** Forbidden Stuff **/
+
+ScratchBufferPool::ScratchBufferPool( const ScratchBufferPool& pool )
+{
+    assert(false);
+}
+
+ScratchBufferPool& ScratchBufferPool::operator = ( const ScratchBufferPool& pool )
+{
+    assert(false);
+    return *this;
+}
+
+ScratchBuffer::ScratchBuffer( const ScratchBuffer& buffer )
+{
+    assert(false);
+}
+
+ScratchBuffer& ScratchBuffer::operator = ( const ScratchBuffer& buffer )
+{
+    assert(false);
+    return *this;
+}
+
+
+}
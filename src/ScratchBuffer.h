@@ -0,0 +1,78 @@
+#ifndef __VMAN_SCRATCH_BUFFER_H__
+#define __VMAN_SCRATCH_BUFFER_H__
+
+#include <vector>
+#include <tinythread.h>
+
+
+namespace vman
+{
+
+class Volume;
+
+/**
+ * Keeps temporary buffers used while loading and saving chunks,
+ * so their memory is reused instead of being allocated on every call.
+ *
+ * Each buffer is used by a single thread at a time.
+ * Since every job thread holds at most one buffer per purpose,
+ * the pool settles at one set of buffers per thread.
+ *
+ * All methods are thread safe.
+ */
+class ScratchBufferPool
+{
+public:
+    enum
+    {
+        /**
+         * Idle buffers beyond this amount are freed.
+         */
+        MAX_IDLE_BUFFERS = 32
+    };
+
+    ScratchBufferPool( Volume* volume );
+    ~ScratchBufferPool();
+
+    /**
+     * @return An empty buffer, which may have capacity left from previous uses.
+     */
+    std::vector<char>* acquire();
+
+    /**
+     * Gives a buffer back to the pool.
+     */
+    void release( std::vector<char>* buffer );
+
+private:
+    ScratchBufferPool( const ScratchBufferPool& pool );
+    ScratchBufferPool& operator = ( const ScratchBufferPool& pool );
+
+    Volume* m_Volume;
+    std::vector< std::vector<char>* > m_IdleBuffers;
+    tthread::mutex m_Mutex;
+};
+
+/**
+ * Borrows a buffer from a pool for the lifetime of this object.
+ */
+class ScratchBuffer
+{
+public:
+    ScratchBuffer( ScratchBufferPool* pool );
+    ~ScratchBuffer();
+
+    std::vector<char>& operator * () const;
+    std::vector<char>* operator -> () const;
+
+private:
+    ScratchBuffer( const ScratchBuffer& buffer );
+    ScratchBuffer& operator = ( const ScratchBuffer& buffer );
+
+    ScratchBufferPool* m_Pool;
+    std::vector<char>* m_Buffer;
+};
+
+}
+
+#endif
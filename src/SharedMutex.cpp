@@ -0,0 +1,164 @@
+#include <assert.h>
+#include "Util.h"
+#include "SharedMutex.h"
+
+
+namespace vman
+{
+
+SharedMutex::SharedMutex() :
+    m_Readers(0),
+    m_Writer(false),
+    m_WaitingWriters(0),
+    m_Version(0),
+    m_ModificationDepth(0)
+{
+}
+
+SharedMutex::~SharedMutex()
+{
+    assert(m_Readers == 0);
+    assert(m_Writer == false);
+}
+
+void SharedMutex::lock()
+{
+    lock_guard guard(m_Mutex);
+    m_WaitingWriters++;
+    while(m_Writer || m_Readers > 0)
+        m_Condition.wait(m_Mutex);
+    m_WaitingWriters--;
+    m_Writer = true;
+}
+
+bool SharedMutex::try_lock()
+{
+    lock_guard guard(m_Mutex);
+    if(m_Writer || m_Readers > 0)
+        return false;
+    m_Writer = true;
+    return true;
+}
+
+bool SharedMutex::try_lock_for( int milliseconds )
+{
+    const uint64_t startTime = GetMonotonicMilliseconds();
+    lock_guard guard(m_Mutex);
+    m_WaitingWriters++;
+    while(m_Writer || m_Readers > 0)
+    {
+        if(waitFor(startTime, milliseconds) == false)
+        {
+            // Readers, which waited behind us, may go on.
+            m_WaitingWriters--;
+            m_Condition.notify_all();
+            return false;
+        }
+    }
+    m_WaitingWriters--;
+    m_Writer = true;
+    return true;
+}
+
+void SharedMutex::unlock()
+{
+    {
+        lock_guard guard(m_Mutex);
+        assert(m_Writer);
+        assert(m_ModificationDepth == 0);
+        m_Writer = false;
+    }
+    m_Condition.notify_all();
+}
+
+void SharedMutex::lock_shared()
+{
+    lock_guard guard(m_Mutex);
+    while(m_Writer || m_WaitingWriters > 0)
+        m_Condition.wait(m_Mutex);
+    m_Readers++;
+}
+
+bool SharedMutex::try_lock_shared()
+{
+    lock_guard guard(m_Mutex);
+    if(m_Writer || m_WaitingWriters > 0)
+        return false;
+    m_Readers++;
+    return true;
+}
+
+bool SharedMutex::try_lock_shared_for( int milliseconds )
+{
+    const uint64_t startTime = GetMonotonicMilliseconds();
+    lock_guard guard(m_Mutex);
+    while(m_Writer || m_WaitingWriters > 0)
+        if(waitFor(startTime, milliseconds) == false)
+            return false;
+    m_Readers++;
+    return true;
+}
+
+void SharedMutex::unlock_shared()
+{
+    bool lastReader;
+    {
+        lock_guard guard(m_Mutex);
+        assert(m_Readers > 0);
+        m_Readers--;
+        lastReader = m_Readers == 0;
+    }
+
+    // Only writers wait for readers.
+    if(lastReader)
+        m_Condition.notify_all();
+}
+
+unsigned int SharedMutex::getVersion() const
+{
+    return m_Version.load(tthread::memory_order_acquire);
+}
+
+void SharedMutex::beginModification()
+{
+    if(m_ModificationDepth++ == 0)
+        m_Version.fetch_add(1);
+}
+
+void SharedMutex::endModification()
+{
+    assert(m_ModificationDepth > 0);
+    if(--m_ModificationDepth == 0)
+        m_Version.fetch_add(1);
+}
+
+
+bool SharedMutex::waitFor( uint64_t startTime, int milliseconds )
+{
+    const int remaining = RemainingMilliseconds(startTime, milliseconds);
+    if(remaining < 0)
+        m_Condition.wait(m_Mutex);
+    else if(remaining > 0)
+        m_Condition.wait_for(m_Mutex, tthread::chrono::milliseconds(remaining));
+    else
+        return false;
+    return true;
+}
+
+
+/** Forbidden Stuff **/
+
+SharedMutex::SharedMutex( const SharedMutex& mutex )
+{
+    assert(false);
+}
+
+SharedMutex& SharedMutex::operator = ( const SharedMutex& mutex )
+{
+    assert(false);
+    return *this;
+}
+
+
+
+}
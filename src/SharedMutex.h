@@ -0,0 +1,149 @@
+#ifndef __VMAN_SHARED_MUTEX_H__
+#define __VMAN_SHARED_MUTEX_H__
+
+#include <stdint.h>
+#include <tinythread.h>
+
+
+namespace vman
+{
+
+/**
+ * A mutex that is either owned by a single writer
+ * or shared by any amount of readers.
+ *
+ * Writers are preferred: Once a writer waits, new readers wait too,
+ * so a steady stream of readers can't starve it.
+ * That's deadlock free as long as all locks are taken in a global order,
+ * like chunks are.
+ *
+ * The exclusive methods match tthread::mutex,
+ * so tthread::lock_guard can be used with it.
+ *
+ * A version counter allows optimistic reads without locking, like a seqlock:
+ * It's odd while the protected data is modified and changes after each modification.
+ * Readers copy the protected data and retry if the version changed meanwhile.
+ * Locking alone doesn't change the version, so writers, which only read,
+ * don't disturb optimistic readers.
+ *
+ * All methods are thread safe.
+ */
+class SharedMutex
+{
+public:
+    SharedMutex();
+    ~SharedMutex();
+
+    /**
+     * Waits until no one else holds the mutex.
+     */
+    void lock();
+
+    /**
+     * @return `false` if someone else holds the mutex.
+     */
+    bool try_lock();
+
+    /**
+     * Waits at most the given time until no one else holds the mutex.
+     * @param milliseconds Negative values wait forever.
+     * @return `false` if it timed out.
+     */
+    bool try_lock_for( int milliseconds );
+
+    void unlock();
+
+    /**
+     * Waits until no writer holds or waits for the mutex.
+     */
+    void lock_shared();
+
+    /**
+     * @return `false` if a writer holds or waits for the mutex.
+     */
+    bool try_lock_shared();
+
+    /**
+     * Waits at most the given time until no writer holds or waits for the mutex.
+     * @param milliseconds Negative values wait forever.
+     * @return `false` if it timed out.
+     */
+    bool try_lock_shared_for( int milliseconds );
+
+    void unlock_shared();
+
+    /**
+     * Is odd while the protected data is modified.
+     */
+    unsigned int getVersion() const;
+
+    /**
+     * Announces that the protected data is modified, until endModification().
+     * The caller must hold the mutex and prevent concurrent modifications,
+     * which is the case for writers.
+     * Modifications may be nested, only the outermost one changes the version.
+     */
+    void beginModification();
+    void endModification();
+
+private:
+    SharedMutex( const SharedMutex& mutex );
+    SharedMutex& operator = ( const SharedMutex& mutex );
+
+    /**
+     * Waits for the condition, unless the timeout expired.
+     * Needs the internal mutex.
+     * @return `false` if the timeout expired.
+     */
+    bool waitFor( uint64_t startTime, int milliseconds );
+
+    tthread::mutex m_Mutex;
+
+    /**
+     * Readers and writers wait on the same condition,
+     * which is notified whenever the mutex becomes available.
+     */
+    tthread::condition_variable m_Condition;
+
+    int m_Readers;
+    bool m_Writer;
+    int m_WaitingWriters;
+
+    tthread::atomic_uint m_Version;
+
+    /**
+     * Nesting level of modifications.
+     * Is guarded like the protected data.
+     */
+    int m_ModificationDepth;
+};
+
+typedef tthread::lock_guard<SharedMutex> exclusive_lock_guard;
+
+/**
+ * Announces a modification while it exists.
+ * @see SharedMutex#beginModification
+ */
+class ModificationGuard
+{
+public:
+    explicit ModificationGuard( SharedMutex& mutex ) : m_Mutex(mutex)
+    {
+        m_Mutex.beginModification();
+    }
+
+    ~ModificationGuard()
+    {
+        m_Mutex.endModification();
+    }
+
+private:
+    ModificationGuard( const ModificationGuard& guard );
+    ModificationGuard& operator = ( const ModificationGuard& guard );
+
+    SharedMutex& m_Mutex;
+};
+
+}
+
+#endif
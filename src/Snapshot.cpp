@@ -0,0 +1,197 @@
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include "Util.h"
+#include "Volume.h"
+#include "Snapshot.h"
+
+
+namespace vman
+{
+
+Snapshot::Snapshot( Volume* volume, const vmanSelection* selection ) :
+    m_Volume(volume),
+    m_Selection(*selection),
+    m_LayerCount(volume->getLayerCount()),
+    m_Layers(),
+    m_Versions()
+{
+    m_Volume->voxelToChunkSelection(&m_Selection, &m_ChunkSelection);
+
+    const int chunkCount =
+        m_ChunkSelection.w *
+        m_ChunkSelection.h *
+        m_ChunkSelection.d;
+    m_Layers.resize(chunkCount*m_LayerCount, NULL);
+    m_Versions.resize(chunkCount*m_LayerCount, NULL);
+    if(chunkCount == 0)
+        return;
+
+    // Chunks are returned referenced, so they stay loaded while they're pinned.
+    std::vector<Chunk*> chunks(chunkCount);
+    m_Volume->getSelection(&m_ChunkSelection, &chunks[0], 0);
+
+    std::vector<Chunk*> lockOrder(chunks);
+    LockManager::SortChunks(&lockOrder);
+
+    LockManager* lockManager = m_Volume->getLockManager();
+    lockManager->lock(&lockOrder[0], chunkCount, false);
+    for(int i = 0; i < chunkCount; ++i)
+        for(int layer = 0; layer < m_LayerCount; ++layer)
+            m_Layers[i*m_LayerCount + layer] = chunks[i]->pinLayer(layer, &m_Versions[i*m_LayerCount + layer]);
+    lockManager->unlock(&lockOrder[0], chunkCount, false);
+
+    for(int i = 0; i < chunkCount; ++i)
+        chunks[i]->releaseReference();
+}
+
+Snapshot::~Snapshot()
+{
+    for(int i = 0; i < m_Versions.size(); ++i)
+        if(m_Versions[i] != NULL)
+            m_Versions[i]->releaseReference();
+}
+
+const vmanSelection* Snapshot::getSelection() const
+{
+    return &m_Selection;
+}
+
+const char* Snapshot::getChunkLayer( int chunkX, int chunkY, int chunkZ, int layer ) const
+{
+    const int chunkIndex = Index3D(
+        m_ChunkSelection.w,
+        m_ChunkSelection.h,
+        m_ChunkSelection.d,
+
+        chunkX-m_ChunkSelection.x,
+        chunkY-m_ChunkSelection.y,
+        chunkZ-m_ChunkSelection.z
+    );
+    return m_Layers[chunkIndex*m_LayerCount + layer];
+}
+
+const void* Snapshot::readVoxelLayer( int x, int y, int z, int layer ) const
+{
+    if(InsideSelection(&m_Selection, x,y,z) == false ||
+       layer < 0 ||
+       layer >= m_LayerCount)
+    {
+        m_Volume->log(VMAN_LOG_ERROR, "Voxel %s is not in snapshot selection (%s).\n",
+            CoordsToString(x,y,z).c_str(),
+            SelectionToString(&m_Selection).c_str()
+        );
+        return NULL;
+    }
+    m_Volume->incStatistic(STATISTIC_READ_OPS);
+
+    const int edgeLength = m_Volume->getChunkEdgeLength();
+    const int chunkX = FloorDiv(x, edgeLength);
+    const int chunkY = FloorDiv(y, edgeLength);
+    const int chunkZ = FloorDiv(z, edgeLength);
+    const int voxelIndex = Index3D(
+        edgeLength, edgeLength, edgeLength,
+        x - chunkX*edgeLength,
+        y - chunkY*edgeLength,
+        z - chunkZ*edgeLength
+    );
+    const int voxelSize = m_Volume->getLayer(layer)->voxelSize;
+    return &getChunkLayer(chunkX, chunkY, chunkZ, layer)[voxelIndex*voxelSize];
+}
+
+bool Snapshot::readRegion( const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount ) const
+{
+    assert(bufferCount == 0 || buffers != NULL);
+
+    if(box->w < 0 || box->h < 0 || box->d < 0 ||
+       ContainsBox(&m_Selection, box) == false)
+    {
+        m_Volume->log(VMAN_LOG_ERROR, "Box (%s) is not in snapshot selection (%s).\n",
+            SelectionToString(box).c_str(),
+            SelectionToString(&m_Selection).c_str()
+        );
+        return false;
+    }
+
+    for(int i = 0; i < bufferCount; ++i)
+    {
+        if(buffers[i].layer < 0 ||
+           buffers[i].layer >= m_LayerCount ||
+           buffers[i].data == NULL)
+        {
+            m_Volume->log(VMAN_LOG_ERROR, "Buffer %d uses an invalid layer or has no data.\n", i);
+            return false;
+        }
+    }
+
+    m_Volume->incStatistic(STATISTIC_READ_OPS, box->w*box->h*box->d*bufferCount);
+
+    const int edgeLength = m_Volume->getChunkEdgeLength();
+
+    for(int i = 0; i < bufferCount; ++i)
+    {
+        const vmanLayerBuffer& buffer = buffers[i];
+        const int voxelSize = m_Volume->getLayer(buffer.layer)->voxelSize;
+        const int voxelStride = buffer.voxelStride ? buffer.voxelStride : voxelSize;
+        const int rowStride = buffer.rowStride ? buffer.rowStride : voxelStride*box->w;
+        const int sliceStride = buffer.sliceStride ? buffer.sliceStride : rowStride*box->h;
+        const bool packed = voxelStride == voxelSize;
+
+        for(int z = box->z; z < box->z + box->d; ++z)
+        for(int y = box->y; y < box->y + box->h; ++y)
+        {
+            const int chunkY = FloorDiv(y, edgeLength);
+            const int chunkZ = FloorDiv(z, edgeLength);
+
+            // Rows are split at the chunk boundaries.
+            int x = box->x;
+            while(x < box->x + box->w)
+            {
+                const int chunkX = FloorDiv(x, edgeLength);
+                const int rowVoxels = std::min(box->x + box->w, (chunkX+1)*edgeLength) - x;
+                const int voxelIndex = Index3D(
+                    edgeLength, edgeLength, edgeLength,
+                    x - chunkX*edgeLength,
+                    y - chunkY*edgeLength,
+                    z - chunkZ*edgeLength
+                );
+                const char* source = &getChunkLayer(chunkX, chunkY, chunkZ, buffer.layer)[voxelIndex*voxelSize];
+                char* bufferRow = reinterpret_cast<char*>(buffer.data) +
+                    (x - box->x)*voxelStride +
+                    (y - box->y)*rowStride +
+                    (z - box->z)*sliceStride;
+
+                if(packed)
+                {
+                    memcpy(bufferRow, source, rowVoxels*voxelSize);
+                }
+                else
+                {
+                    for(int j = 0; j < rowVoxels; ++j)
+                        memcpy(&bufferRow[j*voxelStride], &source[j*voxelSize], voxelSize);
+                }
+                x += rowVoxels;
+            }
+        }
+    }
+    return true;
+}
+
+
+
+/** Forbidden Stuff **/
+
+Snapshot::Snapshot( const Snapshot& snapshot )
+{
+    assert(false);
+}
+
+Snapshot& Snapshot::operator = ( const Snapshot& snapshot )
+{
+    assert(false);
+    return *this;
+}
+
+
+
+}
@@ -0,0 +1,79 @@
+#ifndef __VMAN_SNAPSHOT_H__
+#define __VMAN_SNAPSHOT_H__
+
+#include <vector>
+#include "vman.h"
+
+namespace vman
+{
+
+class Volume;
+class LayerVersion;
+
+/**
+ * Immutable voxels of a selection, as they were when the snapshot was created.
+ *
+ * Creating a snapshot locks the selection for reading just long enough
+ * to pin the current version of each chunk layer.
+ * Chunks copy pinned layers before writing them,
+ * so writers never wait for snapshot readers.
+ * Old versions are freed, once the last snapshot, that uses them, is deleted.
+ *
+ * Snapshots don't keep chunks loaded.
+ * All methods are thread safe, since nothing changes after construction.
+ */
+class Snapshot
+{
+public:
+    Snapshot( Volume* volume, const vmanSelection* selection );
+
+    /**
+     * Releases the pinned layer versions.
+     */
+    ~Snapshot();
+
+    const vmanSelection* getSelection() const;
+
+    /**
+     * @return A read only pointer to the voxel data in the specified layer
+     * or `NULL` if the voxel lies outside the selection.
+     */
+    const void* readVoxelLayer( int x, int y, int z, int layer ) const;
+
+    /**
+     * Copies a box of voxels from one or more layers into caller buffers.
+     * @return `false` if the box lies outside the selection or a layer doesn't exist.
+     * @see Access#readRegion
+     */
+    bool readRegion( const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount ) const;
+
+private:
+    Snapshot( const Snapshot& snapshot );
+    Snapshot& operator = ( const Snapshot& snapshot );
+
+    /**
+     * @return Voxels of a layer of the given chunk, in chunk coordinates.
+     */
+    const char* getChunkLayer( int chunkX, int chunkY, int chunkZ, int layer ) const;
+
+    Volume* m_Volume;
+    vmanSelection m_Selection;
+    vmanSelection m_ChunkSelection;
+    int m_LayerCount;
+
+    /**
+     * Voxels of each layer of each chunk.
+     * Use `Index3D(...)*m_LayerCount + layer` to access them.
+     */
+    std::vector<const char*> m_Layers;
+
+    /**
+     * Pinned versions of m_Layers.
+     * Entries are `NULL` for shared pages, which aren't owned by anyone.
+     */
+    std::vector<LayerVersion*> m_Versions;
+};
+
+}
+
+#endif
@@ -8,8 +8,15 @@
     #define WIN32_LEAN_AND_MEAN
     #define NOGDI
     #include <windows.h>
+    #include <io.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
 #else
     #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <dirent.h>
+    #include <unistd.h>
 #endif
 
 namespace vman
@@ -50,6 +57,115 @@ const char DirSep = '/';
     {
         return CreateDirectory(path, NULL) == TRUE;
     }
+
+    bool ListDirectory( const char* path, std::vector<std::string>* namesOut )
+    {
+        const std::string pattern = std::string(path) + "\\*";
+
+        WIN32_FIND_DATAA data;
+        HANDLE handle = FindFirstFileA(pattern.c_str(), &data);
+        if(handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        do
+        {
+            const std::string name = data.cFileName;
+            if(name != "." && name != "..")
+                namesOut->push_back(name);
+        } while(FindNextFileA(handle, &data));
+
+        FindClose(handle);
+        return true;
+    }
+
+    int OpenFile( const char* path, bool write )
+    {
+        if(write)
+            return _open(path, _O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY, _S_IREAD|_S_IWRITE);
+        else
+            return _open(path, _O_RDONLY|_O_BINARY);
+    }
+
+    int OpenFileForUpdate( const char* path )
+    {
+        return _open(path, _O_WRONLY|_O_BINARY);
+    }
+
+    void CloseFile( int file )
+    {
+        _close(file);
+    }
+
+    int64_t GetFileLength( int file )
+    {
+        return _filelengthi64(file);
+    }
+
+    bool SyncFile( int file )
+    {
+        return _commit(file) == 0;
+    }
+
+    bool SyncFileSystem( int file )
+    {
+        return SyncFile(file);
+    }
+
+    bool SyncDirectory( const char* path )
+    {
+        return true;
+    }
+
+    bool RenameFile( const char* source, const char* destination )
+    {
+        return MoveFileExA(source, destination, MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH) != 0;
+    }
+
+    bool MapFile( FILE* file, size_t offset, size_t length, FileMapping* mappingOut )
+    {
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        const size_t alignedOffset = offset - offset % systemInfo.dwAllocationGranularity;
+
+        HANDLE fileHandle = (HANDLE)_get_osfhandle(_fileno(file));
+        HANDLE mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(mappingHandle == NULL)
+            return false;
+
+        const uint64_t offset64 = alignedOffset;
+        void* address = MapViewOfFile(
+            mappingHandle,
+            FILE_MAP_READ,
+            DWORD(offset64 >> 32),
+            DWORD(offset64 & 0xFFFFFFFF),
+            length + (offset - alignedOffset)
+        );
+        CloseHandle(mappingHandle); // The view keeps the mapping alive.
+        if(address == NULL)
+            return false;
+
+        mappingOut->address = address;
+        mappingOut->length = length + (offset - alignedOffset);
+        mappingOut->data = (const char*)address + (offset - alignedOffset);
+        return true;
+    }
+
+    void UnmapFile( FileMapping* mapping )
+    {
+        if(mapping->address != NULL)
+            UnmapViewOfFile(mapping->address);
+        memset(mapping, 0, sizeof(FileMapping));
+    }
+
+    void* AllocatePages( size_t length )
+    {
+        return VirtualAlloc(NULL, length, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    }
+
+    void FreePages( void* address, size_t length )
+    {
+        VirtualFree(address, 0, MEM_RELEASE);
+    }
 #else
     FileType GetFileType( const char* path )
     {
@@ -68,6 +184,119 @@ const char DirSep = '/';
     {
         return mkdir(path, 0777) == 0;
     }
+
+    bool ListDirectory( const char* path, std::vector<std::string>* namesOut )
+    {
+        DIR* dir = opendir(path);
+        if(dir == NULL)
+            return false;
+
+        const struct dirent* entry;
+        while((entry = readdir(dir)) != NULL)
+        {
+            const std::string name = entry->d_name;
+            if(name != "." && name != "..")
+                namesOut->push_back(name);
+        }
+
+        closedir(dir);
+        return true;
+    }
+
+    int OpenFile( const char* path, bool write )
+    {
+        if(write)
+            return open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+        else
+            return open(path, O_RDONLY|O_CLOEXEC);
+    }
+
+    int OpenFileForUpdate( const char* path )
+    {
+        return open(path, O_WRONLY|O_CLOEXEC);
+    }
+
+    void CloseFile( int file )
+    {
+        close(file);
+    }
+
+    int64_t GetFileLength( int file )
+    {
+        struct stat info;
+        if(fstat(file, &info) == -1)
+            return -1;
+        return info.st_size;
+    }
+
+    bool SyncFile( int file )
+    {
+        return fsync(file) == 0;
+    }
+
+    bool SyncFileSystem( int file )
+    {
+#if defined(__linux__)
+        return syncfs(file) == 0;
+#else
+        return SyncFile(file);
+#endif
+    }
+
+    bool SyncDirectory( const char* path )
+    {
+        const int directory = open(path, O_RDONLY|O_CLOEXEC);
+        if(directory == -1)
+            return false;
+        const bool success = fsync(directory) == 0;
+        close(directory);
+        return success;
+    }
+
+    bool RenameFile( const char* source, const char* destination )
+    {
+        return rename(source, destination) == 0;
+    }
+
+    bool MapFile( FILE* file, size_t offset, size_t length, FileMapping* mappingOut )
+    {
+        static const size_t pageSize = sysconf(_SC_PAGESIZE);
+        const size_t alignedOffset = offset - offset % pageSize;
+        const size_t alignedLength = length + (offset - alignedOffset);
+
+        void* address = mmap(NULL, alignedLength, PROT_READ, MAP_SHARED, fileno(file), alignedOffset);
+        if(address == MAP_FAILED)
+            return false;
+
+        mappingOut->address = address;
+        mappingOut->length = alignedLength;
+        mappingOut->data = (const char*)address + (offset - alignedOffset);
+        return true;
+    }
+
+    void UnmapFile( FileMapping* mapping )
+    {
+        if(mapping->address != NULL)
+            munmap(mapping->address, mapping->length);
+        memset(mapping, 0, sizeof(FileMapping));
+    }
+
+    void* AllocatePages( size_t length )
+    {
+        void* address = mmap(NULL, length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(address == MAP_FAILED)
+            return NULL;
+#if defined(MADV_HUGEPAGE)
+        // Just a hint, which fails silently if huge pages are not available.
+        madvise(address, length, MADV_HUGEPAGE);
+#endif
+        return address;
+    }
+
+    void FreePages( void* address, size_t length )
+    {
+        munmap(address, length);
+    }
 #endif
 
 bool MakePath( const char* path_ )
@@ -81,6 +310,9 @@ bool MakePath( const char* path_ )
     {
         if(path[i] == '/' || path[i] == '\\')
         {
+            if(i == 0)
+                continue; // Absolute path: The root always exists.
+
             path[i] = '\0';
             const FileType fileType = GetFileType(path);
             switch(GetFileType(path))
@@ -155,20 +387,25 @@ std::string SelectionToString( const vmanSelection* selection )
     );
 }
 
-//tthread::mutex g_AddSecondsMutex;
-time_t AddSeconds( const time_t tv, int seconds )
+uint64_t GetMonotonicMilliseconds()
 {
-    /*
-    lock_guard guard(g_AddSecondsMutex);
-
-    struct tm helper;
-    gmtime_r(&tv, &helper);
-
-    helper.tm_sec += seconds;
+#if defined(__WINDOWS__)
+    return GetTickCount64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec)*1000 + now.tv_nsec/1000000;
+#endif
+}
 
-    return mktime(&helper);
-    */
-    return tv+seconds;
+int RemainingMilliseconds( uint64_t startTime, int timeout )
+{
+    if(timeout < 0)
+        return -1;
+    const uint64_t elapsed = GetMonotonicMilliseconds() - startTime;
+    if(elapsed >= uint64_t(timeout))
+        return 0;
+    return timeout - int(elapsed);
 }
 
 }
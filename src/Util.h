@@ -2,10 +2,12 @@
 #define __VMAN_UTIL_H__
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <tinythread.h>
 #include <string>
+#include <vector>
 
 #include "vman.h"
 
@@ -46,13 +48,13 @@ namespace vman
     {
         return (n<<8) | (n>>8);
     }
-    inline int16_t EndianSwap( int16_t n ) { return EndianSwap(n); }
+    inline int16_t EndianSwap( int16_t n ) { return EndianSwap(uint16_t(n)); }
 
     inline uint32_t EndianSwap( uint32_t n )
     {
         return (n<<24) | (n>>24) | ((n>>8)&0xFF00) | ((n<<8)&0xFF0000);
     }
-    inline int32_t EndianSwap( int32_t n ) { return EndianSwap(n); }
+    inline int32_t EndianSwap( int32_t n ) { return EndianSwap(uint32_t(n)); }
 
     inline uint16_t LittleEndian( uint16_t n ) { return IsLittleEndian ? n : EndianSwap(n); }
     inline  int16_t LittleEndian(  int16_t n ) { return IsLittleEndian ? n : EndianSwap(n); }
@@ -86,6 +88,109 @@ namespace vman
      */
     bool MakePath( const char* path );
 
+    /**
+     * Appends the names of all entries in a directory to `namesOut`.
+     * The special entries `.` and `..` are skipped.
+     * @return `false` if the directory can't be read.
+     */
+    bool ListDirectory( const char* path, std::vector<std::string>* namesOut );
+
+
+    // --- unbuffered files ---
+
+    /**
+     * Opens a file for unbuffered, positioned I/O.
+     * Files opened for writing are created or truncated.
+     * @return A file descriptor or `-1` if the file can't be opened.
+     */
+    int OpenFile( const char* path, bool write );
+
+    /**
+     * Opens an existing file for positioned writes without truncating it.
+     * @return A file descriptor or `-1` if the file can't be opened.
+     */
+    int OpenFileForUpdate( const char* path );
+
+    void CloseFile( int file );
+
+    /**
+     * @return Length of the file in bytes or `-1` on errors.
+     */
+    int64_t GetFileLength( int file );
+
+    /**
+     * Waits until the data of a file has reached the disk.
+     */
+    bool SyncFile( int file );
+
+    /**
+     * Waits until all pending writes on the file system,
+     * which contains the file, have reached the disk.
+     * Uses a single system call where available
+     * and falls back to SyncFile otherwise.
+     */
+    bool SyncFileSystem( int file );
+
+    /**
+     * Makes renames and new entries in a directory durable.
+     * Does nothing on systems, which don't need it.
+     */
+    bool SyncDirectory( const char* path );
+
+    /**
+     * Renames `source`, atomically replacing an existing `destination`.
+     */
+    bool RenameFile( const char* source, const char* destination );
+
+
+    // --- memory mapped files ---
+
+    struct FileMapping
+    {
+        /**
+         * Start of the mapped pages.
+         */
+        void* address;
+
+        /**
+         * Length of the mapped pages.
+         */
+        size_t length;
+
+        /**
+         * Points to the requested file offset inside the mapped pages.
+         */
+        const char* data;
+    };
+
+    /**
+     * Maps a part of a file read only into memory.
+     * The mapping stays valid after the file has been closed.
+     * Changes to the file are visible in the mapping.
+     * @return `false` if the file can't be mapped on this system.
+     */
+    bool MapFile( FILE* file, size_t offset, size_t length, FileMapping* mappingOut );
+
+    /**
+     * Unmaps a mapping created by MapFile and resets it.
+     */
+    void UnmapFile( FileMapping* mapping );
+
+
+    // --- page allocation ---
+
+    /**
+     * Allocates zeroed pages directly from the system.
+     * Large allocations are backed by huge pages where the system supports it.
+     * @return `NULL` if the memory can't be allocated.
+     */
+    void* AllocatePages( size_t length );
+
+    /**
+     * Frees pages allocated by AllocatePages.
+     */
+    void FreePages( void* address, size_t length );
+
 
     // --- multi dimensional arrays --
 
@@ -105,11 +210,95 @@ namespace vman
         return x + y*w + z*w*h;
     }
 
+    /**
+     * Integer division that rounds towards negative infinity.
+     * `divisor` must be positive.
+     */
+    inline int FloorDiv( int dividend, int divisor )
+    {
+        if(dividend >= 0)
+            return dividend / divisor;
+        else
+            return -((-dividend + divisor - 1) / divisor);
+    }
+
+
+    // --- selections ---
+
+    inline bool InsideSelection( const vmanSelection* selection, int x, int y, int z )
+    {
+        return
+            (x >= selection->x) &&
+            (x <  selection->x + selection->w) &&
+
+            (y >= selection->y) &&
+            (y <  selection->y + selection->h) &&
+
+            (z >= selection->z) &&
+            (z <  selection->z + selection->d);
+    }
+
+    /**
+     * @return Whether the box lies completely inside the selection.
+     */
+    inline bool ContainsBox( const vmanSelection* selection, const vmanSelection* box )
+    {
+        return
+            (box->x >= selection->x) &&
+            (box->x + box->w <= selection->x + selection->w) &&
+
+            (box->y >= selection->y) &&
+            (box->y + box->h <= selection->y + selection->h) &&
+
+            (box->z >= selection->z) &&
+            (box->z + box->d <= selection->z + selection->d);
+    }
+
 
     // --- Threads ---
 
     typedef tthread::lock_guard<tthread::mutex> lock_guard;
 
+    /**
+     * Pointer, which is shared with threads that read it without locking.
+     * Every access is a full memory barrier,
+     * so objects are complete before they're published.
+     * (tthread::atomic doesn't compile with pointers.)
+     */
+    template<class T>
+    class AtomicPointer
+    {
+    public:
+        AtomicPointer() : m_Pointer(NULL) {}
+
+        T* load() const
+        {
+            return __sync_add_and_fetch(const_cast<T* volatile*>(&m_Pointer), 0);
+        }
+
+        void store( T* pointer )
+        {
+            __sync_synchronize();
+            m_Pointer = pointer;
+            __sync_synchronize();
+        }
+
+        operator T* () const { return load(); }
+        T* operator -> () const { return load(); }
+
+        AtomicPointer& operator = ( T* pointer )
+        {
+            store(pointer);
+            return *this;
+        }
+
+    private:
+        AtomicPointer( const AtomicPointer& pointer );
+        AtomicPointer& operator = ( const AtomicPointer& pointer );
+
+        T* volatile m_Pointer;
+    };
+
 
     // --- string ---
 
@@ -122,7 +311,18 @@ namespace vman
 
     // --- time ---
 
-    time_t AddSeconds( const time_t tv, int seconds );
+    /**
+     * Milliseconds since an unspecified point in time.
+     * Unlike `time()` this clock is not affected by changes of the system time.
+     */
+    uint64_t GetMonotonicMilliseconds();
+
+    /**
+     * Milliseconds left of a timeout, which started at `startTime`.
+     * @param timeout Negative values mean that there is no timeout.
+     * @return `-1` if there is no timeout, otherwise `0` once it has expired.
+     */
+    int RemainingMilliseconds( uint64_t startTime, int timeout );
 }
 
 #endif
@@ -5,9 +5,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 #include <set>
 
 #include "Util.h"
+#include "VoxelCodec.h"
 #include "Access.h"
 #include "Volume.h"
 
@@ -18,9 +20,24 @@ namespace vman
 Volume::Volume( const vmanVolumeParameters* p ) :
     m_Layers(&p->layers[0], &p->layers[p->layerCount]),
     m_MaxLayerVoxelSize(0),
+    m_DefaultPages(p->layerCount),
+    m_UniformPages(p->layerCount),
+    m_LayerPools(p->layerCount, NULL),
+    m_ScratchBuffers(this),
+    m_IoBackend(true),
     m_ChunkEdgeLength(p->chunkEdgeLength),
-    m_ChunkMap(),
+    m_EpochManager(),
+    m_ChunkTable(&m_EpochManager),
     m_BaseDir(), // Just to make it clear.
+    m_ChunkStorage(NULL),
+    m_LayerMappingEnabled(false),
+    m_Durability(p->durability),
+    m_Journal(NULL),
+    m_LockManager(this, &m_ChunkTable),
+    m_ChunkCache(),
+    m_MaxResidentBytes(p->maxResidentBytes),
+    m_ResidentBytes(),
+    m_EvictionMutex(),
     m_Mutex(),
 	m_LogFn(p->logFn),
     m_LogMutex(),
@@ -28,7 +45,10 @@ Volume::Volume( const vmanVolumeParameters* p ) :
 
     m_UnusedChunkTimeout(4),
     m_ModifiedChunkTimeout(3),
+    m_IdleChunkTimeout(-1),
     m_ScheduledChecks(),
+    m_JournalFlushDeadline(NO_DEADLINE),
+    m_ScheduledDeadlines(),
     m_ScheduledChecksMutex(),
     m_SchedulerReevaluateCondition(),
     m_SchedulerThread(NULL),
@@ -36,41 +56,109 @@ Volume::Volume( const vmanVolumeParameters* p ) :
 
     m_NewJobCondition(),
     m_JobListMutex(),
-    m_JobList(),
+    m_LoadJobs(LOAD_JOB),
+    m_SaveJobs(SAVE_JOB),
     m_ActiveLoadJobs(0),
     m_ActiveSaveJobs(0),
     m_JobThreads(),
+    m_RetiredJobThreads(),
+    m_MinJobWorkers(0),
+    m_MaxJobWorkers(0),
+    m_IdleJobWorkers(0),
+    m_StartedJobWorkers(0),
+    m_AverageJobDuration(0),
+    m_FixedJobDuration(-1),
     m_StopJobThreads(0)
 {
     if(p->baseDir != NULL)
+    {
         m_BaseDir = p->baseDir;
+        m_ChunkStorage = new ChunkStorage(this, p->baseDir, p->regionEdgeLength, p->durability);
+        if(m_ChunkStorage->usesRegionFiles())
+            m_ChunkStorage->migrateChunkFiles();
+        log(VMAN_LOG_DEBUG, "Chunk I/O uses %s.\n", m_IoBackend.usesIoUring() ? "io_uring" : "blocking system calls");
+    }
 
     for(int i = 0; i < m_Layers.size(); ++i)
     {
-        const vmanLayer* layer = &m_Layers[i];
+        vmanLayer* layer = &m_Layers[i];
 
         assert(layer->name != NULL);
         assert(strlen(layer->name) > 0);
         assert(strlen(layer->name) <= VMAN_MAX_LAYER_NAME_LENGTH);
         assert(layer->voxelSize > 0);
         assert(layer->revision > 0);
-        assert(layer->serializeFn != NULL);
-        assert(layer->deserializeFn != NULL);
 
         if(layer->voxelSize > m_MaxLayerVoxelSize)
             m_MaxLayerVoxelSize = layer->voxelSize;
+
+        // Mapping is only worth it, if there are layers that can be mapped.
+        if(p->mapLayers && m_ChunkStorage != NULL && layer->deserializeFn == NULL)
+            m_LayerMappingEnabled = true;
+
+        const int voxelCount = getVoxelsPerChunk();
+        char* defaultPage = new char[voxelCount*layer->voxelSize];
+        if(layer->defaultValue != NULL)
+            FillVoxels((const char*)layer->defaultValue, voxelCount, layer->voxelSize, defaultPage);
+        else
+            memset(defaultPage, 0, voxelCount*layer->voxelSize);
+        m_DefaultPages[i] = defaultPage;
+        layer->defaultValue = defaultPage;
+
+        for(int j = 0; j < i; ++j)
+            if(m_Layers[j].voxelSize == layer->voxelSize)
+                m_LayerPools[i] = m_LayerPools[j];
+        if(m_LayerPools[i] == NULL)
+            m_LayerPools[i] = new LayerPool(this, voxelCount*layer->voxelSize);
     }
 
     resetStatistics();
 
-    int workerCount = 4; // tthread::thread::hardware_concurrency() * 2; // This should do the trick at first.
-    if(m_BaseDir.empty())
-        workerCount = 0;
+    if(m_ChunkStorage != NULL)
+    {
+        // A journal that is still there belongs to a volume, which wasn't closed properly.
+        m_Journal = new Journal(this, p->baseDir, m_Durability);
+        if(replayJournal() == false)
+        {
+            log(VMAN_LOG_ERROR, "Journal couldn't be replayed, it's kept for another attempt.\n");
+            delete m_Journal;
+            m_Journal = NULL;
+        }
+        else if(p->enableJournal)
+        {
+            if(m_Journal->open() == false)
+            {
+                delete m_Journal;
+                m_Journal = NULL;
+            }
+        }
+        else
+        {
+            m_Journal->removeFiles();
+            delete m_Journal;
+            m_Journal = NULL;
+        }
+    }
 
-    m_JobThreads.resize(workerCount);
-    for(int i = 0; i < workerCount; ++i)
+    if(m_BaseDir.empty() == false)
     {
-        m_JobThreads[i] = new tthread::thread(JobThreadWrapper, this, Format("JobWorker %d", i).c_str());
+        m_MinJobWorkers = p->workerCount;
+        if(m_MinJobWorkers <= 0)
+        {
+            // The workers mostly wait for the disk.
+            m_MinJobWorkers = tthread::thread::hardware_concurrency() * 2;
+            if(m_MinJobWorkers < MIN_DEFAULT_WORKERS)
+                m_MinJobWorkers = MIN_DEFAULT_WORKERS;
+            if(m_MinJobWorkers > MAX_DEFAULT_WORKERS)
+                m_MinJobWorkers = MAX_DEFAULT_WORKERS;
+        }
+        m_MaxJobWorkers = std::max(m_MinJobWorkers, p->maxWorkerCount);
+    }
+
+    {
+        lock_guard jobListGuard(m_JobListMutex);
+        for(int i = 0; i < m_MinJobWorkers; ++i)
+            addJobWorker();
     }
 
     m_SchedulerThread = new tthread::thread(SchedulerThreadWrapper, this, "Scheduler");
@@ -83,11 +171,9 @@ Volume::Volume( const vmanVolumeParameters* p ) :
 Volume::~Volume()
 {
     // DEBUG START
-    m_ScheduledChecksMutex.lock();
     log(VMAN_LOG_DEBUG, "%d scheduled checks.\n",
-        m_ScheduledChecks.size()
+        getScheduledCheckCount()
     );
-    m_ScheduledChecksMutex.unlock();
     // DEBUG END
 
     m_StopSchedulerThread = 1;
@@ -105,27 +191,50 @@ Volume::~Volume()
     // DEBUG START
     m_JobListMutex.lock();
     log(VMAN_LOG_DEBUG, "%d enqueued jobs.\n",
-        m_JobList.size()
+        getEnqueuedJobCount()
     );
     m_JobListMutex.unlock();
     // DEBUG END
 
-    m_StopJobThreads = 1;
-    m_NewJobCondition.notify_all();
-    std::vector<tthread::thread*>::iterator i = m_JobThreads.begin();
-    for(; i != m_JobThreads.end(); ++i)
+    stopJobWorkers();
+
+    // All chunks have been saved, so the journal isn't needed anymore.
+    delete m_Journal;
+    m_Journal = NULL;
+
+    // Unloaded chunks still need the layer pools.
+    m_EpochManager.deleteRetired();
+
+    std::vector<Chunk*> chunks;
+    for(int stripe = 0; stripe < ChunkTable::STRIPE_COUNT; ++stripe)
     {
-        if((*i)->joinable())
-            (*i)->join();
-        delete *i;
+        lock_guard stripeGuard(*m_ChunkTable.getStripeMutex(stripe));
+        m_ChunkTable.getStripeChunks(stripe, &chunks);
+    }
+    for(int j = 0; j < chunks.size(); ++j)
+    {
+        assert(chunks[j] != NULL);
+        delete chunks[j];
     }
 
+    delete m_ChunkStorage;
+    m_ChunkStorage = NULL;
 
-    std::map<ChunkId,Chunk*>::const_iterator j = m_ChunkMap.begin();
-    for(; j != m_ChunkMap.end(); ++j)
+    for(int i = 0; i < m_Layers.size(); ++i)
     {
-        assert(j->second != NULL);
-        delete j->second;
+        delete[] m_DefaultPages[i];
+
+        std::map<std::string,char*>::const_iterator j = m_UniformPages[i].begin();
+        for(; j != m_UniformPages[i].end(); ++j)
+            delete[] j->second;
+
+        // Shared pools are deleted by the first layer that uses them.
+        bool shared = false;
+        for(int k = 0; k < i; ++k)
+            if(m_LayerPools[k] == m_LayerPools[i])
+                shared = true;
+        if(!shared)
+            delete m_LayerPools[i];
     }
 
     s_PanicMutex.lock();
@@ -151,27 +260,19 @@ void Volume::panicExit()
 {
     /*
     lock_guard guard(m_Mutex);
-    for(; i != m_ChunkMap.end(); ++i)
+    for(; i != m_ChunkTable.end(); ++i)
     {
         Chunk* chunk = i->second;
         assert(chunk != NULL);
 
-        lock_guard chunkGuard(*chunk->getMutex());
+        exclusive_lock_guard chunkGuard(*chunk->getMutex());
         if(chunk->isModified())
             chunk->saveToFile();
     }
     */
 
     saveModifiedChunks();
-    
-    m_StopJobThreads = 1;
-    m_NewJobCondition.notify_all();
-    std::vector<tthread::thread*>::iterator i = m_JobThreads.begin();
-    for(; i != m_JobThreads.end(); ++i)
-    {
-        if((*i)->joinable())
-            (*i)->join();
-    }
+    stopJobWorkers();
 }
 
 int Volume::getLayerCount() const
@@ -204,6 +305,56 @@ int Volume::getLayerIndexByName( const char* name ) const
     return -1;
 }
 
+const char* Volume::getDefaultPage( int layerIndex ) const
+{
+    assert(layerIndex >= 0);
+    assert(layerIndex < getLayerCount());
+    return m_DefaultPages[layerIndex];
+}
+
+const char* Volume::getUniformPage( int layerIndex, const char* voxel )
+{
+    assert(layerIndex >= 0);
+    assert(layerIndex < getLayerCount());
+
+    const int voxelSize = m_Layers[layerIndex].voxelSize;
+    if(memcmp(voxel, m_DefaultPages[layerIndex], voxelSize) == 0)
+        return m_DefaultPages[layerIndex];
+
+    lock_guard guard(m_UniformPagesMutex);
+
+    std::map<std::string,char*>& pages = m_UniformPages[layerIndex];
+    const std::string key(voxel, voxelSize);
+    std::map<std::string,char*>::const_iterator i = pages.find(key);
+    if(i != pages.end())
+        return i->second;
+
+    if(pages.size() >= MAX_UNIFORM_PAGES)
+        return NULL;
+
+    char* page = new char[getVoxelsPerChunk()*voxelSize];
+    FillVoxels(voxel, getVoxelsPerChunk(), voxelSize, page);
+    pages.insert( std::pair<std::string,char*>(key, page) );
+    return page;
+}
+
+LayerPool* Volume::getLayerPool( int layerIndex )
+{
+    assert(layerIndex >= 0);
+    assert(layerIndex < getLayerCount());
+    return m_LayerPools[layerIndex];
+}
+
+ScratchBufferPool* Volume::getScratchBuffers()
+{
+    return &m_ScratchBuffers;
+}
+
+IoBackend* Volume::getIoBackend()
+{
+    return &m_IoBackend;
+}
+
 int Volume::getChunkEdgeLength() const
 {
     return m_ChunkEdgeLength;
@@ -217,18 +368,129 @@ const char* Volume::getBaseDir() const
         return m_BaseDir.c_str();
 }
 
-std::string Volume::getChunkFileName( int chunkX, int chunkY, int chunkZ ) const
+ChunkStorage* Volume::getChunkStorage()
 {
-    if(m_BaseDir.empty())
-        return "";
+    return m_ChunkStorage;
+}
+
+bool Volume::isLayerMappingEnabled() const
+{
+    return m_LayerMappingEnabled;
+}
+
+Journal* Volume::getJournal()
+{
+    return m_Journal;
+}
+
+LockManager* Volume::getLockManager()
+{
+    return &m_LockManager;
+}
+
+size_t Volume::getResidentBytes() const
+{
+    return m_ResidentBytes.load();
+}
+
+size_t Volume::getMaxResidentBytes() const
+{
+    return m_MaxResidentBytes;
+}
+
+bool Volume::isOverBudget() const
+{
+    return m_MaxResidentBytes > 0 &&
+           m_ResidentBytes.load() > m_MaxResidentBytes;
+}
+
+void Volume::incResidentBytes( size_t bytes )
+{
+    m_ResidentBytes.fetch_add(bytes);
+}
+
+void Volume::decResidentBytes( size_t bytes )
+{
+    assert(m_ResidentBytes.load() >= bytes);
+    m_ResidentBytes.fetch_sub(bytes);
+}
+
+int Volume::evictChunks()
+{
+    if(m_EvictionMutex.try_lock() == false)
+        return 0;
+
+    std::vector<ChunkId> ids;
+    {
+        lock_guard cacheGuard(*m_ChunkCache.getMutex());
+        m_ChunkCache.getEvictionOrder(&ids);
+    }
 
-    char buffer[256];
-    sprintf(buffer,"%d_%d_%d",chunkX,chunkY,chunkZ);
+    int evictedChunks = 0;
+    for(int i = 0; i < ids.size() && isOverBudget(); ++i)
+    {
+        lock_guard stripeGuard(*m_ChunkTable.getMutex(ids[i]));
+        Chunk* chunk = getLoadedChunkById(ids[i]);
+        if(chunk != NULL && evictChunk(chunk))
+            evictedChunks++;
+    }
 
-    std::string r = m_BaseDir;
-    r += DirSep;
-    r += buffer;
-    return r;
+    m_EvictionMutex.unlock();
+    return evictedChunks;
+}
+
+bool Volume::evictChunk( Chunk* chunk )
+{
+    // Chunks that are about to be accessed or processed by a job stay.
+    if(chunk->isUnused() == false || chunk->hasJobs())
+        return false;
+
+    if(chunk->getMutex()->try_lock() == false)
+        return false;
+
+    if(chunk->isModified())
+    {
+        if(m_BaseDir.empty() == false)
+        {
+            // Save it with high priority, so it can be evicted afterwards.
+            lock_guard jobListGuard(m_JobListMutex);
+            addJob(SAVE_JOB, INT_MAX, chunk);
+        }
+        chunk->getMutex()->unlock();
+        return false;
+    }
+
+    log(VMAN_LOG_DEBUG, "Evicting chunk %s ...\n", chunk->toString().c_str());
+    if(unloadChunk(chunk) == false)
+        return false;
+    incStatistic(STATISTIC_CHUNK_EVICT_OPS);
+    return true;
+}
+
+static void DeleteChunk( void* chunk )
+{
+    delete reinterpret_cast<Chunk*>(chunk);
+}
+
+bool Volume::unloadChunk( Chunk* chunk )
+{
+    // Lookups without the chunk table mutex may have referenced it meanwhile.
+    if(chunk->markUnloaded() == false)
+    {
+        chunk->getMutex()->unlock();
+        return false;
+    }
+
+    chunk->setState(VMAN_CHUNK_EVICTING);
+    m_ChunkTable.erase(chunk->getId());
+    {
+        lock_guard cacheGuard(*m_ChunkCache.getMutex());
+        m_ChunkCache.remove(chunk->getId());
+    }
+    chunk->setState(VMAN_CHUNK_ABSENT);
+    chunk->getMutex()->unlock();
+    m_EpochManager.retire(chunk, DeleteChunk);
+    return true;
 }
 
 void Volume::log( vmanLogLevel level, const char* format, ... ) const
@@ -254,6 +516,7 @@ void Volume::log( vmanLogLevel level, const char* format, ... ) const
 			case VMAN_LOG_WARNING:
 			case VMAN_LOG_ERROR:
 				logfile = stderr;
+				break;
 
 			default:
 				logfile = stdout;
@@ -282,20 +545,42 @@ void Volume::log( vmanLogLevel level, const char* format, ... ) const
 	}
 }
 
+/**
+ * Gauges describe the current state and are not reset.
+ */
+static bool IsGaugeStatistic( int statistic )
+{
+    switch(statistic)
+    {
+        case STATISTIC_COMPRESSED_BYTES:
+        case STATISTIC_UNCOMPRESSED_BYTES:
+        case STATISTIC_LAYER_POOL_RESERVED_BYTES:
+        case STATISTIC_LAYER_POOL_USED_BYTES:
+        case STATISTIC_SCRATCH_BUFFER_BYTES:
+        case STATISTIC_JOB_WORKERS:
+        case STATISTIC_ACTIVE_JOB_WORKERS:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
 void Volume::resetStatistics()
 {
     if(m_StatisticsEnabled)
         for(int i = 0; i < STATISTIC_COUNT; ++i)
-            m_Statistics[i] = 0;
+            if(IsGaugeStatistic(i) == false)
+                m_Statistics[i] = 0;
 }
 
-void Volume::incStatistic( Statistic statistic, int amount )
+void Volume::incStatistic( Statistic statistic, int64_t amount )
 {
     if(m_StatisticsEnabled)
         m_Statistics[statistic].fetch_add(amount);
 }
 
-void Volume::decStatistic( Statistic statistic, int amount )
+void Volume::decStatistic( Statistic statistic, int64_t amount )
 {
     if(m_StatisticsEnabled)
         m_Statistics[statistic].fetch_sub(amount);
@@ -328,6 +613,19 @@ bool Volume::getStatistics( vmanStatistics* statisticsDestination ) const
     statisticsDestination->chunkLoadOps = m_Statistics[STATISTIC_CHUNK_LOAD_OPS];
     statisticsDestination->chunkSaveOps = m_Statistics[STATISTIC_CHUNK_SAVE_OPS];
     statisticsDestination->chunkUnloadOps = m_Statistics[STATISTIC_CHUNK_UNLOAD_OPS];
+    statisticsDestination->chunkEvictOps = m_Statistics[STATISTIC_CHUNK_EVICT_OPS];
+    statisticsDestination->chunkSyncOps = m_Statistics[STATISTIC_CHUNK_SYNC_OPS];
+    statisticsDestination->journalBytes = m_Statistics[STATISTIC_JOURNAL_BYTES];
+
+    statisticsDestination->chunkIndexHits = m_Statistics[STATISTIC_CHUNK_INDEX_HITS];
+    statisticsDestination->chunkIndexMisses = m_Statistics[STATISTIC_CHUNK_INDEX_MISSES];
+
+    statisticsDestination->compressedBytes = m_Statistics[STATISTIC_COMPRESSED_BYTES];
+    statisticsDestination->uncompressedBytes = m_Statistics[STATISTIC_UNCOMPRESSED_BYTES];
+
+    statisticsDestination->layerPoolReservedBytes = m_Statistics[STATISTIC_LAYER_POOL_RESERVED_BYTES];
+    statisticsDestination->layerPoolUsedBytes = m_Statistics[STATISTIC_LAYER_POOL_USED_BYTES];
+    statisticsDestination->scratchBufferBytes = m_Statistics[STATISTIC_SCRATCH_BUFFER_BYTES];
 
     statisticsDestination->readOps = m_Statistics[STATISTIC_READ_OPS];
     statisticsDestination->writeOps = m_Statistics[STATISTIC_WRITE_OPS];
@@ -336,6 +634,17 @@ bool Volume::getStatistics( vmanStatistics* statisticsDestination ) const
     statisticsDestination->maxScheduledChecks = m_Statistics[STATISTIC_MAX_SCHEDULED_CHECKS];
     statisticsDestination->maxEnqueuedJobs = m_Statistics[STATISTIC_MAX_ENQUEUED_JOBS];
 
+    statisticsDestination->jobWorkers = m_Statistics[STATISTIC_JOB_WORKERS];
+    statisticsDestination->activeJobWorkers = m_Statistics[STATISTIC_ACTIVE_JOB_WORKERS];
+    statisticsDestination->jobBusyMilliseconds = m_Statistics[STATISTIC_JOB_BUSY_MILLISECONDS];
+
+    statisticsDestination->lockWaits = m_Statistics[STATISTIC_LOCK_WAITS];
+    statisticsDestination->lockWaitMilliseconds = m_Statistics[STATISTIC_LOCK_WAIT_MILLISECONDS];
+    statisticsDestination->maxLockWaitMilliseconds = m_Statistics[STATISTIC_MAX_LOCK_WAIT_MILLISECONDS];
+
+    statisticsDestination->optimisticReadConflicts = m_Statistics[STATISTIC_OPTIMISTIC_READ_CONFLICTS];
+    statisticsDestination->optimisticReadFallbacks = m_Statistics[STATISTIC_OPTIMISTIC_READ_FALLBACKS];
+
     return true;
 }
 
@@ -386,12 +695,47 @@ void Volume::getSelection( const vmanSelection* chunkSelection, Chunk** chunksOu
         {
             for(int z = 0; z < chunkSelection->d; ++z)
             {
-                Chunk* chunk = getChunkAt(
-                    chunkSelection->x+x,
-                    chunkSelection->y+y,
-                    chunkSelection->z+z,
-                    priority // TODO: Hmm...
-                );
+                const int chunkX = chunkSelection->x+x;
+                const int chunkY = chunkSelection->y+y;
+                const int chunkZ = chunkSelection->z+z;
+
+                const ChunkId id = Chunk::GenerateChunkId(chunkX, chunkY, chunkZ);
+
+                // Loaded chunks are found and referenced without locking.
+                // The epoch keeps them from being deleted meanwhile.
+                Chunk* chunk = NULL;
+                {
+                    EpochGuard epochGuard(&m_EpochManager, m_ChunkTable.getStripe(id));
+                    chunk = m_ChunkTable.get(id);
+                    if(chunk != NULL && chunk->tryAddReference() == false)
+                        chunk = NULL;
+                }
+
+                if(chunk != NULL)
+                {
+                    incStatistic(STATISTIC_CHUNK_GET_HITS);
+                }
+                else
+                {
+                    // Reference the chunk while the stripe is locked,
+                    // so no one can unload it in the meantime.
+                    lock_guard stripeGuard(*m_ChunkTable.getMutex(id));
+                    chunk = getChunkAt(
+                        chunkX,
+                        chunkY,
+                        chunkZ,
+                        priority // TODO: Hmm...
+                    );
+                    chunk->addReference();
+                }
+
+                // The cache only picks chunks for eviction,
+                // so its mutex is spared without a memory budget.
+                if(m_MaxResidentBytes > 0)
+                {
+                    lock_guard cacheGuard(*m_ChunkCache.getMutex());
+                    m_ChunkCache.touch(chunk->getId());
+                }
 
                 chunksOut[ Index3D(
                     chunkSelection->w, chunkSelection->h, chunkSelection->d,
@@ -400,17 +744,19 @@ void Volume::getSelection( const vmanSelection* chunkSelection, Chunk** chunksOu
             }
         }
     }
+
+    // The selected chunks are referenced and can't be evicted.
+    if(isOverBudget())
+        evictChunks();
 }
 
 bool Volume::chunkFileExists( int chunkX, int chunkY, int chunkZ )
 {
-    if(m_BaseDir.empty())
+    if(m_ChunkStorage == NULL)
         return false;
-    const std::string fileName = getChunkFileName(chunkX, chunkY, chunkZ);
-    return GetFileType(fileName.c_str()) == FILE_TYPE_REGULAR;
+    return m_ChunkStorage->chunkExists(chunkX, chunkY, chunkZ);
 }
 
-// TODO: Make sure that chunks returned by this get referenced .. or they may become zombies.
 Chunk* Volume::getChunkAt( int chunkX, int chunkY, int chunkZ, int priority )
 {
     ChunkId id = Chunk::GenerateChunkId(chunkX, chunkY, chunkZ);
@@ -428,13 +774,16 @@ Chunk* Volume::getChunkAt( int chunkX, int chunkY, int chunkZ, int priority )
             log(VMAN_LOG_DEBUG, "Try loading chunk %s ..\n",
                 CoordsToString(chunkX, chunkY, chunkZ).c_str()
             );
+            // Set before anyone can see the chunk,
+            // so no access locks it before the job has run.
+            chunk->setState(VMAN_CHUNK_LOADING);
             lock_guard jobListGuard(m_JobListMutex);
             addJob(LOAD_JOB, priority, chunk);
         }
 
-        m_ChunkMap.insert( std::pair<ChunkId,Chunk*>(id,chunk) );
+        m_ChunkTable.insert(chunk);
 
-        maxStatistic(STATISTIC_MAX_LOADED_CHUNKS, m_ChunkMap.size());
+        maxStatistic(STATISTIC_MAX_LOADED_CHUNKS, m_ChunkTable.getSize());
     }
     else
     {
@@ -445,23 +794,28 @@ Chunk* Volume::getChunkAt( int chunkX, int chunkY, int chunkZ, int priority )
 
 Chunk* Volume::getLoadedChunkById( ChunkId id )
 {
-    std::map<ChunkId,Chunk*>::iterator it = m_ChunkMap.find(id);
-    if(it != m_ChunkMap.end())
-    {
-        assert(id == it->second->getId());
-        return it->second;
-    }
-    else
-    {
-        return NULL;
-    }
+    return m_ChunkTable.get(id);
 }
 
-bool Volume::checkChunk( Chunk* chunk )
+bool Volume::checkChunk( Chunk* chunk, CheckCause cause )
 {
     chunk->getMutex()->lock();
+
+    if(cause == CHECK_CAUSE_IDLE)
+    {
+        if(chunk->isUnused())
+            chunk->compressLayers();
+        chunk->getMutex()->unlock();
+        return false;
+    }
     
-    bool unloadChunk = chunk->isUnused();
+    // Chunks that have jobs are checked again after the job ran.
+    bool unusedChunk = chunk->isUnused() && chunk->hasJobs() == false;
+
+    // With a memory budget unused chunks stay cached, until memory gets scarce.
+    if(m_MaxResidentBytes > 0 && isOverBudget() == false)
+        unusedChunk = false;
+
     bool saveChunk = false;
     
     if(chunk->isModified() && m_BaseDir.empty() == false)
@@ -470,11 +824,14 @@ bool Volume::checkChunk( Chunk* chunk )
         if(getModifiedChunkTimeout() < 0)
             saveChunk = false;
         // Save immediately
-        else if(getModifiedChunkTimeout() == 0 || m_StopJobThreads.load())
+        else if(m_StopJobThreads.load())
             saveChunk = true;
         // Timeout triggered
-        else if(difftime(time(NULL), chunk->getModificationTime()) >= getModifiedChunkTimeout())
-            saveChunk = true;
+        else if(getModifiedChunkTimeout() == 0 ||
+                GetMonotonicMilliseconds() - chunk->getModificationTime() >= getModifiedChunkTimeout()*1000)
+            // Journaled writes are flushed on their own,
+            // so the chunk only needs to be rewritten before it's unloaded.
+            saveChunk = (m_Journal == NULL) || unusedChunk;
     }
 
     if(saveChunk)
@@ -482,13 +839,15 @@ bool Volume::checkChunk( Chunk* chunk )
         lock_guard jobListGuard(m_JobListMutex);
         addJob(SAVE_JOB, 0, chunk); // TODO: Should have minimum priority
     }
-    else if(unloadChunk && chunk->isModified() == false)
+    else if(unusedChunk && chunk->isModified() == false)
     {
-        incStatistic(STATISTIC_CHUNK_UNLOAD_OPS);
         log(VMAN_LOG_DEBUG, "Unloading chunk %s ...\n", chunk->toString().c_str());
-        m_ChunkMap.erase(chunk->getId());
-        chunk->getMutex()->unlock();
-        delete chunk;
+        if(unloadChunk(chunk) == false)
+            return false;
+        if(m_MaxResidentBytes > 0)
+            incStatistic(STATISTIC_CHUNK_EVICT_OPS);
+        else
+            incStatistic(STATISTIC_CHUNK_UNLOAD_OPS);
         return true;
     }
     
@@ -501,22 +860,78 @@ void Volume::saveModifiedChunks()
     if(m_BaseDir.empty())
         return;
 
-    lock_guard jobListGuard(m_JobListMutex);
+    flushJournal();
 
-    std::map<ChunkId,Chunk*>::const_iterator i = m_ChunkMap.begin();
-    for(; i != m_ChunkMap.end(); ++i)
+    std::vector<Chunk*> chunks;
+    for(int stripe = 0; stripe < ChunkTable::STRIPE_COUNT; ++stripe)
     {
-        Chunk* chunk = i->second;
-        assert(chunk != NULL);
+        lock_guard stripeGuard(*m_ChunkTable.getStripeMutex(stripe));
 
-        lock_guard chunkGuard(*chunk->getMutex());
+        chunks.clear();
+        m_ChunkTable.getStripeChunks(stripe, &chunks);
+        for(int i = 0; i < chunks.size(); ++i)
+        {
+            Chunk* chunk = chunks[i];
+            assert(chunk != NULL);
 
-        if(chunk->isModified())
-            addJob(SAVE_JOB, 0, chunk); // TODO: Should have minimum priority
+            exclusive_lock_guard chunkGuard(*chunk->getMutex());
+
+            if(chunk->isModified())
+            {
+                lock_guard jobListGuard(m_JobListMutex);
+                addJob(SAVE_JOB, 0, chunk); // TODO: Should have minimum priority
+            }
+        }
     }
 }
 
 
+bool Volume::replayJournal()
+{
+    std::vector<Journal::Record> records;
+    std::vector<char> voxels;
+    if(m_Journal->readStoredRecords(&records, &voxels) == false)
+        return false;
+    if(records.empty())
+        return true;
+
+    log(VMAN_LOG_INFO, "Replaying %d journaled voxel writes ..\n", int(records.size()));
+
+    // Chunks are updated one after another, since there are no workers yet.
+    std::map<ChunkId,Chunk*> chunks;
+    for(int i = 0; i < records.size(); ++i)
+    {
+        const Journal::Record& record = records[i];
+        Chunk*& chunk = chunks[record.chunkId];
+        if(chunk == NULL)
+        {
+            int chunkX, chunkY, chunkZ;
+            Chunk::UnpackChunkId(record.chunkId, &chunkX, &chunkY, &chunkZ);
+            chunk = new Chunk(this, chunkX, chunkY, chunkZ);
+            if(chunkFileExists(chunkX, chunkY, chunkZ))
+                chunk->loadFromFile();
+        }
+        const int voxelSize = getLayer(record.layer)->voxelSize;
+        for(int j = 0; j < record.voxelCount; ++j)
+            chunk->writeVoxel(record.layer, record.voxelIndex + j, &voxels[record.voxelOffset + j*voxelSize]);
+    }
+
+    bool success = true;
+    std::map<ChunkId,Chunk*>::iterator i = chunks.begin();
+    for(; i != chunks.end(); ++i)
+    {
+        Chunk* chunk = i->second;
+        if(chunk->isModified() && chunk->saveToFile() == false)
+        {
+            log(VMAN_LOG_ERROR, "Can't save replayed chunk %s.\n", chunk->toString().c_str());
+            chunk->unsetModified();
+            success = false;
+        }
+        delete chunk;
+    }
+    return success;
+}
+
 
 /* --- Scheduled Tasks --- */
 
@@ -540,9 +955,35 @@ int Volume::getModifiedChunkTimeout() const
     return m_ModifiedChunkTimeout;
 }
 
-void Volume::scheduleCheck( CheckCause cause, Chunk* chunk )
+void Volume::setIdleChunkTimeout( int seconds )
+{
+    m_IdleChunkTimeout = (seconds < 0) ? -1 : seconds;
+}
+
+int Volume::getIdleChunkTimeout() const
+{
+    return m_IdleChunkTimeout;
+}
+
+const uint64_t Volume::NO_DEADLINE;
+
+uint64_t Volume::ScheduledCheck::getNextDeadline() const
+{
+    uint64_t deadline = NO_DEADLINE;
+    for(int i = 0; i < CHECK_CAUSE_COUNT; ++i)
+        if(deadlines[i] < deadline)
+            deadline = deadlines[i];
+    return deadline;
+}
+
+bool Volume::ScheduledDeadline::operator > ( const ScheduledDeadline& other ) const
+{
+    return time > other.time;
+}
+
+void Volume::scheduleCheck( CheckCause cause, ChunkId chunkId )
 {
-    int seconds = 0.0;
+    int seconds = 0;
     switch(cause)
     {
         case CHECK_CAUSE_UNUSED:
@@ -553,30 +994,134 @@ void Volume::scheduleCheck( CheckCause cause, Chunk* chunk )
             seconds = getModifiedChunkTimeout();
             break;
 
+        case CHECK_CAUSE_IDLE:
+            seconds = getIdleChunkTimeout();
+            break;
+
         default:
             assert(false);
     }
 
-    scheduleCheck(chunk, seconds);
+    // Negative timeouts disable the check.
+    if(seconds < 0)
+        return;
+
+    scheduleCheck(chunkId, cause, seconds*1000);
 }
 
-void Volume::scheduleCheck( Chunk* chunk, double seconds )
+void Volume::scheduleCheck( ChunkId chunkId, CheckCause cause, int milliseconds )
 {
-    if(m_StopSchedulerThread == true)
+    if(m_StopSchedulerThread.load())
         return;
 
-    ScheduledCheck check;
-    check.executionTime = AddSeconds(time(NULL), seconds);
-    check.chunkId = chunk->getId();
+    const uint64_t deadline = GetMonotonicMilliseconds() + milliseconds;
+    bool isEarliest = false;
 
     m_ScheduledChecksMutex.lock();
-    m_ScheduledChecks.push_back(check); // TODO: Sort in correctly
+    {
+        std::map<ChunkId,ScheduledCheck>::iterator i = m_ScheduledChecks.find(chunkId);
+        if(i == m_ScheduledChecks.end())
+        {
+            ScheduledCheck check;
+            for(int j = 0; j < CHECK_CAUSE_COUNT; ++j)
+                check.deadlines[j] = NO_DEADLINE;
+            i = m_ScheduledChecks.insert( std::pair<ChunkId,ScheduledCheck>(chunkId, check) ).first;
+        }
+
+        // The timeout starts with the latest event.
+        ScheduledCheck& check = i->second;
+        const uint64_t previousDeadline = check.getNextDeadline();
+        check.deadlines[cause] = deadline;
+
+        const uint64_t nextDeadline = check.getNextDeadline();
+        if(nextDeadline != previousDeadline)
+        {
+            pushDeadline(chunkId, nextDeadline);
+            isEarliest = (m_ScheduledDeadlines.top().time == nextDeadline);
+        }
+    }
     maxStatistic(STATISTIC_MAX_SCHEDULED_CHECKS, m_ScheduledChecks.size());
     m_ScheduledChecksMutex.unlock();
 
+    // The scheduler only needs to wake up, if it would sleep too long.
+    if(isEarliest)
+        m_SchedulerReevaluateCondition.notify_one();
+}
+
+void Volume::pushDeadline( ChunkId chunkId, uint64_t time )
+{
+    ScheduledDeadline entry;
+    entry.time = time;
+    entry.chunkId = chunkId;
+    m_ScheduledDeadlines.push(entry);
+
+    if(m_ScheduledDeadlines.size() <= m_ScheduledChecks.size()*2 + MIN_HEAP_SLACK)
+        return;
+
+    // Rebuild the heap from the valid deadlines.
+    std::vector<ScheduledDeadline> entries;
+    entries.reserve(m_ScheduledChecks.size());
+    std::map<ChunkId,ScheduledCheck>::const_iterator i = m_ScheduledChecks.begin();
+    for(; i != m_ScheduledChecks.end(); ++i)
+    {
+        entry.time = i->second.getNextDeadline();
+        entry.chunkId = i->first;
+        if(entry.time != NO_DEADLINE)
+            entries.push_back(entry);
+    }
+    m_ScheduledDeadlines = std::priority_queue<
+        ScheduledDeadline,
+        std::vector<ScheduledDeadline>,
+        std::greater<ScheduledDeadline>
+    >(std::greater<ScheduledDeadline>(), entries);
+}
+
+int Volume::getScheduledCheckCount() const
+{
+    lock_guard guard(m_ScheduledChecksMutex);
+    return m_ScheduledChecks.size();
+}
+
+void Volume::scheduleJournalFlush()
+{
+    if(m_Journal == NULL || getModifiedChunkTimeout() < 0)
+        return;
+
+    const uint64_t deadline = GetMonotonicMilliseconds() + getModifiedChunkTimeout()*1000;
+    {
+        lock_guard scheduledChecksGuard(m_ScheduledChecksMutex);
+        if(m_JournalFlushDeadline != NO_DEADLINE || m_StopSchedulerThread.load())
+            return;
+        m_JournalFlushDeadline = deadline;
+    }
     m_SchedulerReevaluateCondition.notify_one();
 }
 
+void Volume::flushJournal()
+{
+    if(m_Journal == NULL)
+        return;
+
+    std::vector<ChunkId> checkpointChunks;
+    m_Journal->flush(&checkpointChunks);
+
+    // The old journal is deleted, once these have been rewritten.
+    for(int i = 0; i < checkpointChunks.size(); ++i)
+    {
+        lock_guard stripeGuard(*m_ChunkTable.getMutex(checkpointChunks[i]));
+        Chunk* chunk = getLoadedChunkById(checkpointChunks[i]);
+        if(chunk == NULL)
+            continue;
+
+        exclusive_lock_guard chunkGuard(*chunk->getMutex());
+        if(chunk->isModified())
+        {
+            lock_guard jobListGuard(m_JobListMutex);
+            addJob(SAVE_JOB, 0, chunk);
+        }
+    }
+}
+
 void Volume::SchedulerThreadWrapper( void* volumeInstance )
 {
     reinterpret_cast<Volume*>(volumeInstance)->schedulerThreadFn();
@@ -584,46 +1129,107 @@ void Volume::SchedulerThreadWrapper( void* volumeInstance )
 
 void Volume::schedulerThreadFn()
 {
-    static const double NO_WAIT_EPSILON = 0.1; // In seconds
+    std::vector<CheckCause> causes;
 
     while(true)
     {
-        ScheduledCheck check;
+        ChunkId chunkId = 0;
+        causes.clear();
+        bool journalFlushDue = false;
 
         {
             lock_guard scheduledChecksGuard(m_ScheduledChecksMutex);
 
-            while(m_ScheduledChecks.empty())
+            while(causes.empty() && !journalFlushDue)
             {
-                if(m_StopSchedulerThread.load())
-                    return;
+                // Remaining checks are run immediately when stopping.
+                const bool stopping = m_StopSchedulerThread.load();
+                const uint64_t now = GetMonotonicMilliseconds();
 
-                m_SchedulerReevaluateCondition.wait(m_ScheduledChecksMutex);
+                if(m_JournalFlushDeadline != NO_DEADLINE &&
+                   (m_JournalFlushDeadline <= now || stopping))
+                {
+                    m_JournalFlushDeadline = NO_DEADLINE;
+                    journalFlushDue = true;
+                    continue;
+                }
 
-                if(m_ScheduledChecks.empty() && m_StopSchedulerThread.load())
-                    return;
-            }
+                if(m_ScheduledDeadlines.empty())
+                {
+                    if(stopping)
+                        return;
+                    if(m_JournalFlushDeadline == NO_DEADLINE)
+                    {
+                        m_SchedulerReevaluateCondition.wait(m_ScheduledChecksMutex);
+                    }
+                    else
+                    {
+                        const uint64_t wakeTime = m_JournalFlushDeadline;
+                        const tthread::chrono::milliseconds milliseconds(wakeTime > now ? wakeTime - now : 0);
+                        m_SchedulerReevaluateCondition.wait_for(m_ScheduledChecksMutex, milliseconds);
+                    }
+                    continue;
+                }
+
+                const ScheduledDeadline next = m_ScheduledDeadlines.top();
+                std::map<ChunkId,ScheduledCheck>::iterator i = m_ScheduledChecks.find(next.chunkId);
+                if(i == m_ScheduledChecks.end() || i->second.getNextDeadline() != next.time)
+                {
+                    // Has been rescheduled.
+                    m_ScheduledDeadlines.pop();
+                    continue;
+                }
 
-            check = m_ScheduledChecks.front();
-            m_ScheduledChecks.pop_front();
+                if(next.time > now && !stopping)
+                {
+                    // Only the checks mutex is released while waiting.
+                    // New earlier checks wake us up, then everything is evaluated again.
+                    const uint64_t wakeTime = std::min(next.time, m_JournalFlushDeadline);
+                    const tthread::chrono::milliseconds milliseconds(wakeTime > now ? wakeTime - now : 0);
+                    m_SchedulerReevaluateCondition.wait_for(m_ScheduledChecksMutex, milliseconds);
+                    continue;
+                }
+
+                m_ScheduledDeadlines.pop();
+                chunkId = next.chunkId;
+
+                ScheduledCheck& check = i->second;
+                for(int cause = 0; cause < CHECK_CAUSE_COUNT; ++cause)
+                {
+                    if(check.deadlines[cause] <= now || stopping)
+                    {
+                        if(check.deadlines[cause] != NO_DEADLINE)
+                            causes.push_back(CheckCause(cause));
+                        check.deadlines[cause] = NO_DEADLINE;
+                    }
+                }
+
+                const uint64_t remainingDeadline = check.getNextDeadline();
+                if(remainingDeadline == NO_DEADLINE)
+                    m_ScheduledChecks.erase(i);
+                else
+                    pushDeadline(chunkId, remainingDeadline);
+            }
         }
-        
+
+        if(journalFlushDue)
+            flushJournal();
+
+        for(int i = 0; i < causes.size(); ++i)
         {
-            lock_guard volumeGuard(m_Mutex);
-            
-            const double waitTime = m_StopSchedulerThread.load() ? 0.0 : difftime(check.executionTime, time(NULL));
-            if(waitTime > NO_WAIT_EPSILON)
-            {
-                const tthread::chrono::milliseconds milliseconds(waitTime*1000);
-                m_SchedulerReevaluateCondition.wait_for(m_Mutex, milliseconds);
-            }
+            lock_guard stripeGuard(*m_ChunkTable.getMutex(chunkId));
 
-            Chunk* chunk = getLoadedChunkById(check.chunkId);
-            if(chunk != NULL)
-            {
-                checkChunk(chunk);
-            }
+            Chunk* chunk = getLoadedChunkById(chunkId);
+            if(chunk == NULL)
+                break;
+            checkChunk(chunk, causes[i]);
         }
+
+        // Chunks, which were unloaded while lookups were running.
+        m_EpochManager.reclaim();
+
+        if(isOverBudget())
+            evictChunks();
     }
 }
 
@@ -632,104 +1238,286 @@ void Volume::schedulerThreadFn()
 
 /* --- Load/Save Jobs --- */
 
-std::list<JobEntry>::iterator Volume::findJobByChunk( Chunk* chunk )
+void Volume::addJob( JobType type, int priority, Chunk* chunk )
+{
+    // Neither the load nor the save jobs can be run if disk access has been disabled.
+    assert(m_BaseDir.empty() == false);
+
+    // A chunk may have a load and a save job at the same time,
+    // but only one of each type.
+    if(getJobQueue(type)->push(priority, chunk) == false)
+        return;
+
+    maxStatistic(STATISTIC_MAX_ENQUEUED_JOBS, getEnqueuedJobCount());
+    adaptJobWorkers();
+
+    // Notify one waiting thread, that there is a new job available
+    m_NewJobCondition.notify_one();
+}
+
+JobEntry Volume::getJob()
 {
-    std::list<JobEntry>::iterator i = m_JobList.begin();
-    for(; i != m_JobList.end(); ++i)
+    // Save and load job should be distributed equally on the threads.
+    // I.e. if more save than load jobs run, the latter one should be picked.
+    // (If one exists)
+
+    JobQueue* favoredJobs;
+    JobQueue* otherJobs;
+    if(m_ActiveSaveJobs > m_ActiveLoadJobs)
     {
-        if(i->getChunk() == chunk)
-            return i;
+        favoredJobs = &m_LoadJobs; // We favor a load job.
+        otherJobs = &m_SaveJobs;
+    }
+    else
+    {
+        favoredJobs = &m_SaveJobs; // We favor a save job.
+        otherJobs = &m_LoadJobs;
+    }
+
+    JobEntry job = favoredJobs->pop();
+    if(job.getType() == INVALID_JOB)
+        job = otherJobs->pop(); // The favored job type was not found. :(
+
+    switch(job.getType())
+    {
+        case LOAD_JOB: m_ActiveLoadJobs++; break;
+        case SAVE_JOB: m_ActiveSaveJobs++; break;
+        default: ;
     }
-    return m_JobList.end();
+    return job;
 }
 
-void Volume::addJob( JobType type, int priority, Chunk* chunk )
+void Volume::finishJob( JobType type, uint64_t duration )
 {
-    // Neither the load nor the save jobs can be run if disk access has been disabled.
-    assert(m_BaseDir.empty() == false);
+    switch(type)
+    {
+        case LOAD_JOB: m_ActiveLoadJobs--; break;
+        case SAVE_JOB: m_ActiveSaveJobs--; break;
+        default: assert(false);
+    }
+
+    m_AverageJobDuration = m_AverageJobDuration*0.9 + double(duration)*0.1;
+}
 
-    std::list<JobEntry>::iterator jobWithSameChunk = findJobByChunk(chunk);
-    if(jobWithSameChunk->getType() != INVALID_JOB)
+void Volume::collectJobs( JobType type, int maxJobs, std::vector<JobEntry>* jobs )
+{
+    JobQueue* queue = getJobQueue(type);
+    while(jobs->size() < maxJobs)
     {
-        if(type == jobWithSameChunk->getType())
+        JobEntry job = queue->pop();
+        if(job.getType() == INVALID_JOB)
+            break;
+
+        if(job.getChunk()->getMutex()->try_lock() == false)
         {
-            if(priority > jobWithSameChunk->getPriority())
-            {
-                m_JobList.erase(jobWithSameChunk);
-            }
-            else
-            {
-                // If there is already a job of this type enqueued
-                // and it has a even higher priority,
-                // just abort, since we dont't need to do run enqueued jobs twice.
-                return;
-            }
+            // The chunk is busy, so the job goes back to its place.
+            queue->push(job.getPriority(), job.getChunk());
+            break;
         }
-        else
+
+        switch(type)
         {
-            // load <=> save:
-            //assert(!"Unimplemented!");
+            case LOAD_JOB: m_ActiveLoadJobs++; break;
+            case SAVE_JOB: m_ActiveSaveJobs++; break;
+            default: assert(false);
         }
+        jobs->push_back(job);
+    }
+}
+
+void Volume::loadChunks( const std::vector<JobEntry>& jobs, std::vector<bool>* resultsOut )
+{
+    std::vector<ChunkStorage::ChunkRead> reads(jobs.size());
+    std::vector< std::vector<char>* > buffers(jobs.size());
+    for(int i = 0; i < jobs.size(); ++i)
+    {
+        const Chunk* chunk = jobs[i].getChunk();
+        buffers[i] = m_ScratchBuffers.acquire();
+        reads[i].chunkX = chunk->getChunkX();
+        reads[i].chunkY = chunk->getChunkY();
+        reads[i].chunkZ = chunk->getChunkZ();
+        reads[i].dataOut = buffers[i];
+    }
+
+    m_ChunkStorage->readChunks(&reads[0], reads.size());
+
+    // Unused chunks are loaded too, since they may stay cached.
+    for(int i = 0; i < jobs.size(); ++i)
+    {
+        const std::vector<char>& data = *buffers[i];
+        const bool success = reads[i].success &&
+            jobs[i].getChunk()->loadFromData(&data[0], data.size());
+        resultsOut->push_back(success);
+        m_ScratchBuffers.release(buffers[i]);
+    }
+}
+
+void Volume::saveChunks( const std::vector<JobEntry>& jobs, std::vector<bool>* resultsOut )
+{
+    if(jobs.size() > 1)
+        log(VMAN_LOG_DEBUG, "Saving %d chunks in one batch ..\n", int(jobs.size()));
+
+    // Write-ahead: Records of these chunks must reach the journal before the chunks do,
+    // otherwise replaying their older records would undo the save.
+    // Checkpoints are left to the scheduler, since it needs the chunk mutexes.
+    if(m_Journal != NULL && m_Journal->flush(NULL) == false)
+    {
+        log(VMAN_LOG_ERROR, "Not saving %d chunks, since the journal couldn't be flushed.\n", int(jobs.size()));
+        resultsOut->resize(resultsOut->size() + jobs.size(), false);
+        return;
+    }
+
+    // Chunks are either replaced or patched in place.
+    std::vector<ChunkStorage::ChunkWrite> writes(jobs.size());
+    std::vector< std::vector<IoVector> > parts(jobs.size());
+    std::vector< std::vector<uint32_t> > offsets(jobs.size());
+    std::vector< std::vector<char>* > buffers(jobs.size()*2);
+    for(int i = 0; i < jobs.size(); ++i)
+    {
+        Chunk* chunk = jobs[i].getChunk();
+        std::vector<char>* header = buffers[i*2] = m_ScratchBuffers.acquire();
+        std::vector<char>* layerData = buffers[i*2+1] = m_ScratchBuffers.acquire();
+        chunk->serializeChanges(header, layerData, &parts[i], &offsets[i]);
+
+        writes[i].chunkX = chunk->getChunkX();
+        writes[i].chunkY = chunk->getChunkY();
+        writes[i].chunkZ = chunk->getChunkZ();
+        writes[i].parts = &parts[i][0];
+        writes[i].partCount = parts[i].size();
+        writes[i].offsets = offsets[i].empty() ? NULL : &offsets[i][0];
     }
 
-    const JobEntry job(priority, type, chunk);
+    m_ChunkStorage->writeChunks(&writes[0], writes.size());
 
-    // Sort in the job.
-    std::list<JobEntry>::iterator i = m_JobList.begin();
-    for(; i != m_JobList.end(); ++i)
+    bool journalObsolete = false;
+    for(int i = 0; i < jobs.size(); ++i)
     {
-        // This has the neat side effect that,
-        // if there are jobs with equal priority,
-        // new jobs are inserted *after* the old ones.
-        if(job.getPriority() > i->getPriority())
+        Chunk* chunk = jobs[i].getChunk();
+        if(writes[i].success)
         {
-            m_JobList.insert(i, job);
-            break;
+            chunk->unsetModified();
+            if(m_Journal != NULL && m_Journal->chunkSaved(chunk->getId()))
+                journalObsolete = true;
         }
+        resultsOut->push_back(writes[i].success);
     }
 
-    // If there is no job that has a lower priority like us ..
-    if(i == m_JobList.end())
-        m_JobList.push_back(job);
+    // The next flush shrinks the journal.
+    if(journalObsolete)
+        scheduleJournalFlush();
 
-    maxStatistic(STATISTIC_MAX_ENQUEUED_JOBS, m_JobList.size());
+    for(int i = 0; i < buffers.size(); ++i)
+        m_ScratchBuffers.release(buffers[i]);
+}
 
-    // Notify one waiting thread, that there is a new job available
-    m_NewJobCondition.notify_one();
+JobQueue* Volume::getJobQueue( JobType type )
+{
+    switch(type)
+    {
+        case LOAD_JOB: return &m_LoadJobs;
+        case SAVE_JOB: return &m_SaveJobs;
+        default:
+            assert(false);
+            return NULL;
+    }
 }
 
-JobEntry Volume::getJob()
+int Volume::getEnqueuedJobCount() const
 {
-    if(m_JobList.empty())
-        return JobEntry::InvalidJob;
+    return m_LoadJobs.getSize() + m_SaveJobs.getSize();
+}
 
-    // Save and load job should be distributed equally on the threads.
-    // I.e. if more save than load jobs run, the latter one should be picked.
-    // (If one exists)
+void Volume::addJobWorker()
+{
+    joinRetiredJobWorkers();
 
-    JobType favoredJob;
-    if(m_ActiveSaveJobs > m_ActiveLoadJobs)
-        favoredJob = LOAD_JOB; // We favor a load job.
-    else
-        favoredJob = SAVE_JOB; // We favor a save job.
+    const std::string name = Format("JobWorker %d", m_StartedJobWorkers);
+    m_JobThreads.push_back(new tthread::thread(JobThreadWrapper, this, name.c_str()));
+    m_StartedJobWorkers++;
+    incStatistic(STATISTIC_JOB_WORKERS);
+}
 
-    // Try to find our favored job in the list.
-    // The list is sorted from high to low priority.
-    std::list<JobEntry>::iterator i = m_JobList.begin();
-    for(; i != m_JobList.end(); ++i)
+void Volume::retireJobWorker()
+{
+    const tthread::thread::id id = tthread::this_thread::get_id();
+    std::vector<tthread::thread*>::iterator i = m_JobThreads.begin();
+    for(; i != m_JobThreads.end(); ++i)
     {
-        if(i->getType() == favoredJob)
+        if((*i)->get_id() == id)
         {
-            const JobEntry job = *i;
-            m_JobList.erase(i);
-            return job;
+            m_RetiredJobThreads.push_back(*i);
+            m_JobThreads.erase(i);
+            decStatistic(STATISTIC_JOB_WORKERS);
+            return;
         }
     }
+    assert(false);
+}
 
-    // The favored job type was not found. :(
-    const JobEntry job = m_JobList.front();
-    m_JobList.pop_front();
-    return job;
+void Volume::joinRetiredJobWorkers()
+{
+    // Retired workers don't need the job list mutex anymore.
+    for(int i = 0; i < m_RetiredJobThreads.size(); ++i)
+    {
+        m_RetiredJobThreads[i]->join();
+        delete m_RetiredJobThreads[i];
+    }
+    m_RetiredJobThreads.clear();
+}
+
+void Volume::adaptJobWorkers()
+{
+    if(m_JobThreads.size() >= m_MaxJobWorkers ||
+       m_StopJobThreads.load())
+        return;
+
+    // Notified workers count as idle, until they get the job list mutex,
+    // so they only suffice while there's one for each enqueued job.
+    if(m_IdleJobWorkers >= getEnqueuedJobCount())
+        return;
+
+    // Estimate how long the last enqueued job has to wait.
+    const double jobDuration =
+        (m_FixedJobDuration >= 0) ? m_FixedJobDuration : std::max(m_AverageJobDuration, 1.0);
+    const double queueDelay = getEnqueuedJobCount() * jobDuration / m_JobThreads.size();
+    if(queueDelay > MAX_QUEUE_DELAY)
+    {
+        log(VMAN_LOG_DEBUG, "Adding job worker, since jobs wait for %.0f ms.\n", queueDelay);
+        addJobWorker();
+    }
+}
+
+void Volume::stopJobWorkers()
+{
+    std::vector<tthread::thread*> threads;
+    {
+        lock_guard jobListGuard(m_JobListMutex);
+        m_StopJobThreads = 1;
+        decStatistic(STATISTIC_JOB_WORKERS, m_JobThreads.size());
+        threads.swap(m_JobThreads);
+        threads.insert(threads.end(), m_RetiredJobThreads.begin(), m_RetiredJobThreads.end());
+        m_RetiredJobThreads.clear();
+    }
+    m_NewJobCondition.notify_all();
+
+    for(int i = 0; i < threads.size(); ++i)
+    {
+        if(threads[i]->joinable())
+            threads[i]->join();
+        delete threads[i];
+    }
+}
+
+int Volume::getJobWorkerCount() const
+{
+    lock_guard jobListGuard(m_JobListMutex);
+    return m_JobThreads.size();
+}
+
+void Volume::setJobDurationEstimate( double milliseconds )
+{
+    lock_guard jobListGuard(m_JobListMutex);
+    m_FixedJobDuration = milliseconds;
 }
 
 void Volume::JobThreadWrapper(void* volumeInstance)
@@ -739,74 +1527,163 @@ void Volume::JobThreadWrapper(void* volumeInstance)
 
 void Volume::jobThreadFn()
 {
+    std::vector<JobEntry> jobs;
+    std::vector<bool> results;
+
     while(true)
     {
         JobEntry job = JobEntry::InvalidJob;
-        bool success = true;
 
         {
             {
                 lock_guard guard(m_JobListMutex);
                 job = getJob();
 
+                const uint64_t idleTime = GetMonotonicMilliseconds();
                 while(job.getType() == INVALID_JOB)
                 {
                     if(m_StopJobThreads.load())
                         return;
 
+                    // Adaptive pools shrink back when workers stay idle.
+                    if(m_JobThreads.size() > m_MinJobWorkers &&
+                       GetMonotonicMilliseconds() - idleTime >= IDLE_WORKER_TIMEOUT)
+                    {
+                        log(VMAN_LOG_DEBUG, "Retiring idle job worker.\n");
+                        retireJobWorker();
+                        return;
+                    }
+
                     // Unlocks mutex while waiting for the condition
-                    m_NewJobCondition.wait(m_JobListMutex);
+                    m_IdleJobWorkers++;
+                    if(m_MaxJobWorkers > m_MinJobWorkers)
+                        m_NewJobCondition.wait_for(m_JobListMutex, tthread::chrono::milliseconds(IDLE_WORKER_TIMEOUT));
+                    else
+                        m_NewJobCondition.wait(m_JobListMutex);
+                    m_IdleJobWorkers--;
                     job = getJob();
                 }
-            }
 
-            {
-                lock_guard chunkGuard(*job.getChunk()->getMutex());
-                switch(job.getType())
+                // Group commit: Saves that arrive shortly after share one sync.
+                // There is no need to wait, once a whole batch is queued.
+                if(job.getType() == SAVE_JOB && m_Durability == VMAN_DURABILITY_BATCH)
                 {
-                    case LOAD_JOB:
-                        if(job.getChunk()->isUnused())
+                    const uint64_t deadline = GetMonotonicMilliseconds() + GROUP_COMMIT_WINDOW;
+                    while(m_SaveJobs.getSize()+1 < SAVE_BATCH_SIZE && !m_StopJobThreads.load())
+                    {
+                        const uint64_t now = GetMonotonicMilliseconds();
+                        if(now >= deadline)
+                            break;
+
+                        // Unlocks mutex while waiting for the condition
+                        m_NewJobCondition.wait_for(m_JobListMutex, tthread::chrono::milliseconds(deadline - now));
+
+                        // The notification may have been meant for a load job,
+                        // so it's passed on to another worker.
+                        if(!m_LoadJobs.empty())
                         {
-                            log(VMAN_LOG_WARNING, "Canceled load job of chunk %s, because it's unused and would be deleted immediately.",
-                                job.getChunk()->toString().c_str()
-                            );
+                            m_NewJobCondition.notify_one();
+                            break;
                         }
-                        else
+                    }
+                }
+            }
+
+            incStatistic(STATISTIC_ACTIVE_JOB_WORKERS);
+            const uint64_t startTime = GetMonotonicMilliseconds();
+
+            job.getChunk()->getMutex()->lock();
+            jobs.push_back(job);
+            job = JobEntry::InvalidJob;
+
+            switch(jobs[0].getType())
+            {
+                case LOAD_JOB:
+                    if(m_LayerMappingEnabled)
+                    {
+                        // Unused chunks are loaded too, since they may stay cached.
+                        results.push_back(jobs[0].getChunk()->loadFromFile());
+                    }
+                    else
+                    {
+                        // Reading several chunks at once keeps more I/O in flight.
                         {
-                            success = job.getChunk()->loadFromFile();
+                            lock_guard guard(m_JobListMutex);
+                            collectJobs(LOAD_JOB, LOAD_BATCH_SIZE, &jobs);
                         }
-                        break;
+                        loadChunks(jobs, &results);
+                    }
+                    break;
+
+                case SAVE_JOB:
+                    // Writing several chunks at once shares the syncs.
+                    {
+                        lock_guard guard(m_JobListMutex);
+                        collectJobs(SAVE_JOB, SAVE_BATCH_SIZE, &jobs);
+                    }
+                    for(int i = 0; i < jobs.size(); ++i)
+                        jobs[i].getChunk()->setState(VMAN_CHUNK_SAVING);
+                    saveChunks(jobs, &results);
+                    break;
+
+                default:
+                    assert(false);
+            }
 
-                    case SAVE_JOB:
-                        success = job.getChunk()->saveToFile();
-                        break;
+            // Failed loads leave the chunk empty, but it's usable nonetheless.
+            for(int i = 0; i < jobs.size(); ++i)
+                jobs[i].getChunk()->setState(VMAN_CHUNK_READY);
 
-                    default:
-                        assert(false);
-                }
+            for(int i = 0; i < jobs.size(); ++i)
+                jobs[i].getChunk()->getMutex()->unlock();
+
+            // Selection callbacks may lock further chunks and stripes,
+            // so they are only run after releasing the batch.
+            // The job references keep the chunks alive meanwhile.
+            for(int i = 0; i < jobs.size(); ++i)
+                jobs[i].getChunk()->notifyLoadListeners();
+
+            const uint64_t duration = GetMonotonicMilliseconds() - startTime;
+            decStatistic(STATISTIC_ACTIVE_JOB_WORKERS);
+            incStatistic(STATISTIC_JOB_BUSY_MILLISECONDS, duration);
+
+            {
+                lock_guard guard(m_JobListMutex);
+                for(int i = 0; i < jobs.size(); ++i)
+                    finishJob(jobs[i].getType(), duration / jobs.size());
             }
         }
 
-        if(success)
+        for(int i = 0; i < jobs.size(); ++i)
         {
-            lock_guard volumeGuard(m_Mutex);
-            checkChunk(job.getChunk());
-            // ^- For deleting unused chunks directly after saving them to disk
+            Chunk* chunk = jobs[i].getChunk();
+            lock_guard stripeGuard(*m_ChunkTable.getMutex(chunk->getId()));
+            jobs[i] = JobEntry::InvalidJob; // Releases the job reference.
+            if(results[i])
+                checkChunk(chunk, CHECK_CAUSE_MODIFIED);
+                // ^- For deleting unused chunks directly after saving them to disk
         }
+        jobs.clear();
+        results.clear();
+
+        if(isOverBudget())
+            evictChunks();
 
         tthread::this_thread::yield();
     }
 }
 
-tthread::mutex* Volume::getMutex()
-{
-    return &m_Mutex;
-}
-
-
 /** Forbidden Stuff **/
 
-Volume::Volume( const Volume& volume )
+Volume::Volume( const Volume& volume ) :
+    m_ScratchBuffers(NULL),
+    m_IoBackend(false),
+    m_ChunkTable(NULL),
+    m_Durability(VMAN_DURABILITY_NONE),
+    m_LockManager(NULL, NULL),
+    m_MaxResidentBytes(0),
+    m_LoadJobs(LOAD_JOB),
+    m_SaveJobs(SAVE_JOB)
 {
     assert(false);
 }
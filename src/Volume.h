@@ -4,6 +4,8 @@
 #include <vector>
 #include <list>
 #include <map>
+#include <queue>
+#include <functional>
 #include <set>
 #include <string>
 #include <time.h>
@@ -11,7 +13,17 @@
 
 #include "vman.h"
 #include "Chunk.h"
+#include "EpochManager.h"
+#include "ChunkTable.h"
+#include "ChunkStorage.h"
+#include "ChunkCache.h"
+#include "LayerPool.h"
+#include "ScratchBuffer.h"
+#include "IoBackend.h"
+#include "Journal.h"
+#include "LockManager.h"
 #include "JobEntry.h"
+#include "JobQueue.h"
 
 
 namespace vman
@@ -29,6 +41,19 @@ enum Statistic
     STATISTIC_CHUNK_LOAD_OPS,
     STATISTIC_CHUNK_SAVE_OPS,
     STATISTIC_CHUNK_UNLOAD_OPS,
+    STATISTIC_CHUNK_EVICT_OPS,
+    STATISTIC_CHUNK_SYNC_OPS,
+    STATISTIC_JOURNAL_BYTES,
+
+    STATISTIC_CHUNK_INDEX_HITS,
+    STATISTIC_CHUNK_INDEX_MISSES,
+
+    STATISTIC_COMPRESSED_BYTES,
+    STATISTIC_UNCOMPRESSED_BYTES,
+
+    STATISTIC_LAYER_POOL_RESERVED_BYTES,
+    STATISTIC_LAYER_POOL_USED_BYTES,
+    STATISTIC_SCRATCH_BUFFER_BYTES,
     
     STATISTIC_READ_OPS,
     STATISTIC_WRITE_OPS,
@@ -37,6 +62,17 @@ enum Statistic
     STATISTIC_MAX_SCHEDULED_CHECKS,
     STATISTIC_MAX_ENQUEUED_JOBS,
 
+    STATISTIC_JOB_WORKERS,
+    STATISTIC_ACTIVE_JOB_WORKERS,
+    STATISTIC_JOB_BUSY_MILLISECONDS,
+
+    STATISTIC_LOCK_WAITS,
+    STATISTIC_LOCK_WAIT_MILLISECONDS,
+    STATISTIC_MAX_LOCK_WAIT_MILLISECONDS,
+
+    STATISTIC_OPTIMISTIC_READ_CONFLICTS,
+    STATISTIC_OPTIMISTIC_READ_FALLBACKS,
+
     STATISTIC_COUNT
 };
 
@@ -92,6 +128,40 @@ public:
      */
     int getLayerIndexByName( const char* name ) const;
 
+    /**
+     * A read only voxel array filled with the layers default value.
+     * It's used for layers that haven't been written yet.
+     * Is thread safe.
+     * @see vmanLayer#defaultValue
+     */
+    const char* getDefaultPage( int layerIndex ) const;
+
+    /**
+     * A shared read only voxel array filled with the given voxel.
+     * Only a limited amount of pages is kept for each layer.
+     * Is thread safe.
+     * @return The page or `NULL` if there are too many pages already.
+     */
+    const char* getUniformPage( int layerIndex, const char* voxel );
+
+    /**
+     * Allocates the uncompressed voxel arrays of a layer.
+     * Is thread safe.
+     */
+    LayerPool* getLayerPool( int layerIndex );
+
+    /**
+     * Temporary buffers for loading and saving chunks.
+     * Is thread safe.
+     */
+    ScratchBufferPool* getScratchBuffers();
+
+    /**
+     * Executes the file reads and writes of the chunk storage.
+     * Is thread safe.
+     */
+    IoBackend* getIoBackend();
+
 
     /**
      * Directory where the chunks are stored.
@@ -102,12 +172,98 @@ public:
 
 
     /**
-     * Generates the file name where a specific chunk could be stored.
-     * Note that if the base dir is `NULL` the file name will be empty.
+     * Reads and writes the serialized chunks.
      * Is thread safe.
+     * @return The chunk storage or `NULL` if saving to disk has been disabled.
      * @see getBaseDir
      */
-    std::string getChunkFileName( int chunkX, int chunkY, int chunkZ ) const;
+    ChunkStorage* getChunkStorage();
+
+    /**
+     * Whether layers without deserialize function
+     * are mapped from the chunk files.
+     * Is thread safe.
+     * @see vmanVolumeParameters#mapLayers
+     */
+    bool isLayerMappingEnabled() const;
+
+    /**
+     * Records voxel writes, so modified chunks don't need to be rewritten.
+     * Is thread safe.
+     * @return The journal or `NULL` if it has been disabled.
+     * @see vmanVolumeParameters#enableJournal
+     */
+    Journal* getJournal();
+
+    /**
+     * Flushes the journal, once the modified chunk timeout has passed.
+     * Does nothing if a flush is scheduled already.
+     * Is thread safe.
+     */
+    void scheduleJournalFlush();
+
+    /**
+     * Grants access objects the chunks of their selection.
+     * Is thread safe.
+     */
+    LockManager* getLockManager();
+
+
+    /**
+     * Bytes used by the layers of all loaded chunks.
+     * Mapped layers are not counted, since they belong to the file cache.
+     * Is thread safe.
+     */
+    size_t getResidentBytes() const;
+
+    /**
+     * Is thread safe.
+     * @return The memory budget or `0` if there is none.
+     * @see vmanVolumeParameters#maxResidentBytes
+     */
+    size_t getMaxResidentBytes() const;
+
+    /**
+     * Is thread safe.
+     * @return Whether the resident bytes exceed the memory budget.
+     */
+    bool isOverBudget() const;
+
+    /**
+     * Is thread safe.
+     */
+    void incResidentBytes( size_t bytes );
+
+    /**
+     * Is thread safe.
+     */
+    void decResidentBytes( size_t bytes );
+
+    /**
+     * Unloads unused chunks until the volume fits into its memory budget.
+     * Chunks are picked by the chunk cache policy.
+     * Modified chunks are saved with high priority instead,
+     * so they can be evicted after the save.
+     * Returns immediately if another thread is already evicting.
+     * Is thread safe, but must be called without holding any chunk related mutex.
+     * @return Amount of evicted chunks.
+     */
+    int evictChunks();
+
+    /**
+     * Is thread safe.
+     * @return Current size of the I/O worker pool.
+     */
+    int getJobWorkerCount() const;
+
+    /**
+     * Replaces the measured job duration, which the adaptive pool uses
+     * to estimate how long enqueued jobs wait.
+     * Meant for tests, which need the pool to grow predictably.
+     * Is thread safe.
+     * @param milliseconds Negative values restore the measured duration.
+     */
+    void setJobDurationEstimate( double milliseconds );
 
 
     /**
@@ -129,6 +285,9 @@ public:
      *
      * Creates a chunk if it doesn't exists yet.
      * Chunks that need to be loaded from disk are locked.
+     * Each returned chunk has been referenced already,
+     * so it can't be unloaded until the caller releases it.
+     * Is thread safe.
      *
      * @param chunksOut
      * This array must have the size of the `chunkSelection`.
@@ -163,6 +322,7 @@ public:
 
     /**
      * Timeout after that modified chunks are saved to disk.
+     * If the journal is enabled, only the journaled voxel writes are flushed.
      * Negative values disable this behaviour.
      */
     void setModifiedChunkTimeout( int seconds );
@@ -173,6 +333,18 @@ public:
      */
     int getModifiedChunkTimeout() const;
 
+    /**
+     * Timeout after that the layers of unreferenced chunks are compressed.
+     * Negative values disable this behaviour.
+     */
+    void setIdleChunkTimeout( int seconds );
+
+    /**
+     * Timeout after that the layers of unreferenced chunks are compressed.
+     * @return Timeout or `-1` if disabled.
+     */
+    int getIdleChunkTimeout() const;
+
     /**
      * Writes all modified chunks to disk.
      * Is a no-op if saving to disk has been disabled.
@@ -188,7 +360,10 @@ public:
     enum CheckCause
     {
         CHECK_CAUSE_UNUSED,
-        CHECK_CAUSE_MODIFIED
+        CHECK_CAUSE_MODIFIED,
+        CHECK_CAUSE_IDLE,
+
+        CHECK_CAUSE_COUNT
     };
 
     /**
@@ -196,8 +371,17 @@ public:
      * `scheduled_time = now + wait_duration`
      * While the duration is defined by the tasks type.
      * E.g. for the `CHECK_CAUSE_UNUSED` it uses getUnusedChunkTimeout().
+     * Scheduling a cause again replaces its previous time,
+     * so each chunk has at most one pending check.
+     * Is thread safe.
+     */
+    void scheduleCheck( CheckCause cause, ChunkId chunkId );
+
+    /**
+     * Is thread safe.
+     * @return Amount of chunks which have pending checks.
      */
-    void scheduleCheck( CheckCause cause, Chunk* chunk );
+    int getScheduledCheckCount() const;
 
 
     /**
@@ -209,6 +393,8 @@ public:
 
     /**
      * Resets all statistics to zero.
+     * Statistics that describe the current state,
+     * like the compressed bytes, are kept.
      * Is thread safe.
      */
     void resetStatistics();
@@ -218,14 +404,14 @@ public:
      * Increments a statistic.
      * Is thread safe.
      */
-    void incStatistic( Statistic statistic, int amount = 1 );
+    void incStatistic( Statistic statistic, int64_t amount = 1 );
 
 
     /**
      * Decrements a statistic.
      * Is thread safe.
      */
-    void decStatistic( Statistic statistic, int amount = 1 );
+    void decStatistic( Statistic statistic, int64_t amount = 1 );
 
 
     /**
@@ -250,13 +436,6 @@ public:
     bool getStatistics( vmanStatistics* statisticsDestination ) const;
 
 
-    /**
-     * Use this to lock the object while
-     * using methods that aren't thread safe.
-     */
-    tthread::mutex* getMutex();
-
-
     /**
      * Call this function on abnormal or abprupt program termination.
      */
@@ -282,6 +461,7 @@ private:
      * `chunkX = voxelX / chunkEdgeLength`
      * Creates the chunk if it doesn't exists yet.
      * The function may block while loading a chunk from disk.
+     * Needs the chunk table mutex of the chunk id.
      * @param priority Priority when loading a chunk from disk.
      * @return The chunk for the given chunk coordinates.
      */
@@ -289,6 +469,7 @@ private:
 
     /**
      * Get the chunk with the given id.
+     * Needs the chunk table mutex of the chunk id.
      * @return The chunk with the given id or `NULL` if its not loaded/available.
      */
     Chunk* getLoadedChunkById( ChunkId id );
@@ -296,19 +477,109 @@ private:
 
     /**
      * Checks if a chunk should be saved or unloaded and runs these actions.
+     * Idle checks only compress the chunk, if it's still unused.
      * Note that this function uses the chunks mutex.
+     * Needs the chunk table mutex of the chunk id.
      * @return `true` if the chunk was deleted.
      */
-    bool checkChunk( Chunk* chunk );
+    bool checkChunk( Chunk* chunk, CheckCause cause );
+
+    /**
+     * Evicts a chunk, if it's unused, unmodified and has no jobs.
+     * Unused modified chunks are enqueued for saving.
+     * Needs the chunk table mutex of the chunk id.
+     * @return `true` if the chunk was deleted.
+     */
+    bool evictChunk( Chunk* chunk );
+
+    /**
+     * Removes the chunk from the table and the cache and retires it,
+     * so it's deleted once no lock free lookup can see it anymore.
+     * Needs the chunk table mutex of the chunk id and the chunks mutex,
+     * which is unlocked in any case.
+     * @return `false` if the chunk has been referenced meanwhile.
+     */
+    bool unloadChunk( Chunk* chunk );
+
+    /**
+     * Applies the journal of a previous volume to the stored chunks.
+     * Must be called before the workers are started.
+     * @return `false` if some chunks couldn't be updated.
+     */
+    bool replayJournal();
+
+    /**
+     * Writes the buffered journal records.
+     * Enqueues save jobs for the chunks of a checkpoint.
+     * Must be called without holding any chunk related mutex.
+     */
+    void flushJournal();
 
 
     std::vector<vmanLayer> m_Layers;
     int m_MaxLayerVoxelSize;
+
+    /**
+     * Voxel arrays filled with the default value of each layer.
+     * The layer definitions point to their first voxel.
+     */
+    std::vector<char*> m_DefaultPages;
+
+    enum
+    {
+        /**
+         * Maximum amount of uniform pages per layer,
+         * besides the default page.
+         */
+        MAX_UNIFORM_PAGES = 16
+    };
+
+    /**
+     * Maps voxel values to uniform pages for each layer.
+     */
+    std::vector< std::map<std::string,char*> > m_UniformPages;
+    mutable tthread::mutex m_UniformPagesMutex;
+
+    /**
+     * Pool of each layer.
+     * Layers with the same voxel size share a pool.
+     */
+    std::vector<LayerPool*> m_LayerPools;
+    ScratchBufferPool m_ScratchBuffers;
+    IoBackend m_IoBackend;
+
     int m_ChunkEdgeLength;
 
-    std::map<ChunkId,Chunk*> m_ChunkMap; // Dimension
+    /**
+     * Defers the deletion of unloaded chunks,
+     * while lock free lookups may still see them.
+     */
+    EpochManager m_EpochManager;
+
+    /**
+     * Loaded chunks.
+     * Uses its own striped mutexes, which are only needed to modify it.
+     * Already loaded chunks are retrieved without locking.
+     */
+    ChunkTable m_ChunkTable;
     std::string m_BaseDir;
+    ChunkStorage* m_ChunkStorage;
+    bool m_LayerMappingEnabled;
+    const vmanDurability m_Durability;
+    Journal* m_Journal;
+    LockManager m_LockManager;
 
+    /**
+     * Picks the chunks that are evicted first.
+     */
+    ChunkCache m_ChunkCache;
+    const size_t m_MaxResidentBytes;
+    tthread::atomic<size_t> m_ResidentBytes;
+    tthread::mutex m_EvictionMutex;
+
+    /**
+     * Only used by the scheduler thread to wait for due checks.
+     */
     mutable tthread::mutex m_Mutex;
 
 
@@ -319,31 +590,88 @@ private:
     // --- Statistics ---
     
     bool m_StatisticsEnabled; // thread safe (is only set in the constructor)
-    tthread::atomic_int m_Statistics[STATISTIC_COUNT];
+    /**
+     * Byte statistics may exceed the range of `int`.
+     */
+    tthread::atomic_llong m_Statistics[STATISTIC_COUNT];
 
 
     // --- Scheduled Checks ---
 
     int m_UnusedChunkTimeout;
     int m_ModifiedChunkTimeout;
+    int m_IdleChunkTimeout;
+
+    static const uint64_t NO_DEADLINE = UINT64_MAX;
+
+    /**
+     * Outdated heap entries that are tolerated,
+     * before the heap is rebuilt.
+     */
+    static const int MIN_HEAP_SLACK = 64;
 
+    /**
+     * Pending checks of a chunk.
+     * Each cause has its own deadline,
+     * so that a chunk needs only a single entry.
+     */
     struct ScheduledCheck
     {
-        time_t executionTime;
+        /**
+         * In milliseconds of the monotonic clock or `NO_DEADLINE`.
+         */
+        uint64_t deadlines[CHECK_CAUSE_COUNT];
+
+        uint64_t getNextDeadline() const;
+    };
+
+    /**
+     * Entry of the deadline heap.
+     * Entries are not removed when a check is rescheduled,
+     * instead they're skipped if their time doesn't match
+     * the next deadline of the check anymore.
+     */
+    struct ScheduledDeadline
+    {
+        uint64_t time;
         ChunkId chunkId;
+
+        bool operator > ( const ScheduledDeadline& other ) const;
     };
 
     /**
      * Internal version of `scheduleCheck` with time parameter.
      * Don't use this directly.
      */
-    void scheduleCheck( Chunk* chunk, double seconds );
+    void scheduleCheck( ChunkId chunkId, CheckCause cause, int milliseconds );
+
+    /**
+     * Adds a deadline to the heap and discards outdated entries,
+     * when they start to outnumber the valid ones.
+     * Needs the scheduled checks mutex.
+     */
+    void pushDeadline( ChunkId chunkId, uint64_t time );
+
+    /**
+     * These need their own mutex,
+     * because they're heavily used by the chunks.
+     */
+    std::map<ChunkId,ScheduledCheck> m_ScheduledChecks;
 
     /**
-     * This list needs its own mutex,
-     * because its heavily used by the chunks.
+     * When the scheduler flushes the journal or `NO_DEADLINE`.
+     * Uses the scheduled checks mutex.
      */
-    std::list<ScheduledCheck> m_ScheduledChecks;
+    uint64_t m_JournalFlushDeadline;
+
+    /**
+     * Earliest deadline first.
+     */
+    std::priority_queue<
+        ScheduledDeadline,
+        std::vector<ScheduledDeadline>,
+        std::greater<ScheduledDeadline>
+    > m_ScheduledDeadlines;
     
     mutable tthread::mutex m_ScheduledChecksMutex;
     
@@ -360,12 +688,6 @@ private:
 
     tthread::condition_variable m_NewJobCondition;
 
-    /**
-     * Tries to find a job with the given chunk id.
-     * Returns the .end()-iterator if none has been found.
-     */
-    std::list<JobEntry>::iterator findJobByChunk( Chunk* chunk );
-
     /**
      * Adds a job to the job queue.
      * May eventually merge it with another job.
@@ -374,15 +696,134 @@ private:
 
     /**
      * Finds a suitable job, removes it from the job list and returns it.
+     * The job counts as active until finishJob() is called.
      */
     JobEntry getJob();
 
+    /**
+     * Must be called, when a job returned by getJob() is done.
+     */
+    void finishJob( JobType type, uint64_t duration );
+
+    JobQueue* getJobQueue( JobType type );
+
+    /**
+     * Adds further jobs of the same type to a batch,
+     * as long as their chunks can be locked right away.
+     * The chunks of the added jobs stay locked.
+     * Needs the job list mutex.
+     */
+    void collectJobs( JobType type, int maxJobs, std::vector<JobEntry>* jobs );
+
+    /**
+     * Reads the data of all chunks in a single submission and parses it.
+     * The chunks must be locked.
+     */
+    void loadChunks( const std::vector<JobEntry>& jobs, std::vector<bool>* resultsOut );
+
+    /**
+     * Serializes all chunks and writes them as one batch,
+     * which is synced depending on the durability.
+     * The chunks must be locked.
+     */
+    void saveChunks( const std::vector<JobEntry>& jobs, std::vector<bool>* resultsOut );
+
+    /**
+     * Starts a new job worker thread.
+     * Needs the job list mutex.
+     */
+    void addJobWorker();
+
+    /**
+     * Removes the calling worker from the pool.
+     * Its thread is joined later on by joinRetiredJobWorkers().
+     * Needs the job list mutex.
+     */
+    void retireJobWorker();
+
+    /**
+     * Needs the job list mutex.
+     */
+    void joinRetiredJobWorkers();
+
+    /**
+     * Grows the pool, if the enqueued jobs would
+     * take too long with the current workers.
+     * Needs the job list mutex.
+     */
+    void adaptJobWorkers();
+
+    /**
+     * Stops and joins all workers.
+     */
+    void stopJobWorkers();
+
+    /**
+     * @return Amount of enqueued jobs of all types.
+     */
+    int getEnqueuedJobCount() const;
+
     mutable tthread::mutex m_JobListMutex;
-    std::list<JobEntry> m_JobList;
+    JobQueue m_LoadJobs;
+    JobQueue m_SaveJobs;
     int m_ActiveLoadJobs;
     int m_ActiveSaveJobs;
 
+    enum
+    {
+        /**
+         * Idle workers wait this long for new jobs,
+         * before an adaptive pool stops them.
+         */
+        IDLE_WORKER_TIMEOUT = 2000, // In milliseconds
+
+        /**
+         * An adaptive pool grows, when the enqueued jobs
+         * would take longer than this.
+         */
+        MAX_QUEUE_DELAY = 50, // In milliseconds
+
+        /**
+         * Load jobs, whose chunk files are read at once by a worker.
+         */
+        LOAD_BATCH_SIZE = 16,
+
+        /**
+         * Save jobs, whose chunks are written and synced at once by a worker.
+         */
+        SAVE_BATCH_SIZE = 64,
+
+        /**
+         * With batch durability a worker waits up to this long
+         * for more save jobs, while less than a batch is queued.
+         */
+        GROUP_COMMIT_WINDOW = 10, // In milliseconds
+
+        /**
+         * Bounds of the default worker count.
+         */
+        MIN_DEFAULT_WORKERS = 2,
+        MAX_DEFAULT_WORKERS = 32
+    };
+
     std::vector<tthread::thread*> m_JobThreads;
+    std::vector<tthread::thread*> m_RetiredJobThreads;
+    int m_MinJobWorkers;
+    int m_MaxJobWorkers;
+    int m_IdleJobWorkers;
+    int m_StartedJobWorkers;
+
+    /**
+     * Moving average of the job duration in milliseconds.
+     */
+    double m_AverageJobDuration;
+
+    /**
+     * Is used instead of the average, unless its negative.
+     * @see setJobDurationEstimate
+     */
+    double m_FixedJobDuration;
+
     tthread::atomic_int m_StopJobThreads;
     static void JobThreadWrapper(void* volumeInstance);
     void jobThreadFn();
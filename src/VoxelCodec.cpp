@@ -0,0 +1,285 @@
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include "Util.h"
+#include "VoxelCodec.h"
+
+
+namespace vman
+{
+
+/*
+    Run length encoded data:
+
+    [
+        varint runLength (7 bits per byte, least significant first)
+        uint8[voxelSize] voxel
+    ]
+
+
+    Uniform data:
+
+    uint8[voxelSize] voxel
+
+
+    Palette encoded data:
+
+    uint32 paletteSize
+    uint32 bitsPerIndex (0, 1, 2, 4 or 8)
+    [
+        uint8[voxelSize] voxel
+    ]
+    uint8[ceil(voxelCount*bitsPerIndex / 8)] indices (least significant bits first)
+*/
+
+void EncodeVoxels( const char* voxels, int voxelCount, int voxelSize, std::vector<char>* dataOut )
+{
+    assert(voxels != NULL);
+    assert(voxelSize > 0);
+    assert(dataOut != NULL);
+
+    dataOut->clear();
+
+    int i = 0;
+    while(i < voxelCount)
+    {
+        const char* voxel = &voxels[i*voxelSize];
+
+        int runLength = 1;
+        while(i+runLength < voxelCount &&
+              memcmp(voxel, &voxels[(i+runLength)*voxelSize], voxelSize) == 0)
+            runLength++;
+
+        uint32_t count = runLength;
+        do
+        {
+            uint8_t byte = count & 0x7F;
+            count >>= 7;
+            if(count != 0)
+                byte |= 0x80;
+            dataOut->push_back(byte);
+        } while(count != 0);
+
+        dataOut->insert(dataOut->end(), voxel, voxel+voxelSize);
+        i += runLength;
+    }
+}
+
+bool DecodeVoxels( const char* data, int dataSize, int voxelCount, int voxelSize, char* voxelsOut )
+{
+    assert(data != NULL || dataSize == 0);
+    assert(voxelSize > 0);
+    assert(voxelsOut != NULL);
+
+    int offset = 0;
+    int voxelIndex = 0;
+    while(offset < dataSize)
+    {
+        uint32_t runLength = 0;
+        int shift = 0;
+        while(true)
+        {
+            if(offset >= dataSize || shift > 28)
+                return false;
+            const uint8_t byte = data[offset++];
+            runLength |= uint32_t(byte & 0x7F) << shift;
+            shift += 7;
+            if((byte & 0x80) == 0)
+                break;
+        }
+
+        if(offset + voxelSize > dataSize ||
+           runLength == 0 ||
+           runLength > uint32_t(voxelCount - voxelIndex))
+            return false;
+
+        const char* voxel = &data[offset];
+        offset += voxelSize;
+
+        FillVoxels(voxel, runLength, voxelSize, &voxelsOut[voxelIndex*voxelSize]);
+        voxelIndex += runLength;
+    }
+
+    return voxelIndex == voxelCount;
+}
+
+bool EncodePalette( const char* voxels, int voxelCount, int voxelSize, std::vector<char>* dataOut )
+{
+    assert(voxels != NULL);
+    assert(voxelSize > 0);
+    assert(dataOut != NULL);
+
+    dataOut->assign(PALETTE_HEADER_SIZE, 0);
+
+    std::vector<uint8_t> indices(voxelCount);
+    uint32_t paletteSize = 0;
+    int lastIndex = -1;
+    for(int i = 0; i < voxelCount; ++i)
+    {
+        const char* voxel = &voxels[i*voxelSize];
+
+        // Neighbours are often equal, so try the last index first.
+        int index = lastIndex;
+        if(index < 0 || memcmp(voxel, &(*dataOut)[PALETTE_HEADER_SIZE + index*voxelSize], voxelSize) != 0)
+        {
+            index = -1;
+            for(int j = 0; j < paletteSize; ++j)
+            {
+                if(memcmp(voxel, &(*dataOut)[PALETTE_HEADER_SIZE + j*voxelSize], voxelSize) == 0)
+                {
+                    index = j;
+                    break;
+                }
+            }
+
+            if(index < 0)
+            {
+                if(paletteSize == MAX_PALETTE_SIZE)
+                    return false;
+                dataOut->insert(dataOut->end(), voxel, voxel+voxelSize);
+                index = paletteSize++;
+            }
+        }
+
+        indices[i] = index;
+        lastIndex = index;
+    }
+
+    uint32_t bitsPerIndex = 8;
+    if(paletteSize <= 1)
+        bitsPerIndex = 0;
+    else if(paletteSize <= 2)
+        bitsPerIndex = 1;
+    else if(paletteSize <= 4)
+        bitsPerIndex = 2;
+    else if(paletteSize <= 16)
+        bitsPerIndex = 4;
+
+    const uint32_t header[2] = { LittleEndian(paletteSize), LittleEndian(bitsPerIndex) };
+    memcpy(&(*dataOut)[0], header, sizeof(header));
+
+    const int indexOffset = dataOut->size();
+    dataOut->resize(indexOffset + (voxelCount*bitsPerIndex + 7) / 8, 0);
+    if(bitsPerIndex > 0)
+    {
+        char* packedIndices = &(*dataOut)[indexOffset];
+        for(int i = 0; i < voxelCount; ++i)
+        {
+            const int bit = i*bitsPerIndex;
+            packedIndices[bit/8] |= indices[i] << (bit%8);
+        }
+    }
+    return true;
+}
+
+static bool ReadPaletteHeader( const char* data, int dataSize, uint32_t* paletteSizeOut, uint32_t* bitsPerIndexOut )
+{
+    if(dataSize < PALETTE_HEADER_SIZE)
+        return false;
+
+    uint32_t header[2];
+    memcpy(header, data, sizeof(header));
+    *paletteSizeOut = LittleEndian(header[0]);
+    *bitsPerIndexOut = LittleEndian(header[1]);
+
+    if(*paletteSizeOut < 1 || *paletteSizeOut > MAX_PALETTE_SIZE)
+        return false;
+    switch(*bitsPerIndexOut)
+    {
+        case 0: case 1: case 2: case 4: case 8:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int GetPaletteSize( const char* data, int dataSize )
+{
+    uint32_t paletteSize, bitsPerIndex;
+    if(!ReadPaletteHeader(data, dataSize, &paletteSize, &bitsPerIndex))
+        return -1;
+    return paletteSize;
+}
+
+bool DecodePalette( const char* data, int dataSize, int voxelCount, int voxelSize, char* voxelsOut )
+{
+    assert(voxelSize > 0);
+    assert(voxelsOut != NULL);
+
+    uint32_t paletteSize, bitsPerIndex;
+    if(!ReadPaletteHeader(data, dataSize, &paletteSize, &bitsPerIndex))
+        return false;
+
+    const char* palette = &data[PALETTE_HEADER_SIZE];
+    const uint8_t* packedIndices = (const uint8_t*)&palette[paletteSize*voxelSize];
+    if(PALETTE_HEADER_SIZE + paletteSize*voxelSize + (voxelCount*bitsPerIndex + 7) / 8 != dataSize)
+        return false;
+
+    if(bitsPerIndex == 0)
+    {
+        FillVoxels(palette, voxelCount, voxelSize, voxelsOut);
+        return true;
+    }
+
+    const int indexMask = (1 << bitsPerIndex) - 1;
+    for(int i = 0; i < voxelCount; ++i)
+    {
+        const int bit = i*bitsPerIndex;
+        const uint32_t index = (packedIndices[bit/8] >> (bit%8)) & indexMask;
+        if(index >= paletteSize)
+            return false;
+        memcpy(&voxelsOut[i*voxelSize], &palette[index*voxelSize], voxelSize);
+    }
+    return true;
+}
+
+bool IsUniform( const char* voxels, int voxelCount, int voxelSize )
+{
+    // Comparing each voxel with its predecessor
+    // is the same as comparing the whole array shifted by one voxel.
+    if(voxelCount <= 1)
+        return true;
+    return memcmp(voxels, &voxels[voxelSize], (voxelCount-1)*voxelSize) == 0;
+}
+
+void FillVoxels( const char* voxel, int voxelCount, int voxelSize, char* voxelsOut )
+{
+    if(voxelSize == 1)
+    {
+        memset(voxelsOut, *voxel, voxelCount);
+    }
+    else
+    {
+        for(int i = 0; i < voxelCount; ++i)
+            memcpy(&voxelsOut[i*voxelSize], voxel, voxelSize);
+    }
+}
+
+bool DecodeLayer( VoxelCodec codec, const char* data, int dataSize, int voxelCount, int voxelSize, char* voxelsOut )
+{
+    switch(codec)
+    {
+        case VOXEL_CODEC_NONE:
+            if(dataSize != voxelCount*voxelSize)
+                return false;
+            memcpy(voxelsOut, data, dataSize);
+            return true;
+
+        case VOXEL_CODEC_RLE:
+            return DecodeVoxels(data, dataSize, voxelCount, voxelSize, voxelsOut);
+
+        case VOXEL_CODEC_PALETTE:
+            return DecodePalette(data, dataSize, voxelCount, voxelSize, voxelsOut);
+
+        case VOXEL_CODEC_UNIFORM:
+            if(dataSize != voxelSize)
+                return false;
+            FillVoxels(data, voxelCount, voxelSize, voxelsOut);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef __VMAN_VOXEL_CODEC_H__
+#define __VMAN_VOXEL_CODEC_H__
+
+#include <vector>
+
+
+namespace vman
+{
+
+/**
+ * Ways to store the voxels of a layer.
+ */
+enum VoxelCodec
+{
+    /**
+     * Plain voxel array.
+     */
+    VOXEL_CODEC_NONE = 0,
+
+    /**
+     * Run length encoded voxels.
+     * @see EncodeVoxels
+     */
+    VOXEL_CODEC_RLE,
+
+    /**
+     * Table of distinct voxels and bit packed indices.
+     * @see EncodePalette
+     */
+    VOXEL_CODEC_PALETTE,
+
+    /**
+     * All voxels are equal, only a single voxel is stored.
+     * @see IsUniform
+     */
+    VOXEL_CODEC_UNIFORM,
+
+    VOXEL_CODEC_COUNT
+};
+
+enum
+{
+    /**
+     * Layers with more distinct voxels are not palette encoded.
+     */
+    MAX_PALETTE_SIZE = 256,
+
+    /**
+     * Palette entries start after this many bytes.
+     */
+    PALETTE_HEADER_SIZE = 8
+};
+
+/**
+ * Run length encodes voxel arrays.
+ * Volumes consist mostly of large uniform areas (air, stone, ..),
+ * which shrink to a few bytes this way.
+ *
+ * Encodes `voxelCount` voxels of `voxelSize` bytes each.
+ * @param dataOut Is replaced with the encoded data.
+ */
+void EncodeVoxels( const char* voxels, int voxelCount, int voxelSize, std::vector<char>* dataOut );
+
+/**
+ * Decodes data created by EncodeVoxels.
+ * @param voxelsOut Must have space for `voxelCount*voxelSize` bytes.
+ * @return `false` if the data is corrupt or doesn't match the voxel count.
+ */
+bool DecodeVoxels( const char* data, int dataSize, int voxelCount, int voxelSize, char* voxelsOut );
+
+/**
+ * Stores each distinct voxel once and replaces the voxels
+ * with indices into that palette, which use as few bits as possible.
+ * Works well for layers which use only a handful of different values,
+ * like block ids, even if they're scattered.
+ * @param dataOut Is replaced with the encoded data.
+ * @return `false` if there are more than MAX_PALETTE_SIZE distinct voxels.
+ */
+bool EncodePalette( const char* voxels, int voxelCount, int voxelSize, std::vector<char>* dataOut );
+
+/**
+ * Decodes data created by EncodePalette.
+ * @param voxelsOut Must have space for `voxelCount*voxelSize` bytes.
+ * @return `false` if the data is corrupt or doesn't match the voxel count.
+ */
+bool DecodePalette( const char* data, int dataSize, int voxelCount, int voxelSize, char* voxelsOut );
+
+/**
+ * The palette entries are stored as plain voxels
+ * right after PALETTE_HEADER_SIZE bytes.
+ * @return Amount of palette entries or `-1` if the data is corrupt.
+ */
+int GetPaletteSize( const char* data, int dataSize );
+
+/**
+ * @return Whether all voxels are equal to the first one.
+ */
+bool IsUniform( const char* voxels, int voxelCount, int voxelSize );
+
+/**
+ * Fills `voxelCount` voxels with the given one.
+ */
+void FillVoxels( const char* voxel, int voxelCount, int voxelSize, char* voxelsOut );
+
+/**
+ * Decodes data of any codec.
+ * @see VoxelCodec
+ */
+bool DecodeLayer( VoxelCodec codec, const char* data, int dataSize, int voxelCount, int voxelSize, char* voxelsOut );
+
+}
+
+#endif
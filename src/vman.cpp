@@ -4,6 +4,7 @@
 #include "vman.h"
 #include "Volume.h"
 #include "Access.h"
+#include "Snapshot.h"
 
 /*
     Just check the 'this' pointers for NULL here,
@@ -44,6 +45,12 @@ void vmanSetModifiedChunkTimeout( const vmanVolume volume, int seconds )
     ((vman::Volume*)volume)->setModifiedChunkTimeout(seconds);
 }
 
+void vmanSetIdleChunkTimeout( const vmanVolume volume, int seconds )
+{
+    assert(volume != NULL);
+    ((vman::Volume*)volume)->setIdleChunkTimeout(seconds);
+}
+
 void vmanResetStatistics( const vmanVolume volume )
 {
     assert(volume != NULL);
@@ -56,6 +63,12 @@ bool vmanGetStatistics( const vmanVolume volume, vmanStatistics* statisticsDesti
     return ((vman::Volume*)volume)->getStatistics(statisticsDestination);
 }
 
+size_t vmanGetResidentBytes( const vmanVolume volume )
+{
+    assert(volume != NULL);
+    return ((const vman::Volume*)volume)->getResidentBytes();
+}
+
 vmanAccess vmanCreateAccess( const vmanVolume volume )
 {
     assert(volume != NULL);
@@ -74,6 +87,21 @@ void vmanSelect( vmanAccess access, const vmanSelection* selection )
     ((vman::Access*)access)->select(selection);
 }
 
+void vmanSelectAsync( vmanAccess access, const vmanSelection* selection, vmanSelectionCallback callback, void* context )
+{
+    assert(access != NULL);
+    ((vman::Access*)access)->selectAsync(selection, callback, context);
+}
+
+int vmanIsSelectionReady( const vmanAccess access )
+{
+    assert(access != NULL);
+    if( ((vman::Access*)access)->isSelectionReady() )
+        return 1;
+    else
+        return 0;
+}
+
 void vmanLockAccess( vmanAccess access, int mode )
 {
     assert(access != NULL);
@@ -89,12 +117,28 @@ int vmanTryLockAccess( vmanAccess access, int mode )
         return 0;
 }
 
+int vmanLockAccessFor( vmanAccess access, int mode, int milliseconds )
+{
+    assert(access != NULL);
+    if( ((vman::Access*)access)->lockFor(mode, milliseconds) )
+        return 1;
+    else
+        return 0;
+}
+
 void vmanUnlockAccess( vmanAccess access )
 {
     assert(access != NULL);
     ((vman::Access*)access)->unlock();
 }
 
+int vmanGetAccessChunkStates( const vmanAccess access, vmanChunkState* statesOut, int maxCount )
+{
+    assert(access != NULL);
+    assert(maxCount == 0 || statesOut != NULL);
+    return ((vman::Access*)access)->getChunkStates(statesOut, maxCount);
+}
+
 const void* vmanReadVoxelLayer( const vmanAccess access, int x, int y, int z, int layer )
 {
     assert(access != NULL);
@@ -107,3 +151,82 @@ void* vmanReadWriteVoxelLayer( const vmanAccess access, int x, int y, int z, int
     return ((vman::Access*)access)->readWriteVoxelLayer(x,y,z, layer);
 }
 
+int vmanWriteVoxelLayer( const vmanAccess access, int x, int y, int z, int layer, const void* voxel )
+{
+    assert(access != NULL);
+    assert(voxel != NULL);
+    if( ((vman::Access*)access)->writeVoxelLayer(x,y,z, layer, voxel) )
+        return 1;
+    else
+        return 0;
+}
+
+int vmanReadRegion( const vmanAccess access, const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount )
+{
+    assert(access != NULL);
+    assert(box != NULL);
+    if( ((vman::Access*)access)->readRegion(box, buffers, bufferCount) )
+        return 1;
+    else
+        return 0;
+}
+
+int vmanWriteRegion( const vmanAccess access, const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount )
+{
+    assert(access != NULL);
+    assert(box != NULL);
+    if( ((vman::Access*)access)->writeRegion(box, buffers, bufferCount) )
+        return 1;
+    else
+        return 0;
+}
+
+int vmanReadVoxelSpan( const vmanAccess access, int x, int y, int z, int layer, vmanVoxelSpan* spanOut )
+{
+    assert(access != NULL);
+    assert(spanOut != NULL);
+    if( ((vman::Access*)access)->readVoxelSpan(x,y,z, layer, spanOut) )
+        return 1;
+    else
+        return 0;
+}
+
+int vmanReadWriteVoxelSpan( const vmanAccess access, int x, int y, int z, int layer, vmanVoxelSpan* spanOut )
+{
+    assert(access != NULL);
+    assert(spanOut != NULL);
+    if( ((vman::Access*)access)->readWriteVoxelSpan(x,y,z, layer, spanOut) )
+        return 1;
+    else
+        return 0;
+}
+
+vmanSnapshot vmanCreateSnapshot( const vmanVolume volume, const vmanSelection* selection )
+{
+    assert(volume != NULL);
+    assert(selection != NULL);
+    return new vman::Snapshot((vman::Volume*)volume, selection);
+}
+
+void vmanDeleteSnapshot( const vmanSnapshot snapshot )
+{
+    assert(snapshot != NULL);
+    delete (vman::Snapshot*)snapshot;
+}
+
+const void* vmanReadSnapshotVoxelLayer( const vmanSnapshot snapshot, int x, int y, int z, int layer )
+{
+    assert(snapshot != NULL);
+    return ((vman::Snapshot*)snapshot)->readVoxelLayer(x,y,z, layer);
+}
+
+int vmanReadSnapshotRegion( const vmanSnapshot snapshot, const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount )
+{
+    assert(snapshot != NULL);
+    assert(box != NULL);
+    if( ((vman::Snapshot*)snapshot)->readRegion(box, buffers, bufferCount) )
+        return 1;
+    else
+        return 0;
+}
+
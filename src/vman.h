@@ -30,6 +30,8 @@
     #define VMAN_API
 #endif
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -81,6 +83,7 @@ typedef struct
     /**
      * Used to convert voxels in a portable representation. (e.g. when saving them to disk)
      * Serialize to little endian, since most target machines use it and results in a noop there.
+     * May be `NULL` if the voxels are already portable, then they're copied as they are.
      * @count Amount of voxels that are affected. Length of source and destination is computed by `bytes*count`.
      */
     void (*serializeFn)( const void* source, void* destination, int count );
@@ -88,10 +91,19 @@ typedef struct
     /**
      * Used to convert voxels from their portable representation. (e.g. when loading them from disk)
      * Deserialize from little endian, since most target machines use it and results in a noop there.
+     * May be `NULL` if the voxels are already portable, then they're copied as they are.
+     * Such layers can be mapped into memory, see vmanVolumeParameters#mapLayers.
      * @count Amount of voxels that are affected. Length of source and destination is computed by `bytes*count`.
      */
     void (*deserializeFn)( const void* source, void* destination, int count );
 
+    /**
+     * Points to a single voxel, which is used for voxels that haven't been written.
+     * May be `NULL`, then all bytes are zero.
+     * The value is copied when the volume is created.
+     */
+    const void* defaultValue;
+
     // ...
 } vmanLayer;
 
@@ -107,12 +119,115 @@ typedef struct
     int chunkSaveOps;
     int chunkUnloadOps;
 
+    /**
+     * Chunks unloaded because the volume exceeded its memory budget.
+     */
+    int chunkEvictOps;
+
+    /**
+     * Calls that waited for saved chunks to reach the disk.
+     * @see vmanDurability
+     */
+    int chunkSyncOps;
+
+    /**
+     * Bytes appended to the voxel journal.
+     * @see vmanVolumeParameters#enableJournal
+     */
+    size_t journalBytes;
+
+    /**
+     * Lookups in the index of stored chunks,
+     * which found a stored chunk.
+     */
+    int chunkIndexHits;
+
+    /**
+     * Lookups in the index of stored chunks,
+     * which found no stored chunk.
+     * None of them needed to access the disk.
+     */
+    int chunkIndexMisses;
+
+    /**
+     * Bytes used by compressed layers.
+     * That are layers of idle chunks and
+     * palette encoded layers, which haven't been used since loading.
+     */
+    size_t compressedBytes;
+
+    /**
+     * Bytes the compressed layers would use without compression.
+     */
+    size_t uncompressedBytes;
+
+    /**
+     * Bytes reserved for uncompressed layers.
+     * Memory is reserved in large arenas, which are reused
+     * when chunks are unloaded and kept until the volume is deleted.
+     */
+    size_t layerPoolReservedBytes;
+
+    /**
+     * Bytes of the reserved memory, which are used by layers right now.
+     */
+    size_t layerPoolUsedBytes;
+
+    /**
+     * Bytes kept in idle buffers, which are reused for loading and saving chunks.
+     */
+    size_t scratchBufferBytes;
+
     int readOps;
     int writeOps;
 
     int maxLoadedChunks;
     int maxScheduledChecks;
     int maxEnqueuedJobs;
+
+    /**
+     * Current size of the I/O worker pool.
+     */
+    int jobWorkers;
+
+    /**
+     * Workers that are running a job right now.
+     */
+    int activeJobWorkers;
+
+    /**
+     * Time the workers spent running jobs.
+     * The pool utilization is `jobBusyMilliseconds / (jobWorkers * elapsed milliseconds)`.
+     */
+    size_t jobBusyMilliseconds;
+
+    /**
+     * Locks of access objects, which had to wait for other access objects.
+     */
+    int lockWaits;
+
+    /**
+     * Time these locks spent waiting.
+     */
+    size_t lockWaitMilliseconds;
+
+    /**
+     * Longest time a single lock had to wait.
+     */
+    int maxLockWaitMilliseconds;
+
+    /**
+     * Optimistic chunk reads, which had to be repeated
+     * because the chunk was modified meanwhile.
+     */
+    int optimisticReadConflicts;
+
+    /**
+     * Optimistic chunk reads, which locked the chunk in the end.
+     * That happens after too many conflicts and
+     * for layers that can't be read without lock, like compressed ones.
+     */
+    int optimisticReadFallbacks;
 } vmanStatistics;
 
 
@@ -126,6 +241,44 @@ typedef enum
     VMAN_LOG_ERROR
 } vmanLogLevel;
 
+/**
+ * Decides what happens to saved chunks, if the system crashes.
+ *
+ * Saving 8192 small chunks with 8 workers to their own files on ext4
+ * achieved these rates: (Inside a VM, whose disk acknowledges syncs from its cache.
+ * On physical disks each sync costs milliseconds, which makes the gaps much larger.)
+ * - none:  17000 - 19500 chunks/s
+ * - batch: 13500 - 16000 chunks/s
+ * - chunk:  7000 - 13500 chunks/s
+ *
+ * The benchmark selects the level with `volume.durability=none|batch|chunk`.
+ */
+typedef enum
+{
+    /**
+     * Chunks are overwritten in place and reach the disk whenever
+     * the system decides to write them back.
+     * Only the modified voxel blocks of plainly stored layers are rewritten.
+     * A crash may lose recent saves and leave chunks half written. (default)
+     */
+    VMAN_DURABILITY_NONE = 0,
+
+    /**
+     * Group commit: Save jobs picked up within a short window are written together,
+     * synced with a single call and then renamed over the previous files.
+     * Region files write the chunks to new space instead,
+     * which their index points to once the data has been synced.
+     * A crash loses at most the last batch and never leaves a chunk half written.
+     */
+    VMAN_DURABILITY_BATCH,
+
+    /**
+     * Like VMAN_DURABILITY_BATCH, but every chunk is synced on its own,
+     * before the next one is written.
+     */
+    VMAN_DURABILITY_CHUNK
+} vmanDurability;
+
 typedef struct
 {
     /**
@@ -150,6 +303,64 @@ typedef struct
      */
     const char* baseDir;
 
+    /**
+     * Chunks are grouped into region files,
+     * which contain `regionEdgeLength^3` chunks each.
+     * `0` stores each chunk in its own file.
+     * Chunk files that were written without regions are migrated automatically.
+     * Don't change this later on!
+     */
+    int regionEdgeLength;
+
+    /**
+     * Layers without `deserializeFn` are mapped directly from the chunk files,
+     * instead of reading them into memory.
+     * They share the memory with the systems file cache
+     * and are copied when they're written for the first time.
+     */
+    bool mapLayers;
+
+    /**
+     * How safely saved chunks are written.
+     * @see vmanDurability
+     */
+    vmanDurability durability;
+
+    /**
+     * Voxel writes are appended to a journal in the base directory,
+     * which is flushed after the modified chunk timeout.
+     * Modified chunks are then only rewritten completely before they're unloaded
+     * or when the journal grows too large. (checkpoint)
+     * If the volume wasn't closed properly, the journal is replayed
+     * when it's created the next time, even if the journal is disabled by then.
+     * The journal is synced on each flush, unless durability is VMAN_DURABILITY_NONE.
+     */
+    bool enableJournal;
+
+    /**
+     * Memory budget for the layers of loaded chunks in bytes.
+     * Unused chunks stay in memory until the budget is exceeded,
+     * then the least valuable ones are unloaded.
+     * The unused chunk timeout is ignored in that case.
+     * `0` disables the budget. (default)
+     */
+    size_t maxResidentBytes;
+
+    /**
+     * Amount of threads that load and save chunks.
+     * `0` picks one based on the available cores. (default)
+     * Is ignored if `baseDir` is `NULL`.
+     */
+    int workerCount;
+
+    /**
+     * If this is larger than `workerCount`, the pool grows up to this size
+     * while jobs queue up faster than the workers can handle them
+     * and shrinks back to `workerCount` when workers become idle.
+     * Otherwise the pool has a fixed size. (default)
+     */
+    int maxWorkerCount;
+
     /**
      * Whether statistics should be enabled.
      */
@@ -197,13 +408,24 @@ VMAN_API void vmanSetUnusedChunkTimeout( const vmanVolume volume, int seconds );
 
 /**
  * Timeout after that modified chunks are saved to disk.
+ * If the journal is enabled, only the journaled voxel writes are flushed.
  * Negative values disable this behaviour.
+ * @see vmanVolumeParameters#enableJournal
  */
 VMAN_API void vmanSetModifiedChunkTimeout( const vmanVolume volume, int seconds );
 
 
+/**
+ * Timeout after that the layers of unreferenced chunks are compressed.
+ * They're decompressed transparently when they're accessed again.
+ * Negative values disable this behaviour. (default)
+ */
+VMAN_API void vmanSetIdleChunkTimeout( const vmanVolume volume, int seconds );
+
+
 /**
  * Resets all statistics to zero.
+ * Except the byte counts, which describe the current state.
  */
 VMAN_API void vmanResetStatistics( const vmanVolume volume );
 
@@ -216,6 +438,14 @@ VMAN_API void vmanResetStatistics( const vmanVolume volume );
 VMAN_API bool vmanGetStatistics( const vmanVolume volume, vmanStatistics* statisticsDestination );
 
 
+/**
+ * Bytes used by the layers of all loaded chunks.
+ * Layers that are mapped from chunk files are not counted.
+ * @see vmanVolumeParameters#maxResidentBytes
+ */
+VMAN_API size_t vmanGetResidentBytes( const vmanVolume volume );
+
+
 // -- Selection --
 
 typedef struct
@@ -230,7 +460,19 @@ typedef struct
 typedef enum
 {
     VMAN_READ_ACCESS  = 1,
-    VMAN_WRITE_ACCESS = 2
+    VMAN_WRITE_ACCESS = 2,
+
+    /**
+     * Reads without locking any chunk, which is meant for frequent small reads.
+     * Only vmanReadRegion() may be used, since voxels can only be read by copying them:
+     * Each chunk has a version, which changes whenever it's modified.
+     * The copied voxels are discarded and read again, if the version changed meanwhile.
+     * After a few conflicts the chunk is locked for reading instead.
+     * Every chunk is copied consistently,
+     * but different chunks may show different points in time.
+     * Must not be combined with the other flags.
+     */
+    VMAN_OPTIMISTIC_READ_ACCESS = 4
 } vmanAccessMode;
 
 typedef void* vmanAccess;
@@ -255,11 +497,41 @@ VMAN_API void vmanDeleteAccess( const vmanAccess access );
  */
 VMAN_API void vmanSelect( vmanAccess access, const vmanSelection* selection );
 
+/**
+ * Called when the chunks of an asynchronous selection have been loaded.
+ * It may run on a worker thread or directly within vmanSelectAsync.
+ * It must return quickly and must neither use nor delete its access object;
+ * it's meant to set a flag, which is checked in the next update.
+ * Other access objects may be selected though.
+ */
+typedef void (*vmanSelectionCallback)( vmanAccess access, void* context );
+
+/**
+ * Behaves like vmanSelect, but calls `callback` once none of the
+ * selected chunks needs to be loaded anymore.
+ * Neither function waits for the disk, so instead of locking right away
+ * applications may skip regions until they're ready.
+ * Changing the selection cancels the callback.
+ * @param callback May be NULL.
+ * @see vmanIsSelectionReady
+ */
+VMAN_API void vmanSelectAsync( vmanAccess access, const vmanSelection* selection, vmanSelectionCallback callback, void* context );
+
+/**
+ * Returns a positive value if none of the selected chunks is being loaded
+ * or saved, so locking won't have to wait for the disk.
+ * Is thread safe.
+ */
+VMAN_API int vmanIsSelectionReady( const vmanAccess access );
+
 /**
  * Locks access to the specified selection.
  * May block when intersecting chunks are already locked by other access objects.
  * May also block while affected chunks are loaded from disk.
- * Multiple access objects may read simultaneously from the same chunk.
+ * Multiple access objects may read simultaneously from the same chunk,
+ * as long as they were locked without VMAN_WRITE_ACCESS.
+ * All chunks of the selection are granted at once and
+ * access objects that wait for the same chunk are served in order.
  * @param mode Access mode bitmask.
  * @see vmanAccessMode
  */
@@ -273,12 +545,59 @@ VMAN_API void vmanLockAccess( vmanAccess access, int mode );
  */
 VMAN_API int vmanTryLockAccess( vmanAccess access, int mode );
 
+/**
+ * Behaves like vmanLockAccess, but gives up after the given time.
+ * Returns 0 if it timed out and a positive value on success.
+ * @param milliseconds Negative values wait forever.
+ * @see vmanLockAccess
+ */
+VMAN_API int vmanLockAccessFor( vmanAccess access, int mode, int milliseconds );
+
 
 /**
  * Unlocks access.
  */
 VMAN_API void vmanUnlockAccess( vmanAccess access );
 
+typedef enum
+{
+    /**
+     * The chunk isn't in memory.
+     */
+    VMAN_CHUNK_ABSENT = 0,
+
+    /**
+     * Waits for its data to be read from disk.
+     * Locking an access waits until its chunks are loaded.
+     */
+    VMAN_CHUNK_LOADING,
+
+    /**
+     * The chunk can be used.
+     */
+    VMAN_CHUNK_READY,
+
+    /**
+     * The chunk is being written to disk.
+     * Access objects wait until the save is done.
+     */
+    VMAN_CHUNK_SAVING,
+
+    /**
+     * The chunk is being removed from memory.
+     */
+    VMAN_CHUNK_EVICTING
+} vmanChunkState;
+
+/**
+ * Copies the current state of each selected chunk to `statesOut`.
+ * The states are ordered like voxels: x varies fastest, then y, then z.
+ * They're meant for diagnostics, as they may change right afterwards.
+ * @param maxCount Size of `statesOut`, further states are skipped.
+ * @return Amount of selected chunks.
+ */
+VMAN_API int vmanGetAccessChunkStates( const vmanAccess access, vmanChunkState* statesOut, int maxCount );
+
 /**
  * @return A read only pointer to the voxel data in the specified layer.
  * Will return NULL if the voxel lies outside the selection or
@@ -294,6 +613,160 @@ VMAN_API const void* vmanReadVoxelLayer( const vmanAccess access, int x, int y,
  */
 VMAN_API void* vmanReadWriteVoxelLayer( const vmanAccess access, int x, int y, int z, int layer );
 
+/**
+ * Copies a voxel into the specified layer.
+ * Prefer this over vmanReadWriteVoxelLayer() for sparse data:
+ * Layers that are absent or uniform are only allocated,
+ * if the written value differs from their current value.
+ * @return `1` on success or `0` if the voxel lies outside the selection or
+ * an incomplatible access mode has been selected.
+ */
+VMAN_API int vmanWriteVoxelLayer( const vmanAccess access, int x, int y, int z, int layer, const void* voxel );
+
+/**
+ * Describes where the voxels of one layer are stored in a caller buffer,
+ * when a box is copied with vmanReadRegion() or vmanWriteRegion().
+ * Voxel `(x,y,z)` of the box, relative to its origin, is located at
+ * `data + x*voxelStride + y*rowStride + z*sliceStride`.
+ * Strides are given in bytes, `0` selects a tightly packed layout.
+ * Layers can be interleaved by using the same buffer with a larger voxel stride.
+ */
+typedef struct
+{
+    int layer;
+    void* data;
+    int voxelStride;
+    int rowStride;
+    int sliceStride;
+} vmanLayerBuffer;
+
+/**
+ * Copies a box of voxels from one or more layers into caller buffers.
+ * Voxels are copied chunk by chunk and row by row,
+ * which is much faster than reading them one by one.
+ * @param box Voxel box, which must lie inside the selection.
+ * @param buffers One buffer for each copied layer.
+ * @return `1` on success or `0` if the box lies outside the selection,
+ * a layer doesn't exist or an incomplatible access mode has been selected.
+ */
+VMAN_API int vmanReadRegion( const vmanAccess access, const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount );
+
+/**
+ * Copies caller buffers into a box of voxels.
+ * Like vmanWriteVoxelLayer() layers that are absent or uniform
+ * are only allocated, if the written values differ from them.
+ * Needs write access only.
+ * @see vmanReadRegion
+ */
+VMAN_API int vmanWriteRegion( const vmanAccess access, const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount );
+
+/**
+ * Voxels of one layer, that lie inside a single chunk
+ * and can be accessed directly without any further calls.
+ * The span starts at the requested voxel and ends at the chunk
+ * or selection boundary in each direction, whichever comes first.
+ * Voxel `(x,y,z)` of the span, relative to its start, is located at
+ * `data + x*voxelStride + y*rowStride + z*sliceStride`.
+ *
+ * A mesher may iterate a selection like this:
+ *
+ *     for(z = sel.z; z < sel.z+sel.d; z += span.slices)
+ *     for(y = sel.y; y < sel.y+sel.h; y += span.rows)
+ *     for(x = sel.x; x < sel.x+sel.w; x += span.length)
+ *     {
+ *         vmanReadVoxelSpan(access, x,y,z, layer, &span);
+ *         // Process span.length * span.rows * span.slices voxels.
+ *     }
+ *
+ * That works, because spans starting at the same y and z
+ * end at the same chunk or selection boundaries.
+ */
+typedef struct
+{
+    /**
+     * First voxel of the span.
+     */
+    void* data;
+
+    /**
+     * Voxels in each row. (x axis)
+     */
+    int length;
+
+    /**
+     * Rows in each slice. (y axis)
+     */
+    int rows;
+
+    /**
+     * Slices in the span. (z axis)
+     */
+    int slices;
+
+    /**
+     * Strides in bytes.
+     * Voxels inside a row are contiguous, so voxelStride is the voxel size.
+     */
+    int voxelStride;
+    int rowStride;
+    int sliceStride;
+} vmanVoxelSpan;
+
+/**
+ * Provides read only access to the voxels of a chunk, starting at the given voxel.
+ * The span stays valid until the access is unlocked.
+ * Absent and uniform layers may be backed by a shared read only page.
+ * @return `1` on success or `0` if the voxel lies outside the selection or
+ * an incomplatible access mode has been selected.
+ * @see vmanVoxelSpan
+ */
+VMAN_API int vmanReadVoxelSpan( const vmanAccess access, int x, int y, int z, int layer, vmanVoxelSpan* spanOut );
+
+/**
+ * Like vmanReadVoxelSpan(), but the voxels may be written too.
+ * All voxels of the span are considered as modified.
+ * Read only spans of the same layer and chunk may become stale afterwards.
+ * Needs read and write access like vmanReadWriteVoxelLayer().
+ */
+VMAN_API int vmanReadWriteVoxelSpan( const vmanAccess access, int x, int y, int z, int layer, vmanVoxelSpan* spanOut );
+
+
+// -- Snapshots --
+
+typedef void* vmanSnapshot;
+
+/**
+ * Pins the current voxels of a selection for long running readers,
+ * like backups, exports or meshing in the background.
+ * The selection is only locked for reading while the snapshot is created.
+ * Afterwards writers copy the pinned layers before modifying them,
+ * so they never wait for snapshot readers.
+ * Snapshots are read only and may be used by any amount of threads.
+ * @return NULL when something went wrong.
+ */
+VMAN_API vmanSnapshot vmanCreateSnapshot( const vmanVolume volume, const vmanSelection* selection );
+
+/**
+ * Frees the layer versions, which aren't used by anyone else.
+ * Snapshots must be deleted before their volume.
+ */
+VMAN_API void vmanDeleteSnapshot( const vmanSnapshot snapshot );
+
+/**
+ * @return A read only pointer to the voxel data in the specified layer,
+ * which stays valid until the snapshot is deleted.
+ * Will return NULL if the voxel lies outside the snapshot selection.
+ */
+VMAN_API const void* vmanReadSnapshotVoxelLayer( const vmanSnapshot snapshot, int x, int y, int z, int layer );
+
+/**
+ * Copies a box of voxels from one or more layers into caller buffers.
+ * @return `1` on success or `0` if the box lies outside the snapshot selection
+ * or a layer doesn't exist.
+ * @see vmanReadRegion
+ */
+VMAN_API int vmanReadSnapshotRegion( const vmanSnapshot snapshot, const vmanSelection* box, const vmanLayerBuffer* buffers, int bufferCount );
+
 
 #ifdef __cplusplus
 }
@@ -22,8 +22,8 @@ void CopyBytes( const void* source, void* destination, int count )
 
 static const vmanLayer layers[LAYER_COUNT] =
 {
-    {"Material", 1, 1, CopyBytes, CopyBytes},
-    {"Pressure", 1, 1, CopyBytes, CopyBytes}
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL},
+    {"Pressure", 1, 1, CopyBytes, CopyBytes, NULL}
 };
 
 static const int CHUNK_EDGE_LENGTH = 8;
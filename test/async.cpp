@@ -0,0 +1,378 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <tinythread.h>
+
+#include <Volume.h>
+#include <Access.h>
+#include <SharedMutex.h>
+#include <Util.h>
+
+using namespace vman;
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int CHUNKS_PER_EDGE = 4;
+static const int CHUNK_COUNT = CHUNKS_PER_EDGE*CHUNKS_PER_EDGE*CHUNKS_PER_EDGE;
+
+vmanSelection MakeBox( int x, int y, int z, int w, int h, int d )
+{
+    vmanSelection box;
+    box.x = x;
+    box.y = y;
+    box.z = z;
+    box.w = w;
+    box.h = h;
+    box.d = d;
+    return box;
+}
+
+/**
+ * Selects one voxel of each chunk.
+ */
+vmanSelection ChunkCorners()
+{
+    return MakeBox(0,0,0,
+        (CHUNKS_PER_EDGE-1)*CHUNK_EDGE_LENGTH+1,
+        (CHUNKS_PER_EDGE-1)*CHUNK_EDGE_LENGTH+1,
+        (CHUNKS_PER_EDGE-1)*CHUNK_EDGE_LENGTH+1
+    );
+}
+
+struct CallbackCounter
+{
+    CallbackCounter() : calls(0), access(NULL) {}
+    tthread::atomic_int calls;
+    vmanAccess access;
+};
+
+void CountCallback( vmanAccess access, void* context )
+{
+    CallbackCounter* counter = (CallbackCounter*)context;
+    counter->access = access;
+    counter->calls++;
+}
+
+/**
+ * The callback is called once, after the stored chunks have been loaded.
+ */
+void TestStoredChunks( const vmanVolumeParameters* volumeParams )
+{
+    {
+        Volume volume(volumeParams);
+        Access access(&volume);
+        const vmanSelection selection = ChunkCorners();
+        access.select(&selection);
+        access.lock(VMAN_WRITE_ACCESS);
+        const char material = 42;
+        for(int z = 0; z < CHUNKS_PER_EDGE; ++z)
+        for(int y = 0; y < CHUNKS_PER_EDGE; ++y)
+        for(int x = 0; x < CHUNKS_PER_EDGE; ++x)
+            assert(access.writeVoxelLayer(x*CHUNK_EDGE_LENGTH, y*CHUNK_EDGE_LENGTH, z*CHUNK_EDGE_LENGTH, 0, &material));
+        access.unlock();
+        access.select(NULL);
+    }
+
+    Volume volume(volumeParams);
+    Access access(&volume);
+    const vmanSelection selection = ChunkCorners();
+    CallbackCounter counter;
+    access.selectAsync(&selection, CountCallback, &counter);
+
+    while(counter.calls == 0)
+        tthread::this_thread::yield();
+    assert(counter.access == &access);
+    assert(access.isSelectionReady());
+
+    assert(access.lockFor(VMAN_READ_ACCESS, 0));
+    const char* material = (const char*)access.readVoxelLayer(0,0,0, 0);
+    assert(*material == 42);
+    access.unlock();
+
+    access.select(NULL);
+    assert(counter.calls == 1);
+}
+
+struct DeselectingCallback
+{
+    DeselectingCallback() : calls(0), other(NULL) {}
+    tthread::atomic_int calls;
+    Access* other;
+};
+
+void DeselectOther( vmanAccess access, void* context )
+{
+    DeselectingCallback* callback = (DeselectingCallback*)context;
+    callback->other->select(NULL);
+    callback->calls++;
+}
+
+/**
+ * Callbacks may select other access objects, which wait for the same chunks.
+ */
+void TestCallbackSelectsOther( const vmanVolumeParameters* volumeParams )
+{
+    Volume volume(volumeParams);
+    Access first(&volume);
+    Access second(&volume);
+    const vmanSelection selection = ChunkCorners();
+
+    CallbackCounter counter;
+    second.selectAsync(&selection, CountCallback, &counter);
+
+    DeselectingCallback callback;
+    callback.other = &second;
+    first.selectAsync(&selection, DeselectOther, &callback);
+
+    while(callback.calls == 0)
+        tthread::this_thread::yield();
+
+    first.select(NULL);
+    assert(callback.calls == 1);
+    assert(counter.calls <= 1);
+}
+
+struct SelectingCallback
+{
+    SelectingCallback() : calls(0), other(NULL) {}
+    tthread::atomic_int calls;
+    Access* other;
+    vmanSelection selection;
+};
+
+void SelectOther( vmanAccess access, void* context )
+{
+    SelectingCallback* callback = (SelectingCallback*)context;
+    callback->other->select(&callback->selection);
+    callback->calls++;
+}
+
+/**
+ * Callbacks may select chunks, which haven't been loaded yet,
+ * while the scheduler waits for the chunks that are being loaded.
+ */
+void TestCallbackSelectsNewChunks( const vmanVolumeParameters* volumeParams )
+{
+    const vmanSelection selection = ChunkCorners();
+    for(int round = 0; round < 32; ++round)
+    {
+        Volume volume(volumeParams);
+        volume.setUnusedChunkTimeout(0);
+
+        // Released chunks are checked right away, even while they're loading.
+        Access loader(&volume);
+        loader.select(&selection);
+        loader.select(NULL);
+
+        Access first(&volume);
+        Access second(&volume);
+        SelectingCallback callback;
+        callback.other = &second;
+        // Spans enough chunks to share stripes with the loaded ones.
+        callback.selection = MakeBox((round+1)*CHUNK_COUNT*CHUNK_EDGE_LENGTH,0,0,
+            CHUNK_COUNT*CHUNK_EDGE_LENGTH, CHUNK_EDGE_LENGTH, CHUNK_EDGE_LENGTH
+        );
+        const vmanSelection lastChunk = MakeBox(
+            (CHUNKS_PER_EDGE-1)*CHUNK_EDGE_LENGTH,
+            (CHUNKS_PER_EDGE-1)*CHUNK_EDGE_LENGTH,
+            (CHUNKS_PER_EDGE-1)*CHUNK_EDGE_LENGTH,
+            1,1,1
+        );
+        first.selectAsync(&lastChunk, SelectOther, &callback);
+
+        const uint64_t startTime = GetMonotonicMilliseconds();
+        while(callback.calls == 0)
+        {
+            assert(GetMonotonicMilliseconds() - startTime < 10000);
+            loader.select(&selection);
+            loader.select(NULL);
+        }
+
+        assert(second.lockFor(VMAN_READ_ACCESS, 10000));
+        second.unlock();
+        first.select(NULL);
+        second.select(NULL);
+        assert(callback.calls == 1);
+    }
+}
+
+struct ReadinessCallback
+{
+    ReadinessCallback() : calls(0), earlyCalls(0), access(NULL) {}
+    tthread::atomic_int calls;
+    tthread::atomic_int earlyCalls;
+    Access* access;
+};
+
+void CheckReadiness( vmanAccess access, void* context )
+{
+    ReadinessCallback* callback = (ReadinessCallback*)context;
+    std::vector<vmanChunkState> states(callback->access->getChunkStates(NULL, 0));
+    callback->access->getChunkStates(&states[0], states.size());
+    for(int i = 0; i < states.size(); ++i)
+        if(states[i] == VMAN_CHUNK_LOADING)
+            callback->earlyCalls++;
+    callback->calls++;
+}
+
+/**
+ * Chunks that are loaded while selectAsync registers its listeners
+ * must not call back before the others are loaded, nor more than once.
+ */
+void TestLoadsWhileRegistering( const vmanVolumeParameters* volumeParams )
+{
+    // Enough chunks, so registering takes as long as loading a few of them.
+    const vmanSelection selection = MakeBox(0,0,0,
+        16*CHUNK_EDGE_LENGTH, 16*CHUNK_EDGE_LENGTH, 4*CHUNK_EDGE_LENGTH
+    );
+    {
+        Volume volume(volumeParams);
+        Access access(&volume);
+        access.select(&selection);
+        access.lock(VMAN_WRITE_ACCESS);
+        const char material = 1;
+        for(int z = 0; z < selection.d; z += CHUNK_EDGE_LENGTH)
+        for(int y = 0; y < selection.h; y += CHUNK_EDGE_LENGTH)
+        for(int x = 0; x < selection.w; x += CHUNK_EDGE_LENGTH)
+            assert(access.writeVoxelLayer(x,y,z, 0, &material));
+        access.unlock();
+        access.select(NULL);
+    }
+
+    for(int round = 0; round < 16; ++round)
+    {
+        Volume volume(volumeParams);
+
+        // Starts the loads right before the listeners are registered.
+        Access loader(&volume);
+        loader.select(&selection);
+
+        Access access(&volume);
+        ReadinessCallback callback;
+        callback.access = &access;
+        access.selectAsync(&selection, CheckReadiness, &callback);
+
+        const uint64_t startTime = GetMonotonicMilliseconds();
+        while(callback.calls == 0)
+        {
+            assert(GetMonotonicMilliseconds() - startTime < 10000);
+            tthread::this_thread::yield();
+        }
+
+        // A second call would follow right away.
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+        access.select(NULL);
+        loader.select(NULL);
+        assert(callback.calls == 1);
+        assert(callback.earlyCalls == 0);
+    }
+}
+
+/**
+ * Nothing needs to be loaded, so the callback is called right away.
+ */
+void TestNewChunks( const vmanVolumeParameters* volumeParams )
+{
+    Volume volume(volumeParams);
+    Access access(&volume);
+    const vmanSelection selection = MakeBox(0,0,0, 1,1,1);
+    CallbackCounter counter;
+    access.selectAsync(&selection, CountCallback, &counter);
+    assert(counter.calls == 1);
+    assert(access.isSelectionReady());
+
+    // Locking would wait for running saves too.
+    const vmanSelection chunkSelection = MakeBox(0,0,0, 1,1,1);
+    Chunk* chunk = NULL;
+    volume.getSelection(&chunkSelection, &chunk, 0);
+    chunk->setState(VMAN_CHUNK_SAVING);
+    assert(access.isSelectionReady() == false);
+    chunk->setState(VMAN_CHUNK_READY);
+    assert(access.isSelectionReady());
+    chunk->releaseReference();
+
+    // Selecting again doesn't call the old callback.
+    access.select(&selection);
+    assert(counter.calls == 1);
+    access.select(NULL);
+}
+
+/**
+ * Timed out locks don't keep their place in the queue.
+ */
+void TestLockTimeout( const vmanVolumeParameters* volumeParams )
+{
+    Volume volume(volumeParams);
+    const vmanSelection selection = MakeBox(0,0,0, 1,1,1);
+
+    Access writer(&volume);
+    writer.select(&selection);
+    writer.lock(VMAN_WRITE_ACCESS);
+
+    Access reader(&volume);
+    reader.select(&selection);
+    assert(reader.lockFor(VMAN_READ_ACCESS, 20) == false);
+    assert(reader.tryLock(VMAN_READ_ACCESS) == false);
+    writer.unlock();
+
+    assert(reader.lockFor(VMAN_READ_ACCESS, 1000));
+    assert(writer.tryLock(VMAN_WRITE_ACCESS) == false);
+    reader.unlock();
+    assert(writer.tryLock(VMAN_WRITE_ACCESS));
+    writer.unlock();
+
+    reader.select(NULL);
+    writer.select(NULL);
+}
+
+void TestSharedMutexTimeout()
+{
+    SharedMutex mutex;
+    mutex.lock_shared();
+    assert(mutex.try_lock_for(10) == false);
+    assert(mutex.try_lock_shared_for(0)); // Waiting writers have given up.
+    mutex.unlock_shared();
+    mutex.unlock_shared();
+
+    assert(mutex.try_lock_for(0));
+    assert(mutex.try_lock_shared_for(10) == false);
+    mutex.unlock();
+    assert(mutex.try_lock_shared_for(-1));
+    mutex.unlock_shared();
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "asyncChunks";
+
+    TestStoredChunks(&volumeParams);
+    TestCallbackSelectsOther(&volumeParams);
+    TestCallbackSelectsNewChunks(&volumeParams);
+
+    volumeParams.baseDir = "registeringChunks";
+    TestLoadsWhileRegistering(&volumeParams);
+
+    volumeParams.baseDir = NULL;
+    TestNewChunks(&volumeParams);
+    TestLockTimeout(&volumeParams);
+    TestSharedMutexTimeout();
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -6,6 +6,9 @@
 #include <time.h>
 #include <stdint.h>
 #include <signal.h>
+#if !defined(_WIN32)
+#include <sys/time.h>
+#endif
 #include <vector>
 #include <map>
 #include <string>
@@ -43,6 +46,10 @@ struct Configuration
 	float minWait;
 	float maxWait;
 
+	float writeRatio;
+	float holdTime;
+	bool optimisticReads;
+
 	float secondsPerStatisticSample;
 	std::string statisticsFile;
 };
@@ -100,6 +107,193 @@ void BenchmarkerThread( void* context )
 // -----------
 
 
+double GetSeconds()
+{
+#if defined(_WIN32)
+	return double(GetTickCount()) / 1000.0;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return double(tv.tv_sec) + double(tv.tv_usec) / 1000000.0;
+#endif
+}
+
+struct ContentionContext
+{
+	const Configuration* config;
+	int threadIndex;
+};
+
+void ContentionThread( void* context )
+{
+	const ContentionContext* contentionContext = (ContentionContext*)context;
+	const Configuration* config = contentionContext->config;
+
+	// Every thread selects in its own area,
+	// so the threads only compete for the volume internals.
+	const int areaSize = config->maxSelectionDistance*2 + config->maxSelectionSize;
+	const int areaX = contentionContext->threadIndex * areaSize;
+
+	vmanAccess access = vmanCreateAccess(config->volume);
+
+	for(int i = 0; i < config->iterations; ++i)
+	{
+		vmanSelection selection =
+		{
+			areaX + Random(0, config->maxSelectionDistance*2),
+			Random(-config->maxSelectionDistance, config->maxSelectionDistance),
+			Random(-config->maxSelectionDistance, config->maxSelectionDistance),
+
+			Random(1, config->maxSelectionSize),
+			Random(1, config->maxSelectionSize),
+			Random(1, config->maxSelectionSize)
+		};
+		vmanSelect(access, &selection);
+	}
+
+	vmanDeleteAccess(access);
+}
+
+/**
+ * Runs the contention benchmark with 1, 2, 4, .. maxThreadCount threads
+ * and prints how many selections per second were done.
+ */
+void RunContentionBenchmark( const Configuration* config, int maxThreadCount )
+{
+	puts("# threads seconds selects/s");
+
+	for(int threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2)
+	{
+		if(threadCount*2 > maxThreadCount)
+			threadCount = maxThreadCount; // Always end with the requested thread count.
+
+		std::vector<ContentionContext> contexts(threadCount);
+		std::vector<tthread::thread*> contentionThreads(threadCount);
+
+		const double startTime = GetSeconds();
+		for(int i = 0; i < threadCount; ++i)
+		{
+			char buffer[32];
+			sprintf(buffer, "Contender %d", i);
+			contexts[i].config = config;
+			contexts[i].threadIndex = i;
+			contentionThreads[i] = new tthread::thread(ContentionThread, &contexts[i], buffer);
+		}
+
+		for(int i = 0; i < threadCount; ++i)
+		{
+			contentionThreads[i]->join();
+			delete contentionThreads[i];
+		}
+		const double duration = GetSeconds() - startTime;
+
+		printf("%9d %7.4f %9.1f\n",
+			threadCount,
+			duration,
+			double(threadCount) * double(config->iterations) / duration
+		);
+	}
+}
+
+void MixedThread( void* context )
+{
+	const Configuration* config = (Configuration*)context;
+
+	// All threads share the same area,
+	// so they compete for the same chunks.
+	const vmanSelection selection =
+	{
+		0, 0, 0,
+		config->maxSelectionSize,
+		config->maxSelectionSize,
+		config->maxSelectionSize
+	};
+	std::vector<char> voxels(selection.w*selection.h*selection.d*config->layers[0].voxelSize);
+	vmanLayerBuffer buffer;
+	memset(&buffer, 0, sizeof(buffer));
+	buffer.layer = 0;
+	buffer.data = &voxels[0];
+
+	vmanAccess access = vmanCreateAccess(config->volume);
+	vmanSelect(access, &selection);
+
+	for(int i = 0; i < config->iterations; ++i)
+	{
+		const bool write = Random(1.0f) < config->writeRatio;
+		if(write)
+			vmanLockAccess(access, VMAN_READ_ACCESS|VMAN_WRITE_ACCESS);
+		else if(config->optimisticReads)
+			vmanLockAccess(access, VMAN_OPTIMISTIC_READ_ACCESS);
+		else
+			vmanLockAccess(access, VMAN_READ_ACCESS);
+
+		vmanReadRegion(access, &selection, &buffer, 1);
+		if(write)
+		{
+			char* voxel = (char*)vmanReadWriteVoxelLayer(access,
+				Random(selection.x, selection.x + selection.w-1),
+				Random(selection.y, selection.y + selection.h-1),
+				Random(selection.z, selection.z + selection.d-1),
+				0
+			);
+			if(voxel != NULL)
+				*voxel = char(i);
+		}
+
+		// Simulates work done while the lock is held.
+		if(config->holdTime > 0.0f)
+			tthread::this_thread::sleep_for( tthread::chrono::milliseconds(config->holdTime*1000) );
+
+		vmanUnlockAccess(access);
+	}
+
+	vmanDeleteAccess(access);
+}
+
+/**
+ * Runs the read/write mix benchmark with 1, 2, 4, .. maxThreadCount threads
+ * and prints how many locks per second were done.
+ * Read only locks are shared, so they scale as long as writes are rare.
+ */
+void RunMixedBenchmark( const Configuration* config, int maxThreadCount )
+{
+	printf("# write ratio %.2f\n", config->writeRatio);
+	puts("# threads seconds locks/s");
+
+	for(int threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2)
+	{
+		if(threadCount*2 > maxThreadCount)
+			threadCount = maxThreadCount; // Always end with the requested thread count.
+
+		std::vector<tthread::thread*> mixedThreads(threadCount);
+
+		const double startTime = GetSeconds();
+		for(int i = 0; i < threadCount; ++i)
+		{
+			char buffer[32];
+			sprintf(buffer, "Mixer %d", i);
+			mixedThreads[i] = new tthread::thread(MixedThread, (void*)config, buffer);
+		}
+
+		for(int i = 0; i < threadCount; ++i)
+		{
+			mixedThreads[i]->join();
+			delete mixedThreads[i];
+		}
+		const double duration = GetSeconds() - startTime;
+
+		printf("%9d %7.4f %9.1f\n",
+			threadCount,
+			duration,
+			double(threadCount) * double(config->iterations) / duration
+		);
+	}
+}
+
+
+// -----------
+
+
 void CopyBytes( const void* source, void* destination, int count )
 {
     memcpy(destination, source, count);
@@ -119,7 +313,7 @@ char* CreateString( const char* format, ... )
     return out;
 }
 
-vmanLayer* CreateLayers( int count, int size )
+vmanLayer* CreateLayers( int count, int size, bool mappable )
 {
     vmanLayer* layers = new vmanLayer[count];
     for(int i = 0; i < count; ++i)
@@ -128,8 +322,9 @@ vmanLayer* CreateLayers( int count, int size )
         layer.name = CreateString("Layer %d", i);
         layer.voxelSize = size;
         layer.revision = 1;
-        layer.serializeFn = CopyBytes;
-        layer.deserializeFn = CopyBytes;
+        layer.serializeFn = mappable ? NULL : CopyBytes;
+        layer.deserializeFn = mappable ? NULL : CopyBytes;
+        layer.defaultValue = NULL;
     }
     return layers;
 }
@@ -228,6 +423,16 @@ float GetConfigFloat( const char* key, float defaultValue )
 	return str.empty() ? defaultValue : atof(str.c_str());
 }
 
+vmanDurability ParseDurability( const std::string& name )
+{
+	if(name == "batch")
+		return VMAN_DURABILITY_BATCH;
+	else if(name == "chunk")
+		return VMAN_DURABILITY_CHUNK;
+	else
+		return VMAN_DURABILITY_NONE;
+}
+
 bool GetConfigBool( const char* key, bool defaultValue )
 {
 	const std::string str = GetConfigString(key, "");
@@ -280,18 +485,37 @@ void WriteStatistics( const Configuration* config, FILE* file, time_t startTime
 		assert(false);
 
 	fprintf(file,
-		"%9.4f %4d %4d %4d %4d %4d %4d %4d %4d %4d %4d\n",
+		"%9.4f %4d %4d %4d %4d %4d %4d %4d %4lu %4d %4d %4lu %4lu %4lu %4lu %4lu %4d %4d %4d %4d %4d %4d %4d %4lu %4d %4lu %4d %4d %4d %4lu\n",
 		difftime(time(NULL), startTime),
 		statistics.chunkGetHits,
 		statistics.chunkGetMisses,
 		statistics.chunkLoadOps,
 		statistics.chunkSaveOps,
 		statistics.chunkUnloadOps,
+		statistics.chunkEvictOps,
+		statistics.chunkSyncOps,
+		(unsigned long)statistics.journalBytes,
+		statistics.chunkIndexHits,
+		statistics.chunkIndexMisses,
+		(unsigned long)statistics.compressedBytes,
+		(unsigned long)statistics.uncompressedBytes,
+		(unsigned long)statistics.layerPoolReservedBytes,
+		(unsigned long)statistics.layerPoolUsedBytes,
+		(unsigned long)statistics.scratchBufferBytes,
 		statistics.readOps,
 		statistics.writeOps,
 		statistics.maxLoadedChunks,
 		statistics.maxScheduledChecks,
-		statistics.maxEnqueuedJobs
+		statistics.maxEnqueuedJobs,
+		statistics.jobWorkers,
+		statistics.activeJobWorkers,
+		(unsigned long)statistics.jobBusyMilliseconds,
+		statistics.lockWaits,
+		(unsigned long)statistics.lockWaitMilliseconds,
+		statistics.maxLockWaitMilliseconds,
+		statistics.optimisticReadConflicts,
+		statistics.optimisticReadFallbacks,
+		(unsigned long)vmanGetResidentBytes(config->volume)
 	);
 
 	vmanResetStatistics(config->volume);
@@ -318,11 +542,30 @@ void StatisticsWriterThread( void* context )
 			"chunkLoadOps "
 			"chunkSaveOps "
 			"chunkUnloadOps "
+			"chunkEvictOps "
+			"chunkSyncOps "
+			"journalBytes "
+			"chunkIndexHits "
+			"chunkIndexMisses "
+			"compressedBytes "
+			"uncompressedBytes "
+			"layerPoolReservedBytes "
+			"layerPoolUsedBytes "
+			"scratchBufferBytes "
 			"readOps "
 			"writeOps "
 			"maxLoadedChunks "
 			"maxScheduledChecks "
-			"maxEnqueuedJobs\n"
+			"maxEnqueuedJobs "
+			"jobWorkers "
+			"activeJobWorkers "
+			"jobBusyMilliseconds "
+			"lockWaits "
+			"lockWaitMilliseconds "
+			"maxLockWaitMilliseconds "
+			"optimisticReadConflicts "
+			"optimisticReadFallbacks "
+			"residentBytes\n"
 		);
 	}
 
@@ -367,7 +610,8 @@ int main( int argc, char* argv[] )
 
     const int layerSize = GetConfigInt("layer.size", 1);
     const int layerCount = GetConfigInt("layer.count", 1);
-    vmanLayer* layers = CreateLayers(layerCount, layerSize);
+    const bool mapLayers = GetConfigBool("volume.map-layers", false);
+    vmanLayer* layers = CreateLayers(layerCount, layerSize, mapLayers);
     const int chunkEdgeLength = GetConfigInt("chunk.edge-length", 8);
     const std::string volumeDir = GetConfigString("volume.directory", "");
 
@@ -379,11 +623,19 @@ int main( int argc, char* argv[] )
 	volumeParams.layerCount = layerCount;
 	volumeParams.chunkEdgeLength = chunkEdgeLength;
 	volumeParams.baseDir = volumeDir.empty() ? NULL : volumeDir.c_str();
+	volumeParams.regionEdgeLength = GetConfigInt("volume.region-edge-length", 0);
+	volumeParams.mapLayers = mapLayers;
+	volumeParams.maxResidentBytes = GetConfigInt("volume.max-resident-bytes", 0);
+	volumeParams.workerCount = GetConfigInt("volume.worker-count", 0);
+	volumeParams.maxWorkerCount = GetConfigInt("volume.max-worker-count", 0);
+	volumeParams.durability = ParseDurability(GetConfigString("volume.durability", "none"));
+	volumeParams.enableJournal = GetConfigBool("volume.journal", false);
 	volumeParams.enableStatistics = true;
     config.volume = vmanCreateVolume(&volumeParams);
 
 	vmanSetUnusedChunkTimeout(config.volume, GetConfigInt("chunk.unused-timeout", 4));
 	vmanSetModifiedChunkTimeout(config.volume, GetConfigInt("chunk.modified-timeout", 3));
+	vmanSetIdleChunkTimeout(config.volume, GetConfigInt("chunk.idle-timeout", -1));
 
     config.layers = layers;
     config.layerCount = layerCount;
@@ -392,6 +644,9 @@ int main( int argc, char* argv[] )
     config.maxSelectionSize = GetConfigInt("thread.max-selection_size", 10);
 	config.minWait = GetConfigFloat("thread.min-wait", 0);
 	config.maxWait = GetConfigFloat("thread.max-wait", 0);
+	config.writeRatio = GetConfigFloat("benchmark.write-ratio", 0.1f);
+	config.holdTime = GetConfigFloat("benchmark.hold-time", 0);
+	config.optimisticReads = GetConfigBool("benchmark.optimistic-reads", false);
 
 	const bool statisticsEnabled = GetConfigBool("statistics.enabled", false);
 	config.secondsPerStatisticSample = GetConfigFloat("statistics.seconds-per-sample", 0);
@@ -401,13 +656,25 @@ int main( int argc, char* argv[] )
 	if(statisticsEnabled)
 		statisticsWriterThread = new tthread::thread(StatisticsWriterThread, &config, "StatWriter");
 
+	const std::string mode = GetConfigString("benchmark.mode", "random");
 	const int threadCount = GetConfigInt("thread.count", 1);
-    for(int i = 0; i < threadCount; ++i)
-    {
-		char buffer[32];
-		sprintf(buffer, "Benchmarker %d", i);
-        threads.push_back( new tthread::thread(BenchmarkerThread, &config, buffer) );
-    }
+	if(mode == "contention")
+	{
+		RunContentionBenchmark(&config, threadCount);
+	}
+	else if(mode == "mixed")
+	{
+		RunMixedBenchmark(&config, threadCount);
+	}
+	else
+	{
+		for(int i = 0; i < threadCount; ++i)
+		{
+			char buffer[32];
+			sprintf(buffer, "Benchmarker %d", i);
+			threads.push_back( new tthread::thread(BenchmarkerThread, &config, buffer) );
+		}
+	}
 
 	for(int i = 0; i < threads.size(); ++i)
 	{
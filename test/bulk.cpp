@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+
+#include <Volume.h>
+#include <Chunk.h>
+#include <Access.h>
+
+using namespace vman;
+
+enum LayerIndex
+{
+    BASE_LAYER = 0,
+    EXTRA_LAYER,
+    LAYER_COUNT
+};
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[LAYER_COUNT] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL},
+    {"Pressure", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+
+/**
+ * Both layers of a voxel, as the application stores them.
+ */
+struct InterleavedVoxel
+{
+    char material;
+    char pressure;
+    char padding[2];
+};
+
+char Material( int x, int y, int z )
+{
+    return char(1 + x + y*3 + z*7);
+}
+
+char Pressure( int x, int y, int z )
+{
+    return char(100 + x - y + z*5);
+}
+
+vmanSelection MakeBox( int x, int y, int z, int w, int h, int d )
+{
+    vmanSelection box;
+    box.x = x;
+    box.y = y;
+    box.z = z;
+    box.w = w;
+    box.h = h;
+    box.d = d;
+    return box;
+}
+
+void TestWriteRegion( Access* access, const vmanSelection& box )
+{
+    // Tightly packed layers.
+    std::vector<char> material(box.w*box.h*box.d);
+    std::vector<char> pressure(box.w*box.h*box.d);
+    for(int z = 0; z < box.d; ++z)
+    for(int y = 0; y < box.h; ++y)
+    for(int x = 0; x < box.w; ++x)
+    {
+        const int i = x + y*box.w + z*box.w*box.h;
+        material[i] = Material(box.x+x, box.y+y, box.z+z);
+        pressure[i] = Pressure(box.x+x, box.y+y, box.z+z);
+    }
+
+    vmanLayerBuffer buffers[LAYER_COUNT];
+    memset(buffers, 0, sizeof(buffers));
+    buffers[0].layer = BASE_LAYER;
+    buffers[0].data = &material[0];
+    buffers[1].layer = EXTRA_LAYER;
+    buffers[1].data = &pressure[0];
+
+    access->lock(VMAN_WRITE_ACCESS);
+    assert(access->writeRegion(&box, buffers, LAYER_COUNT));
+    access->unlock();
+
+    access->lock(VMAN_READ_ACCESS);
+    for(int z = box.z; z < box.z+box.d; ++z)
+    for(int y = box.y; y < box.y+box.h; ++y)
+    for(int x = box.x; x < box.x+box.w; ++x)
+    {
+        assert(*(const char*)access->readVoxelLayer(x,y,z, BASE_LAYER) == Material(x,y,z));
+        assert(*(const char*)access->readVoxelLayer(x,y,z, EXTRA_LAYER) == Pressure(x,y,z));
+    }
+    access->unlock();
+}
+
+void TestReadRegion( Access* access, const vmanSelection& box )
+{
+    // Interleaved layers with padded rows.
+    const int rowStride = (box.w+1)*sizeof(InterleavedVoxel);
+    const int sliceStride = rowStride*box.h;
+    std::vector<char> data(sliceStride*box.d, 0);
+
+    vmanLayerBuffer buffers[LAYER_COUNT];
+    buffers[0].layer = BASE_LAYER;
+    buffers[0].data = &data[0];
+    buffers[1].layer = EXTRA_LAYER;
+    buffers[1].data = &data[1];
+    for(int i = 0; i < LAYER_COUNT; ++i)
+    {
+        buffers[i].voxelStride = sizeof(InterleavedVoxel);
+        buffers[i].rowStride = rowStride;
+        buffers[i].sliceStride = sliceStride;
+    }
+
+    access->lock(VMAN_READ_ACCESS);
+    assert(access->readRegion(&box, buffers, LAYER_COUNT));
+    access->unlock();
+
+    for(int z = 0; z < box.d; ++z)
+    for(int y = 0; y < box.h; ++y)
+    {
+        const InterleavedVoxel* row = (const InterleavedVoxel*)&data[y*rowStride + z*sliceStride];
+        for(int x = 0; x < box.w; ++x)
+        {
+            assert(row[x].material == Material(box.x+x, box.y+y, box.z+z));
+            assert(row[x].pressure == Pressure(box.x+x, box.y+y, box.z+z));
+        }
+        assert(row[box.w].material == 0); // Padding is untouched.
+    }
+}
+
+void TestUnchangedRegion( Volume* volume, Access* access, const vmanSelection& box )
+{
+    vmanStatistics before;
+    assert(volume->getStatistics(&before));
+
+    // Default values don't allocate layers.
+    std::vector<char> zeros(box.w*box.h*box.d, 0);
+    vmanLayerBuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.layer = BASE_LAYER;
+    buffer.data = &zeros[0];
+
+    access->lock(VMAN_WRITE_ACCESS);
+    assert(access->writeRegion(&box, &buffer, 1));
+    access->unlock();
+
+    vmanStatistics after;
+    assert(volume->getStatistics(&after));
+    assert(after.layerPoolUsedBytes == before.layerPoolUsedBytes);
+}
+
+void TestInvalidRegions( Access* access, const vmanSelection& selection )
+{
+    char voxel = 0;
+    vmanLayerBuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.layer = BASE_LAYER;
+    buffer.data = &voxel;
+
+    const vmanSelection outside = MakeBox(selection.x-1, selection.y, selection.z, 1, 1, 1);
+    const vmanSelection inside = MakeBox(selection.x, selection.y, selection.z, 1, 1, 1);
+
+    access->lock(VMAN_READ_ACCESS);
+    assert(!access->readRegion(&outside, &buffer, 1));
+    assert(!access->writeRegion(&inside, &buffer, 1)); // Needs write access.
+    buffer.layer = LAYER_COUNT;
+    assert(!access->readRegion(&inside, &buffer, 1));
+    access->unlock();
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = LAYER_COUNT;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "bulk-volume";
+	volumeParams.enableStatistics = true;
+    Volume volume(&volumeParams);
+
+    const vmanSelection selection = MakeBox(-20,-20,-20, 40,40,40);
+    Access access(&volume);
+    access.select(&selection);
+
+    // Spans several chunks, including negative ones.
+    const vmanSelection box = MakeBox(-5,-3,-11, 13,11,20);
+    TestWriteRegion(&access, box);
+    TestReadRegion(&access, box);
+
+    // Chunks that haven't been written yet.
+    TestUnchangedRegion(&volume, &access, MakeBox(10,10,10, 10,10,10));
+
+    TestInvalidRegions(&access, selection);
+
+    access.select(NULL);
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <assert.h>
+#include <vector>
+#include <Util.h>
+#include <Volume.h>
+#include <Chunk.h>
+#include <ChunkCache.h>
+#include <Access.h>
+
+using namespace vman;
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int BUDGET_CHUNKS = 4;
+static const int WRITTEN_CHUNKS = 16;
+
+void TestCachePolicy()
+{
+    ChunkCache cache;
+
+    for(ChunkId id = 1; id <= 8; ++id)
+        cache.touch(id);
+    cache.touch(1); // Repeated uses in probation don't count.
+    assert(cache.getSize() == 8);
+    assert(cache.isProtected(1) == false);
+
+    std::vector<ChunkId> order;
+    cache.getEvictionOrder(&order);
+    assert(order.size() == 8);
+    for(int i = 0; i < order.size(); ++i)
+        assert(order[i] == i+1);
+
+    // Chunks that come back after being evicted are protected.
+    cache.remove(1);
+    assert(cache.contains(1) == false);
+    cache.touch(1);
+    assert(cache.isProtected(1));
+
+    // A scan doesn't push the protected chunk out.
+    for(ChunkId id = 100; id < 120; ++id)
+        cache.touch(id);
+    order.clear();
+    cache.getEvictionOrder(&order);
+    assert(order.size() == cache.getSize());
+    assert(order.front() == 2);
+    assert(order.back() == 119);
+    int protectedPosition = 0;
+    while(order[protectedPosition] != 1)
+        protectedPosition++;
+    assert(order[protectedPosition-1] != 119);
+    assert(protectedPosition >= 20);
+}
+
+void RemoveStoredChunks( const char* baseDir )
+{
+    // Chunks of previous runs would be loaded while they are written.
+    std::vector<std::string> names;
+    ListDirectory(baseDir, &names);
+    for(int i = 0; i < names.size(); ++i)
+        remove((std::string(baseDir) + DirSep + names[i]).c_str());
+}
+
+void TestBudgetEviction( Volume* volume, size_t budget )
+{
+    Access access(volume);
+    for(int i = 0; i < WRITTEN_CHUNKS; ++i)
+    {
+        vmanSelection selection;
+        selection.x = i*CHUNK_EDGE_LENGTH;
+        selection.y = 0;
+        selection.z = 0;
+        selection.w = 1;
+        selection.h = 1;
+        selection.d = 1;
+        access.select(&selection);
+
+        const char material = i+1;
+        access.lock(VMAN_WRITE_ACCESS);
+        assert(access.writeVoxelLayer(i*CHUNK_EDGE_LENGTH,0,0, 0, &material));
+        access.unlock();
+    }
+    assert(volume->getResidentBytes() > budget);
+
+    // Modified chunks are saved before they're evicted.
+    for(int i = 0; i < 100 && volume->getResidentBytes() > budget; ++i)
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(100));
+    assert(volume->getResidentBytes() <= budget);
+
+    vmanStatistics statistics;
+    assert(volume->getStatistics(&statistics));
+    assert(statistics.chunkEvictOps > 0);
+    assert(statistics.chunkSaveOps > 0);
+}
+
+void TestStoredChunks( Volume* volume )
+{
+    // Nothing got lost.
+    for(int i = 0; i < WRITTEN_CHUNKS; ++i)
+    {
+        Chunk chunk(volume, i,0,0);
+        assert(chunk.loadFromFile());
+        assert(*(const char*)chunk.getConstLayer(0) == i+1);
+    }
+}
+
+int main()
+{
+    TestCachePolicy();
+
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "cached";
+	volumeParams.enableStatistics = true;
+	volumeParams.maxResidentBytes = BUDGET_CHUNKS*CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH;
+    RemoveStoredChunks(volumeParams.baseDir);
+    {
+        Volume volume(&volumeParams);
+        TestBudgetEviction(&volume, volumeParams.maxResidentBytes);
+    }
+
+    volumeParams.maxResidentBytes = 0;
+    Volume volume(&volumeParams);
+    TestStoredChunks(&volume);
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -20,12 +20,83 @@ void CopyBytes( const void* source, void* destination, int count )
 
 static const vmanLayer layers[LAYER_COUNT] =
 {
-    {"Material", 1, 1, CopyBytes, CopyBytes},
-    {"Pressure", 1, 1, CopyBytes, CopyBytes}
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL},
+    {"Pressure", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const vmanLayer mappedLayers[LAYER_COUNT] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL},
+    {"Pressure", 1, 1, CopyBytes, CopyBytes, NULL}
 };
 
 static const int CHUNK_EDGE_LENGTH = 8;
 
+void TestLayerMapping( int regionEdgeLength )
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = mappedLayers;
+	volumeParams.layerCount = LAYER_COUNT;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "mapped";
+	volumeParams.regionEdgeLength = regionEdgeLength;
+	volumeParams.mapLayers = true;
+    Volume volume(&volumeParams);
+    assert(volume.isLayerMappingEnabled());
+
+    {
+        Chunk chunk(&volume, 1,2,3);
+        char* material = (char*)chunk.getLayer(BASE_LAYER);
+        char* pressure = (char*)chunk.getLayer(EXTRA_LAYER);
+        material[0] = 42;
+        pressure[0] = 100;
+        bool success = chunk.saveToFile();
+        assert(success);
+    }
+
+    {
+        Chunk chunk(&volume, 1,2,3);
+        bool success = chunk.loadFromFile();
+        assert(success);
+
+        // Only layers without deserialize function are mapped.
+        assert(chunk.m_LayerMapped[BASE_LAYER]);
+        assert(!chunk.m_LayerMapped[EXTRA_LAYER]);
+
+        const char* mappedMaterial = (const char*)chunk.getConstLayer(BASE_LAYER);
+        assert(mappedMaterial[0] == 42);
+
+        // Writing copies the layer.
+        char* material = (char*)chunk.getLayer(BASE_LAYER);
+        assert(material != mappedMaterial);
+        assert(material[0] == 42);
+        assert(!chunk.m_LayerMapped[BASE_LAYER]);
+        assert(chunk.m_Mapping.address == NULL);
+        material[0] = 43;
+        chunk.setVoxelsModified(BASE_LAYER, 0, 1);
+
+        success = chunk.saveToFile();
+        assert(success);
+    }
+
+    {
+        Chunk chunk(&volume, 1,2,3);
+        bool success = chunk.loadFromFile();
+        assert(success);
+
+        // Saving must not change the data of mapped layers.
+        const char* material = (const char*)chunk.getConstLayer(BASE_LAYER);
+        assert(material[0] == 43);
+        chunk.setModified();
+        success = chunk.saveToFile();
+        assert(success);
+        material = (const char*)chunk.getConstLayer(BASE_LAYER);
+        assert(material[0] == 43);
+        assert(!chunk.m_LayerMapped[BASE_LAYER]);
+    }
+}
+
 int main()
 {
 	vmanVolumeParameters volumeParams;
@@ -62,6 +133,9 @@ int main()
         assert(success == false);
     }
 
+    TestLayerMapping(0);
+    TestLayerMapping(4);
+
     puts("No problems detected.");
 
     return 0;
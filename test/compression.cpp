@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <VoxelCodec.h>
+#include <Volume.h>
+#include <Chunk.h>
+
+using namespace vman;
+
+enum LayerIndex
+{
+    BASE_LAYER = 0,
+    EXTRA_LAYER,
+    LAYER_COUNT
+};
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[LAYER_COUNT] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL},
+    {"Temperature", 4, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+
+void TestVoxelCodec()
+{
+    const int voxelCount = 1000;
+    const int voxelSize = 2;
+
+    std::vector<char> voxels(voxelCount*voxelSize, 0);
+    for(int i = 300; i < 310; ++i)
+        voxels[i*voxelSize] = i;
+    voxels[(voxelCount-1)*voxelSize+1] = 7;
+
+    std::vector<char> data;
+    EncodeVoxels(&voxels[0], voxelCount, voxelSize, &data);
+    assert(data.size() < voxels.size() / 10);
+
+    std::vector<char> decoded(voxels.size(), 1);
+    assert(DecodeVoxels(&data[0], data.size(), voxelCount, voxelSize, &decoded[0]));
+    assert(decoded == voxels);
+
+    // Corrupt data is detected.
+    assert(DecodeVoxels(&data[0], data.size()-1, voxelCount, voxelSize, &decoded[0]) == false);
+    assert(DecodeVoxels(&data[0], data.size(), voxelCount-1, voxelSize, &decoded[0]) == false);
+
+    // Long runs need multiple length bytes.
+    std::vector<char> uniform(100000, 3);
+    EncodeVoxels(&uniform[0], uniform.size(), 1, &data);
+    assert(data.size() == 4);
+    std::vector<char> uniformDecoded(uniform.size());
+    assert(DecodeVoxels(&data[0], data.size(), uniform.size(), 1, &uniformDecoded[0]));
+    assert(uniformDecoded == uniform);
+}
+
+void TestPaletteCodec()
+{
+    const int voxelCount = 1000;
+    const int voxelSize = 2;
+
+    // Scattered values don't suit run length encoding.
+    std::vector<char> voxels(voxelCount*voxelSize, 0);
+    for(int i = 0; i < voxelCount; ++i)
+        voxels[i*voxelSize+1] = (i*7) % 3;
+
+    std::vector<char> data;
+    assert(EncodePalette(&voxels[0], voxelCount, voxelSize, &data));
+    assert(GetPaletteSize(&data[0], data.size()) == 3);
+    assert(data.size() == PALETTE_HEADER_SIZE + 3*voxelSize + voxelCount*2/8);
+
+    std::vector<char> decoded(voxels.size(), 1);
+    assert(DecodePalette(&data[0], data.size(), voxelCount, voxelSize, &decoded[0]));
+    assert(decoded == voxels);
+    assert(DecodePalette(&data[0], data.size()-1, voxelCount, voxelSize, &decoded[0]) == false);
+
+    // Uniform voxels need no indices at all.
+    std::vector<char> uniform(voxels.size(), 5);
+    assert(EncodePalette(&uniform[0], voxelCount, voxelSize, &data));
+    assert(data.size() == PALETTE_HEADER_SIZE + voxelSize);
+    assert(DecodeLayer(VOXEL_CODEC_PALETTE, &data[0], data.size(), voxelCount, voxelSize, &decoded[0]));
+    assert(decoded == uniform);
+
+    // Too many distinct values.
+    for(int i = 0; i < voxelCount; ++i)
+        voxels[i*voxelSize] = i % 200;
+    assert(EncodePalette(&voxels[0], voxelCount, voxelSize, &data) == false);
+}
+
+void TestPaletteFiles()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = LAYER_COUNT;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "paletted";
+    Volume volume(&volumeParams);
+
+    const int voxelsPerChunk = volume.getVoxelsPerChunk();
+
+    {
+        Chunk chunk(&volume, 1,2,3);
+        char* material = (char*)chunk.getLayer(BASE_LAYER);
+        for(int i = 0; i < voxelsPerChunk; ++i)
+            material[i] = (i*7) % 3;
+        assert(chunk.saveToFile());
+    }
+
+    std::vector<char> data;
+    assert(volume.getChunkStorage()->readChunk(1,2,3, &data));
+    assert(data.size() < voxelsPerChunk/2);
+
+    {
+        // Palette encoded layers are decoded when they're used.
+        Chunk chunk(&volume, 1,2,3);
+        assert(chunk.loadFromFile());
+        assert(chunk.m_LayerCodecs[BASE_LAYER] == VOXEL_CODEC_PALETTE);
+        const char* material = (const char*)chunk.getConstLayer(BASE_LAYER);
+        assert(chunk.m_LayerCodecs[BASE_LAYER] == VOXEL_CODEC_NONE);
+        for(int i = 0; i < voxelsPerChunk; ++i)
+            assert(material[i] == (i*7) % 3);
+    }
+
+    {
+        // Version 1 files store plain voxel arrays.
+        std::vector<char> v1(12 + 44 + voxelsPerChunk, 0);
+        const uint32_t header[3] = { 1, CHUNK_EDGE_LENGTH, 1 };
+        memcpy(&v1[0], header, sizeof(header));
+        strcpy(&v1[12], "Material");
+        const uint32_t layerInfo[3] = { 1, 1, 12 + 44 };
+        memcpy(&v1[12+32], layerInfo, sizeof(layerInfo));
+        v1[12+44+5] = 9;
+        assert(volume.getChunkStorage()->writeChunk(4,5,6, &v1[0], v1.size()));
+
+        Chunk chunk(&volume, 4,5,6);
+        assert(chunk.loadFromFile());
+        const char* material = (const char*)chunk.getConstLayer(BASE_LAYER);
+        assert(material[5] == 9);
+        assert(material[6] == 0);
+        assert(chunk.hasLayer(EXTRA_LAYER) == false);
+    }
+}
+
+void TestChunkCompression()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = LAYER_COUNT;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "compressed";
+	volumeParams.enableStatistics = true;
+    Volume volume(&volumeParams);
+
+    vmanStatistics statistics;
+
+    {
+        Chunk chunk(&volume, 1,2,3);
+        char* material = (char*)chunk.getLayer(BASE_LAYER);
+        material[0] = 42;
+        char* temperature = (char*)chunk.getLayer(EXTRA_LAYER);
+        temperature[7] = 1;
+
+        assert(chunk.compressLayers() == LAYER_COUNT);
+        assert(chunk.m_LayerCodecs[BASE_LAYER] != VOXEL_CODEC_NONE);
+        assert(chunk.m_LayerCodecs[EXTRA_LAYER] != VOXEL_CODEC_NONE);
+        assert(chunk.compressLayers() == 0);
+
+        const int voxelsPerChunk = volume.getVoxelsPerChunk();
+        assert(volume.getStatistics(&statistics));
+        assert(statistics.uncompressedBytes == voxelsPerChunk*(1+4));
+        assert(statistics.compressedBytes*10 < statistics.uncompressedBytes);
+
+        // Resetting keeps the current amounts.
+        volume.resetStatistics();
+        assert(volume.getStatistics(&statistics));
+        assert(statistics.uncompressedBytes == voxelsPerChunk*(1+4));
+
+        // Saving leaves the layers compressed.
+        assert(chunk.saveToFile());
+        assert(chunk.m_LayerCodecs[BASE_LAYER] != VOXEL_CODEC_NONE);
+
+        // Reading decompresses the layer.
+        const char* constMaterial = (const char*)chunk.getConstLayer(BASE_LAYER);
+        assert(chunk.m_LayerCodecs[BASE_LAYER] == VOXEL_CODEC_NONE);
+        assert(constMaterial[0] == 42);
+        assert(constMaterial[1] == 0);
+
+        assert(volume.getStatistics(&statistics));
+        assert(statistics.uncompressedBytes == voxelsPerChunk*4);
+    }
+
+    // Deleting the chunk releases the compressed layers.
+    assert(volume.getStatistics(&statistics));
+    assert(statistics.compressedBytes == 0);
+    assert(statistics.uncompressedBytes == 0);
+
+    {
+        Chunk chunk(&volume, 1,2,3);
+        assert(chunk.loadFromFile());
+        const char* material = (const char*)chunk.getConstLayer(BASE_LAYER);
+        assert(material[0] == 42);
+    }
+}
+
+int main()
+{
+    TestVoxelCodec();
+    TestPaletteCodec();
+    TestChunkCompression();
+    TestPaletteFiles();
+
+    puts("No problems detected.");
+
+    return 0;
+}
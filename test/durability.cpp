@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <Util.h>
+#include <Volume.h>
+#include <Access.h>
+
+using namespace vman;
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int WRITTEN_CHUNKS = 24;
+
+void RemoveDirectoryEntries( const char* baseDir )
+{
+    std::vector<std::string> names;
+    ListDirectory(baseDir, &names);
+    for(int i = 0; i < names.size(); ++i)
+        remove((std::string(baseDir) + DirSep + names[i]).c_str());
+}
+
+int CountTempFiles( const char* baseDir )
+{
+    std::vector<std::string> names;
+    ListDirectory(baseDir, &names);
+    int count = 0;
+    for(int i = 0; i < names.size(); ++i)
+        if(names[i].find(".tmp") != std::string::npos)
+            count++;
+    return count;
+}
+
+/**
+ * Writes the chunks and waits until all of them have been saved.
+ * @return Sync operations that were needed.
+ */
+int WriteChunks( Volume* volume, int value, bool stored )
+{
+    Access access(volume);
+    vmanSelection selection;
+    selection.x = 0;
+    selection.y = 0;
+    selection.z = 0;
+    selection.w = WRITTEN_CHUNKS*CHUNK_EDGE_LENGTH;
+    selection.h = 1;
+    selection.d = 1;
+    access.select(&selection);
+
+    vmanStatistics statistics;
+    for(int i = 0; i < 200 && stored; ++i)
+    {
+        // Stored chunks are loaded first, so they don't replace the written voxels.
+        assert(volume->getStatistics(&statistics));
+        if(statistics.chunkLoadOps >= WRITTEN_CHUNKS)
+            break;
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(20));
+    }
+
+    access.lock(VMAN_WRITE_ACCESS);
+    for(int i = 0; i < WRITTEN_CHUNKS; ++i)
+    {
+        const char material = value+i;
+        assert(access.writeVoxelLayer(i*CHUNK_EDGE_LENGTH,0,0, 0, &material));
+    }
+    access.unlock();
+
+    volume->saveModifiedChunks();
+
+    for(int i = 0; i < 200; ++i)
+    {
+        assert(volume->getStatistics(&statistics));
+        if(statistics.chunkSaveOps >= WRITTEN_CHUNKS && statistics.activeJobWorkers == 0)
+            break;
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(20));
+    }
+    assert(statistics.chunkSaveOps == WRITTEN_CHUNKS);
+    return statistics.chunkSyncOps;
+}
+
+void CheckStoredChunks( Volume* volume, int value )
+{
+    for(int i = 0; i < WRITTEN_CHUNKS; ++i)
+    {
+        Chunk chunk(volume, i,0,0);
+        assert(chunk.loadFromFile());
+        assert(*(const char*)chunk.getConstLayer(0) == char(value+i));
+    }
+}
+
+int TestDurability( vmanVolumeParameters volumeParams, vmanDurability durability )
+{
+    volumeParams.durability = durability;
+    RemoveDirectoryEntries(volumeParams.baseDir);
+
+    int syncOps = 0;
+    {
+        Volume volume(&volumeParams);
+        syncOps = WriteChunks(&volume, 1, false);
+        CheckStoredChunks(&volume, 1);
+    }
+
+    // Chunks are replaced as a whole.
+    {
+        Volume volume(&volumeParams);
+        WriteChunks(&volume, 50, true);
+        CheckStoredChunks(&volume, 50);
+    }
+    assert(CountTempFiles(volumeParams.baseDir) == 0);
+    return syncOps;
+}
+
+void TestTempFileCleanup( const vmanVolumeParameters* volumeParams )
+{
+    const std::string baseDir = volumeParams->baseDir;
+
+    // A crash leaves a temporary file and an outdated index.
+    FILE* f = fopen((baseDir + DirSep + "9_9_9.tmp").c_str(), "wb");
+    assert(f != NULL);
+    fputs("half written", f);
+    fclose(f);
+    remove((baseDir + DirSep + "chunks.index").c_str());
+
+    Volume volume(volumeParams);
+    assert(CountTempFiles(volumeParams->baseDir) == 0);
+    assert(volume.getChunkStorage()->chunkExists(9,9,9) == false);
+    assert(volume.getChunkStorage()->chunkExists(0,0,0));
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "durable";
+	volumeParams.enableStatistics = true;
+
+    assert(TestDurability(volumeParams, VMAN_DURABILITY_NONE) == 0);
+
+    // Batches need far fewer syncs than chunks.
+    const int batchSyncOps = TestDurability(volumeParams, VMAN_DURABILITY_BATCH);
+    assert(batchSyncOps > 0);
+    assert(batchSyncOps < WRITTEN_CHUNKS);
+
+    assert(TestDurability(volumeParams, VMAN_DURABILITY_CHUNK) >= WRITTEN_CHUNKS);
+
+    TestTempFileCleanup(&volumeParams);
+
+    // Region files are synced too.
+    volumeParams.baseDir = "durable-regions";
+    volumeParams.regionEdgeLength = 4;
+    const int regionSyncOps = TestDurability(volumeParams, VMAN_DURABILITY_BATCH);
+    assert(regionSyncOps > 0);
+    assert(regionSyncOps < WRITTEN_CHUNKS);
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <tinythread.h>
+
+#include <EpochManager.h>
+#include <Volume.h>
+#include <Access.h>
+
+using namespace vman;
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int ITERATIONS = 300;
+
+vmanSelection MakeBox( int x, int y, int z, int w, int h, int d )
+{
+    vmanSelection box;
+    box.x = x;
+    box.y = y;
+    box.z = z;
+    box.w = w;
+    box.h = h;
+    box.d = d;
+    return box;
+}
+
+void DeleteInt( void* object )
+{
+    delete (int*)object;
+}
+
+void TestEpochManager()
+{
+    EpochManager manager;
+
+    // Objects nobody can see are deleted right away.
+    manager.retire(new int(1), DeleteInt);
+    assert(manager.getRetiredCount() == 0);
+
+    // Readers keep them alive ...
+    const unsigned int epoch = manager.enter(0);
+    manager.retire(new int(2), DeleteInt);
+    assert(manager.getRetiredCount() == 1);
+
+    // ... even if the epoch advanced meanwhile ...
+    {
+        EpochGuard guard(&manager, 1);
+        assert(manager.reclaim() == 0);
+    }
+    assert(manager.getRetiredCount() == 1);
+
+    // ... and no matter which stripe they use.
+    manager.leave(epoch, 0);
+    const unsigned int stripedEpoch = manager.enter(EpochManager::STRIPE_COUNT-1);
+    manager.retire(new int(3), DeleteInt);
+    assert(manager.getRetiredCount() == 1);
+    assert(manager.reclaim() == 0);
+
+    manager.leave(stripedEpoch, EpochManager::STRIPE_COUNT-1);
+    assert(manager.reclaim() == 1);
+    assert(manager.getRetiredCount() == 0);
+
+    const unsigned int otherEpoch = manager.enter(0);
+    manager.retire(new int(4), DeleteInt);
+    manager.leave(otherEpoch, 0);
+    manager.deleteRetired();
+    assert(manager.getRetiredCount() == 0);
+}
+
+struct SelectorContext
+{
+    Volume* volume;
+    vmanSelection selection;
+};
+
+/**
+ * Selects chunks again and again,
+ * while they're unloaded as soon as they're unused.
+ */
+void Selector( void* context )
+{
+    const SelectorContext* selectorContext = (SelectorContext*)context;
+
+    Access access(selectorContext->volume);
+    for(int i = 0; i < ITERATIONS; ++i)
+    {
+        access.select(&selectorContext->selection);
+        access.lock(VMAN_READ_ACCESS);
+        const vmanSelection& selection = selectorContext->selection;
+        assert(*(const char*)access.readVoxelLayer(selection.x, selection.y, selection.z, 0) == 0);
+        access.unlock();
+        access.select(NULL);
+    }
+}
+
+/**
+ * Lock free lookups never see chunks that have been deleted.
+ */
+void TestConcurrentUnloading( Volume* volume )
+{
+    volume->setUnusedChunkTimeout(0);
+
+    SelectorContext contexts[3];
+    contexts[0].selection = MakeBox(  0,  0,  0, 16,16,16);
+    contexts[1].selection = MakeBox( -8, -8, -8, 16,16,16);
+    contexts[2].selection = MakeBox(  8,  0, -8, 16,16,16);
+
+    tthread::thread* threads[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        contexts[i].volume = volume;
+        threads[i] = new tthread::thread(Selector, &contexts[i], "Selector");
+    }
+    for(int i = 0; i < 3; ++i)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    vmanStatistics statistics;
+    assert(volume->getStatistics(&statistics));
+    assert(statistics.chunkUnloadOps > 0);
+    assert(statistics.chunkGetHits > 0);
+}
+
+/**
+ * Lookups keep working while the chunk table grows.
+ */
+void TestGrowingTable( Volume* volume )
+{
+    volume->setUnusedChunkTimeout(60);
+
+    SelectorContext context;
+    context.volume = volume;
+    context.selection = MakeBox(-4,-4,-4, 8,8,8);
+    tthread::thread selector(Selector, &context, "Selector");
+
+    // Enough chunks to grow every stripe at least once.
+    Access access(volume);
+    const vmanSelection large = MakeBox(64,64,64, 16*CHUNK_EDGE_LENGTH, 16*CHUNK_EDGE_LENGTH, 8*CHUNK_EDGE_LENGTH);
+    access.select(&large);
+    access.select(NULL);
+
+    selector.join();
+}
+
+int main()
+{
+    TestEpochManager();
+
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.enableStatistics = true;
+    Volume volume(&volumeParams);
+
+    TestConcurrentUnloading(&volume);
+    TestGrowingTable(&volume);
+
+    puts("No problems detected.");
+
+    return 0;
+}
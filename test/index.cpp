@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <Util.h>
+#include <ChunkIndex.h>
+#include <Volume.h>
+#include <Chunk.h>
+
+using namespace vman;
+
+enum LayerIndex
+{
+    BASE_LAYER = 0,
+    EXTRA_LAYER,
+    LAYER_COUNT
+};
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[LAYER_COUNT] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL},
+    {"Pressure", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+
+void TestChunkIndex()
+{
+    {
+        ChunkIndex index(4);
+        index.insert(1,2,3);
+        index.insert(-1,-1,-1);
+        assert(index.contains(1,2,3));
+        assert(index.contains(-1,-1,-1));
+        assert(index.contains(3,2,1) == false);
+        assert(index.contains(-4,-1,-1) == false);
+
+        assert(index.save("test.index", false));
+        assert(index.load("test.index") == false); // Wasn't closed cleanly.
+        assert(index.contains(1,2,3) == false);
+
+        index.insert(1,2,3);
+        index.insert(-1,-1,-1);
+        assert(index.save("test.index", true));
+    }
+
+    {
+        ChunkIndex index(4);
+        assert(index.load("test.index"));
+        assert(index.contains(1,2,3));
+        assert(index.contains(-1,-1,-1));
+        assert(index.contains(3,2,1) == false);
+    }
+
+    {
+        ChunkIndex index(5);
+        assert(index.load("test.index") == false); // Region edge length differs.
+    }
+}
+
+void TestVolumeIndex( int regionEdgeLength )
+{
+    vmanVolumeParameters volumeParams;
+    vmanInitVolumeParameters(&volumeParams);
+    volumeParams.layers = layers;
+    volumeParams.layerCount = LAYER_COUNT;
+    volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+    volumeParams.baseDir = "indexed";
+    volumeParams.regionEdgeLength = regionEdgeLength;
+    volumeParams.enableStatistics = true;
+
+    {
+        Volume volume(&volumeParams);
+        Chunk chunk(&volume, 1,2,3);
+        chunk.getLayer(BASE_LAYER);
+        assert(chunk.saveToFile());
+    }
+    assert(GetFileType("indexed/chunks.index") == FILE_TYPE_REGULAR);
+
+    // Is rebuilt from the stored chunks.
+    remove("indexed/chunks.index");
+
+    {
+        Volume volume(&volumeParams);
+        ChunkStorage* storage = volume.getChunkStorage();
+        assert(storage->chunkExists(1,2,3));
+        assert(storage->chunkExists(1,2,4) == false);
+        assert(storage->chunkExists(-7,2,4) == false);
+
+        vmanStatistics statistics;
+        assert(volume.getStatistics(&statistics));
+        assert(statistics.chunkIndexHits == 1);
+        assert(statistics.chunkIndexMisses == 2);
+    }
+}
+
+int main()
+{
+    TestChunkIndex();
+    TestVolumeIndex(0);
+    TestVolumeIndex(4);
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <Util.h>
+#include <Volume.h>
+#include <IoBackend.h>
+#include <Access.h>
+
+using namespace vman;
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int WRITTEN_CHUNKS = 40;
+static const int SMALL_READS = 200; // More than fit into a ring at once.
+
+void TestBackend( bool useIoUring )
+{
+    IoBackend backend(useIoUring);
+    printf("io_uring: %s\n", backend.usesIoUring() ? "yes" : "no");
+    if(!useIoUring)
+        assert(backend.usesIoUring() == false);
+
+    // Three parts are written as one file.
+    char header[10];
+    std::vector<char> body(5000);
+    char trailer[3];
+    memset(header, 'h', sizeof(header));
+    for(int i = 0; i < body.size(); ++i)
+        body[i] = i % 251;
+    memset(trailer, 't', sizeof(trailer));
+
+    IoVector parts[3];
+    parts[0].data = header;
+    parts[0].length = sizeof(header);
+    parts[1].data = &body[0];
+    parts[1].length = body.size();
+    parts[2].data = trailer;
+    parts[2].length = sizeof(trailer);
+
+    const int length = sizeof(header) + body.size() + sizeof(trailer);
+
+    int file = OpenFile("io.bin", true);
+    assert(file != -1);
+    IoRequest write;
+    write.file = file;
+    write.offset = 0;
+    write.vectors = parts;
+    write.vectorCount = 3;
+    write.write = true;
+    assert(backend.run(&write, 1));
+    assert(write.result == length);
+    CloseFile(file);
+
+    file = OpenFile("io.bin", false);
+    assert(file != -1);
+    assert(GetFileLength(file) == length);
+
+    // Many small reads are in flight at once.
+    std::vector<char> bytes(SMALL_READS);
+    std::vector<IoVector> vectors(SMALL_READS);
+    std::vector<IoRequest> reads(SMALL_READS);
+    for(int i = 0; i < SMALL_READS; ++i)
+    {
+        vectors[i].data = &bytes[i];
+        vectors[i].length = 1;
+        reads[i].file = file;
+        reads[i].offset = sizeof(header) + i*7;
+        reads[i].vectors = &vectors[i];
+        reads[i].vectorCount = 1;
+        reads[i].write = false;
+    }
+    assert(backend.run(&reads[0], reads.size()));
+    for(int i = 0; i < SMALL_READS; ++i)
+    {
+        assert(reads[i].result == 1);
+        assert(bytes[i] == char((i*7) % 251));
+    }
+
+    // Reads beyond the end of file are short.
+    char tail[10];
+    IoVector tailVector;
+    tailVector.data = tail;
+    tailVector.length = sizeof(tail);
+    IoRequest read;
+    read.file = file;
+    read.offset = length - 3;
+    read.vectors = &tailVector;
+    read.vectorCount = 1;
+    read.write = false;
+    assert(backend.run(&read, 1) == false);
+    assert(read.result == 3);
+    assert(memcmp(tail, trailer, 3) == 0);
+
+    CloseFile(file);
+    remove("io.bin");
+}
+
+void WriteChunks( const vmanVolumeParameters* volumeParams )
+{
+    Volume volume(volumeParams);
+    Access access(&volume);
+    for(int i = 0; i < WRITTEN_CHUNKS; ++i)
+    {
+        vmanSelection selection;
+        selection.x = i*CHUNK_EDGE_LENGTH;
+        selection.y = 0;
+        selection.z = 0;
+        selection.w = 1;
+        selection.h = 1;
+        selection.d = 1;
+        access.select(&selection);
+
+        const char material = i+1;
+        access.lock(VMAN_WRITE_ACCESS);
+        assert(access.writeVoxelLayer(i*CHUNK_EDGE_LENGTH,0,0, 0, &material));
+        access.unlock();
+    }
+}
+
+void TestBatchedReads( Volume* volume )
+{
+    ChunkStorage* storage = volume->getChunkStorage();
+
+    std::vector< std::vector<char> > buffers(WRITTEN_CHUNKS+1);
+    std::vector<ChunkStorage::ChunkRead> reads(WRITTEN_CHUNKS+1);
+    for(int i = 0; i < reads.size(); ++i)
+    {
+        reads[i].chunkX = i;
+        reads[i].chunkY = 0;
+        reads[i].chunkZ = 0;
+        reads[i].dataOut = &buffers[i];
+    }
+
+    // The last chunk has never been stored.
+    assert(storage->readChunks(&reads[0], reads.size()) == false);
+    for(int i = 0; i < WRITTEN_CHUNKS; ++i)
+    {
+        assert(reads[i].success);
+
+        Chunk chunk(volume, i,0,0);
+        assert(chunk.loadFromData(&buffers[i][0], buffers[i].size()));
+        assert(*(const char*)chunk.getConstLayer(0) == i+1);
+    }
+    assert(reads[WRITTEN_CHUNKS].success == false);
+}
+
+void TestBatchedLoadJobs( Volume* volume )
+{
+    // All chunks are requested at once, so the workers load them in batches.
+    Access access(volume);
+    vmanSelection selection;
+    selection.x = 0;
+    selection.y = 0;
+    selection.z = 0;
+    selection.w = WRITTEN_CHUNKS*CHUNK_EDGE_LENGTH;
+    selection.h = 1;
+    selection.d = 1;
+    access.select(&selection);
+
+    vmanStatistics statistics;
+    for(int i = 0; i < 100; ++i)
+    {
+        assert(volume->getStatistics(&statistics));
+        if(statistics.chunkLoadOps >= WRITTEN_CHUNKS)
+            break;
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(50));
+    }
+    assert(statistics.chunkLoadOps == WRITTEN_CHUNKS);
+
+    access.lock(VMAN_READ_ACCESS);
+    for(int i = 0; i < WRITTEN_CHUNKS; ++i)
+    {
+        const char* material = (const char*)access.readVoxelLayer(i*CHUNK_EDGE_LENGTH,0,0, 0);
+        assert(*material == i+1);
+    }
+    access.unlock();
+}
+
+int main()
+{
+    TestBackend(false);
+    TestBackend(true);
+
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "batched";
+	volumeParams.enableStatistics = true;
+    WriteChunks(&volumeParams);
+
+    {
+        Volume volume(&volumeParams);
+        TestBatchedReads(&volume);
+    }
+
+    Volume volume(&volumeParams);
+    TestBatchedLoadJobs(&volume);
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <assert.h>
+#include <vector>
+#include <Volume.h>
+#include <Chunk.h>
+#include <JobQueue.h>
+
+using namespace vman;
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL}
+};
+
+void TestOrder( Volume* volume )
+{
+    Chunk a(volume, 0,0,0);
+    Chunk b(volume, 1,0,0);
+    Chunk c(volume, 2,0,0);
+    Chunk d(volume, 3,0,0);
+
+    JobQueue queue(LOAD_JOB);
+    assert(queue.empty());
+    assert(queue.pop().getType() == INVALID_JOB);
+
+    assert(queue.push(1, &a));
+    assert(queue.push(5, &b));
+    assert(queue.push(1, &c));
+    assert(queue.push(3, &d));
+    assert(queue.getSize() == 4);
+    assert(queue.contains(&c));
+    assert(a.hasJobs());
+
+    // Higher priority first, equal priority in order of arrival.
+    assert(queue.pop().getChunk() == &b);
+    assert(queue.pop().getChunk() == &d);
+    assert(queue.pop().getChunk() == &a);
+    const JobEntry job = queue.pop();
+    assert(job.getChunk() == &c);
+    assert(job.getType() == LOAD_JOB);
+    assert(job.getPriority() == 1);
+    assert(queue.empty());
+    assert(queue.contains(&c) == false);
+    assert(a.hasJobs() == false);
+}
+
+void TestMerge( Volume* volume )
+{
+    Chunk a(volume, 0,0,0);
+    Chunk b(volume, 1,0,0);
+    Chunk c(volume, 2,0,0);
+
+    JobQueue loadQueue(LOAD_JOB);
+    JobQueue saveQueue(SAVE_JOB);
+    assert(loadQueue.push(2, &a));
+    assert(loadQueue.push(2, &b));
+    assert(loadQueue.push(2, &c));
+
+    // A chunk has one job per queue.
+    assert(loadQueue.push(1, &a) == false);
+    assert(loadQueue.push(2, &a) == false);
+    assert(loadQueue.getSize() == 3);
+    assert(loadQueue.getPriority(&a) == 2);
+
+    // But it may have jobs of different types.
+    assert(saveQueue.push(0, &a));
+    assert(saveQueue.contains(&a));
+
+    // A higher priority moves the job forward.
+    assert(loadQueue.push(3, &c));
+    assert(loadQueue.getSize() == 3);
+    assert(loadQueue.pop().getChunk() == &c);
+    assert(loadQueue.pop().getChunk() == &a);
+    assert(loadQueue.pop().getChunk() == &b);
+
+    assert(saveQueue.pop().getChunk() == &a);
+}
+
+void TestMany( Volume* volume )
+{
+    static const int COUNT = 1000;
+
+    std::vector<Chunk*> chunks;
+    for(int i = 0; i < COUNT; ++i)
+        chunks.push_back(new Chunk(volume, i,0,0));
+
+    JobQueue queue(SAVE_JOB);
+    for(int i = 0; i < COUNT; ++i)
+        queue.push((i*7919) % 101, chunks[i]);
+    for(int i = 0; i < COUNT; i += 3)
+        queue.push(200 + i % 5, chunks[i]);
+    assert(queue.getSize() == COUNT);
+
+    int lastPriority = 1000;
+    for(int i = 0; i < COUNT; ++i)
+    {
+        const JobEntry job = queue.pop();
+        assert(job.getPriority() <= lastPriority);
+        lastPriority = job.getPriority();
+    }
+    assert(queue.empty());
+
+    for(int i = 0; i < COUNT; ++i)
+        delete chunks[i];
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = 8;
+    Volume volume(&volumeParams);
+
+    TestOrder(&volume);
+    TestMerge(&volume);
+    TestMany(&volume);
+
+    puts("No problems detected.");
+
+    return 0;
+}
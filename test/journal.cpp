@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <Util.h>
+#include <Volume.h>
+#include <Access.h>
+
+using namespace vman;
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL},
+    {"Pressure", 1, 1, NULL, NULL, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int WRITTEN_CHUNKS = 4;
+
+void ReadFile( const std::string& fileName, std::vector<char>* dataOut )
+{
+    FILE* f = fopen(fileName.c_str(), "rb");
+    assert(f != NULL);
+    char buffer[4096];
+    size_t length;
+    while((length = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        dataOut->insert(dataOut->end(), buffer, buffer+length);
+    fclose(f);
+}
+
+void WriteFile( const std::string& fileName, const std::vector<char>& data )
+{
+    FILE* f = fopen(fileName.c_str(), "wb");
+    assert(f != NULL);
+    assert(fwrite(&data[0], data.size(), 1, f) == 1);
+    fclose(f);
+}
+
+void SelectChunks( Access* access, int chunkCount )
+{
+    vmanSelection selection;
+    selection.x = 0;
+    selection.y = 0;
+    selection.z = 0;
+    selection.w = chunkCount*CHUNK_EDGE_LENGTH;
+    selection.h = 1;
+    selection.d = 1;
+    access->select(&selection);
+}
+
+void WaitForStatistics( Volume* volume, int journalBytes, int chunkSaveOps, vmanStatistics* statistics )
+{
+    for(int i = 0; i < 250; ++i)
+    {
+        assert(volume->getStatistics(statistics));
+        if(statistics->journalBytes >= journalBytes &&
+           statistics->chunkSaveOps >= chunkSaveOps)
+            return;
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(20));
+    }
+}
+
+/**
+ * Writes a few voxels and keeps a copy of the flushed journal,
+ * as if the volume crashed afterwards.
+ */
+void TestJournaledWrites( vmanVolumeParameters volumeParams, const std::string& crashedBaseDir )
+{
+    const std::string journalName = std::string(volumeParams.baseDir) + DirSep + "voxels.journal";
+    {
+        Volume volume(&volumeParams);
+        volume.setModifiedChunkTimeout(0);
+        assert(GetFileType(journalName.c_str()) == FILE_TYPE_REGULAR);
+
+        Access access(&volume);
+        SelectChunks(&access, WRITTEN_CHUNKS);
+        access.lock(VMAN_READ_ACCESS|VMAN_WRITE_ACCESS);
+        for(int i = 0; i < WRITTEN_CHUNKS; ++i)
+        {
+            const char material = 10+i;
+            assert(access.writeVoxelLayer(i*CHUNK_EDGE_LENGTH,0,0, 0, &material));
+            *(char*)access.readWriteVoxelLayer(i*CHUNK_EDGE_LENGTH+1,0,0, 0) = 20+i;
+            *(char*)access.readWriteVoxelLayer(i*CHUNK_EDGE_LENGTH+1,0,0, 0) = 30+i; // Recorded once
+        }
+        access.unlock();
+
+        vmanStatistics statistics;
+        WaitForStatistics(&volume, 1, 0, &statistics);
+        assert(statistics.journalBytes > 0);
+
+        // The chunks are in use, so only the journal has been written.
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(100));
+        assert(volume.getStatistics(&statistics));
+        assert(statistics.chunkSaveOps == 0);
+
+        std::vector<char> journal;
+        ReadFile(journalName, &journal);
+        MakePath((crashedBaseDir + DirSep).c_str());
+        WriteFile(crashedBaseDir + DirSep + "voxels.journal", journal);
+
+        // A block that was cut off by the crash.
+        journal.resize(journal.size() + 7, 1);
+        WriteFile(crashedBaseDir + DirSep + "voxels.journal", journal);
+
+        access.select(NULL);
+    }
+
+    // Closing the volume saves the chunks and deletes the journal.
+    assert(GetFileType(journalName.c_str()) == FILE_TYPE_INVALID);
+}
+
+void CheckReplayedVoxels( vmanVolumeParameters volumeParams )
+{
+    Volume volume(&volumeParams);
+
+    const std::string journalName = std::string(volumeParams.baseDir) + DirSep + "voxels.journal";
+    assert(GetFileType(journalName.c_str()) == FILE_TYPE_INVALID);
+
+    Access access(&volume);
+    SelectChunks(&access, WRITTEN_CHUNKS);
+
+    vmanStatistics statistics;
+    for(int i = 0; i < 100; ++i)
+    {
+        assert(volume.getStatistics(&statistics));
+        if(statistics.chunkLoadOps >= WRITTEN_CHUNKS)
+            break;
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(20));
+    }
+
+    access.lock(VMAN_READ_ACCESS);
+    for(int i = 0; i < WRITTEN_CHUNKS; ++i)
+    {
+        assert(*(const char*)access.readVoxelLayer(i*CHUNK_EDGE_LENGTH,0,0, 0) == 10+i);
+        assert(*(const char*)access.readVoxelLayer(i*CHUNK_EDGE_LENGTH+1,0,0, 0) == 30+i);
+        assert(*(const char*)access.readVoxelLayer(i*CHUNK_EDGE_LENGTH+2,0,0, 0) == 0);
+    }
+    access.unlock();
+}
+
+void WriteVoxel( Access* access, int x, char material )
+{
+    access->lock(VMAN_WRITE_ACCESS);
+    assert(access->writeVoxelLayer(x,0,0, 0, &material));
+    access->unlock();
+}
+
+/**
+ * A chunk is evicted between two journaled writes and the volume crashes
+ * before the next flush: Replaying the older write must not undo the save.
+ */
+void TestEvictionBetweenWrites( vmanVolumeParameters volumeParams )
+{
+    const std::string journalName = std::string(volumeParams.baseDir) + DirSep + "voxels.journal";
+    std::vector<char> journal;
+    {
+        Volume volume(&volumeParams);
+        volume.setModifiedChunkTimeout(0);
+
+        Access access(&volume);
+        SelectChunks(&access, 2);
+        WriteVoxel(&access, 0, 1);
+        WriteVoxel(&access, CHUNK_EDGE_LENGTH, 1);
+        vmanStatistics statistics;
+        WaitForStatistics(&volume, 1, 0, &statistics);
+        assert(statistics.journalBytes > 0);
+
+        // The second write stays buffered.
+        volume.setModifiedChunkTimeout(-1);
+        WriteVoxel(&access, 0, 2);
+
+        // The first chunk is saved and unloaded,
+        // while the second one keeps the journal alive.
+        Access keeper(&volume);
+        vmanSelection selection;
+        selection.x = CHUNK_EDGE_LENGTH;
+        selection.y = 0;
+        selection.z = 0;
+        selection.w = 1;
+        selection.h = 1;
+        selection.d = 1;
+        keeper.select(&selection);
+        volume.setModifiedChunkTimeout(0);
+        volume.setUnusedChunkTimeout(0);
+        access.select(NULL);
+        WaitForStatistics(&volume, 1, 1, &statistics);
+        assert(statistics.chunkSaveOps == 1);
+
+        ReadFile(journalName, &journal);
+        keeper.select(NULL);
+    }
+
+    // The volume saved the remaining chunk on closing,
+    // so the chunk files are like they were at the crash.
+    WriteFile(journalName, journal);
+
+    Volume volume(&volumeParams);
+    Access access(&volume);
+    SelectChunks(&access, 2);
+    access.lock(VMAN_READ_ACCESS);
+    assert(*(const char*)access.readVoxelLayer(0,0,0, 0) == 2);
+    assert(*(const char*)access.readVoxelLayer(CHUNK_EDGE_LENGTH,0,0, 0) == 1);
+    access.unlock();
+    access.select(NULL);
+}
+
+/**
+ * Spans are journaled as runs of voxels instead of single voxels.
+ */
+void TestSpanRecords( vmanVolumeParameters volumeParams )
+{
+    const std::string journalName = std::string(volumeParams.baseDir) + DirSep + "voxels.journal";
+    const int voxelsPerChunk = CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH;
+    std::vector<char> journal;
+    {
+        Volume volume(&volumeParams);
+        volume.setModifiedChunkTimeout(0);
+
+        vmanSelection selection;
+        selection.x = 0;
+        selection.y = 0;
+        selection.z = 0;
+        selection.w = CHUNK_EDGE_LENGTH;
+        selection.h = CHUNK_EDGE_LENGTH;
+        selection.d = CHUNK_EDGE_LENGTH;
+        Access access(&volume);
+        access.select(&selection);
+        access.lock(VMAN_READ_ACCESS|VMAN_WRITE_ACCESS);
+        vmanVoxelSpan span;
+        assert(access.readWriteVoxelSpan(0,0,0, 0, &span));
+        assert(span.length*span.rows*span.slices == voxelsPerChunk);
+        for(int i = 0; i < voxelsPerChunk; ++i)
+            ((char*)span.data)[i] = 1 + i % 100;
+        access.unlock();
+
+        // A single record covers the whole chunk.
+        vmanStatistics statistics;
+        WaitForStatistics(&volume, 1, 0, &statistics);
+        assert(statistics.journalBytes > voxelsPerChunk);
+        assert(statistics.journalBytes < voxelsPerChunk + 64);
+
+        ReadFile(journalName, &journal);
+        access.select(NULL);
+    }
+
+    // Replaying restores the span, as if the volume crashed.
+    const std::string crashedBaseDir = std::string(volumeParams.baseDir) + "Crashed";
+    MakePath((crashedBaseDir + DirSep).c_str());
+    WriteFile(crashedBaseDir + DirSep + "voxels.journal", journal);
+    volumeParams.baseDir = crashedBaseDir.c_str();
+
+    Volume volume(&volumeParams);
+    Access access(&volume);
+    vmanSelection selection;
+    selection.x = 0;
+    selection.y = 0;
+    selection.z = 0;
+    selection.w = CHUNK_EDGE_LENGTH;
+    selection.h = CHUNK_EDGE_LENGTH;
+    selection.d = CHUNK_EDGE_LENGTH;
+    access.select(&selection);
+    access.lock(VMAN_READ_ACCESS);
+    vmanVoxelSpan span;
+    assert(access.readVoxelSpan(0,0,0, 0, &span));
+    for(int i = 0; i < voxelsPerChunk; ++i)
+        assert(((const char*)span.data)[i] == 1 + i % 100);
+    access.unlock();
+    access.select(NULL);
+}
+
+/**
+ * Records of layers, which the volume doesn't have anymore, are skipped.
+ */
+void TestRemovedLayer( vmanVolumeParameters volumeParams )
+{
+    const std::string journalName = std::string(volumeParams.baseDir) + DirSep + "voxels.journal";
+    std::vector<char> journal;
+    {
+        volumeParams.layerCount = 2;
+        Volume volume(&volumeParams);
+        volume.setModifiedChunkTimeout(0);
+
+        Access access(&volume);
+        SelectChunks(&access, 1);
+        access.lock(VMAN_WRITE_ACCESS);
+        const char material = 5;
+        const char pressure = 7;
+        assert(access.writeVoxelLayer(0,0,0, 0, &material));
+        assert(access.writeVoxelLayer(0,0,0, 1, &pressure));
+        access.unlock();
+
+        vmanStatistics statistics;
+        WaitForStatistics(&volume, 1, 0, &statistics);
+        assert(statistics.journalBytes > 0);
+
+        ReadFile(journalName, &journal);
+        access.select(NULL);
+    }
+
+    // The crashed volume only keeps the second layer.
+    const std::string crashedBaseDir = std::string(volumeParams.baseDir) + "Crashed";
+    MakePath((crashedBaseDir + DirSep).c_str());
+    WriteFile(crashedBaseDir + DirSep + "voxels.journal", journal);
+    volumeParams.baseDir = crashedBaseDir.c_str();
+    volumeParams.layers = &layers[1];
+    volumeParams.layerCount = 1;
+
+    Volume volume(&volumeParams);
+    Access access(&volume);
+    SelectChunks(&access, 1);
+    access.lock(VMAN_READ_ACCESS);
+    assert(*(const char*)access.readVoxelLayer(0,0,0, 0) == 7);
+    access.unlock();
+    access.select(NULL);
+}
+
+void TestCheckpoint( vmanVolumeParameters volumeParams )
+{
+    // Enough records to exceed the checkpoint size.
+    // Every other voxel is written, since neighbouring ones share a record.
+    const int voxelsPerChunk = CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH;
+    const int chunkCount = Journal::CHECKPOINT_BYTES / (voxelsPerChunk/2*20) + 1;
+
+    Volume volume(&volumeParams);
+    volume.setModifiedChunkTimeout(0);
+
+    vmanSelection selection;
+    selection.x = 0;
+    selection.y = 0;
+    selection.z = 0;
+    selection.w = chunkCount*CHUNK_EDGE_LENGTH;
+    selection.h = CHUNK_EDGE_LENGTH;
+    selection.d = CHUNK_EDGE_LENGTH;
+
+    Access access(&volume);
+    access.select(&selection);
+    access.lock(VMAN_WRITE_ACCESS);
+    for(int x = 0; x < selection.w; x += 2)
+    for(int y = 0; y < selection.h; ++y)
+    for(int z = 0; z < selection.d; ++z)
+    {
+        const char material = 1 + (x+y+z) % 100;
+        assert(access.writeVoxelLayer(x,y,z, 0, &material));
+    }
+    access.unlock();
+
+    // The checkpoint rewrites all chunks, although they're still in use.
+    vmanStatistics statistics;
+    WaitForStatistics(&volume, Journal::CHECKPOINT_BYTES, chunkCount, &statistics);
+    assert(statistics.chunkSaveOps == chunkCount);
+
+    // Afterwards the old journal is deleted.
+    const std::string oldJournalName = std::string(volumeParams.baseDir) + DirSep + "voxels.journal.old";
+    for(int i = 0; i < 100 && GetFileType(oldJournalName.c_str()) != FILE_TYPE_INVALID; ++i)
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(20));
+    assert(GetFileType(oldJournalName.c_str()) == FILE_TYPE_INVALID);
+
+    access.select(NULL);
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "journaled";
+	volumeParams.enableJournal = true;
+	volumeParams.enableStatistics = true;
+
+    TestJournaledWrites(volumeParams, "crashed");
+
+    // Journals are replayed, even if they're disabled.
+    vmanVolumeParameters crashedParams = volumeParams;
+    crashedParams.baseDir = "crashed";
+    crashedParams.enableJournal = false;
+    CheckReplayedVoxels(crashedParams);
+
+    volumeParams.baseDir = "evicted";
+    TestEvictionBetweenWrites(volumeParams);
+
+    volumeParams.baseDir = "spans";
+    TestSpanRecords(volumeParams);
+
+    volumeParams.baseDir = "removedLayer";
+    TestRemovedLayer(volumeParams);
+
+    volumeParams.baseDir = "checkpoint";
+    volumeParams.durability = VMAN_DURABILITY_BATCH;
+    TestCheckpoint(volumeParams);
+
+    puts("No problems detected.");
+
+    return 0;
+}
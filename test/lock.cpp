@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <tinythread.h>
+
+#include <Util.h>
+#include <Volume.h>
+#include <Access.h>
+
+using namespace vman;
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int ITERATIONS = 200;
+
+vmanSelection MakeBox( int x, int y, int z, int w, int h, int d )
+{
+    vmanSelection box;
+    box.x = x;
+    box.y = y;
+    box.z = z;
+    box.w = w;
+    box.h = h;
+    box.d = d;
+    return box;
+}
+
+struct WriterContext
+{
+    Volume* volume;
+    vmanSelection selection;
+};
+
+void Writer( void* context )
+{
+    const WriterContext* writerContext = (WriterContext*)context;
+
+    Access access(writerContext->volume);
+    access.select(&writerContext->selection);
+    for(int i = 0; i < ITERATIONS; ++i)
+    {
+        access.lock(VMAN_READ_ACCESS|VMAN_WRITE_ACCESS);
+        char* voxel = (char*)access.readWriteVoxelLayer(
+            writerContext->selection.x,
+            writerContext->selection.y,
+            writerContext->selection.z,
+            0
+        );
+        (*voxel)++;
+        access.unlock();
+    }
+    access.select(NULL);
+}
+
+/**
+ * Selections that are offset from each other must not deadlock.
+ */
+void TestOverlappingSelections( Volume* volume )
+{
+    WriterContext contexts[3];
+    contexts[0].selection = MakeBox(-12,-12,-12, 24,24,24);
+    contexts[1].selection = MakeBox( -4, -4, -4, 24,24,24);
+    contexts[2].selection = MakeBox(-12, -4,  4, 24,24,24);
+
+    tthread::thread* threads[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        contexts[i].volume = volume;
+        threads[i] = new tthread::thread(Writer, &contexts[i], "Writer");
+    }
+    for(int i = 0; i < 3; ++i)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    Access access(volume);
+    const vmanSelection selection = MakeBox(-12,-12,-12, 1,1,1);
+    access.select(&selection);
+    access.lock(VMAN_READ_ACCESS);
+    assert(*(const char*)access.readVoxelLayer(-12,-12,-12, 0) == char(ITERATIONS));
+    access.unlock();
+    access.select(NULL);
+}
+
+/**
+ * A waiting writer is served before readers, which came after it,
+ * even though they only need some of its chunks.
+ */
+void TestFairQueuing( Volume* volume )
+{
+    vmanStatistics before;
+    assert(volume->getStatistics(&before));
+
+    Access reader(volume);
+    const vmanSelection small = MakeBox(0,0,0, 1,1,1);
+    reader.select(&small);
+    reader.lock(VMAN_READ_ACCESS);
+
+    WriterContext context;
+    context.volume = volume;
+    context.selection = MakeBox(-16,-16,-16, 32,32,32);
+    tthread::thread writer(Writer, &context, "Writer");
+
+    Access lateReader(volume);
+    lateReader.select(&small);
+    while(lateReader.tryLock(VMAN_READ_ACCESS))
+    {
+        lateReader.unlock();
+        tthread::this_thread::yield();
+    }
+
+    reader.unlock();
+    writer.join();
+
+    // The writer has been queued at least once.
+    vmanStatistics after;
+    assert(volume->getStatistics(&after));
+    assert(after.lockWaits > before.lockWaits);
+    assert(after.maxLockWaitMilliseconds >= 0);
+
+    assert(lateReader.tryLock(VMAN_READ_ACCESS));
+    lateReader.unlock();
+
+    reader.select(NULL);
+    lateReader.select(NULL);
+}
+
+struct ReaderContext
+{
+    Volume* volume;
+    vmanSelection selection;
+    tthread::atomic_int* holding;
+    bool shared;
+};
+
+/**
+ * Waits until all readers hold the selection at once.
+ */
+void Reader( void* context )
+{
+    ReaderContext* readerContext = (ReaderContext*)context;
+
+    Access access(readerContext->volume);
+    access.select(&readerContext->selection);
+    assert(access.lockFor(VMAN_READ_ACCESS, 10000));
+    (*readerContext->holding)++;
+
+    const uint64_t startTime = GetMonotonicMilliseconds();
+    while(*readerContext->holding < 3 && GetMonotonicMilliseconds() - startTime < 10000)
+        tthread::this_thread::yield();
+    readerContext->shared = (*readerContext->holding == 3);
+
+    access.unlock();
+    access.select(NULL);
+}
+
+/**
+ * All readers, which wait behind a writer, are woken when it's done.
+ */
+void TestWaitingReaders( Volume* volume )
+{
+    const vmanSelection selection = MakeBox(0,0,0, 2*CHUNK_EDGE_LENGTH,1,1);
+    Access writer(volume);
+    writer.select(&selection);
+    writer.lock(VMAN_WRITE_ACCESS);
+
+    tthread::atomic_int holding(0);
+    ReaderContext contexts[3];
+    tthread::thread* threads[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        contexts[i].volume = volume;
+        contexts[i].selection = MakeBox(i*CHUNK_EDGE_LENGTH/2,0,0, CHUNK_EDGE_LENGTH,1,1);
+        contexts[i].holding = &holding;
+        contexts[i].shared = false;
+        threads[i] = new tthread::thread(Reader, &contexts[i], "Reader");
+    }
+
+    tthread::this_thread::sleep_for(tthread::chrono::milliseconds(50));
+    assert(holding == 0);
+    writer.unlock();
+
+    for(int i = 0; i < 3; ++i)
+    {
+        threads[i]->join();
+        delete threads[i];
+        assert(contexts[i].shared);
+    }
+    writer.select(NULL);
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.enableStatistics = true;
+    Volume volume(&volumeParams);
+
+    TestOverlappingSelections(&volume);
+    TestFairQueuing(&volume);
+    TestWaitingReaders(&volume);
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <tinythread.h>
+
+#include <SharedMutex.h>
+#include <Volume.h>
+#include <Access.h>
+
+using namespace vman;
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int VOXELS_PER_CHUNK = CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH;
+static const int ITERATIONS = 500;
+
+vmanSelection MakeBox( int x, int y, int z, int w, int h, int d )
+{
+    vmanSelection box;
+    box.x = x;
+    box.y = y;
+    box.z = z;
+    box.w = w;
+    box.h = h;
+    box.d = d;
+    return box;
+}
+
+void TestVersion()
+{
+    SharedMutex mutex;
+    const unsigned int version = mutex.getVersion();
+    assert((version & 1) == 0);
+
+    // Readers don't change the version ...
+    mutex.lock_shared();
+    assert(mutex.getVersion() == version);
+    mutex.beginModification();
+    assert(mutex.getVersion() & 1);
+    mutex.endModification();
+    mutex.unlock_shared();
+
+    // ... unless they modify something.
+    assert(mutex.getVersion() == version+2);
+
+    // Neither do writers, which don't modify anything.
+    mutex.lock();
+    assert(mutex.getVersion() == version+2);
+
+    // Nested modifications change it only once.
+    mutex.beginModification();
+    mutex.beginModification();
+    assert(mutex.getVersion() & 1);
+    mutex.endModification();
+    assert(mutex.getVersion() & 1);
+    mutex.endModification();
+    mutex.unlock();
+    assert(mutex.getVersion() == version+4);
+}
+
+void TestOptimisticAccess( Volume* volume )
+{
+    const vmanSelection box = MakeBox(-4,-4,-4, 8,8,8);
+    Access access(volume);
+    access.select(&box);
+
+    std::vector<char> voxels(box.w*box.h*box.d);
+    for(int i = 0; i < voxels.size(); ++i)
+        voxels[i] = char(i);
+    vmanLayerBuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.layer = 0;
+    buffer.data = &voxels[0];
+
+    access.lock(VMAN_WRITE_ACCESS);
+    assert(access.writeRegion(&box, &buffer, 1));
+    access.unlock();
+
+    std::vector<char> copy(voxels.size(), 0);
+    buffer.data = &copy[0];
+
+    // Works while others read ...
+    Access reader(volume);
+    reader.select(&box);
+    reader.lock(VMAN_READ_ACCESS);
+
+    access.lock(VMAN_OPTIMISTIC_READ_ACCESS);
+    assert(access.readRegion(&box, &buffer, 1));
+    assert(copy == voxels);
+
+    // ... but voxels can only be copied.
+    assert(access.readVoxelLayer(0,0,0, 0) == NULL);
+    assert(!access.writeRegion(&box, &buffer, 1));
+    access.unlock();
+
+    reader.unlock();
+    reader.select(NULL);
+    access.select(NULL);
+}
+
+struct WriterContext
+{
+    Volume* volume;
+    vmanSelection chunk;
+};
+
+/**
+ * Fills the whole chunk with the same value again and again.
+ */
+void Writer( void* context )
+{
+    const WriterContext* writerContext = (WriterContext*)context;
+
+    Access access(writerContext->volume);
+    access.select(&writerContext->chunk);
+
+    std::vector<char> voxels(VOXELS_PER_CHUNK);
+    vmanLayerBuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.layer = 0;
+    buffer.data = &voxels[0];
+
+    for(int i = 0; i < ITERATIONS; ++i)
+    {
+        memset(&voxels[0], char(i), voxels.size());
+        access.lock(VMAN_WRITE_ACCESS);
+        assert(access.writeRegion(&writerContext->chunk, &buffer, 1));
+        access.unlock();
+    }
+
+    access.select(NULL);
+}
+
+/**
+ * Optimistic readers never see a partially written chunk.
+ */
+void TestConcurrentWriter( Volume* volume )
+{
+    WriterContext context;
+    context.volume = volume;
+    context.chunk = MakeBox(16,16,16, CHUNK_EDGE_LENGTH,CHUNK_EDGE_LENGTH,CHUNK_EDGE_LENGTH);
+
+    tthread::thread writer(Writer, &context, "Writer");
+
+    Access access(volume);
+    access.select(&context.chunk);
+
+    std::vector<char> voxels(VOXELS_PER_CHUNK);
+    vmanLayerBuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.layer = 0;
+    buffer.data = &voxels[0];
+
+    for(int i = 0; i < ITERATIONS; ++i)
+    {
+        access.lock(VMAN_OPTIMISTIC_READ_ACCESS);
+        assert(access.readRegion(&context.chunk, &buffer, 1));
+        access.unlock();
+
+        for(int j = 1; j < voxels.size(); ++j)
+            assert(voxels[j] == voxels[0]);
+    }
+
+    writer.join();
+    access.select(NULL);
+}
+
+int main()
+{
+    TestVersion();
+
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.enableStatistics = true;
+    Volume volume(&volumeParams);
+
+    TestOptimisticAccess(&volume);
+    TestConcurrentWriter(&volume);
+
+    vmanStatistics statistics;
+    assert(volume.getStatistics(&statistics));
+    printf("%d conflicts, %d fallbacks\n",
+        statistics.optimisticReadConflicts,
+        statistics.optimisticReadFallbacks
+    );
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <Volume.h>
+#include <Chunk.h>
+
+using namespace vman;
+
+enum LayerIndex
+{
+    MATERIAL_LAYER = 0,
+    LIGHT_LAYER,
+    LAYER_COUNT
+};
+
+static int SerializedVoxels[LAYER_COUNT];
+
+void SerializeMaterial( const void* source, void* destination, int count )
+{
+    SerializedVoxels[MATERIAL_LAYER] += count;
+    memcpy(destination, source, count);
+}
+
+void SerializeLight( const void* source, void* destination, int count )
+{
+    SerializedVoxels[LIGHT_LAYER] += count;
+    memcpy(destination, source, count);
+}
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[LAYER_COUNT] =
+{
+    {"Material", 1, 1, SerializeMaterial, CopyBytes, NULL},
+    {"Light", 1, 1, SerializeLight, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int VOXELS_PER_CHUNK = CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH;
+static const int BLOCK_VOXELS = VOXELS_PER_CHUNK / Chunk::DIRTY_BLOCK_COUNT;
+
+void ResetCounters()
+{
+    memset(SerializedVoxels, 0, sizeof(SerializedVoxels));
+}
+
+/**
+ * Voxels with many different values, so layers are stored as plain arrays.
+ */
+char VoxelValue( int layer, int voxelIndex )
+{
+    return char(voxelIndex + layer*3);
+}
+
+void TestPartialRewrite( const char* baseDir, int regionEdgeLength, vmanDurability durability, bool patched )
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = LAYER_COUNT;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = baseDir;
+	volumeParams.regionEdgeLength = regionEdgeLength;
+	volumeParams.durability = durability;
+    Volume volume(&volumeParams);
+
+    {
+        Chunk chunk(&volume, 1,2,3);
+        for(int layer = 0; layer < LAYER_COUNT; ++layer)
+        {
+            char* voxels = (char*)chunk.getLayer(layer);
+            for(int i = 0; i < VOXELS_PER_CHUNK; ++i)
+                voxels[i] = VoxelValue(layer, i);
+        }
+        chunk.setModified();
+
+        ResetCounters();
+        assert(chunk.saveToFile());
+        assert(SerializedVoxels[MATERIAL_LAYER] == VOXELS_PER_CHUNK);
+        assert(SerializedVoxels[LIGHT_LAYER] == VOXELS_PER_CHUNK);
+    }
+
+    {
+        Chunk chunk(&volume, 1,2,3);
+        assert(chunk.loadFromFile());
+
+        // Fetching a layer doesn't modify it.
+        chunk.getLayer(LIGHT_LAYER);
+        assert(!chunk.isModified());
+
+        const char light = 1;
+        assert(chunk.writeVoxel(LIGHT_LAYER, 100, &light));
+        assert(chunk.writeVoxel(LIGHT_LAYER, 101, &light));
+        assert(chunk.isLayerModified(LIGHT_LAYER));
+        assert(!chunk.isLayerModified(MATERIAL_LAYER));
+
+        ResetCounters();
+        assert(chunk.saveToFile());
+        assert(!chunk.isLayerModified(LIGHT_LAYER));
+        if(patched)
+        {
+            // Only the block of the written voxels is serialized.
+            assert(SerializedVoxels[MATERIAL_LAYER] == 0);
+            assert(SerializedVoxels[LIGHT_LAYER] == BLOCK_VOXELS);
+        }
+        else
+        {
+            assert(SerializedVoxels[MATERIAL_LAYER] == VOXELS_PER_CHUNK);
+            assert(SerializedVoxels[LIGHT_LAYER] == VOXELS_PER_CHUNK);
+        }
+
+        // Patches work after the chunk has been saved too.
+        const char material = 2;
+        assert(chunk.writeVoxel(MATERIAL_LAYER, VOXELS_PER_CHUNK-1, &material));
+        ResetCounters();
+        assert(chunk.saveToFile());
+        if(patched)
+        {
+            assert(SerializedVoxels[MATERIAL_LAYER] == BLOCK_VOXELS);
+            assert(SerializedVoxels[LIGHT_LAYER] == 0);
+        }
+    }
+
+    {
+        Chunk chunk(&volume, 1,2,3);
+        assert(chunk.loadFromFile());
+        const char* material = (const char*)chunk.getConstLayer(MATERIAL_LAYER);
+        const char* light = (const char*)chunk.getConstLayer(LIGHT_LAYER);
+        for(int i = 0; i < VOXELS_PER_CHUNK; ++i)
+        {
+            if(i == VOXELS_PER_CHUNK-1)
+                assert(material[i] == 2);
+            else
+                assert(material[i] == VoxelValue(MATERIAL_LAYER, i));
+
+            if(i == 100 || i == 101)
+                assert(light[i] == 1);
+            else
+                assert(light[i] == VoxelValue(LIGHT_LAYER, i));
+        }
+    }
+}
+
+int main()
+{
+    TestPartialRewrite("patched", 0, VMAN_DURABILITY_NONE, true);
+    TestPartialRewrite("patched-regions", 4, VMAN_DURABILITY_NONE, true);
+
+    // Durable chunks are always replaced as a whole.
+    TestPartialRewrite("replaced", 0, VMAN_DURABILITY_CHUNK, false);
+    TestPartialRewrite("replaced-regions", 4, VMAN_DURABILITY_CHUNK, false);
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <Volume.h>
+#include <Chunk.h>
+#include <LayerPool.h>
+#include <ScratchBuffer.h>
+
+using namespace vman;
+
+enum LayerIndex
+{
+    BASE_LAYER = 0,
+    EXTRA_LAYER,
+    WIDE_LAYER,
+    LAYER_COUNT
+};
+
+static const vmanLayer layers[LAYER_COUNT] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL},
+    {"Pressure", 1, 1, NULL, NULL, NULL},
+    {"Temperature", 4, 1, NULL, NULL, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+
+void TestLayerPool( Volume* volume )
+{
+    LayerPool pool(volume, 1000);
+    assert(pool.getBlockSize() >= 1000);
+    assert(pool.getBlockSize() % LayerPool::BLOCK_ALIGNMENT == 0);
+    assert(pool.getArenaCount() == 0);
+
+    char* a = pool.allocate();
+    char* b = pool.allocate();
+    assert(a != b);
+    assert(pool.getArenaCount() == 1);
+    assert(pool.getUsedBlockCount() == 2);
+    memset(a, 1, 1000);
+    memset(b, 2, 1000);
+    assert(b[0] == 2);
+
+    // Released blocks are reused.
+    pool.release(a);
+    assert(pool.getUsedBlockCount() == 1);
+    char* c = pool.allocate();
+    assert(c == a);
+
+    // A new arena is allocated when the current one is used up.
+    const int blocksPerArena = LayerPool::ARENA_SIZE / pool.getBlockSize();
+    std::vector<char*> blocks;
+    for(int i = 2; i < blocksPerArena+1; ++i)
+        blocks.push_back(pool.allocate());
+    assert(pool.getArenaCount() == 2);
+
+    for(int i = 0; i < blocks.size(); ++i)
+        pool.release(blocks[i]);
+    pool.release(b);
+    pool.release(c);
+    assert(pool.getUsedBlockCount() == 0);
+
+    // Blocks larger than an arena get their own arena.
+    LayerPool largePool(volume, LayerPool::ARENA_SIZE+1);
+    char* large = largePool.allocate();
+    large[LayerPool::ARENA_SIZE] = 3;
+    largePool.release(large);
+}
+
+void TestChunkLayers( Volume* volume )
+{
+    // Layers with the same voxel size share a pool.
+    assert(volume->getLayerPool(BASE_LAYER) == volume->getLayerPool(EXTRA_LAYER));
+    assert(volume->getLayerPool(BASE_LAYER) != volume->getLayerPool(WIDE_LAYER));
+
+    LayerPool* pool = volume->getLayerPool(BASE_LAYER);
+    const int voxelsPerChunk = volume->getVoxelsPerChunk();
+
+    vmanStatistics statistics;
+    const char* decompressed = NULL;
+    {
+        Chunk chunk(volume, 1,2,3);
+        char* material = (char*)chunk.getLayer(BASE_LAYER);
+        for(int i = 0; i < voxelsPerChunk; ++i)
+            material[i] = i % 7;
+        chunk.getLayer(EXTRA_LAYER);
+        assert(pool->getUsedBlockCount() == 2);
+
+        assert(volume->getStatistics(&statistics));
+        assert(statistics.layerPoolUsedBytes == 2*pool->getBlockSize());
+        assert(statistics.layerPoolReservedBytes >= statistics.layerPoolUsedBytes);
+
+        // Compressed layers give their block back.
+        assert(chunk.compressLayers() == 2);
+        assert(pool->getUsedBlockCount() == 0);
+        decompressed = (const char*)chunk.getConstLayer(BASE_LAYER);
+        assert(pool->getUsedBlockCount() == 1);
+
+        assert(chunk.saveToFile());
+    }
+    assert(pool->getUsedBlockCount() == 0);
+
+    {
+        // The next chunk reuses the blocks of the previous one.
+        Chunk chunk(volume, 1,2,3);
+        assert(chunk.loadFromFile());
+        const char* loaded = (const char*)chunk.getConstLayer(BASE_LAYER);
+        assert(loaded == decompressed);
+        for(int i = 0; i < voxelsPerChunk; ++i)
+            assert(loaded[i] == i % 7);
+    }
+
+    assert(volume->getStatistics(&statistics));
+    assert(statistics.layerPoolUsedBytes == 0);
+    assert(statistics.scratchBufferBytes > 0);
+}
+
+void TestScratchBuffers( Volume* volume )
+{
+    ScratchBufferPool* pool = volume->getScratchBuffers();
+
+    std::vector<char>* first = NULL;
+    {
+        ScratchBuffer buffer(pool);
+        buffer->resize(1000);
+        first = &*buffer;
+
+        // Buffers in use are not handed out twice.
+        ScratchBuffer other(pool);
+        assert(&*other != first);
+    }
+
+    {
+        ScratchBuffer buffer(pool);
+        assert(buffer->empty());
+        assert(buffer->capacity() >= 1000);
+    }
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = LAYER_COUNT;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "pooled";
+	volumeParams.enableStatistics = true;
+    Volume volume(&volumeParams);
+
+    TestLayerPool(&volume);
+    TestChunkLayers(&volume);
+    TestScratchBuffers(&volume);
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <Volume.h>
+#include <Chunk.h>
+#include <JobQueue.h>
+#include <Util.h>
+
+using namespace vman;
+
+/*
+ * Measures the job queue at different queue depths:
+ * Enqueueing jobs, raising the priority of enqueued jobs
+ * and taking them out again, like the job workers do.
+ *
+ * Usage: queueBenchmark [max depth]
+ */
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL}
+};
+
+static const int OPERATIONS_PER_DEPTH = 2000000;
+
+void RunDepth( Volume* volume, int depth )
+{
+    std::vector<Chunk*> chunks(depth);
+    for(int i = 0; i < depth; ++i)
+        chunks[i] = new Chunk(volume, i % 1000, i / 1000, 0);
+
+    JobQueue queue(LOAD_JOB);
+
+    const int rounds = OPERATIONS_PER_DEPTH/depth > 0 ? OPERATIONS_PER_DEPTH/depth : 1;
+    uint64_t pushTime = 0;
+    uint64_t raiseTime = 0;
+    uint64_t popTime = 0;
+
+    for(int round = 0; round < rounds; ++round)
+    {
+        uint64_t startTime = GetMonotonicMilliseconds();
+        for(int i = 0; i < depth; ++i)
+            queue.push(rand() % 100, chunks[i]);
+        pushTime += GetMonotonicMilliseconds() - startTime;
+
+        // Chunks near the player become more urgent.
+        startTime = GetMonotonicMilliseconds();
+        for(int i = 0; i < depth; i += 4)
+            queue.push(100 + rand() % 100, chunks[i]);
+        raiseTime += GetMonotonicMilliseconds() - startTime;
+
+        startTime = GetMonotonicMilliseconds();
+        while(queue.empty() == false)
+            queue.pop();
+        popTime += GetMonotonicMilliseconds() - startTime;
+    }
+
+    const double operations = double(rounds) * depth;
+    printf("%8d %10.1f %10.1f %10.1f\n",
+        depth,
+        pushTime * 1000000.0 / operations,
+        raiseTime * 1000000.0 / (operations/4),
+        popTime * 1000000.0 / operations
+    );
+
+    for(int i = 0; i < depth; ++i)
+        delete chunks[i];
+}
+
+int main( int argc, char** argv )
+{
+    const int maxDepth = (argc > 1) ? atoi(argv[1]) : 100000;
+
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = 8;
+    Volume volume(&volumeParams);
+
+    printf("# depth push(ns) raise(ns) pop(ns)\n");
+    for(int depth = 10; depth <= maxDepth; depth *= 10)
+        RunDepth(&volume, depth);
+
+    return 0;
+}
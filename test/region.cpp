@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <Util.h>
+#include <RegionFile.h>
+#include <Volume.h>
+#include <Chunk.h>
+
+using namespace vman;
+
+enum LayerIndex
+{
+    BASE_LAYER = 0,
+    EXTRA_LAYER,
+    LAYER_COUNT
+};
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[LAYER_COUNT] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL},
+    {"Pressure", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int REGION_EDGE_LENGTH = 4;
+
+void TestRegionFile()
+{
+    const std::vector<char> small(100, 'a');
+    const std::vector<char> large(1000, 'b');
+    const std::vector<char> other(300, 'c');
+    std::vector<char> data;
+
+    {
+        RegionFile region("test.region", REGION_EDGE_LENGTH, false);
+        assert(region.hasChunk(0) == false);
+        assert(region.readChunk(0, &data) == false);
+
+        assert(region.writeChunk(0, &small[0], small.size()));
+        assert(region.writeChunk(1, &other[0], other.size()));
+        assert(region.hasChunk(0));
+        assert(region.hasChunk(1));
+        assert(region.hasChunk(2) == false);
+
+        // Doesn't fit into the old space anymore and is moved.
+        assert(region.writeChunk(0, &large[0], large.size()));
+
+        region.close();
+        assert(region.readChunk(0, &data));
+        assert(data == large);
+    }
+
+    {
+        RegionFile region("test.region", REGION_EDGE_LENGTH, false);
+        assert(region.readChunk(1, &data));
+        assert(data == other);
+        assert(region.readChunk(0, &data));
+        assert(data == large);
+
+        // Reuses the space that was freed before.
+        assert(region.writeChunk(2, &small[0], small.size()));
+        assert(region.readChunk(2, &data));
+        assert(data == small);
+    }
+
+    {
+        RegionFile region("test.region", REGION_EDGE_LENGTH+1, false);
+        assert(region.hasChunk(0) == false); // Edge length differs.
+        assert(region.getLastError().empty() == false);
+    }
+}
+
+int64_t GetRegionFileLength( const char* fileName )
+{
+    const int file = OpenFile(fileName, false);
+    assert(file != -1);
+    const int64_t length = GetFileLength(file);
+    CloseFile(file);
+    return length;
+}
+
+void TestCopyOnWrite()
+{
+    const std::vector<char> first(100, 'a');
+    const std::vector<char> second(100, 'b');
+    std::vector<char> data;
+
+    {
+        RegionFile region("cow.region", REGION_EDGE_LENGTH, true);
+        assert(region.writeChunk(0, &first[0], first.size()));
+        const int64_t length = GetRegionFileLength("cow.region");
+
+        // Would fit into the old space, but is written behind it.
+        assert(region.writeChunk(0, &second[0], second.size()));
+        assert(GetRegionFileLength("cow.region") > length);
+        const int64_t grownLength = GetRegionFileLength("cow.region");
+
+        // The old space is free again.
+        assert(region.writeChunk(1, &first[0], first.size()));
+        assert(GetRegionFileLength("cow.region") == grownLength);
+    }
+
+    {
+        RegionFile region("cow.region", REGION_EDGE_LENGTH, true);
+        assert(region.readChunk(0, &data));
+        assert(data == second);
+        assert(region.readChunk(1, &data));
+        assert(data == first);
+    }
+}
+
+void InitVolumeParameters( vmanVolumeParameters* volumeParams, int regionEdgeLength )
+{
+    vmanInitVolumeParameters(volumeParams);
+    volumeParams->layers = layers;
+    volumeParams->layerCount = LAYER_COUNT;
+    volumeParams->chunkEdgeLength = CHUNK_EDGE_LENGTH;
+    volumeParams->baseDir = "volume";
+    volumeParams->regionEdgeLength = regionEdgeLength;
+}
+
+void TestMigration()
+{
+    vmanVolumeParameters volumeParams;
+
+    {
+        InitVolumeParameters(&volumeParams, 0);
+        Volume volume(&volumeParams);
+
+        Chunk chunk(&volume, 1,2,3);
+        char* material = (char*)chunk.getLayer(BASE_LAYER);
+        material[0] = 42;
+        assert(chunk.saveToFile());
+    }
+    assert(GetFileType("volume/1_2_3") == FILE_TYPE_REGULAR);
+
+    // Empty chunk files are left alone.
+    FILE* emptyFile = fopen("volume/4_4_4", "wb");
+    assert(emptyFile != NULL);
+    fclose(emptyFile);
+
+    {
+        InitVolumeParameters(&volumeParams, REGION_EDGE_LENGTH);
+        Volume volume(&volumeParams);
+        assert(GetFileType("volume/1_2_3") == FILE_TYPE_INVALID);
+        assert(GetFileType("volume/4_4_4") == FILE_TYPE_REGULAR);
+        assert(GetFileType("volume/0_0_0.region") == FILE_TYPE_REGULAR);
+
+        {
+            Chunk chunk(&volume, 1,2,3);
+            assert(chunk.loadFromFile());
+            const char* material = (const char*)chunk.getConstLayer(BASE_LAYER);
+            assert(material[0] == 42);
+        }
+
+        {
+            Chunk chunk(&volume, -1,-5,3);
+            char* pressure = (char*)chunk.getLayer(EXTRA_LAYER);
+            pressure[0] = 100;
+            assert(chunk.saveToFile());
+        }
+        assert(GetFileType("volume/-1_-2_0.region") == FILE_TYPE_REGULAR);
+
+        {
+            Chunk chunk(&volume, -1,-5,3);
+            assert(chunk.loadFromFile());
+            assert(chunk.hasLayer(BASE_LAYER) == false);
+            const char* pressure = (const char*)chunk.getConstLayer(EXTRA_LAYER);
+            assert(pressure[0] == 100);
+        }
+
+        {
+            Chunk chunk(&volume, -1,-4,3);
+            assert(chunk.loadFromFile() == false);
+        }
+    }
+}
+
+int main()
+{
+    TestRegionFile();
+    TestCopyOnWrite();
+    TestMigration();
+
+    puts("No problems detected.");
+
+    return 0;
+}
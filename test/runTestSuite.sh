@@ -51,7 +51,7 @@ function RunTest
 		Error "Can't find '$testExecutable'!."
 	fi
 	
-	rm -rf "$TempDir/*" # Clean up previous garbage
+	rm -rf "$TempDir"/* # Clean up previous garbage
 
 	local old="$PWD"
 	cd "$TempDir"
@@ -73,6 +73,28 @@ RunTest 'test' 'test'
 RunTest 'volume' 'volume'
 RunTest 'chunk' 'chunk'
 RunTest 'access' 'access'
+RunTest 'region' 'region'
+RunTest 'index' 'index'
+RunTest 'compression' 'compression'
+RunTest 'uniform' 'uniform'
+RunTest 'pool' 'pool'
+RunTest 'cache' 'cache'
+RunTest 'scheduler' 'scheduler'
+RunTest 'jobs' 'jobs'
+RunTest 'workers' 'workers'
+RunTest 'io' 'io'
+RunTest 'durability' 'durability'
+RunTest 'journal' 'journal'
+RunTest 'patch' 'patch'
+RunTest 'bulk' 'bulk'
+RunTest 'span' 'span'
+RunTest 'shared' 'shared'
+RunTest 'lock' 'lock'
+RunTest 'optimistic' 'optimistic'
+RunTest 'snapshot' 'snapshot'
+RunTest 'epoch' 'epoch'
+RunTest 'state' 'state'
+RunTest 'async' 'async'
 
 
 let TotalCount=SuccessCount+FailureCount
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <assert.h>
+#include <Volume.h>
+#include <Access.h>
+#include <Util.h>
+
+using namespace vman;
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+
+void SelectChunk( Access* access, int chunkX )
+{
+    vmanSelection selection;
+    selection.x = chunkX*CHUNK_EDGE_LENGTH;
+    selection.y = 0;
+    selection.z = 0;
+    selection.w = 1;
+    selection.h = 1;
+    selection.d = 1;
+    access->select(&selection);
+
+    access->lock(VMAN_READ_ACCESS);
+    access->readVoxelLayer(chunkX*CHUNK_EDGE_LENGTH,0,0, 0);
+    access->unlock();
+}
+
+int GetUnloadOps( Volume* volume )
+{
+    vmanStatistics statistics;
+    assert(volume->getStatistics(&statistics));
+    return statistics.chunkUnloadOps;
+}
+
+void TestSingleCheckPerChunk( Volume* volume )
+{
+    volume->setUnusedChunkTimeout(60);
+    volume->setIdleChunkTimeout(60);
+
+    Access access(volume);
+    for(int i = 0; i < 100; ++i)
+        SelectChunk(&access, i % 2);
+    SelectChunk(&access, 2);
+
+    // Both causes of a chunk share one entry.
+    assert(volume->getScheduledCheckCount() == 2);
+}
+
+void TestUnusedTimeout( Volume* volume )
+{
+    volume->setUnusedChunkTimeout(1);
+    volume->setIdleChunkTimeout(-1);
+
+    const uint64_t startTime = GetMonotonicMilliseconds();
+    {
+        Access access(volume);
+        SelectChunk(&access, 10);
+    }
+    assert(GetUnloadOps(volume) == 0);
+
+    // Rescheduling an earlier check must wake the scheduler,
+    // although it sleeps until the checks of the previous test.
+    while(GetUnloadOps(volume) == 0)
+    {
+        assert(GetMonotonicMilliseconds() - startTime < 5000);
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+    }
+    assert(GetMonotonicMilliseconds() - startTime >= 1000);
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.enableStatistics = true;
+    Volume volume(&volumeParams);
+
+    TestSingleCheckPerChunk(&volume);
+    TestUnusedTimeout(&volume);
+
+    puts("No problems detected.");
+
+    return 0;
+}
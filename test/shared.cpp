@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <tinythread.h>
+
+#include <SharedMutex.h>
+#include <Volume.h>
+#include <Access.h>
+
+using namespace vman;
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+void TestSharedMutex()
+{
+    SharedMutex mutex;
+
+    // Readers share the mutex ...
+    mutex.lock_shared();
+    assert(mutex.try_lock_shared());
+    assert(!mutex.try_lock());
+    mutex.unlock_shared();
+    mutex.unlock_shared();
+
+    // ... while a writer owns it.
+    assert(mutex.try_lock());
+    assert(!mutex.try_lock_shared());
+    assert(!mutex.try_lock());
+    mutex.unlock();
+
+    assert(mutex.try_lock_shared());
+    mutex.unlock_shared();
+}
+
+void LockExclusive( void* context )
+{
+    SharedMutex* mutex = (SharedMutex*)context;
+    mutex->lock();
+    mutex->unlock();
+}
+
+void TestWriterPreference()
+{
+    SharedMutex mutex;
+    mutex.lock_shared();
+
+    tthread::thread writer(LockExclusive, &mutex, "Writer");
+
+    // Once the writer waits, new readers have to wait too.
+    while(mutex.try_lock_shared())
+    {
+        mutex.unlock_shared();
+        tthread::this_thread::yield();
+    }
+
+    mutex.unlock_shared();
+    writer.join();
+
+    assert(mutex.try_lock_shared());
+    mutex.unlock_shared();
+}
+
+void TestSharedAccess()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = 8;
+    Volume volume(&volumeParams);
+
+    const vmanSelection selection = { -4,-4,-4, 8,8,8 };
+    Access first(&volume);
+    Access second(&volume);
+    first.select(&selection);
+    second.select(&selection);
+
+    // Read only accesses don't block each other.
+    first.lock(VMAN_READ_ACCESS);
+    assert(second.tryLock(VMAN_READ_ACCESS));
+    assert(*(const char*)second.readVoxelLayer(0,0,0, 0) == 0);
+    second.unlock();
+
+    // Writers still need the chunks for themselves.
+    assert(!second.tryLock(VMAN_READ_ACCESS|VMAN_WRITE_ACCESS));
+    first.unlock();
+
+    second.lock(VMAN_READ_ACCESS|VMAN_WRITE_ACCESS);
+    assert(!first.tryLock(VMAN_READ_ACCESS));
+    second.unlock();
+
+    first.select(NULL);
+    second.select(NULL);
+}
+
+int main()
+{
+    TestSharedMutex();
+    TestWriterPreference();
+    TestSharedAccess();
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+
+#include <Volume.h>
+#include <Access.h>
+#include <Snapshot.h>
+
+using namespace vman;
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+
+vmanSelection MakeBox( int x, int y, int z, int w, int h, int d )
+{
+    vmanSelection box;
+    box.x = x;
+    box.y = y;
+    box.z = z;
+    box.w = w;
+    box.h = h;
+    box.d = d;
+    return box;
+}
+
+char Voxel( int x, int y, int z, int generation )
+{
+    return char(x + y*3 + z*5 + generation*7);
+}
+
+void WriteGeneration( Access* access, const vmanSelection& box, int generation )
+{
+    access->lock(VMAN_READ_ACCESS|VMAN_WRITE_ACCESS);
+    for(int z = box.z; z < box.z+box.d; ++z)
+    for(int y = box.y; y < box.y+box.h; ++y)
+    for(int x = box.x; x < box.x+box.w; ++x)
+    {
+        const char voxel = Voxel(x,y,z, generation);
+        assert(access->writeVoxelLayer(x,y,z, 0, &voxel));
+    }
+    access->unlock();
+}
+
+void CheckSnapshot( const Snapshot& snapshot, const vmanSelection& box, int generation )
+{
+    for(int z = box.z; z < box.z+box.d; ++z)
+    for(int y = box.y; y < box.y+box.h; ++y)
+    for(int x = box.x; x < box.x+box.w; ++x)
+        assert(*(const char*)snapshot.readVoxelLayer(x,y,z, 0) == Voxel(x,y,z, generation));
+
+    std::vector<char> voxels(box.w*box.h*box.d);
+    vmanLayerBuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.layer = 0;
+    buffer.data = &voxels[0];
+    assert(snapshot.readRegion(&box, &buffer, 1));
+    for(int z = 0; z < box.d; ++z)
+    for(int y = 0; y < box.h; ++y)
+    for(int x = 0; x < box.w; ++x)
+        assert(voxels[x + y*box.w + z*box.w*box.h] == Voxel(box.x+x, box.y+y, box.z+z, generation));
+}
+
+int LayerPoolUsedBytes( Volume* volume )
+{
+    vmanStatistics statistics;
+    assert(volume->getStatistics(&statistics));
+    return statistics.layerPoolUsedBytes;
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.enableStatistics = true;
+    Volume volume(&volumeParams);
+
+    // Covers parts of 2x2x2 chunks.
+    const vmanSelection box = MakeBox(-5,-3,-2, 10,8,6);
+    Access access(&volume);
+    access.select(&box);
+
+    WriteGeneration(&access, box, 1);
+    const int usedBytes = LayerPoolUsedBytes(&volume);
+
+    // Writers don't wait for snapshots and don't change them.
+    {
+        Snapshot snapshot(&volume, &box);
+        CheckSnapshot(snapshot, box, 1);
+
+        WriteGeneration(&access, box, 2);
+        CheckSnapshot(snapshot, box, 1);
+        assert(LayerPoolUsedBytes(&volume) == usedBytes*2);
+
+        // Only layers that are still pinned are copied.
+        WriteGeneration(&access, box, 3);
+        assert(LayerPoolUsedBytes(&volume) == usedBytes*2);
+
+        Snapshot newerSnapshot(&volume, &box);
+        CheckSnapshot(newerSnapshot, box, 3);
+        CheckSnapshot(snapshot, box, 1);
+    }
+
+    // Old versions are gone with their snapshots.
+    assert(LayerPoolUsedBytes(&volume) == usedBytes);
+
+    // Unchanged layers are taken back without copying.
+    {
+        Snapshot snapshot(&volume, &box);
+    }
+    WriteGeneration(&access, box, 4);
+    assert(LayerPoolUsedBytes(&volume) == usedBytes);
+
+    // Absent layers use the default page.
+    {
+        const vmanSelection empty = MakeBox(100,100,100, 4,4,4);
+        Snapshot snapshot(&volume, &empty);
+        assert(*(const char*)snapshot.readVoxelLayer(101,102,103, 0) == 0);
+        assert(snapshot.readVoxelLayer(99,100,100, 0) == NULL);
+    }
+
+    access.select(NULL);
+
+    puts("No problems detected.");
+
+    return 0;
+}
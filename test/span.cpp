@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <Volume.h>
+#include <Chunk.h>
+#include <Access.h>
+
+using namespace vman;
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[] =
+{
+    {"Material", 2, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+
+short Material( int x, int y, int z )
+{
+    return short(x*1000 + y*30 + z);
+}
+
+/**
+ * Visits every voxel of the selection through spans.
+ * @return Amount of spans.
+ */
+int WriteSpans( Access* access, const vmanSelection& selection )
+{
+    int spanCount = 0;
+    vmanVoxelSpan span;
+    for(int z = selection.z; z < selection.z+selection.d; z += span.slices)
+    for(int y = selection.y; y < selection.y+selection.h; y += span.rows)
+    for(int x = selection.x; x < selection.x+selection.w; x += span.length)
+    {
+        assert(access->readWriteVoxelSpan(x,y,z, 0, &span));
+        assert(span.voxelStride == sizeof(short));
+        assert(span.rowStride == CHUNK_EDGE_LENGTH*sizeof(short));
+        assert(span.sliceStride == CHUNK_EDGE_LENGTH*CHUNK_EDGE_LENGTH*sizeof(short));
+        spanCount++;
+
+        for(int sz = 0; sz < span.slices; ++sz)
+        for(int sy = 0; sy < span.rows; ++sy)
+        {
+            short* row = (short*)((char*)span.data + sy*span.rowStride + sz*span.sliceStride);
+            for(int sx = 0; sx < span.length; ++sx)
+                row[sx] = Material(x+sx, y+sy, z+sz);
+        }
+    }
+    return spanCount;
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "span-volume";
+    Volume volume(&volumeParams);
+
+    // Covers parts of 3x2x2 chunks.
+    vmanSelection selection;
+    selection.x = -3;
+    selection.y = 2;
+    selection.z = -8;
+    selection.w = 12;
+    selection.h = 10;
+    selection.d = 9;
+
+    Access access(&volume);
+    access.select(&selection);
+
+    access.lock(VMAN_WRITE_ACCESS);
+    vmanVoxelSpan span;
+    assert(!access.readWriteVoxelSpan(0,2,0, 0, &span)); // Needs read access too.
+    access.unlock();
+
+    access.lock(VMAN_READ_ACCESS|VMAN_WRITE_ACCESS);
+    assert(WriteSpans(&access, selection) == 3*2*2);
+
+    // Spans stop at the chunk boundary ...
+    assert(access.readVoxelSpan(-3,2,-8, 0, &span));
+    assert(span.length == 3);
+    assert(span.rows == 6);
+    assert(span.slices == 8);
+
+    // ... and at the selection boundary.
+    assert(access.readVoxelSpan(5,9,0, 0, &span));
+    assert(span.length == 3);
+    assert(span.rows == 3);
+    assert(span.slices == 1);
+    assert(*(const short*)span.data == Material(5,9,0));
+
+    assert(!access.readVoxelSpan(-4,2,-8, 0, &span));
+    access.unlock();
+
+    access.lock(VMAN_READ_ACCESS);
+    for(int z = selection.z; z < selection.z+selection.d; ++z)
+    for(int y = selection.y; y < selection.y+selection.h; ++y)
+    for(int x = selection.x; x < selection.x+selection.w; ++x)
+        assert(*(const short*)access.readVoxelLayer(x,y,z, 0) == Material(x,y,z));
+    access.unlock();
+
+    access.select(NULL);
+
+    puts("No problems detected.");
+
+    return 0;
+}
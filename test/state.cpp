@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <tinythread.h>
+
+#include <Volume.h>
+#include <Access.h>
+
+using namespace vman;
+
+void CopyBytes( const void* source, void* destination, int count )
+{
+    memcpy(destination, source, count);
+}
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, CopyBytes, CopyBytes, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int CHUNKS_PER_EDGE = 4;
+static const int CHUNK_COUNT = CHUNKS_PER_EDGE*CHUNKS_PER_EDGE*CHUNKS_PER_EDGE;
+
+vmanSelection MakeBox( int x, int y, int z, int w, int h, int d )
+{
+    vmanSelection box;
+    box.x = x;
+    box.y = y;
+    box.z = z;
+    box.w = w;
+    box.h = h;
+    box.d = d;
+    return box;
+}
+
+/**
+ * Selects one voxel of each chunk.
+ */
+vmanSelection ChunkCorners()
+{
+    return MakeBox(0,0,0,
+        (CHUNKS_PER_EDGE-1)*CHUNK_EDGE_LENGTH+1,
+        (CHUNKS_PER_EDGE-1)*CHUNK_EDGE_LENGTH+1,
+        (CHUNKS_PER_EDGE-1)*CHUNK_EDGE_LENGTH+1
+    );
+}
+
+char Material( int chunkX, int chunkY, int chunkZ, int generation )
+{
+    return char(1 + chunkX + chunkY*5 + chunkZ*11 + generation*3);
+}
+
+void WriteChunks( Access* access, int generation )
+{
+    for(int z = 0; z < CHUNKS_PER_EDGE; ++z)
+    for(int y = 0; y < CHUNKS_PER_EDGE; ++y)
+    for(int x = 0; x < CHUNKS_PER_EDGE; ++x)
+    {
+        const char material = Material(x,y,z, generation);
+        assert(access->writeVoxelLayer(
+            x*CHUNK_EDGE_LENGTH,
+            y*CHUNK_EDGE_LENGTH,
+            z*CHUNK_EDGE_LENGTH,
+            0, &material));
+    }
+}
+
+void CheckChunks( Access* access, int generation )
+{
+    for(int z = 0; z < CHUNKS_PER_EDGE; ++z)
+    for(int y = 0; y < CHUNKS_PER_EDGE; ++y)
+    for(int x = 0; x < CHUNKS_PER_EDGE; ++x)
+    {
+        const char* material = (const char*)access->readVoxelLayer(
+            x*CHUNK_EDGE_LENGTH,
+            y*CHUNK_EDGE_LENGTH,
+            z*CHUNK_EDGE_LENGTH,
+            0);
+        assert(*material == Material(x,y,z, generation));
+    }
+}
+
+void CheckStates( const Access& access, bool loaded )
+{
+    std::vector<vmanChunkState> states(CHUNK_COUNT);
+    assert(access.getChunkStates(&states[0], states.size()) == CHUNK_COUNT);
+    for(int i = 0; i < states.size(); ++i)
+    {
+        if(loaded)
+            assert(states[i] == VMAN_CHUNK_READY);
+        else
+            assert(states[i] == VMAN_CHUNK_LOADING ||
+                   states[i] == VMAN_CHUNK_READY);
+    }
+}
+
+/**
+ * Writers that lock right after selecting are not overwritten by the load jobs.
+ */
+void TestLockWaitsForLoading( const vmanVolumeParameters* volumeParams )
+{
+    {
+        Volume volume(volumeParams);
+        Access access(&volume);
+        const vmanSelection selection = ChunkCorners();
+        access.select(&selection);
+        access.lock(VMAN_WRITE_ACCESS);
+        WriteChunks(&access, 1);
+        access.unlock();
+        access.select(NULL);
+    }
+
+    for(int generation = 2; generation < 5; ++generation)
+    {
+        Volume volume(volumeParams);
+        Access access(&volume);
+        const vmanSelection selection = ChunkCorners();
+        access.select(&selection);
+        CheckStates(access, false);
+
+        access.lock(VMAN_READ_ACCESS|VMAN_WRITE_ACCESS);
+        CheckStates(access, true);
+        CheckChunks(&access, generation-1);
+        WriteChunks(&access, generation);
+        access.unlock();
+        access.select(NULL);
+    }
+}
+
+/**
+ * Optimistic readers and tryLock() don't see chunks before they're loaded.
+ */
+void TestOtherModes( const vmanVolumeParameters* volumeParams )
+{
+    Volume volume(volumeParams);
+    const vmanSelection selection = ChunkCorners();
+
+    Access access(&volume);
+    access.select(&selection);
+    access.lock(VMAN_OPTIMISTIC_READ_ACCESS);
+    CheckStates(access, true);
+
+    std::vector<char> voxels(selection.w*selection.h*selection.d);
+    vmanLayerBuffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.layer = 0;
+    buffer.data = &voxels[0];
+    assert(access.readRegion(&selection, &buffer, 1));
+    assert(voxels[0] == Material(0,0,0, 4));
+    assert(voxels.back() == Material(CHUNKS_PER_EDGE-1,CHUNKS_PER_EDGE-1,CHUNKS_PER_EDGE-1, 4));
+    access.unlock();
+
+    Access other(&volume);
+    const vmanSelection otherSelection = MakeBox(-CHUNK_EDGE_LENGTH,0,0, 1,1,1);
+    other.select(&otherSelection);
+    while(other.tryLock(VMAN_READ_ACCESS) == false)
+        tthread::this_thread::yield();
+    CheckStates(access, true);
+    other.unlock();
+
+    other.select(NULL);
+    access.select(NULL);
+}
+
+void SetReady( void* chunk )
+{
+    tthread::this_thread::sleep_for(tthread::chrono::milliseconds(50));
+    ((Chunk*)chunk)->setState(VMAN_CHUNK_READY);
+}
+
+void TestWaiting( Volume* volume )
+{
+    Chunk chunk(volume, 0,0,0);
+    assert(chunk.getState() == VMAN_CHUNK_READY);
+    chunk.waitWhileState(VMAN_CHUNK_LOADING);
+
+    chunk.setState(VMAN_CHUNK_LOADING);
+    tthread::thread thread(SetReady, &chunk, "SetReady");
+    chunk.waitWhileState(VMAN_CHUNK_LOADING);
+    assert(chunk.getState() == VMAN_CHUNK_READY);
+    thread.join();
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "states";
+	volumeParams.enableStatistics = true;
+
+    TestLockWaitsForLoading(&volumeParams);
+    TestOtherModes(&volumeParams);
+
+    {
+        volumeParams.baseDir = NULL;
+        Volume volume(&volumeParams);
+        TestWaiting(&volume);
+    }
+
+    puts("No problems detected.");
+
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+#include <VoxelCodec.h>
+#include <Volume.h>
+#include <Chunk.h>
+#include <Access.h>
+
+using namespace vman;
+
+enum LayerIndex
+{
+    BASE_LAYER = 0,
+    EXTRA_LAYER,
+    LAYER_COUNT
+};
+
+static const int32_t DEFAULT_TEMPERATURE = 20;
+
+static const vmanLayer layers[LAYER_COUNT] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL},
+    {"Temperature", 4, 1, NULL, NULL, &DEFAULT_TEMPERATURE}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+
+int32_t GetTemperature( const void* layer, int voxelIndex )
+{
+    int32_t temperature;
+    memcpy(&temperature, &reinterpret_cast<const char*>(layer)[voxelIndex*4], 4);
+    return temperature;
+}
+
+void TestDefaultValues( Volume* volume )
+{
+    const int voxelsPerChunk = volume->getVoxelsPerChunk();
+
+    Chunk chunk(volume, 0,0,0);
+
+    // Absent layers consist of the default value.
+    const void* temperature = chunk.getConstLayer(EXTRA_LAYER);
+    assert(temperature != NULL);
+    assert(chunk.hasLayer(EXTRA_LAYER) == false);
+    assert(GetTemperature(temperature, 0) == DEFAULT_TEMPERATURE);
+    assert(GetTemperature(temperature, voxelsPerChunk-1) == DEFAULT_TEMPERATURE);
+
+    // Writing the default value doesn't allocate the layer.
+    assert(chunk.writeVoxel(EXTRA_LAYER, 5, &DEFAULT_TEMPERATURE) == false);
+    assert(chunk.hasLayer(EXTRA_LAYER) == false);
+
+    const int32_t hot = 90;
+    assert(chunk.writeVoxel(EXTRA_LAYER, 5, &hot));
+    assert(chunk.hasLayer(EXTRA_LAYER));
+    assert(GetTemperature(chunk.getConstLayer(EXTRA_LAYER), 5) == hot);
+    assert(GetTemperature(chunk.getConstLayer(EXTRA_LAYER), 4) == DEFAULT_TEMPERATURE);
+
+    // New layers are initialized with the default value.
+    Chunk other(volume, 0,0,1);
+    assert(GetTemperature(other.getLayer(EXTRA_LAYER), 7) == DEFAULT_TEMPERATURE);
+
+    assert(chunk.saveToFile());
+    assert(other.saveToFile());
+}
+
+void TestUniformLayers( Volume* volume )
+{
+    const int voxelsPerChunk = volume->getVoxelsPerChunk();
+    const int32_t cold = -5;
+
+    {
+        // Uniform layers of different chunks share their voxel data.
+        Chunk a(volume, 1,0,0);
+        Chunk b(volume, 2,0,0);
+        a.setUniformLayer(EXTRA_LAYER, reinterpret_cast<const char*>(&cold));
+        b.setUniformLayer(EXTRA_LAYER, reinterpret_cast<const char*>(&cold));
+        assert(a.m_LayerCodecs[EXTRA_LAYER] == VOXEL_CODEC_UNIFORM);
+        assert(a.getConstLayer(EXTRA_LAYER) == b.getConstLayer(EXTRA_LAYER));
+        assert(GetTemperature(a.getConstLayer(EXTRA_LAYER), voxelsPerChunk-1) == cold);
+
+        // Writing the uniform value doesn't allocate the layer either.
+        assert(a.writeVoxel(EXTRA_LAYER, 3, &cold) == false);
+        assert(a.m_LayerCodecs[EXTRA_LAYER] == VOXEL_CODEC_UNIFORM);
+        assert(a.saveToFile());
+    }
+
+    {
+        // Layers that became uniform are stored as single voxel.
+        Chunk chunk(volume, 3,0,0);
+        int32_t* temperature = (int32_t*)chunk.getLayer(EXTRA_LAYER);
+        for(int i = 0; i < voxelsPerChunk; ++i)
+            memcpy(&temperature[i], &cold, 4);
+        assert(chunk.saveToFile());
+    }
+
+    std::vector<char> data;
+    assert(volume->getChunkStorage()->readChunk(3,0,0, &data));
+    assert(data.size() < 200);
+
+    {
+        Chunk chunk(volume, 3,0,0);
+        assert(chunk.loadFromFile());
+        assert(chunk.hasLayer(BASE_LAYER) == false);
+        assert(chunk.m_LayerCodecs[EXTRA_LAYER] == VOXEL_CODEC_UNIFORM);
+        assert(GetTemperature(chunk.getConstLayer(EXTRA_LAYER), 17) == cold);
+
+        // Changing a single voxel expands the layer.
+        const int32_t hot = 90;
+        assert(chunk.writeVoxel(EXTRA_LAYER, 17, &hot));
+        assert(chunk.m_LayerCodecs[EXTRA_LAYER] == VOXEL_CODEC_NONE);
+        assert(GetTemperature(chunk.getConstLayer(EXTRA_LAYER), 17) == hot);
+        assert(GetTemperature(chunk.getConstLayer(EXTRA_LAYER), 16) == cold);
+        assert(chunk.saveToFile());
+    }
+
+    {
+        // Layers that consist of the default value become absent.
+        Chunk chunk(volume, 4,0,0);
+        int32_t* temperature = (int32_t*)chunk.getLayer(EXTRA_LAYER);
+        for(int i = 0; i < voxelsPerChunk; ++i)
+            memcpy(&temperature[i], &DEFAULT_TEMPERATURE, 4);
+        assert(chunk.saveToFile());
+        assert(chunk.hasLayer(EXTRA_LAYER) == false);
+    }
+
+    {
+        Chunk chunk(volume, 4,0,0);
+        assert(chunk.loadFromFile());
+        assert(chunk.hasLayer(EXTRA_LAYER) == false);
+        assert(GetTemperature(chunk.getConstLayer(EXTRA_LAYER), 0) == DEFAULT_TEMPERATURE);
+    }
+
+    {
+        // Once all uniform pages are in use, layers are encoded otherwise.
+        Chunk chunk(volume, 5,0,0);
+        int32_t value = 1000;
+        while(chunk.setUniformLayer(EXTRA_LAYER, reinterpret_cast<const char*>(&value)))
+        {
+            assert(value < 1100);
+            value++;
+        }
+        int32_t* temperature = (int32_t*)chunk.getLayer(EXTRA_LAYER);
+        for(int i = 0; i < voxelsPerChunk; ++i)
+            memcpy(&temperature[i], &value, 4);
+        assert(chunk.compressLayers() == 1);
+        assert(chunk.m_LayerCodecs[EXTRA_LAYER] != VOXEL_CODEC_UNIFORM);
+        assert(chunk.m_LayerCodecs[EXTRA_LAYER] != VOXEL_CODEC_NONE);
+        assert(GetTemperature(chunk.getConstLayer(EXTRA_LAYER), voxelsPerChunk-1) == value);
+    }
+}
+
+void TestAccess( Volume* volume )
+{
+    Access access(volume);
+
+    // Uses chunks that haven't been stored yet.
+    vmanSelection selection;
+    selection.x = -80;
+    selection.y = 0;
+    selection.z = 0;
+    selection.w = CHUNK_EDGE_LENGTH;
+    selection.h = CHUNK_EDGE_LENGTH;
+    selection.d = CHUNK_EDGE_LENGTH;
+    access.select(&selection);
+
+    const int32_t hot = 90;
+
+    access.lock(VMAN_READ_ACCESS);
+    assert(GetTemperature(access.readVoxelLayer(-77,2,1, EXTRA_LAYER), 0) == DEFAULT_TEMPERATURE);
+    assert(access.writeVoxelLayer(-77,2,1, EXTRA_LAYER, &hot) == false);
+    access.unlock();
+
+    access.lock(VMAN_WRITE_ACCESS);
+    assert(access.writeVoxelLayer(-77,2,1, EXTRA_LAYER, &DEFAULT_TEMPERATURE));
+    assert(access.writeVoxelLayer(-76,2,1, EXTRA_LAYER, &hot));
+    access.unlock();
+
+    // Voxels wider than a byte don't overlap.
+    access.lock(VMAN_READ_ACCESS);
+    assert(GetTemperature(access.readVoxelLayer(-77,2,1, EXTRA_LAYER), 0) == DEFAULT_TEMPERATURE);
+    assert(GetTemperature(access.readVoxelLayer(-76,2,1, EXTRA_LAYER), 0) == hot);
+    assert(GetTemperature(access.readVoxelLayer(-75,2,1, EXTRA_LAYER), 0) == DEFAULT_TEMPERATURE);
+    access.unlock();
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = LAYER_COUNT;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "uniform";
+    Volume volume(&volumeParams);
+
+    TestDefaultValues(&volume);
+    TestUniformLayers(&volume);
+    TestAccess(&volume);
+
+    puts("No problems detected.");
+
+    return 0;
+}
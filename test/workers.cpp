@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <assert.h>
+#include <Volume.h>
+#include <Access.h>
+#include <Util.h>
+
+using namespace vman;
+
+static const vmanLayer layers[] =
+{
+    {"Material", 1, 1, NULL, NULL, NULL}
+};
+
+static const int CHUNK_EDGE_LENGTH = 8;
+static const int WRITTEN_CHUNKS = 400;
+
+void WriteChunks( Volume* volume )
+{
+    Access access(volume);
+
+    vmanSelection selection;
+    selection.x = 0;
+    selection.y = 0;
+    selection.z = 0;
+    selection.w = WRITTEN_CHUNKS/20*CHUNK_EDGE_LENGTH;
+    selection.h = 20*CHUNK_EDGE_LENGTH;
+    selection.d = 1;
+    access.select(&selection);
+
+    const char material = 1;
+    access.lock(VMAN_WRITE_ACCESS);
+    for(int x = 0; x < selection.w; x += CHUNK_EDGE_LENGTH)
+        for(int y = 0; y < selection.h; y += CHUNK_EDGE_LENGTH)
+            access.writeVoxelLayer(x,y,0, 0, &material);
+    access.unlock();
+}
+
+bool WaitForWorkerCount( Volume* volume, int count, int milliseconds )
+{
+    const uint64_t startTime = GetMonotonicMilliseconds();
+    while(GetMonotonicMilliseconds() - startTime < milliseconds)
+    {
+        if(volume->getJobWorkerCount() == count)
+            return true;
+        tthread::this_thread::sleep_for(tthread::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+void TestFixedPool( vmanVolumeParameters volumeParams )
+{
+    volumeParams.workerCount = 3;
+    Volume volume(&volumeParams);
+    assert(volume.getJobWorkerCount() == 3);
+
+    vmanStatistics statistics;
+    assert(volume.getStatistics(&statistics));
+    assert(statistics.jobWorkers == 3);
+}
+
+void TestAdaptivePool( vmanVolumeParameters volumeParams )
+{
+    volumeParams.workerCount = 1;
+    volumeParams.maxWorkerCount = 4;
+    Volume volume(&volumeParams);
+    assert(volume.getJobWorkerCount() == 1);
+
+    // Small saves finish too fast to be noticed reliably,
+    // so every job enqueued while a worker is busy counts as delayed.
+    volume.setJobDurationEstimate(1000);
+
+    // Lots of saves make the pool grow ..
+    volume.setModifiedChunkTimeout(-1);
+    WriteChunks(&volume);
+    volume.saveModifiedChunks();
+    const int workers = volume.getJobWorkerCount();
+    assert(workers > 1);
+    assert(workers <= 4);
+
+    // .. and it shrinks when they're done.
+    assert(WaitForWorkerCount(&volume, 1, 10000));
+
+    vmanStatistics statistics;
+    assert(volume.getStatistics(&statistics));
+    assert(statistics.jobWorkers == 1);
+    assert(statistics.activeJobWorkers == 0);
+    assert(statistics.chunkSaveOps > 0);
+}
+
+int main()
+{
+	vmanVolumeParameters volumeParams;
+	vmanInitVolumeParameters(&volumeParams);
+	volumeParams.layers = layers;
+	volumeParams.layerCount = 1;
+	volumeParams.chunkEdgeLength = CHUNK_EDGE_LENGTH;
+	volumeParams.baseDir = "workers";
+	volumeParams.enableStatistics = true;
+
+    TestFixedPool(volumeParams);
+    TestAdaptivePool(volumeParams);
+
+    puts("No problems detected.");
+
+    return 0;
+}